@@ -1,21 +1,98 @@
 #include <ntifs.h>
+#include <wdmsec.h>
 #include "driver.hpp"
 #include "driver_irp_handler.hpp"
 
 #include <algorithm>
 #include "siren/vmx/mshv_hypervisor.hpp"
 #include "siren/vmx/mshv_virtual_cpu.hpp"
+#include "siren/contiguous_arena.hpp"
 
-static siren::hypervisor* g_SirenHypervisor;
+//
+// Reads an optional REG_DWORD value of
+//   HKLM\SYSTEM\CurrentControlSet\Services\<service name>\Parameters
+//
+static NTSTATUS SirenHvQueryParameterDword(_In_ PUNICODE_STRING RegistryPath, _In_ PCUNICODE_STRING ValueName, _Out_ PULONG Value) {
+    NTSTATUS status;
+    HANDLE service_key = nullptr;
+    HANDLE parameters_key = nullptr;
+    OBJECT_ATTRIBUTES object_attributes;
+    UNICODE_STRING parameters_key_name = RTL_CONSTANT_STRING(L"Parameters");
+
+    union {
+        KEY_VALUE_PARTIAL_INFORMATION info;
+        UCHAR raw[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)];
+    } value_buffer;
+    ULONG value_length;
+
+    *Value = 0;
+
+    InitializeObjectAttributes(&object_attributes, RegistryPath, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+    status = ZwOpenKey(&service_key, KEY_READ, &object_attributes);
+    if (!NT_SUCCESS(status)) {
+        goto ON_FINAL;
+    }
+
+    InitializeObjectAttributes(&object_attributes, &parameters_key_name, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, service_key, nullptr);
+    status = ZwOpenKey(&parameters_key, KEY_READ, &object_attributes);
+    if (!NT_SUCCESS(status)) {
+        goto ON_FINAL;
+    }
+
+    status = ZwQueryValueKey(parameters_key, const_cast<PUNICODE_STRING>(ValueName), KeyValuePartialInformation, &value_buffer, sizeof(value_buffer), &value_length);
+    if (!NT_SUCCESS(status)) {
+        goto ON_FINAL;
+    }
+
+    if (value_buffer.info.Type != REG_DWORD || value_buffer.info.DataLength != sizeof(ULONG)) {
+        status = STATUS_OBJECT_TYPE_MISMATCH;
+        goto ON_FINAL;
+    }
+
+    *Value = *reinterpret_cast<PULONG>(value_buffer.info.Data);
+
+ON_FINAL:
+    if (parameters_key) {
+        ZwClose(parameters_key);
+    }
+
+    if (service_key) {
+        ZwClose(service_key);
+    }
+
+    return status;
+}
 
 extern "C"
 NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING RegistryPath) {
-    UNREFERENCED_PARAMETER(RegistryPath);
 
     NTSTATUS status;
     PDEVICE_OBJECT siren_dev_object = nullptr;
     BOOLEAN siren_dev_symboliclinked = FALSE;
 
+    {
+        UNICODE_STRING value_name = RTL_CONSTANT_STRING(L"ContiguousArenaSize");
+        ULONG value;
+        size_t arena_size = siren::contiguous_arena::default_size_v;
+
+        if (NT_SUCCESS(SirenHvQueryParameterDword(RegistryPath, &value_name, &value))) {
+            arena_size = value;
+        }
+
+        // 0 turns the arena off, contiguous_allocator then always goes to MmAllocateContiguousMemory
+        if (arena_size != 0 && siren::reserved_contiguous_arena.reserve(arena_size).has_error()) {
+            KdPrint(("siren-hv: ContiguousArenaSize = 0x%zx is not reserved, must be a multiple of 2MiB up to 32MiB\n", arena_size));
+        }
+    }
+
+    {
+        auto expt_status = siren::initialize_cpu_work_queues();
+        if (expt_status.has_error()) {
+            status = expt_status.error().value;
+            goto ON_FINAL;
+        }
+    }
+
     {
         auto expt_hypervisor = siren::allocate_unique<siren::vmx::mshv_hypervisor>(siren::npaged_pool);
         if (expt_hypervisor.has_error()) {
@@ -23,6 +100,17 @@ NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING Regi
             goto ON_FINAL;
         }
 
+        {
+            UNICODE_STRING value_name = RTL_CONSTANT_STRING(L"VmexitStackSize");
+            ULONG value;
+
+            if (NT_SUCCESS(SirenHvQueryParameterDword(RegistryPath, &value_name, &value))) {
+                if (expt_hypervisor.value()->set_vmexit_stack_size(value).has_error()) {
+                    KdPrint(("siren-hv: VmexitStackSize = 0x%x is ignored, must be a multiple of 4KiB within [16KiB, 1MiB]\n", value));
+                }
+            }
+        }
+
         auto expt_status = expt_hypervisor.value()->intialize();
         if (expt_status.has_error()) {
             status = expt_status.error().value;
@@ -39,7 +127,18 @@ NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING Regi
         g_SirenHypervisor = expt_hypervisor.value().release();
     }
 
-    status = IoCreateDevice(DriverObject, 0, (PUNICODE_STRING)&g_DeviceName, FILE_DEVICE_UNKNOWN, FILE_DEVICE_SECURE_OPEN, FALSE, &siren_dev_object);
+    // The device controls the hypervisor, only SYSTEM and administrators may open it.
+    status = IoCreateDeviceSecure(
+        DriverObject,
+        0,
+        (PUNICODE_STRING)&g_DeviceName,
+        FILE_DEVICE_UNKNOWN,
+        FILE_DEVICE_SECURE_OPEN,
+        FALSE,
+        &SDDL_DEVOBJ_SYS_ALL_ADM_ALL,
+        &g_DeviceClassGuid,
+        &siren_dev_object
+    );
     if (!NT_SUCCESS(status)) {
         goto ON_FINAL;
     }
@@ -59,16 +158,30 @@ NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING Regi
     DriverObject->DriverUnload = SirenHvDriverUnload;
 
     g_DriverObject = DriverObject;
+    g_DeviceObject = siren_dev_object;
 
 ON_FINAL:
-    if (!NT_SUCCESS(status) && siren_dev_symboliclinked) {
-        IoDeleteSymbolicLink((PUNICODE_STRING)&g_DeviceDosName);
-        siren_dev_symboliclinked = FALSE;
-    }
+    if (!NT_SUCCESS(status)) {
+        if (siren_dev_symboliclinked) {
+            IoDeleteSymbolicLink((PUNICODE_STRING)&g_DeviceDosName);
+            siren_dev_symboliclinked = FALSE;
+        }
+
+        if (siren_dev_object) {
+            IoDeleteDevice(siren_dev_object);
+            siren_dev_object = nullptr;
+        }
 
-    if (siren_dev_object) {
-        IoDeleteDevice(siren_dev_object);
-        siren_dev_object = nullptr;
+        // DriverUnload is not called when DriverEntry fails
+        if (g_SirenHypervisor) {
+            g_SirenHypervisor->stop();
+            siren::allocator_delete(siren::npaged_pool, static_cast<siren::vmx::mshv_hypervisor*>(g_SirenHypervisor));
+            g_SirenHypervisor = nullptr;
+        }
+
+        siren::release_cpu_work_queues();
+        siren::reserved_contiguous_arena.release();
+        siren::release_size_class_pools();
     }
 
     return status;
@@ -86,7 +199,11 @@ VOID SirenHvDriverUnload(_In_ PDRIVER_OBJECT DriverObject) {
 
     if (g_SirenHypervisor) {
         g_SirenHypervisor->stop();
-        siren::allocator_delete(siren::npaged_pool, g_SirenHypervisor);
+        siren::allocator_delete(siren::npaged_pool, static_cast<siren::vmx::mshv_hypervisor*>(g_SirenHypervisor));
         g_SirenHypervisor = nullptr;
     }
+
+    siren::release_cpu_work_queues();
+    siren::reserved_contiguous_arena.release();
+    siren::release_size_class_pools();
 }
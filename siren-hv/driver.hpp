@@ -1,11 +1,17 @@
 #pragma once
 #include <wdm.h>
+#include "siren/hypervisor.hpp"
 
 DECLARE_GLOBAL_CONST_UNICODE_STRING(g_DeviceName, L"\\Device\\siren-hv");
 DECLARE_GLOBAL_CONST_UNICODE_STRING(g_DeviceDosName, L"\\DosDevices\\siren-hv");
 
+// Setup class of the control device. IoCreateDeviceSecure looks up a security descriptor override under it.
+// {5E2B6C8A-3F41-4D0B-9C7E-1A8D2F6B4E93}
+inline constexpr GUID g_DeviceClassGuid = { 0x5e2b6c8a, 0x3f41, 0x4d0b, { 0x9c, 0x7e, 0x1a, 0x8d, 0x2f, 0x6b, 0x4e, 0x93 } };
+
 inline PDRIVER_OBJECT g_DriverObject;
 inline PDEVICE_OBJECT g_DeviceObject;
+inline siren::hypervisor* g_SirenHypervisor;
 
 extern "C"
 NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING RegistryPath);
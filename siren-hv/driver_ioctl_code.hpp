@@ -1,2 +1,91 @@
 #pragma once
 #include <wdm.h>
+
+//
+// Exit recorder, see siren/vmx/exit_recorder.hpp
+//
+//   IOCTL_SIREN_HV_EXIT_RECORDER_START
+//     input:  SIREN_HV_EXIT_RECORDER_START_INPUT
+//
+//   IOCTL_SIREN_HV_EXIT_RECORDER_STOP
+//     no input, no output
+//
+//   IOCTL_SIREN_HV_EXIT_RECORDER_READ
+//     input:  SIREN_HV_EXIT_RECORDER_READ_INPUT
+//     output: siren::vmx::exit_record_file_header_t followed by as many siren::vmx::exit_record_t as fit
+//
+// START and STOP need a handle opened for writing, READ one opened for reading.
+//
+#define IOCTL_SIREN_HV_EXIT_RECORDER_START  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SIREN_HV_EXIT_RECORDER_STOP   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SIREN_HV_EXIT_RECORDER_READ   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+typedef struct _SIREN_HV_EXIT_RECORDER_START_INPUT {
+    ULONG64 RecordCount;
+} SIREN_HV_EXIT_RECORDER_START_INPUT, *PSIREN_HV_EXIT_RECORDER_START_INPUT;
+
+typedef struct _SIREN_HV_EXIT_RECORDER_READ_INPUT {
+    ULONG64 FirstRecord;
+} SIREN_HV_EXIT_RECORDER_READ_INPUT, *PSIREN_HV_EXIT_RECORDER_READ_INPUT;
+
+//
+// Vmexit stack usage of every virtual cpu, see siren::vmx::mshv_virtual_cpu::get_vmexit_stack_usage
+//
+//   IOCTL_SIREN_HV_QUERY_VMEXIT_STACK_USAGE
+//     output: one SIREN_HV_VMEXIT_STACK_USAGE per virtual cpu, in cpu index order
+//
+#define IOCTL_SIREN_HV_QUERY_VMEXIT_STACK_USAGE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x803, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+typedef struct _SIREN_HV_VMEXIT_STACK_USAGE {
+    ULONG64 StackSize;
+    ULONG64 HighWaterMark;
+} SIREN_HV_VMEXIT_STACK_USAGE, *PSIREN_HV_VMEXIT_STACK_USAGE;
+
+//
+// Suspend and resume virtualization without tearing down virtual cpus, see siren::vmx::mshv_hypervisor::suspend
+//
+//   IOCTL_SIREN_HV_SUSPEND
+//     no input, no output
+//
+//   IOCTL_SIREN_HV_RESUME
+//     no input, no output
+//
+// Both need a handle opened for writing.
+//
+#define IOCTL_SIREN_HV_SUSPEND              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SIREN_HV_RESUME               CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Occupancy and fragmentation of the reserved contiguous arena, see siren::contiguous_arena
+//
+//   IOCTL_SIREN_HV_QUERY_CONTIGUOUS_ARENA
+//     output: SIREN_HV_CONTIGUOUS_ARENA_STATISTICS
+//
+#define IOCTL_SIREN_HV_QUERY_CONTIGUOUS_ARENA CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+typedef struct _SIREN_HV_CONTIGUOUS_ARENA_STATISTICS {
+    ULONG64 RegionCount;
+    ULONG64 TotalPages;
+    ULONG64 FreePages;
+    ULONG64 AllocatedBlocks;
+    ULONG64 LargestFreeBlockPages;
+    ULONG64 MissedAllocations;
+} SIREN_HV_CONTIGUOUS_ARENA_STATISTICS, *PSIREN_HV_CONTIGUOUS_ARENA_STATISTICS;
+
+//
+// Live and peak bytes of the typed allocators by what the memory is for, see siren/allocation_telemetry.hpp
+//
+//   IOCTL_SIREN_HV_QUERY_ALLOCATION_TELEMETRY
+//     output: SIREN_HV_ALLOCATION_CATEGORY_COUNT SIREN_HV_ALLOCATION_STATISTICS, in siren::allocation_category_e order:
+//             general, hypervisor, virtual cpu, EPT, MSR bitmap, exit recorder
+//
+#define IOCTL_SIREN_HV_QUERY_ALLOCATION_TELEMETRY CTL_CODE(FILE_DEVICE_UNKNOWN, 0x807, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define SIREN_HV_ALLOCATION_CATEGORY_COUNT 6
+
+typedef struct _SIREN_HV_ALLOCATION_STATISTICS {
+    ULONG64 LiveBytes;
+    ULONG64 PeakBytes;
+    ULONG64 AllocationCount;
+    ULONG64 DeallocationCount;
+} SIREN_HV_ALLOCATION_STATISTICS, *PSIREN_HV_ALLOCATION_STATISTICS;
@@ -1,4 +1,10 @@
+#include "driver.hpp"
 #include "driver_irp_handler.hpp"
+#include "driver_ioctl_code.hpp"
+
+#include "siren/vmx/mshv_hypervisor.hpp"
+#include "siren/contiguous_arena.hpp"
+#include "siren/allocation_telemetry.hpp"
 
 NTSTATUS SirenHvIrpCreate(_In_ PDEVICE_OBJECT DeviceObject, _Inout_ PIRP Irp) {
     UNREFERENCED_PARAMETER(DeviceObject);
@@ -20,12 +26,162 @@ NTSTATUS SirenHvIrpClose(_In_ PDEVICE_OBJECT DeviceObject, _Inout_ PIRP Irp) {
     return Irp->IoStatus.Status;
 }
 
+static NTSTATUS SirenHvIoctlExitRecorder(_In_ PIO_STACK_LOCATION IrpStack, _Inout_ PIRP Irp) {
+    if (g_SirenHypervisor == nullptr || g_SirenHypervisor->get_implementation() != siren::implementation_e::X86_VMX_MICROSOFT_HV) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    auto& recorder = static_cast<siren::vmx::mshv_hypervisor*>(g_SirenHypervisor)->get_exit_recorder();
+
+    switch (IrpStack->Parameters.DeviceIoControl.IoControlCode) {
+        case IOCTL_SIREN_HV_EXIT_RECORDER_START: {
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < sizeof(SIREN_HV_EXIT_RECORDER_START_INPUT)) {
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+
+            auto input = static_cast<PSIREN_HV_EXIT_RECORDER_START_INPUT>(Irp->AssociatedIrp.SystemBuffer);
+            auto r = recorder.start(input->RecordCount);
+            return r.has_value() ? STATUS_SUCCESS : static_cast<NTSTATUS>(r.error().value);
+        }
+        case IOCTL_SIREN_HV_EXIT_RECORDER_STOP:
+            recorder.stop();
+            return STATUS_SUCCESS;
+        case IOCTL_SIREN_HV_EXIT_RECORDER_READ: {
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < sizeof(SIREN_HV_EXIT_RECORDER_READ_INPUT)) {
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+
+            auto input = static_cast<PSIREN_HV_EXIT_RECORDER_READ_INPUT>(Irp->AssociatedIrp.SystemBuffer);
+
+            auto output = Irp->MdlAddress ? MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute) : nullptr;
+            if (output == nullptr) {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            auto r = recorder.read(output, IrpStack->Parameters.DeviceIoControl.OutputBufferLength, input->FirstRecord);
+            if (r.has_value()) {
+                Irp->IoStatus.Information = r.value();
+                return STATUS_SUCCESS;
+            } else {
+                return static_cast<NTSTATUS>(r.error().value);
+            }
+        }
+        default:
+            return STATUS_INVALID_DEVICE_REQUEST;
+    }
+}
+
+static NTSTATUS SirenHvIoctlQueryVmexitStackUsage(_In_ PIO_STACK_LOCATION IrpStack, _Inout_ PIRP Irp) {
+    if (g_SirenHypervisor == nullptr || g_SirenHypervisor->get_implementation() != siren::implementation_e::X86_VMX_MICROSOFT_HV) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    auto cpu_count = g_SirenHypervisor->get_virtual_cpu_count();
+    if (IrpStack->Parameters.DeviceIoControl.OutputBufferLength < cpu_count * sizeof(SIREN_HV_VMEXIT_STACK_USAGE)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    auto output = static_cast<PSIREN_HV_VMEXIT_STACK_USAGE>(Irp->AssociatedIrp.SystemBuffer);
+
+    for (uint32_t i = 0; i < cpu_count; ++i) {
+        auto usage = static_cast<siren::vmx::mshv_virtual_cpu*>(g_SirenHypervisor->get_virtual_cpu(i))->get_vmexit_stack_usage();
+        output[i].StackSize = usage.size;
+        output[i].HighWaterMark = usage.high_water_mark;
+    }
+
+    Irp->IoStatus.Information = cpu_count * sizeof(SIREN_HV_VMEXIT_STACK_USAGE);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS SirenHvIoctlQueryContiguousArena(_In_ PIO_STACK_LOCATION IrpStack, _Inout_ PIRP Irp) {
+    if (IrpStack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(SIREN_HV_CONTIGUOUS_ARENA_STATISTICS)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    auto statistics = siren::reserved_contiguous_arena.get_statistics();
+    auto output = static_cast<PSIREN_HV_CONTIGUOUS_ARENA_STATISTICS>(Irp->AssociatedIrp.SystemBuffer);
+
+    output->RegionCount = statistics.region_count;
+    output->TotalPages = statistics.total_pages;
+    output->FreePages = statistics.free_pages;
+    output->AllocatedBlocks = statistics.allocated_blocks;
+    output->LargestFreeBlockPages = statistics.largest_free_block_pages;
+    output->MissedAllocations = statistics.missed_allocations;
+
+    Irp->IoStatus.Information = sizeof(SIREN_HV_CONTIGUOUS_ARENA_STATISTICS);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS SirenHvIoctlQueryAllocationTelemetry(_In_ PIO_STACK_LOCATION IrpStack, _Inout_ PIRP Irp) {
+    static_assert(SIREN_HV_ALLOCATION_CATEGORY_COUNT == siren::allocation_category_count_v);
+
+    if (IrpStack->Parameters.DeviceIoControl.OutputBufferLength < SIREN_HV_ALLOCATION_CATEGORY_COUNT * sizeof(SIREN_HV_ALLOCATION_STATISTICS)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    siren::allocation_statistics_t statistics[siren::allocation_category_count_v];
+    siren::query_allocation_statistics(statistics);
+
+    auto output = static_cast<PSIREN_HV_ALLOCATION_STATISTICS>(Irp->AssociatedIrp.SystemBuffer);
+
+    for (size_t i = 0; i < siren::allocation_category_count_v; ++i) {
+        output[i].LiveBytes = statistics[i].live_bytes;
+        output[i].PeakBytes = statistics[i].peak_bytes;
+        output[i].AllocationCount = statistics[i].allocation_count;
+        output[i].DeallocationCount = statistics[i].deallocation_count;
+    }
+
+    Irp->IoStatus.Information = SIREN_HV_ALLOCATION_CATEGORY_COUNT * sizeof(SIREN_HV_ALLOCATION_STATISTICS);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS SirenHvIoctlSuspendResume(_In_ PIO_STACK_LOCATION IrpStack) {
+    if (g_SirenHypervisor == nullptr || g_SirenHypervisor->get_implementation() != siren::implementation_e::X86_VMX_MICROSOFT_HV) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    auto hypervisor = static_cast<siren::vmx::mshv_hypervisor*>(g_SirenHypervisor);
+
+    if (IrpStack->Parameters.DeviceIoControl.IoControlCode == IOCTL_SIREN_HV_SUSPEND) {
+        hypervisor->suspend();
+    } else {
+        hypervisor->resume();
+    }
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS SirenHvIrpDeviceCtrl(_In_ PDEVICE_OBJECT DeviceObject, _Inout_ PIRP Irp) {
     UNREFERENCED_PARAMETER(DeviceObject);
 
-    Irp->IoStatus.Status = STATUS_NOT_IMPLEMENTED;
+    auto irp_stack = IoGetCurrentIrpStackLocation(Irp);
+
     Irp->IoStatus.Information = 0;
 
+    switch (irp_stack->Parameters.DeviceIoControl.IoControlCode) {
+        case IOCTL_SIREN_HV_EXIT_RECORDER_START:
+        case IOCTL_SIREN_HV_EXIT_RECORDER_STOP:
+        case IOCTL_SIREN_HV_EXIT_RECORDER_READ:
+            Irp->IoStatus.Status = SirenHvIoctlExitRecorder(irp_stack, Irp);
+            break;
+        case IOCTL_SIREN_HV_QUERY_VMEXIT_STACK_USAGE:
+            Irp->IoStatus.Status = SirenHvIoctlQueryVmexitStackUsage(irp_stack, Irp);
+            break;
+        case IOCTL_SIREN_HV_SUSPEND:
+        case IOCTL_SIREN_HV_RESUME:
+            Irp->IoStatus.Status = SirenHvIoctlSuspendResume(irp_stack);
+            break;
+        case IOCTL_SIREN_HV_QUERY_CONTIGUOUS_ARENA:
+            Irp->IoStatus.Status = SirenHvIoctlQueryContiguousArena(irp_stack, Irp);
+            break;
+        case IOCTL_SIREN_HV_QUERY_ALLOCATION_TELEMETRY:
+            Irp->IoStatus.Status = SirenHvIoctlQueryAllocationTelemetry(irp_stack, Irp);
+            break;
+        default:
+            Irp->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+    }
+
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
     return Irp->IoStatus.Status;
 }
@@ -1,7 +1,129 @@
 #include "address_space.hpp"
+#include "synchronization.hpp"
+#include <atomic>
+#include <algorithm>
 #include <ntddk.h>
 
 namespace siren {
+    namespace {
+        struct address_region_t {
+            uintptr_t virtual_base;
+            uint64_t physical_base;
+            size_t size;
+        };
+
+        struct address_region_table_t {
+            size_t count;
+            address_region_t by_virtual[max_address_region_count_v];   // sorted by virtual_base
+            address_region_t by_physical[max_address_region_count_v];  // sorted by physical_base
+        };
+
+        class address_region_registry {
+        private:
+            versioned<address_region_table_t> m_table;
+
+            template<auto BaseV>
+            static const address_region_t* find(const address_region_t* regions, size_t count, uint64_t address) noexcept {
+                count = std::min(count, max_address_region_count_v);     // readers can be given a table in the middle of an update
+
+                auto it = std::upper_bound(regions, regions + count, address, [](uint64_t value, const address_region_t& region) { return value < region.*BaseV; });
+                if (it != regions) {
+                    --it;
+                    if (address - it->*BaseV < it->size) {
+                        return it;
+                    }
+                }
+                return nullptr;
+            }
+
+            template<auto BaseV>
+            static bool insert(address_region_t* regions, size_t count, const address_region_t& region) noexcept {
+                auto it = std::upper_bound(regions, regions + count, region.*BaseV, [](uint64_t value, const address_region_t& r) { return value < r.*BaseV; });
+                if (it != regions && region.*BaseV - (it - 1)->*BaseV < (it - 1)->size) {
+                    return false;
+                }
+                if (it != regions + count && it->*BaseV - region.*BaseV < region.size) {
+                    return false;
+                }
+                std::copy_backward(it, regions + count, regions + count + 1);
+                *it = region;
+                return true;
+            }
+
+            template<auto BaseV>
+            static void erase(address_region_t* regions, size_t count, uint64_t base) noexcept {
+                auto it = std::find_if(regions, regions + count, [base](const address_region_t& r) { return r.*BaseV == base; });
+                if (it != regions + count) {
+                    std::copy(it + 1, regions + count, it);
+                }
+            }
+
+        public:
+            constexpr address_region_registry() noexcept
+                : m_table{} {}
+
+            expected<void, nt_status> add(const address_region_t& region) noexcept {
+                return m_table.update([&region](address_region_table_t& table) noexcept -> expected<void, nt_status> {
+                    if (table.count == max_address_region_count_v) {
+                        return unexpected{ nt_status_insufficient_resources_v };
+                    }
+
+                    if (!insert<&address_region_t::virtual_base>(table.by_virtual, table.count, region)) {
+                        return unexpected{ nt_status_object_name_collision_v };
+                    }
+
+                    if (!insert<&address_region_t::physical_base>(table.by_physical, table.count, region)) {
+                        erase<&address_region_t::virtual_base>(table.by_virtual, table.count + 1, region.virtual_base);
+                        return unexpected{ nt_status_object_name_collision_v };
+                    }
+
+                    ++table.count;
+                    return {};
+                });
+            }
+
+            void remove(uintptr_t virtual_base) noexcept {
+                auto expt_status = m_table.update([virtual_base](address_region_table_t& table) noexcept -> expected<void, nt_status> {
+                    auto region = find<&address_region_t::virtual_base>(table.by_virtual, table.count, virtual_base);
+                    if (region == nullptr || region->virtual_base != virtual_base) {
+                        return unexpected{ nt_status_not_found_v };
+                    }
+
+                    uint64_t physical_base = region->physical_base;
+                    erase<&address_region_t::virtual_base>(table.by_virtual, table.count, virtual_base);
+                    erase<&address_region_t::physical_base>(table.by_physical, table.count, physical_base);
+                    --table.count;
+                    return {};
+                });
+                NT_ASSERT(expt_status.has_value());
+            }
+
+            expected<uint64_t, nt_status> to_physical(uintptr_t virtual_address) const noexcept {
+                return m_table.read([virtual_address](const address_region_table_t& table) noexcept -> expected<uint64_t, nt_status> {
+                    auto region = find<&address_region_t::virtual_base>(table.by_virtual, table.count, virtual_address);
+                    if (region) {
+                        return region->physical_base + (virtual_address - region->virtual_base);
+                    } else {
+                        return unexpected{ nt_status_not_found_v };
+                    }
+                });
+            }
+
+            expected<uintptr_t, nt_status> to_virtual(uint64_t physical_address) const noexcept {
+                return m_table.read([physical_address](const address_region_table_t& table) noexcept -> expected<uintptr_t, nt_status> {
+                    auto region = find<&address_region_t::physical_base>(table.by_physical, table.count, physical_address);
+                    if (region) {
+                        return region->virtual_base + static_cast<uintptr_t>(physical_address - region->physical_base);
+                    } else {
+                        return unexpected{ nt_status_not_found_v };
+                    }
+                });
+            }
+        };
+
+        constinit address_region_registry registry;
+    }
+
     uint64_t get_physical_address(uintptr_t virtual_address) noexcept {
         return MmGetPhysicalAddress(reinterpret_cast<void*>(virtual_address)).QuadPart;
     }
@@ -10,4 +132,27 @@ namespace siren {
         auto pa = PHYSICAL_ADDRESS{ .QuadPart = static_cast<decltype(PHYSICAL_ADDRESS::QuadPart)>(physical_address) };
         return reinterpret_cast<uintptr_t>(MmGetVirtualForPhysical(pa));
     }
+
+    expected<void, nt_status> register_address_region(const void* base, size_t size) noexcept {
+        return register_address_region(base, get_physical_address(base), size);
+    }
+
+    expected<void, nt_status> register_address_region(const void* base, uint64_t physical_base, size_t size) noexcept {
+        if (base == nullptr || size == 0) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+        return registry.add({ .virtual_base = reinterpret_cast<uintptr_t>(base), .physical_base = physical_base, .size = size });
+    }
+
+    void unregister_address_region(const void* base) noexcept {
+        registry.remove(reinterpret_cast<uintptr_t>(base));
+    }
+
+    expected<uint64_t, nt_status> translate_virtual_address(const void* ptr) noexcept {
+        return registry.to_physical(reinterpret_cast<uintptr_t>(ptr));
+    }
+
+    expected<uintptr_t, nt_status> translate_physical_address(uint64_t physical_address) noexcept {
+        return registry.to_virtual(physical_address);
+    }
 }
@@ -1,6 +1,10 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 #include <type_traits>
+#include "expected.hpp"
+#include "nt_status.hpp"
+#include "irql_annotations.hpp"
 
 namespace siren {
     [[nodiscard]]
@@ -25,4 +29,45 @@ namespace siren {
     PtrTy get_virtual_address(uint64_t physical_address) noexcept {
         return reinterpret_cast<PtrTy>(get_virtual_address(physical_address));
     }
+
+    // Hypervisor-owned memory is registered here so that it can be translated without the kernel memory manager.
+    // Translations are pure arithmetic over a sorted range table and are safe at any IRQL, VM-exit handlers included.
+    // The table is double buffered: a writer fills the table readers are not using and then flips a sequence number,
+    // so a reader never waits for a writer, not even one it interrupted on the same cpu.
+
+    constexpr size_t max_address_region_count_v = 128;
+
+    // `base` to `base + size` must be physically contiguous, the physical address is looked up once here.
+    // Fails with nt_status_object_name_collision_v if it overlaps a registered region.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    [[nodiscard]]
+    expected<void, nt_status> register_address_region(const void* base, size_t size) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    [[nodiscard]]
+    expected<void, nt_status> register_address_region(const void* base, uint64_t physical_base, size_t size) noexcept;
+
+    // `base` must be the base of a registered region.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void unregister_address_region(const void* base) noexcept;
+
+    // Fails with nt_status_not_found_v if `ptr` is not in a registered region.
+    [[nodiscard]]
+    expected<uint64_t, nt_status> translate_virtual_address(const void* ptr) noexcept;
+
+    // Fails with nt_status_not_found_v if `physical_address` is not in a registered region.
+    [[nodiscard]]
+    expected<uintptr_t, nt_status> translate_physical_address(uint64_t physical_address) noexcept;
+
+    template<typename PtrTy>
+        requires std::is_pointer_v<PtrTy>
+    [[nodiscard]]
+    expected<PtrTy, nt_status> translate_physical_address(uint64_t physical_address) noexcept {
+        auto expt_address = translate_physical_address(physical_address);
+        if (expt_address.has_value()) {
+            return reinterpret_cast<PtrTy>(expt_address.value());
+        } else {
+            return unexpected{ expt_address.error() };
+        }
+    }
 }
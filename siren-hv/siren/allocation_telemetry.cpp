@@ -0,0 +1,100 @@
+#include "allocation_telemetry.hpp"
+#include "multiprocessor.hpp"
+#include <atomic>
+
+namespace siren {
+    namespace {
+        // Processors beyond slot_count_v share slots, which is why the counters are atomic even though a slot is mostly touched by one cpu.
+        // Bytes freed on another cpu than they were allocated on make a slot's live bytes negative, only the sum is meaningful.
+        class allocation_counters {
+        public:
+            static constexpr size_t slot_count_v = 64;
+            static constexpr uint32_t peak_sample_interval_v = 64;
+
+        private:
+            struct alignas(64) slot_t {
+                std::atomic<int64_t> live_bytes[allocation_category_count_v];
+                std::atomic<uint64_t> allocation_count[allocation_category_count_v];
+                std::atomic<uint64_t> deallocation_count[allocation_category_count_v];
+                std::atomic<uint32_t> allocations_since_sample;
+            };
+
+            slot_t m_slots[slot_count_v];
+            std::atomic<uint64_t> m_peak_bytes[allocation_category_count_v];
+
+            [[nodiscard]]
+            slot_t& current_slot() noexcept {
+                return m_slots[current_cpu_index() % slot_count_v];
+            }
+
+            uint64_t sample_live_bytes(size_t index) noexcept {
+                int64_t live_bytes = 0;
+                for (auto& slot : m_slots) {
+                    live_bytes += slot.live_bytes[index].load(std::memory_order_relaxed);
+                }
+
+                // a racing deallocation on another cpu can be seen before its allocation
+                auto sample = live_bytes < 0 ? uint64_t{ 0 } : static_cast<uint64_t>(live_bytes);
+
+                uint64_t peak = m_peak_bytes[index].load(std::memory_order_relaxed);
+                while (peak < sample && !m_peak_bytes[index].compare_exchange_weak(peak, sample, std::memory_order_relaxed)) {}
+
+                return sample;
+            }
+
+        public:
+            constexpr allocation_counters() noexcept
+                : m_slots{}, m_peak_bytes{} {}
+
+            void add(allocation_category_e category, size_t size) noexcept {
+                auto index = static_cast<size_t>(category);
+                auto& slot = current_slot();
+
+                slot.live_bytes[index].fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+                slot.allocation_count[index].fetch_add(1, std::memory_order_relaxed);
+
+                if (slot.allocations_since_sample.fetch_add(1, std::memory_order_relaxed) % peak_sample_interval_v == 0) {
+                    sample_live_bytes(index);
+                }
+            }
+
+            void subtract(allocation_category_e category, size_t size) noexcept {
+                auto index = static_cast<size_t>(category);
+                auto& slot = current_slot();
+
+                slot.live_bytes[index].fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+                slot.deallocation_count[index].fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void query(allocation_statistics_t (&statistics)[allocation_category_count_v]) noexcept {
+                for (size_t i = 0; i < allocation_category_count_v; ++i) {
+                    statistics[i] = {};
+                    statistics[i].live_bytes = sample_live_bytes(i);
+                    statistics[i].peak_bytes = m_peak_bytes[i].load(std::memory_order_relaxed);
+
+                    for (auto& slot : m_slots) {
+                        statistics[i].allocation_count += slot.allocation_count[i].load(std::memory_order_relaxed);
+                        statistics[i].deallocation_count += slot.deallocation_count[i].load(std::memory_order_relaxed);
+                    }
+                }
+            }
+        };
+
+        constinit allocation_counters counters;
+    }
+
+    _IRQL_requires_max_(HIGH_LEVEL)
+    void record_allocation(allocation_category_e category, size_t size) noexcept {
+        counters.add(category, size);
+    }
+
+    _IRQL_requires_max_(HIGH_LEVEL)
+    void record_deallocation(allocation_category_e category, size_t size) noexcept {
+        counters.subtract(category, size);
+    }
+
+    _IRQL_requires_max_(HIGH_LEVEL)
+    void query_allocation_statistics(allocation_statistics_t (&statistics)[allocation_category_count_v]) noexcept {
+        counters.query(statistics);
+    }
+}
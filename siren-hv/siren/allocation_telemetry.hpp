@@ -0,0 +1,50 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <concepts>
+#include "irql_annotations.hpp"
+
+namespace siren {
+    // What memory handed out by the typed allocators of memory.hpp is for.
+    // The order is part of IOCTL_SIREN_HV_QUERY_ALLOCATION_TELEMETRY, append only.
+    enum class allocation_category_e : uint32_t {
+        general,
+        hypervisor,
+        virtual_cpu,        // mshv_virtual_cpu objects and their VMX blocks, which also hold the vmexit stacks
+        ept,
+        msr_bitmap,
+        exit_recorder,
+        count
+    };
+
+    constexpr size_t allocation_category_count_v = static_cast<size_t>(allocation_category_e::count);
+
+    // Category of every allocation of `Ty` made through paged_allocator<Ty>, npaged_allocator<Ty> or contiguous_allocator<Ty>,
+    // hence also of allocate_unique<Ty> and allocator_delete.
+    // A class opts in by a `static constexpr allocation_category_e allocation_category_v` member,
+    // types that cannot have one, like the x86 structures, specialize this next to their owner.
+    template<typename Ty>
+    inline constexpr allocation_category_e allocation_category_of_v = allocation_category_e::general;
+
+    template<typename Ty>
+        requires requires { { Ty::allocation_category_v } -> std::convertible_to<allocation_category_e>; }
+    inline constexpr allocation_category_e allocation_category_of_v<Ty> = Ty::allocation_category_v;
+
+    struct allocation_statistics_t {
+        uint64_t live_bytes;
+        uint64_t peak_bytes;            // sampled, may miss short spikes
+        uint64_t allocation_count;
+        uint64_t deallocation_count;
+    };
+
+    // Counts requested bytes, not what the pool really spends on alignment and size class rounding.
+    // The counters are per cpu and only summed up by query_allocation_statistics() and, for the peak, every few allocations of a cpu.
+    _IRQL_requires_max_(HIGH_LEVEL)
+    void record_allocation(allocation_category_e category, size_t size) noexcept;
+
+    _IRQL_requires_max_(HIGH_LEVEL)
+    void record_deallocation(allocation_category_e category, size_t size) noexcept;
+
+    _IRQL_requires_max_(HIGH_LEVEL)
+    void query_allocation_statistics(allocation_statistics_t (&statistics)[allocation_category_count_v]) noexcept;
+}
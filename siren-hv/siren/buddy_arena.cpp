@@ -0,0 +1,163 @@
+#include "buddy_arena.hpp"
+#include <bit>
+#include <algorithm>
+
+namespace siren {
+    void buddy_arena::free_list_push(uint32_t order, size_t page_index) noexcept {
+        free_block_t* block = block_at(page_index);
+
+        block->prev = nullptr;
+        block->next = m_free_lists[order];
+        if (block->next) {
+            block->next->prev = block;
+        }
+        m_free_lists[order] = block;
+
+        m_page_states[page_index] = static_cast<uint8_t>(state_free_v | order);
+        ++m_free_blocks[order];
+    }
+
+    void buddy_arena::free_list_remove(uint32_t order, size_t page_index) noexcept {
+        free_block_t* block = block_at(page_index);
+
+        if (block->prev) {
+            block->prev->next = block->next;
+        } else {
+            m_free_lists[order] = block->next;
+        }
+
+        if (block->next) {
+            block->next->prev = block->prev;
+        }
+
+        m_page_states[page_index] = state_inner_v;
+        --m_free_blocks[order];
+    }
+
+    void buddy_arena::mark_block(size_t page_index, uint32_t order, bool free) noexcept {
+        m_page_states[page_index] = static_cast<uint8_t>(free ? state_free_v | order : order);
+    }
+
+    expected<void, nt_status> buddy_arena::initialize(void* base, uint64_t physical_base, size_t page_count, uint8_t* page_states) noexcept {
+        if (is_initialized() || base == nullptr || reinterpret_cast<uintptr_t>(base) % page_size_v != 0 || physical_base % page_size_v != 0 || page_count == 0 || page_states == nullptr) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+
+        m_base = reinterpret_cast<uintptr_t>(base);
+        m_physical_base = physical_base;
+        m_page_count = page_count;
+        m_page_states = page_states;
+
+        std::fill_n(m_page_states, m_page_count, state_inner_v);
+
+        // cover the region greedily with the largest naturally aligned blocks
+        for (size_t index = 0; index < m_page_count;) {
+            uint32_t order = index == 0 ? order_count_v - 1 : static_cast<uint32_t>(std::countr_zero(index));
+            order = std::min<uint32_t>(order, static_cast<uint32_t>(std::bit_width(m_page_count - index)) - 1);
+            order = std::min<uint32_t>(order, order_count_v - 1);
+
+            free_list_push(order, index);
+            index += size_t{ 1 } << order;
+        }
+
+        m_free_pages = m_page_count;
+        m_allocated_blocks = 0;
+
+        return {};
+    }
+
+    void buddy_arena::reset() noexcept {
+        m_base = 0;
+        m_physical_base = 0;
+        m_page_count = 0;
+        m_page_states = nullptr;
+        std::fill(std::begin(m_free_lists), std::end(m_free_lists), nullptr);
+        m_free_pages = 0;
+        m_allocated_blocks = 0;
+        std::fill(std::begin(m_free_blocks), std::end(m_free_blocks), 0);
+    }
+
+    expected<void*, nt_status> buddy_arena::allocate(size_t page_count) noexcept {
+        if (page_count == 0) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+
+        auto order = static_cast<uint32_t>(std::bit_width(page_count - 1));
+        if (order_count_v <= order) {
+            return unexpected{ nt_status_insufficient_resources_v };
+        }
+
+        uint32_t k = order;
+        while (k < order_count_v && m_free_lists[k] == nullptr) {
+            ++k;
+        }
+
+        if (k == order_count_v) {
+            return unexpected{ nt_status_insufficient_resources_v };
+        }
+
+        size_t index = index_of(m_free_lists[k]);
+        free_list_remove(k, index);
+
+        // give the upper halves back until the block is just big enough
+        while (order < k) {
+            --k;
+            free_list_push(k, index + (size_t{ 1 } << k));
+        }
+
+        mark_block(index, order, false);
+
+        m_free_pages -= size_t{ 1 } << order;
+        ++m_allocated_blocks;
+
+        return block_at(index);
+    }
+
+    void buddy_arena::deallocate(void* p) noexcept {
+        size_t index = index_of(p);
+
+        uint8_t state = m_page_states[index];
+        if (state & state_free_v) {
+            return;     // not the start of an allocated block
+        }
+
+        uint32_t order = state;
+
+        m_free_pages += size_t{ 1 } << order;
+        --m_allocated_blocks;
+
+        while (order + 1 < order_count_v) {
+            size_t buddy = index ^ (size_t{ 1 } << order);
+            if (m_page_count < buddy + (size_t{ 1 } << order) || m_page_states[buddy] != (state_free_v | order)) {
+                break;
+            }
+
+            free_list_remove(order, buddy);
+            m_page_states[index] = state_inner_v;
+
+            index = std::min(index, buddy);
+            ++order;
+        }
+
+        free_list_push(order, index);
+    }
+
+    buddy_arena::statistics_t buddy_arena::get_statistics() const noexcept {
+        statistics_t statistics = {
+            .total_pages = m_page_count,
+            .free_pages = m_free_pages,
+            .allocated_blocks = m_allocated_blocks,
+            .largest_free_block_pages = 0,
+            .free_blocks = {}
+        };
+
+        for (uint32_t order = 0; order < order_count_v; ++order) {
+            statistics.free_blocks[order] = m_free_blocks[order];
+            if (m_free_blocks[order] != 0) {
+                statistics.largest_free_block_pages = size_t{ 1 } << order;
+            }
+        }
+
+        return statistics;
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "literals.hpp"
+#include "expected.hpp"
+#include "nt_status.hpp"
+
+namespace siren {
+    using namespace ::siren::size_literals;
+
+    // Binary buddy allocator over one virtually and physically contiguous region of whole pages.
+    //
+    // A block of order k is 2^k pages and starts at a page index, relative to the region, that is a multiple of 2^k.
+    // Its buddy is the block at `index ^ 2^k`, and two free buddies of the same order are merged into one of order k + 1.
+    // The region does not need to be a power of two pages, the tail is covered by smaller blocks.
+    //
+    // Free blocks are kept in one intrusive doubly linked list per order, the links live in the free pages themselves.
+    // One byte of caller-provided state per page records whether the page starts a block, which order the block has and whether it is free,
+    // so allocate() and deallocate() are O(log n) and need no other memory.
+    //
+    // Not synchronized. Holds no resources of its own, the region and the page states stay owned by the caller.
+    // Depends on nothing kernel-specific so that it can be exercised by a host build.
+    class buddy_arena {
+    public:
+        static constexpr size_t page_size_v = 4_Kiuz;
+        static constexpr uint32_t order_count_v = 32;
+
+        struct statistics_t {
+            size_t total_pages;
+            size_t free_pages;
+            size_t allocated_blocks;
+            size_t largest_free_block_pages;
+            size_t free_blocks[order_count_v];  // by order
+        };
+
+    private:
+        struct free_block_t {
+            free_block_t* next;
+            free_block_t* prev;
+        };
+
+        // page state
+        //   0b0xxxxxxx: first page of an allocated block of order x
+        //   0b1xxxxxxx: first page of a free block of order x
+        //   0xff:       any other page
+        static constexpr uint8_t state_free_v = 0x80;
+        static constexpr uint8_t state_inner_v = 0xff;
+
+        uintptr_t m_base;
+        uint64_t m_physical_base;
+        size_t m_page_count;
+        uint8_t* m_page_states;
+        free_block_t* m_free_lists[order_count_v];
+
+        size_t m_free_pages;
+        size_t m_allocated_blocks;
+        size_t m_free_blocks[order_count_v];
+
+        [[nodiscard]]
+        free_block_t* block_at(size_t page_index) const noexcept {
+            return reinterpret_cast<free_block_t*>(m_base + page_index * page_size_v);
+        }
+
+        [[nodiscard]]
+        size_t index_of(const void* block) const noexcept {
+            return (reinterpret_cast<uintptr_t>(block) - m_base) / page_size_v;
+        }
+
+        void free_list_push(uint32_t order, size_t page_index) noexcept;
+
+        void free_list_remove(uint32_t order, size_t page_index) noexcept;
+
+        void mark_block(size_t page_index, uint32_t order, bool free) noexcept;
+
+    public:
+        constexpr buddy_arena() noexcept
+            : m_base{}, m_physical_base{}, m_page_count{}, m_page_states{}, m_free_lists{}, m_free_pages{}, m_allocated_blocks{}, m_free_blocks{} {}
+
+        buddy_arena(const buddy_arena&) = delete;
+
+        buddy_arena& operator=(const buddy_arena&) = delete;
+
+        // `base` must be page aligned and `page_states` must have room for `page_count` bytes.
+        [[nodiscard]]
+        expected<void, nt_status> initialize(void* base, uint64_t physical_base, size_t page_count, uint8_t* page_states) noexcept;
+
+        // Forgets the region, the caller frees it.
+        void reset() noexcept;
+
+        [[nodiscard]]
+        bool is_initialized() const noexcept {
+            return m_page_states != nullptr;
+        }
+
+        // Rounds `page_count` up to a power of two.
+        [[nodiscard]]
+        expected<void*, nt_status> allocate(size_t page_count) noexcept;
+
+        // `p` must be a block returned by allocate() and not freed yet.
+        void deallocate(void* p) noexcept;
+
+        [[nodiscard]]
+        bool contains(const void* p) const noexcept {
+            auto address = reinterpret_cast<uintptr_t>(p);
+            return m_base <= address && address - m_base < m_page_count * page_size_v;
+        }
+
+        [[nodiscard]]
+        bool contains_physical(uint64_t physical_address) const noexcept {
+            return m_physical_base <= physical_address && physical_address - m_physical_base < m_page_count * page_size_v;
+        }
+
+        // Only for addresses that satisfy contains().
+        [[nodiscard]]
+        uint64_t physical_address_of(const void* p) const noexcept {
+            return m_physical_base + (reinterpret_cast<uintptr_t>(p) - m_base);
+        }
+
+        // Only for addresses that satisfy contains_physical().
+        [[nodiscard]]
+        void* virtual_address_of(uint64_t physical_address) const noexcept {
+            return reinterpret_cast<void*>(m_base + static_cast<uintptr_t>(physical_address - m_physical_base));
+        }
+
+        [[nodiscard]]
+        uintptr_t get_base() const noexcept {
+            return m_base;
+        }
+
+        [[nodiscard]]
+        uint64_t get_physical_base() const noexcept {
+            return m_physical_base;
+        }
+
+        [[nodiscard]]
+        size_t get_size() const noexcept {
+            return m_page_count * page_size_v;
+        }
+
+        [[nodiscard]]
+        statistics_t get_statistics() const noexcept;
+    };
+}
@@ -1,4 +1,6 @@
 #pragma once
+#include <limits.h>
+#include <stddef.h>
 #include <concepts>
 #include <type_traits>
 #include <limits>
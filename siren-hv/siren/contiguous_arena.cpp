@@ -0,0 +1,151 @@
+#include "contiguous_arena.hpp"
+#include "address_space.hpp"
+#include <algorithm>
+#include <wdm.h>
+
+namespace siren {
+    expected<void, nt_status> contiguous_arena::reserve(size_t size) noexcept {
+        if (m_region_count != 0 || size == 0 || size % region_size_v != 0 || max_region_count_v < size / region_size_v) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+
+        for (size_t i = 0; i < size / region_size_v; ++i) {
+            void* p = MmAllocateContiguousMemory(region_size_v, PHYSICAL_ADDRESS{ .QuadPart = MAXLONGLONG });
+            if (p == nullptr) {
+                break;
+            }
+
+            uint64_t physical_base = get_physical_address(p);
+
+            auto expt_status = register_address_region(p, physical_base, region_size_v);
+            if (expt_status.has_error()) {
+                MmFreeContiguousMemory(p);
+                break;
+            }
+
+            expt_status = m_regions[m_region_count].initialize(p, physical_base, region_page_count_v, m_page_states[m_region_count]);
+            if (expt_status.has_error()) {
+                unregister_address_region(p);
+                MmFreeContiguousMemory(p);
+                break;
+            }
+
+            ++m_region_count;
+        }
+
+        if (m_region_count == 0) {
+            return unexpected{ nt_status_insufficient_resources_v };
+        }
+
+        return {};
+    }
+
+    void contiguous_arena::release() noexcept {
+        for (uint32_t i = 0; i < m_region_count; ++i) {
+            auto statistics = m_regions[i].get_statistics();
+            if (statistics.allocated_blocks == 0) {
+                unregister_address_region(reinterpret_cast<void*>(m_regions[i].get_base()));
+                MmFreeContiguousMemory(reinterpret_cast<void*>(m_regions[i].get_base()));
+            } else {
+                KdPrint(("siren-hv: contiguous arena region %u still has %zu blocks, leaked\n", i, statistics.allocated_blocks));
+            }
+            m_regions[i].reset();
+        }
+
+        m_region_count = 0;
+    }
+
+    expected<void*, nt_status> contiguous_arena::allocate(size_t size, uint64_t highest_acceptable_physical_address) noexcept {
+        if (m_region_count == 0) {
+            return unexpected{ nt_status_not_found_v };
+        }
+
+        size_t page_count = (size + buddy_arena::page_size_v - 1) / buddy_arena::page_size_v;
+
+        if (page_count != 0 && page_count <= region_page_count_v) {
+            void* block = nullptr;
+
+            // a holder preempted at PASSIVE_LEVEL would leave every other cpu spinning on the lock
+            KIRQL old_irql;
+            KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+            {
+                lock_guard guard{ m_lock };
+
+                for (uint32_t i = 0; i < m_region_count; ++i) {
+                    auto& region = m_regions[i];
+                    if (highest_acceptable_physical_address < region.get_physical_base() + (region.get_size() - 1)) {
+                        continue;
+                    }
+
+                    auto expt_block = region.allocate(page_count);
+                    if (expt_block.has_value()) {
+                        block = expt_block.value();
+                        break;
+                    }
+                }
+            }
+
+            KeLowerIrql(old_irql);
+
+            if (block) {
+                return block;
+            }
+        }
+
+        m_missed_allocations.fetch_add(1, std::memory_order_relaxed);
+        return unexpected{ nt_status_insufficient_resources_v };
+    }
+
+    bool contiguous_arena::deallocate(void* p) noexcept {
+        for (uint32_t i = 0; i < m_region_count; ++i) {
+            if (m_regions[i].contains(p)) {
+                KIRQL old_irql;
+                KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+                {
+                    lock_guard guard{ m_lock };
+                    m_regions[i].deallocate(p);
+                }
+
+                KeLowerIrql(old_irql);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool contiguous_arena::contains(const void* p) const noexcept {
+        return std::any_of(m_regions, m_regions + m_region_count, [p](const buddy_arena& region) { return region.contains(p); });
+    }
+
+    contiguous_arena::statistics_t contiguous_arena::get_statistics() noexcept {
+        statistics_t statistics = {
+            .region_count = m_region_count,
+            .total_pages = 0,
+            .free_pages = 0,
+            .allocated_blocks = 0,
+            .largest_free_block_pages = 0,
+            .missed_allocations = m_missed_allocations.load(std::memory_order_relaxed)
+        };
+
+        KIRQL old_irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+        {
+            lock_guard guard{ m_lock };
+
+            for (uint32_t i = 0; i < m_region_count; ++i) {
+                auto region_statistics = m_regions[i].get_statistics();
+                statistics.total_pages += region_statistics.total_pages;
+                statistics.free_pages += region_statistics.free_pages;
+                statistics.allocated_blocks += region_statistics.allocated_blocks;
+                statistics.largest_free_block_pages = std::max(statistics.largest_free_block_pages, region_statistics.largest_free_block_pages);
+            }
+        }
+
+        KeLowerIrql(old_irql);
+
+        return statistics;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include "buddy_arena.hpp"
+#include "synchronization.hpp"
+#include "irql_annotations.hpp"
+
+namespace siren {
+    // A few physically contiguous regions reserved at driver load, each managed by a buddy_arena.
+    // Every region is registered by register_address_region, so translate_virtual_address covers all blocks of the arena.
+    // contiguous_allocator takes page-sized blocks from here first and only calls MmAllocateContiguousMemory for what does not fit,
+    // which keeps VMX structures and EPT tables off the kernel's contiguous memory path after long uptimes.
+    //
+    // Constant-initialized and without a destructor so that it can be a global of the driver, release() gives the regions back.
+    class contiguous_arena {
+    public:
+        static constexpr size_t region_size_v = 2_Miuz;
+        static constexpr uint32_t max_region_count_v = 16;
+        static constexpr size_t default_size_v = 8_Miuz;
+
+        struct statistics_t {
+            uint32_t region_count;
+            size_t total_pages;
+            size_t free_pages;
+            size_t allocated_blocks;
+            size_t largest_free_block_pages;    // 1 - largest_free_block_pages / free_pages is the external fragmentation
+            uint64_t missed_allocations;        // requests that fell back to MmAllocateContiguousMemory
+        };
+
+    private:
+        static constexpr size_t region_page_count_v = region_size_v / buddy_arena::page_size_v;
+
+        buddy_arena m_regions[max_region_count_v];
+        uint8_t m_page_states[max_region_count_v][region_page_count_v];
+        uint32_t m_region_count;
+        queued_spin_lock m_lock;
+        std::atomic<uint64_t> m_missed_allocations;
+
+    public:
+        constexpr contiguous_arena() noexcept
+            : m_regions{}, m_page_states{}, m_region_count{ 0 }, m_lock{}, m_missed_allocations{ 0 } {}
+
+        contiguous_arena(const contiguous_arena&) = delete;
+
+        contiguous_arena& operator=(const contiguous_arena&) = delete;
+
+        // `size` must be a non-zero multiple of region_size_v, at most max_region_count_v regions.
+        // Keeps the regions it managed to allocate and fails only if there is none.
+        // Must finish before the first allocation.
+        _IRQL_requires_max_(APC_LEVEL)
+        [[nodiscard]]
+        expected<void, nt_status> reserve(size_t size) noexcept;
+
+        // Every block must have been freed, a region that still has blocks is leaked rather than freed under its users.
+        _IRQL_requires_max_(APC_LEVEL)
+        void release() noexcept;
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        [[nodiscard]]
+        expected<void*, nt_status> allocate(size_t size, uint64_t highest_acceptable_physical_address) noexcept;
+
+        // Returns false if `p` was not allocated from the arena.
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        bool deallocate(void* p) noexcept;
+
+        [[nodiscard]]
+        bool contains(const void* p) const noexcept;
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        [[nodiscard]]
+        statistics_t get_statistics() noexcept;
+    };
+
+    constinit inline contiguous_arena reserved_contiguous_arena;
+}
@@ -1,11 +1,63 @@
 #include "memory.hpp"
+#include "contiguous_arena.hpp"
+#include "synchronization.hpp"
 #include <bit>
+#include <algorithm>
 #include <wdm.h>
 #include <ntintsafe.h>
 
 namespace siren {
+    // Guards a nonpaged size class. Nonpaged allocations come at DISPATCH_LEVEL too, so the lock is only ever held at DISPATCH_LEVEL,
+    // where its holder cannot be preempted while other cpus spin behind it.
+    class npaged_class_lock {
+    private:
+        queued_spin_lock m_lock;
+        KIRQL m_old_irql;
+
+    public:
+        constexpr npaged_class_lock() noexcept
+            : m_lock{}, m_old_irql{ PASSIVE_LEVEL } {}
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        void lock() noexcept {
+            KIRQL old_irql;
+            KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+            m_lock.lock();
+            m_old_irql = old_irql;
+        }
+
+        _IRQL_requires_(DISPATCH_LEVEL)
+        void unlock() noexcept {
+            KIRQL old_irql = m_old_irql;
+            m_lock.unlock();
+            KeLowerIrql(old_irql);
+        }
+    };
+
+    // Guards a paged size class. Paged allocations run at APC_LEVEL or below and may fault their slots in,
+    // which must not happen at DISPATCH_LEVEL, so the class waits on a push lock instead of spinning.
+    using paged_class_lock = push_lock;
+
+    template<bool Paged>
+    using Xsize_class_pool = size_class_pool<std::conditional_t<Paged, paged_allocator<void>, npaged_allocator<void>>, std::conditional_t<Paged, paged_class_lock, npaged_class_lock>>;
+
+    static_assert(Xsize_class_pool<true>::page_size_v == PAGE_SIZE);
+    static_assert(Xsize_class_pool<true>::min_alignment_v == MEMORY_ALLOCATION_ALIGNMENT);
+
+    constinit Xsize_class_pool<true> paged_size_class_pool;
+    constinit Xsize_class_pool<false> npaged_size_class_pool;
+
     template<bool Paged>
     struct Xpaged_allocator {
+        [[nodiscard]]
+        static Xsize_class_pool<Paged>& size_classes() noexcept {
+            if constexpr (Paged) {
+                return paged_size_class_pool;
+            } else {
+                return npaged_size_class_pool;
+            }
+        }
+
         _When_(Paged, _IRQL_requires_max_(APC_LEVEL))
         _When_(!Paged, _IRQL_requires_max_(DISPATCH_LEVEL))
         [[nodiscard]]
@@ -18,6 +70,10 @@ namespace siren {
 
             NT_ASSERT(std::has_single_bit(std::to_underlying(alignment)));
 
+            if (Xsize_class_pool<Paged>::is_eligible(size, alignment)) {
+                return size_classes().allocate(Xsize_class_pool<Paged>::class_index_of(size, alignment));
+            }
+
             //
             // If NumberOfBytes is PAGE_SIZE or greater, a page-aligned buffer is allocated.
             // Memory allocations of PAGE_SIZE or less do not cross page boundaries.
@@ -58,14 +114,16 @@ namespace siren {
             //     that will be copied to an untrusted location (user-mode, over the network, etc.) to avoid disclosing sensitive information.
             p = ExAllocatePool2(pool_flags, allocate_size, siren::pool_tag_v);
 #else
-            POOL_TYPE pool_type = paged ? PagedPool : NonPagedPoolNx;
+            POOL_TYPE pool_type = Paged ? PagedPool : NonPagedPoolNx;
 
             // Memory that ExAllocatePoolWithTag allocates is uninitialized. 
             // A kernel-mode driver must first zero this memory if it is going to make it visible to user-mode software (to avoid leaking potentially privileged contents).
             p = ExAllocatePoolWithTag(pool_type, allocate_size, siren::pool_tag_v);
 #endif
 
-            NT_ASSERT(p != nullptr);
+            if (p == nullptr) {
+                return unexpected{ nt_status_insufficient_resources_v };
+            }
 
             if (reserved_size) {
                 auto pp = reinterpret_cast<void**>(siren::align_down(reinterpret_cast<uintptr_t>(p) + reserved_size, alignment));
@@ -93,9 +151,15 @@ namespace siren {
         }
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
-        static void deallocate(void* ptr, std::align_val_t alignment) noexcept {
+        static void deallocate(void* ptr, std::size_t size, std::align_val_t alignment) noexcept {
+            if (std::to_underlying(alignment) == 0) {
+                alignment = std::align_val_t{ 1 };
+            }
+
             if (ptr) {
-                if (std::to_underlying(alignment) <= MEMORY_ALLOCATION_ALIGNMENT || std::to_underlying(alignment) == PAGE_SIZE) {
+                if (Xsize_class_pool<Paged>::is_eligible(size, alignment)) {
+                    size_classes().deallocate(ptr, Xsize_class_pool<Paged>::class_index_of(size, alignment));
+                } else if (std::to_underlying(alignment) <= MEMORY_ALLOCATION_ALIGNMENT || std::to_underlying(alignment) == PAGE_SIZE) {
                     ExFreePoolWithTag(ptr, siren::pool_tag_v);
                 } else {
                     ExFreePoolWithTag(reinterpret_cast<void**>(ptr)[-1], siren::pool_tag_v);
@@ -115,8 +179,8 @@ namespace siren {
     }
 
     _IRQL_requires_max_(APC_LEVEL)
-    void paged_allocator<void>::deallocate(void* ptr, std::align_val_t alignment) noexcept {
-        return Xpaged_allocator<true>::deallocate(ptr, alignment);
+    void paged_allocator<void>::deallocate(void* ptr, std::size_t size, std::align_val_t alignment) noexcept {
+        return Xpaged_allocator<true>::deallocate(ptr, size, alignment);
     }
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -130,12 +194,33 @@ namespace siren {
     }
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
-    void npaged_allocator<void>::deallocate(void* ptr, std::align_val_t alignment) noexcept {
-        return Xpaged_allocator<false>::deallocate(ptr, alignment);
+    void npaged_allocator<void>::deallocate(void* ptr, std::size_t size, std::align_val_t alignment) noexcept {
+        return Xpaged_allocator<false>::deallocate(ptr, size, alignment);
+    }
+
+    _IRQL_requires_max_(APC_LEVEL)
+    void query_size_class_statistics(bool paged, size_class_statistics_t (&statistics)[size_class_count_v]) noexcept {
+        if (paged) {
+            paged_size_class_pool.query(statistics);
+        } else {
+            npaged_size_class_pool.query(statistics);
+        }
+    }
+
+    _IRQL_requires_max_(APC_LEVEL)
+    void release_size_class_pools() noexcept {
+        bool paged_all_free = paged_size_class_pool.release();
+        bool npaged_all_free = npaged_size_class_pool.release();
+        NT_ASSERT(paged_all_free && npaged_all_free);
     }
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
     expected<void*, nt_status> contiguous_allocator<void>::allocate(std::size_t size, uint64_t highest_acceptable_physical_address) {
+        auto expt_block = reserved_contiguous_arena.allocate(size, highest_acceptable_physical_address);
+        if (expt_block.has_value()) {
+            return expt_block;
+        }
+
         void* p = MmAllocateContiguousMemory(size, PHYSICAL_ADDRESS{ .QuadPart = static_cast<LONGLONG>(highest_acceptable_physical_address) });
         if (p) {
             return expected<void*, nt_status>{ p };
@@ -155,9 +240,33 @@ namespace siren {
         }
     }
 
+    _IRQL_requires_max_(APC_LEVEL)
+    expected<void*, nt_status> contiguous_allocator<void>::allocate_on_node(std::size_t size, std::size_t count, uint64_t highest_acceptable_physical_address, uint32_t preferred_node) {
+        std::size_t total_size;
+        nt_status status = { static_cast<uint32_t>(RtlSizeTMult(size, count, &total_size)) };
+        if (!status.is_success()) {
+            return unexpected{ status };
+        }
+
+        PHYSICAL_ADDRESS lowest = { .QuadPart = 0 };
+        PHYSICAL_ADDRESS highest = { .QuadPart = static_cast<LONGLONG>(highest_acceptable_physical_address) };
+        PHYSICAL_ADDRESS boundary = { .QuadPart = 0 };
+
+        void* p = MmAllocateContiguousNodeMemory(total_size, lowest, highest, boundary, PAGE_READWRITE, preferred_node);
+        if (p == nullptr) {
+            p = MmAllocateContiguousNodeMemory(total_size, lowest, highest, boundary, PAGE_READWRITE, MM_ANY_NODE_OK);
+        }
+
+        if (p) {
+            return expected<void*, nt_status>{ p };
+        } else {
+            return unexpected{ nt_status{ static_cast<uint32_t>(STATUS_INSUFFICIENT_RESOURCES) } };
+        }
+    }
+
     _IRQL_requires_max_(DISPATCH_LEVEL)
     void contiguous_allocator<void>::deallocate(void* p) noexcept {
-        if (p) {
+        if (p && !reserved_contiguous_arena.deallocate(p)) {
             MmFreeContiguousMemory(p);
         }
     }
@@ -1,15 +1,27 @@
 #pragma once
 #include <new>
+#include <atomic>
 #include <memory>
 #include <utility>
 #include "concepts.hpp"
 #include "expected.hpp"
 #include "nt_status.hpp"
 #include "irql_annotations.hpp"
+#include "multiprocessor.hpp"
+#include "allocation_telemetry.hpp"
+#include "size_class_pool.hpp"
 
 namespace siren {
     constexpr uint32_t pool_tag_v = 'vhrs';
 
+    // `paged` selects the size classes behind paged_allocator or npaged_allocator.
+    _IRQL_requires_max_(APC_LEVEL)
+    void query_size_class_statistics(bool paged, size_class_statistics_t (&statistics)[size_class_count_v]) noexcept;
+
+    // Gives the pages of all size classes back to the kernel, every object must have been freed. For driver unload.
+    _IRQL_requires_max_(APC_LEVEL)
+    void release_size_class_pools() noexcept;
+
     template<typename Ty>
     struct paged_allocator;
 
@@ -23,8 +35,9 @@ namespace siren {
         [[nodiscard]]
         static expected<void*, nt_status> allocate(std::size_t size, std::size_t count, std::align_val_t alignment) noexcept;
 
+        // `size` is the total size passed to allocate().
         _IRQL_requires_max_(APC_LEVEL)
-        static void deallocate(void* ptr, std::align_val_t alignment) noexcept;
+        static void deallocate(void* ptr, std::size_t size, std::align_val_t alignment) noexcept;
     };
 
     template<satisfy_none<std::is_void, std::is_const, std::is_array> Ty>
@@ -55,6 +68,7 @@ namespace siren {
         expected<Ty*, nt_status> allocate(std::size_t n) {
             auto r = paged_allocator<void>::allocate(sizeof(Ty), n, std::align_val_t{ alignof(Ty) });
             if (r.has_value()) {
+                record_allocation(allocation_category_of_v<Ty>, sizeof(Ty) * n);
                 return static_cast<Ty*>(r.value());
             } else {
                 return unexpected{ r.error() };
@@ -62,8 +76,9 @@ namespace siren {
         }
 
         _IRQL_requires_max_(APC_LEVEL)
-        void deallocate(Ty* p, std::size_t) {
-            return paged_allocator<void>::deallocate(p, std::align_val_t{ alignof(Ty) });
+        void deallocate(Ty* p, std::size_t n) {
+            record_deallocation(allocation_category_of_v<Ty>, sizeof(Ty) * n);
+            return paged_allocator<void>::deallocate(p, sizeof(Ty) * n, std::align_val_t{ alignof(Ty) });
         }
     };
 
@@ -80,8 +95,9 @@ namespace siren {
         [[nodiscard]]
         static expected<void*, nt_status> allocate(std::size_t size, std::size_t count, std::align_val_t alignment) noexcept;
 
+        // `size` is the total size passed to allocate().
         _IRQL_requires_max_(DISPATCH_LEVEL)
-        static void deallocate(void* ptr, std::align_val_t alignment) noexcept;
+        static void deallocate(void* ptr, std::size_t size, std::align_val_t alignment) noexcept;
     };
 
     template<satisfy_none<std::is_void, std::is_const, std::is_array> Ty>
@@ -112,6 +128,7 @@ namespace siren {
         expected<Ty*, nt_status> allocate(std::size_t n) {
             auto r = npaged_allocator<void>::allocate(sizeof(Ty), n, std::align_val_t{ alignof(Ty) });
             if (r.has_value()) {
+                record_allocation(allocation_category_of_v<Ty>, sizeof(Ty) * n);
                 return static_cast<Ty*>(r.value());
             } else {
                 return unexpected{ r.error() };
@@ -119,14 +136,16 @@ namespace siren {
         }
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
-        void deallocate(Ty* ptr, std::size_t) {
-            return npaged_allocator<void>::deallocate(ptr, std::align_val_t{ alignof(Ty) });
+        void deallocate(Ty* ptr, std::size_t n) {
+            record_deallocation(allocation_category_of_v<Ty>, sizeof(Ty) * n);
+            return npaged_allocator<void>::deallocate(ptr, sizeof(Ty) * n, std::align_val_t{ alignof(Ty) });
         }
     };
 
     template<typename Ty>
     struct contiguous_allocator;
 
+    // Served from reserved_contiguous_arena when it can, see contiguous_arena.hpp.
     template<>
     struct contiguous_allocator<void> {
         _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -137,6 +156,12 @@ namespace siren {
         [[nodiscard]]
         static expected<void*, nt_status> allocate(std::size_t size, std::size_t count, uint64_t highest_acceptable_physical_address);
 
+        // Prefers physical memory of NUMA node `preferred_node`, falls back to any node.
+        // Always goes to the kernel, the reserved contiguous arena is not NUMA aware.
+        _IRQL_requires_max_(APC_LEVEL)
+        [[nodiscard]]
+        static expected<void*, nt_status> allocate_on_node(std::size_t size, std::size_t count, uint64_t highest_acceptable_physical_address, uint32_t preferred_node);
+
         _IRQL_requires_max_(DISPATCH_LEVEL)
         static void deallocate(void* p) noexcept;
     };
@@ -170,6 +195,19 @@ namespace siren {
         expected<Ty*, nt_status> allocate(std::size_t n) {
             auto r = contiguous_allocator<void>::allocate(sizeof(Ty), n, std::numeric_limits<uint64_t>::max());
             if (r.has_value()) {
+                record_allocation(allocation_category_of_v<Ty>, sizeof(Ty) * n);
+                return static_cast<Ty*>(r.value());
+            } else {
+                return unexpected{ r.error() };
+            }
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        [[nodiscard]]
+        expected<Ty*, nt_status> allocate_on_node(std::size_t n, uint32_t preferred_node) {
+            auto r = contiguous_allocator<void>::allocate_on_node(sizeof(Ty), n, std::numeric_limits<uint64_t>::max(), preferred_node);
+            if (r.has_value()) {
+                record_allocation(allocation_category_of_v<Ty>, sizeof(Ty) * n);
                 return static_cast<Ty*>(r.value());
             } else {
                 return unexpected{ r.error() };
@@ -177,7 +215,8 @@ namespace siren {
         }
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
-        void deallocate(Ty* p, std::size_t) {
+        void deallocate(Ty* p, std::size_t n) {
+            record_deallocation(allocation_category_of_v<Ty>, sizeof(Ty) * n);
             contiguous_allocator<void>::deallocate(p);
         }
     };
@@ -396,4 +435,421 @@ namespace siren {
 
     template<typename Ty>
     using unique_contiguous = std::unique_ptr<Ty, allocation_delete<Ty, contiguous_allocator<std::remove_extent_t<Ty>>>>;
+
+    constexpr size_t per_cpu_pool_magazine_size_default_v = 32;
+
+    // Pool of fixed-size objects that can be allocated and freed at any IRQL, VM-exit handlers included.
+    //
+    // Every cpu keeps free objects in two magazines, `loaded` and `previous`, of MagazineSizeV objects each.
+    // In the common case allocate() and deallocate() only touch the current cpu's own cache line and are O(1).
+    // When both magazines of a cpu run out, a full or an empty magazine is swapped with the depot,
+    // which is a pair of lock-free stacks shared by all cpus.
+    //
+    // Neither allocate() nor deallocate() ever calls into the kernel.
+    // Objects only enter the pool by refill() and leave it by trim(), both at DISPATCH_LEVEL or below.
+    // allocate() fails with nt_status_insufficient_resources_v rather than grow when the depot has no full magazine left,
+    // so callers that allocate at high IRQL have to refill() beforehand.
+    //
+    // Nothing in the driver uses it yet: VM-exit handlers do not allocate today, and dynamic_ept keeps its own node cache.
+    //
+    // Interrupts are masked while a cpu's magazines are in use, but a VM exit can still land in the middle of an allocation
+    // made by the guest on the same cpu. Therefore every cpu has one set of magazines per nesting level (a lane),
+    // claimed by an exchange on that cpu's own cache line.
+    //
+    // Handed out objects are uninitialized storage, use per_cpu_pool_allocator to go through allocate_unique.
+    template<satisfy_none<std::is_void, std::is_const, std::is_array> Ty, size_t MagazineSizeV = per_cpu_pool_magazine_size_default_v>
+        requires (0 < MagazineSizeV)
+    class per_cpu_pool {
+    public:
+        static constexpr size_t magazine_size_v = MagazineSizeV;
+
+        // the guest, and a VM-exit handler that interrupts it
+        static constexpr size_t lane_count_v = 2;
+
+        struct statistics_t {
+            size_t capacity;
+            size_t object_count;            // objects owned by the pool, free or in use
+            size_t full_magazine_count;     // full magazines in the depot, approximate
+            uint64_t allocation_failures;
+        };
+
+    private:
+        union slot_t {
+            static constexpr allocation_category_e allocation_category_v = allocation_category_of_v<Ty>;
+
+            slot_t* next;
+            alignas(Ty) std::byte storage[sizeof(Ty)];
+        };
+
+        struct magazine_t {
+            std::atomic<uint32_t> next;     // link in the depot
+            uint32_t count;
+            slot_t* slots[MagazineSizeV];
+        };
+
+        struct lane_t {
+            std::atomic<bool> busy;
+            uint32_t loaded;
+            uint32_t previous;
+        };
+
+        struct alignas(64) cpu_cache_t {
+            lane_t lanes[lane_count_v];
+        };
+
+        static constexpr uint32_t none_v = UINT32_MAX;
+
+        unique_npaged<cpu_cache_t[]> m_cpu_caches;
+        unique_npaged<magazine_t[]> m_magazines;
+        uint32_t m_cpu_count;
+        uint32_t m_magazine_count;
+        size_t m_capacity;
+
+        // low 32 bits: top magazine index, high 32 bits: ABA tag
+        alignas(64) std::atomic<uint64_t> m_full_depot;
+        std::atomic<size_t> m_full_depot_count;
+        alignas(64) std::atomic<uint64_t> m_empty_depot;
+
+        // objects freed while every lane of the cpu was busy, handed back to the kernel by refill() or trim()
+        std::atomic<slot_t*> m_orphans;
+
+        std::atomic<size_t> m_object_count;
+        std::atomic<uint64_t> m_allocation_failures;
+
+        static void depot_push(std::atomic<uint64_t>& depot, magazine_t* magazines, uint32_t index) noexcept {
+            uint64_t top = depot.load(std::memory_order_relaxed);
+            uint64_t new_top;
+            do {
+                magazines[index].next.store(static_cast<uint32_t>(top), std::memory_order_relaxed);
+                new_top = (((top >> 32) + 1) << 32) | index;
+            } while (!depot.compare_exchange_weak(top, new_top, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        [[nodiscard]]
+        static uint32_t depot_pop(std::atomic<uint64_t>& depot, magazine_t* magazines) noexcept {
+            uint64_t top = depot.load(std::memory_order_acquire);
+            uint64_t new_top;
+            uint32_t index;
+            do {
+                index = static_cast<uint32_t>(top);
+                if (index == none_v) {
+                    return none_v;
+                }
+                // magazines are never freed before the pool, so reading a popped magazine's link is harmless, the tag rejects it
+                new_top = (((top >> 32) + 1) << 32) | magazines[index].next.load(std::memory_order_relaxed);
+            } while (!depot.compare_exchange_weak(top, new_top, std::memory_order_acquire, std::memory_order_acquire));
+            return index;
+        }
+
+        [[nodiscard]]
+        lane_t* lane_acquire() noexcept {
+            auto cpu_index = current_cpu_index();
+            if (cpu_index < m_cpu_count) {
+                for (auto& lane : m_cpu_caches[cpu_index].lanes) {
+                    if (!lane.busy.exchange(true, std::memory_order_acquire)) {
+                        return std::addressof(lane);
+                    }
+                }
+            }
+            return nullptr;
+        }
+
+        static void lane_release(lane_t* lane) noexcept {
+            lane->busy.store(false, std::memory_order_release);
+        }
+
+        [[nodiscard]]
+        slot_t* lane_pop(lane_t* lane) noexcept {
+            magazine_t* magazines = m_magazines.get();
+
+            if (magazines[lane->loaded].count == 0) {
+                if (magazines[lane->previous].count != 0) {
+                    std::swap(lane->loaded, lane->previous);
+                } else {
+                    uint32_t full = depot_pop(m_full_depot, magazines);
+                    if (full == none_v) {
+                        return nullptr;
+                    }
+
+                    m_full_depot_count.fetch_sub(1, std::memory_order_relaxed);
+                    depot_push(m_empty_depot, magazines, lane->previous);
+
+                    lane->previous = lane->loaded;
+                    lane->loaded = full;
+                }
+            }
+
+            auto& magazine = magazines[lane->loaded];
+            return magazine.slots[--magazine.count];
+        }
+
+        [[nodiscard]]
+        bool lane_push(lane_t* lane, slot_t* slot) noexcept {
+            magazine_t* magazines = m_magazines.get();
+
+            if (magazines[lane->loaded].count == MagazineSizeV) {
+                if (magazines[lane->previous].count != MagazineSizeV) {
+                    std::swap(lane->loaded, lane->previous);
+                } else {
+                    uint32_t empty = depot_pop(m_empty_depot, magazines);
+                    if (empty == none_v) {
+                        return false;
+                    }
+
+                    depot_push(m_full_depot, magazines, lane->previous);
+                    m_full_depot_count.fetch_add(1, std::memory_order_relaxed);
+
+                    lane->previous = lane->loaded;
+                    lane->loaded = empty;
+                }
+            }
+
+            auto& magazine = magazines[lane->loaded];
+            magazine.slots[magazine.count++] = slot;
+            return true;
+        }
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        void free_magazine_objects(magazine_t& magazine) noexcept {
+            for (uint32_t i = 0; i < magazine.count; ++i) {
+                allocator_delete<slot_t>(npaged_pool, magazine.slots[i]);
+            }
+            m_object_count.fetch_sub(magazine.count, std::memory_order_relaxed);
+            magazine.count = 0;
+        }
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        void free_orphans() noexcept {
+            slot_t* slot = m_orphans.exchange(nullptr, std::memory_order_acquire);
+            while (slot) {
+                slot_t* next = slot->next;
+                allocator_delete<slot_t>(npaged_pool, slot);
+                m_object_count.fetch_sub(1, std::memory_order_relaxed);
+                slot = next;
+            }
+        }
+
+    public:
+        per_cpu_pool() noexcept
+            : m_cpu_caches{}, m_magazines{}, m_cpu_count{ 0 }, m_magazine_count{ 0 }, m_capacity{ 0 },
+              m_full_depot{ none_v }, m_full_depot_count{ 0 }, m_empty_depot{ none_v }, m_orphans{ nullptr }, m_object_count{ 0 }, m_allocation_failures{ 0 } {}
+
+        per_cpu_pool(const per_cpu_pool&) = delete;
+
+        per_cpu_pool& operator=(const per_cpu_pool&) = delete;
+
+        // No cpu may be using the pool anymore.
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        ~per_cpu_pool() noexcept {
+            if (m_magazines) {
+                for (uint32_t i = 0; i < m_magazine_count; ++i) {
+                    free_magazine_objects(m_magazines[i]);
+                }
+            }
+            free_orphans();
+        }
+
+        // Sets up the cpu caches and the depot for at most `capacity` objects, the depot starts with empty magazines only.
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        [[nodiscard]]
+        expected<void, nt_status> initialize(size_t capacity) noexcept {
+            if (capacity == 0 || m_magazines) {
+                return unexpected{ nt_status_invalid_parameter_v };
+            }
+
+            uint32_t cpu_count = active_cpu_count();
+
+            // Lanes hold two magazines each, the depot gets enough to hold `capacity` objects,
+            // plus one more per lane so that a cpu in the middle of a swap never leaves another without an empty magazine.
+            size_t magazine_count = (capacity + MagazineSizeV - 1) / MagazineSizeV + 3 * lane_count_v * cpu_count;
+            if (none_v <= magazine_count) {
+                return unexpected{ nt_status_invalid_parameter_v };
+            }
+
+            auto expt_cpu_caches = allocate_unique<cpu_cache_t[]>(npaged_pool, cpu_count);
+            if (expt_cpu_caches.has_error()) {
+                return unexpected{ expt_cpu_caches.error() };
+            }
+
+            auto expt_magazines = allocate_unique<magazine_t[]>(npaged_pool, magazine_count);
+            if (expt_magazines.has_error()) {
+                return unexpected{ expt_magazines.error() };
+            }
+
+            uint32_t index = 0;
+
+            for (uint32_t i = 0; i < cpu_count; ++i) {
+                for (auto& lane : expt_cpu_caches.value()[i].lanes) {
+                    lane.loaded = index++;
+                    lane.previous = index++;
+                }
+            }
+
+            for (; index < magazine_count; ++index) {
+                depot_push(m_empty_depot, expt_magazines.value().get(), index);
+            }
+
+            m_cpu_caches = std::move(expt_cpu_caches.value());
+            m_magazines = std::move(expt_magazines.value());
+            m_cpu_count = cpu_count;
+            m_magazine_count = static_cast<uint32_t>(magazine_count);
+            m_capacity = capacity;
+
+            return {};
+        }
+
+        // Allocates new objects until the depot holds at least `full_magazine_count` full magazines.
+        // Fails with nt_status_insufficient_resources_v if that would exceed the capacity.
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        [[nodiscard]]
+        expected<void, nt_status> refill(size_t full_magazine_count) noexcept {
+            free_orphans();
+
+            while (m_full_depot_count.load(std::memory_order_relaxed) < full_magazine_count) {
+                size_t object_count = m_object_count.load(std::memory_order_relaxed);
+                do {
+                    if (m_capacity < object_count + MagazineSizeV) {
+                        return unexpected{ nt_status_insufficient_resources_v };
+                    }
+                } while (!m_object_count.compare_exchange_weak(object_count, object_count + MagazineSizeV, std::memory_order_relaxed));
+
+                uint32_t index = depot_pop(m_empty_depot, m_magazines.get());
+                if (index == none_v) {
+                    m_object_count.fetch_sub(MagazineSizeV, std::memory_order_relaxed);
+                    return unexpected{ nt_status_insufficient_resources_v };
+                }
+
+                auto& magazine = m_magazines[index];
+
+                for (; magazine.count < MagazineSizeV; ++magazine.count) {
+                    auto expt_slot = allocator_new_uninitialized<slot_t>(npaged_pool);
+                    if (expt_slot.has_error()) {
+                        m_object_count.fetch_sub(MagazineSizeV - magazine.count, std::memory_order_relaxed);
+                        free_magazine_objects(magazine);
+                        depot_push(m_empty_depot, m_magazines.get(), index);
+                        return unexpected{ expt_slot.error() };
+                    }
+                    magazine.slots[magazine.count] = expt_slot.value();
+                }
+
+                depot_push(m_full_depot, m_magazines.get(), index);
+                m_full_depot_count.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            return {};
+        }
+
+        // Hands objects in the depot back to the kernel until at most `keep_full_magazine_count` full magazines are left.
+        // Objects cached by cpus are left alone.
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        void trim(size_t keep_full_magazine_count) noexcept {
+            free_orphans();
+
+            while (keep_full_magazine_count < m_full_depot_count.load(std::memory_order_relaxed)) {
+                uint32_t index = depot_pop(m_full_depot, m_magazines.get());
+                if (index == none_v) {
+                    break;
+                }
+
+                m_full_depot_count.fetch_sub(1, std::memory_order_relaxed);
+                free_magazine_objects(m_magazines[index]);
+                depot_push(m_empty_depot, m_magazines.get(), index);
+            }
+        }
+
+        _IRQL_requires_max_(HIGH_LEVEL)
+        [[nodiscard]]
+        expected<Ty*, nt_status> allocate() noexcept {
+            slot_t* slot = nullptr;
+
+            bool interrupts_enabled = disable_interrupts();
+            if (lane_t* lane = lane_acquire()) {
+                slot = lane_pop(lane);
+                lane_release(lane);
+            }
+            restore_interrupts(interrupts_enabled);
+
+            if (slot) {
+                return reinterpret_cast<Ty*>(slot->storage);
+            } else {
+                m_allocation_failures.fetch_add(1, std::memory_order_relaxed);
+                return unexpected{ nt_status_insufficient_resources_v };
+            }
+        }
+
+        _IRQL_requires_max_(HIGH_LEVEL)
+        void deallocate(Ty* ptr) noexcept {
+            auto* slot = reinterpret_cast<slot_t*>(ptr);
+            bool cached = false;
+
+            bool interrupts_enabled = disable_interrupts();
+            if (lane_t* lane = lane_acquire()) {
+                cached = lane_push(lane, slot);
+                lane_release(lane);
+            }
+            restore_interrupts(interrupts_enabled);
+
+            if (!cached) {
+                slot->next = m_orphans.load(std::memory_order_relaxed);
+                while (!m_orphans.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {}
+            }
+        }
+
+        [[nodiscard]]
+        statistics_t get_statistics() const noexcept {
+            return {
+                .capacity = m_capacity,
+                .object_count = m_object_count.load(std::memory_order_relaxed),
+                .full_magazine_count = m_full_depot_count.load(std::memory_order_relaxed),
+                .allocation_failures = m_allocation_failures.load(std::memory_order_relaxed)
+            };
+        }
+    };
+
+    // Lets allocate_unique and allocator_new take objects from a per_cpu_pool, one object at a time.
+    template<satisfy_none<std::is_void, std::is_const, std::is_array> Ty, size_t MagazineSizeV = per_cpu_pool_magazine_size_default_v>
+    struct per_cpu_pool_allocator {
+        using value_type = Ty;
+
+        using pointer = Ty*;
+        using const_pointer = const Ty*;
+
+        using reference = Ty&;
+        using const_reference = const Ty&;
+
+        using size_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+
+        using propagate_on_container_move_assignment = std::true_type;
+        using is_always_equal = std::false_type;
+
+        template<typename Ty2>
+        struct rebind {
+            using other = per_cpu_pool_allocator<Ty2, MagazineSizeV>;
+        };
+
+        per_cpu_pool<Ty, MagazineSizeV>* pool;
+
+        per_cpu_pool_allocator(per_cpu_pool<Ty, MagazineSizeV>& p) noexcept
+            : pool{ std::addressof(p) } {}
+
+        per_cpu_pool_allocator(const per_cpu_pool_allocator&) noexcept = default;
+
+        _IRQL_requires_max_(HIGH_LEVEL)
+        [[nodiscard]]
+        expected<Ty*, nt_status> allocate(std::size_t n) noexcept {
+            if (n != 1) {
+                return unexpected{ nt_status_invalid_parameter_v };
+            }
+            return pool->allocate();
+        }
+
+        _IRQL_requires_max_(HIGH_LEVEL)
+        void deallocate(Ty* ptr, std::size_t) noexcept {
+            pool->deallocate(ptr);
+        }
+    };
+
+    template<typename Ty, size_t MagazineSizeV = per_cpu_pool_magazine_size_default_v>
+    using unique_pooled = std::unique_ptr<Ty, allocation_delete<Ty, per_cpu_pool_allocator<Ty, MagazineSizeV>>>;
 }
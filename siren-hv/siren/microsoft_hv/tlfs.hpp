@@ -1,6 +1,7 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <bit>
 #include "../literals.hpp"
 
 namespace siren::microsoft_hv {
@@ -16,6 +17,26 @@ namespace siren::microsoft_hv {
     constexpr auto vp_index_any_v = static_cast<vp_index_t>(-1);
     constexpr auto vp_index_self_v = static_cast<vp_index_t>(-2);
 
+    // HV_VP_SET in the sparse 4K format: bank i holds VP indexes [64 * i, 64 * i + 63].
+    // Banks are kept by bank number here and only packed when the set is sent.
+    struct vp_set_t {
+        static constexpr uint64_t format_sparse_4k_v = 0;
+        static constexpr size_t max_bank_count_v = 64;
+
+        uint64_t valid_banks_mask;
+        uint64_t banks[max_bank_count_v];
+
+        constexpr void add(vp_index_t vp_index) noexcept {
+            valid_banks_mask |= uint64_t{ 1 } << (vp_index / 64u);
+            banks[vp_index / 64u] |= uint64_t{ 1 } << (vp_index % 64u);
+        }
+
+        [[nodiscard]]
+        constexpr size_t bank_count() const noexcept {
+            return static_cast<size_t>(std::popcount(valid_banks_mask));
+        }
+    };
+
     struct connection_id_t {
         union {
             uint32_t storage;
@@ -45,6 +66,47 @@ namespace siren::microsoft_hv {
     static_assert(sizeof(flush_flags_t) == 4);
     static_assert(sizeof(flush_flags_t::storage) == sizeof(flush_flags_t::semantics));
 
+    // HV_GPA_PAGE_RANGE: 1 + additional_pages pages of 4KiB starting at base_pfn.
+    struct gpa_page_range_t {
+        static constexpr uint64_t max_page_count_v = 2048;
+
+        union {
+            uint64_t storage;
+            struct {
+                uint64_t additional_pages : 11;
+                uint64_t large_page : 1;
+                uint64_t base_pfn : 40;
+                uint64_t reserved : 12;
+            } semantics;
+        };
+    };
+
+    static_assert(sizeof(gpa_page_range_t) == 8);
+    static_assert(sizeof(gpa_page_range_t::storage) == sizeof(gpa_page_range_t::semantics));
+
+    // Appends the HV_GPA_PAGE_RANGEs covering the 4KiB pages of [base, base + size) to ranges[0, capacity), starting at `range_count`.
+    // Returns false, with `range_count` unspecified, if they do not fit.
+    [[nodiscard]]
+    constexpr bool append_gpa_page_ranges(gpa_t base, uint64_t size, gpa_page_range_t* ranges, size_t& range_count, size_t capacity) noexcept {
+        if (size == 0) {
+            return true;
+        }
+
+        uint64_t pfn = base / 4_Kiuz;
+        uint64_t end_pfn = (base + (size - 1)) / 4_Kiuz + 1;
+        while (pfn < end_pfn) {
+            if (range_count == capacity) {
+                return false;
+            }
+
+            uint64_t page_count = end_pfn - pfn < gpa_page_range_t::max_page_count_v ? end_pfn - pfn : gpa_page_range_t::max_page_count_v;
+            ranges[range_count++] = { .semantics = { .additional_pages = page_count - 1, .large_page = 0, .base_pfn = pfn } };
+            pfn += page_count;
+        }
+
+        return true;
+    }
+
     struct nested_enlightenments_control_t {
         union {
             uint32_t storage;
@@ -26,6 +26,44 @@ namespace siren::microsoft_hv {
             return result_value_t{ .storage = HvlInvokeFastExtendedHypercall(input_value.storage, &input_block, sizeof(input_block), nullptr, 0) };
         }
 
+        [[nodiscard]]
+        result_value_t flush_virtual_address_space_ex(address_space_id_t address_space, flush_flags_t flags, const vp_set_t& processor_set) noexcept {
+            // fast hypercall input is limited to rdx, r8 and xmm0-xmm5, i.e. 14 qwords
+            constexpr size_t fixed_header_count = 4;
+            constexpr size_t max_bank_count = 14 - fixed_header_count;
+
+            UINT64 input_block[fixed_header_count + max_bank_count];
+            size_t bank_count = processor_set.bank_count();
+
+            if (bank_count > max_bank_count) {
+                flags.semantics.all_processors = 1;
+                bank_count = 0;
+            }
+
+            input_block[0] = address_space;                     // AddressSpace     +0x0    8
+            input_block[1] = flags.storage;                     // Flags            +0x8    8
+            input_block[2] = vp_set_t::format_sparse_4k_v;      // ProcessorSet     +0x10   HV_VP_SET
+            input_block[3] = bank_count != 0 ? processor_set.valid_banks_mask : 0;
+
+            if (bank_count != 0) {
+                size_t i = fixed_header_count;
+                for (auto mask = processor_set.valid_banks_mask; mask != 0; mask &= mask - 1) {
+                    input_block[i++] = processor_set.banks[std::countr_zero(mask)];
+                }
+            }
+
+            auto input_value = input_value_t{
+                .semantics = {
+                    .call_code = call_code_e::HvCallFlushVirtualAddressSpaceEx,
+                    .fast = 1,
+                    .variable_header_size = static_cast<uint16_t>(bank_count),     // in qwords, only the bank contents are variable
+                    .is_nested = 0
+                }
+            };
+
+            return result_value_t{ .storage = HvlInvokeFastExtendedHypercall(input_value.storage, &input_block, static_cast<ULONG>((fixed_header_count + bank_count) * sizeof(UINT64)), nullptr, 0) };
+        }
+
         [[nodiscard]]
         result_value_t flush_guest_physical_address_space(spa_t address_space) noexcept {
             UINT64 input_block[2];
@@ -42,5 +80,60 @@ namespace siren::microsoft_hv {
 
             return result_value_t{ .storage = HvlInvokeFastExtendedHypercall(input_value.storage, &input_block, sizeof(input_block), nullptr, 0) };
         }
+
+        [[nodiscard]]
+        result_value_t flush_guest_physical_address_list(spa_t address_space, const gpa_page_range_t* ranges, size_t range_count) noexcept {
+            constexpr size_t fixed_header_count = 2;
+
+            UINT64 input_block[fixed_header_count + max_fast_gpa_page_range_count_v];
+            if (range_count > max_fast_gpa_page_range_count_v) {
+                return result_value_t{ .semantics = { .result = status_code_e::HV_STATUS_INVALID_PARAMETER } };
+            }
+
+            input_block[0] = address_space;     // AddressSpace +0x0    8   Specifies an address space ID (EPT PML4 table pointer).
+            input_block[1] = 0;                 // Flags        +0x8    8   RsvdZ
+            for (size_t i = 0; i < range_count; ++i) {
+                input_block[fixed_header_count + i] = ranges[i].storage;   // GpaRangeList +0x10  8 * rep count
+            }
+
+            auto input_value = input_value_t{
+                .semantics = {
+                    .call_code = call_code_e::HvCallFlushGuestPhysicalAddressList,
+                    .fast = 1,
+                    .is_nested = 0,
+                    .rep_count = static_cast<uint16_t>(range_count)
+                }
+            };
+
+            auto input_block_size = static_cast<ULONG>((fixed_header_count + range_count) * sizeof(UINT64));
+            for (;;) {
+                auto result_value = result_value_t{ .storage = HvlInvokeFastExtendedHypercall(input_value.storage, &input_block, input_block_size, nullptr, 0) };
+
+                // the hypervisor may hand a rep hypercall back unfinished, go on from where it stopped as long as it moves
+                if (result_value.semantics.result != status_code_e::HV_STATUS_SUCCESS ||
+                    result_value.semantics.reps_completed >= range_count ||
+                    result_value.semantics.reps_completed <= input_value.semantics.rep_start_index) {
+                    return result_value;
+                }
+
+                input_value.semantics.rep_start_index = result_value.semantics.reps_completed;
+            }
+        }
+
+        [[nodiscard]]
+        result_value_t notify_long_spin_wait(uint64_t spin_wait_count) noexcept {
+            UINT64 input_block[1];
+            input_block[0] = spin_wait_count;   // SpinWaitCount    +0x0    8   Number of times the spin wait has been attempted.
+
+            auto input_value = input_value_t{
+                .semantics = {
+                    .call_code = call_code_e::HvCallNotifyLongSpinWait,
+                    .fast = 1,
+                    .is_nested = 0
+                }
+            };
+
+            return result_value_t{ .storage = HvlInvokeFastExtendedHypercall(input_value.storage, &input_block, sizeof(input_block), nullptr, 0) };
+        }
     }
 }
@@ -202,10 +202,21 @@ namespace siren::microsoft_hv {
         [[nodiscard]]
         result_value_t flush_virtual_address_space(address_space_id_t address_space, flush_flags_t flags, uint64_t processor_mask) noexcept;
 
+        // Falls back to all processors if the set does not fit in a fast hypercall.
+        [[nodiscard]]
+        result_value_t flush_virtual_address_space_ex(address_space_id_t address_space, flush_flags_t flags, const vp_set_t& processor_set) noexcept;
+
         [[nodiscard]]
         result_value_t flush_guest_physical_address_space(spa_t address_space) noexcept;
 
-        //[[nodiscard]]
-        //result_value_t flush_guest_physical_address_list(spa_t address_space, /*todo*/) noexcept;
+        // fast hypercall input is limited to 14 qwords, the header of HvCallFlushGuestPhysicalAddressList takes 2
+        constexpr size_t max_fast_gpa_page_range_count_v = 12;
+
+        // Continues the rep hypercall until every range is flushed. Fewer reps completed than `range_count` on success means the hypervisor stopped making progress.
+        [[nodiscard]]
+        result_value_t flush_guest_physical_address_list(spa_t address_space, const gpa_page_range_t* ranges, size_t range_count) noexcept;
+
+        [[nodiscard]]
+        result_value_t notify_long_spin_wait(uint64_t spin_wait_count) noexcept;
     }
 }
@@ -1,7 +1,92 @@
 #include "multiprocessor.hpp"
+#include "memory.hpp"
+#include "x86/flags_register.hpp"
+#include <algorithm>
 #include <wdm.h>
 
 namespace siren {
+    namespace {
+        struct parallel_run_context_t {
+            cpu_callback_t fn;
+            uintptr_t arg;
+            uint32_t cpu_index;
+        };
+
+        KSTART_ROUTINE parallel_run_routine;
+
+        void parallel_run_routine(PVOID context) {
+            auto* ctx = static_cast<parallel_run_context_t*>(context);
+
+            PROCESSOR_NUMBER processor_number;
+            NT_VERIFY(NT_SUCCESS(KeGetProcessorNumberFromIndex(ctx->cpu_index, &processor_number)));
+
+            GROUP_AFFINITY group_affinity = {};
+            group_affinity.Mask = KAFFINITY{ 1 } << processor_number.Number;
+            group_affinity.Group = processor_number.Group;
+
+            // the thread exits right after, no need to revert
+            KeSetSystemGroupAffinityThread(&group_affinity, nullptr);
+            ctx->fn(ctx->arg);
+
+            PsTerminateSystemThread(STATUS_SUCCESS);
+        }
+    }
+
+    struct cpu_call_block_t {
+        std::atomic<uint32_t> pending;
+        uint32_t item_count;
+        cpu_work_item_t items[1];   // item_count of them
+
+        [[nodiscard]]
+        static constexpr size_t size_for(uint32_t item_count) noexcept {
+            return offsetof(cpu_call_block_t, items) + sizeof(cpu_work_item_t) * (item_count == 0 ? 1 : item_count);
+        }
+    };
+
+    namespace {
+        struct alignas(64) cpu_work_queue_t {
+            std::atomic<cpu_work_item_t*> head;     // LIFO, reversed when drained
+            KDPC dpc;
+        };
+
+        constinit cpu_work_queue_t* cpu_work_queues = nullptr;
+        constinit uint32_t cpu_work_queue_count = 0;
+
+        void cpu_work_queue_drain(cpu_work_queue_t& queue) noexcept {
+            cpu_work_item_t* reversed = queue.head.exchange(nullptr, std::memory_order_acquire);
+
+            cpu_work_item_t* item = nullptr;
+            while (reversed) {
+                cpu_work_item_t* next = reversed->next;
+                reversed->next = item;
+                item = reversed;
+                reversed = next;
+            }
+
+            while (item) {
+                cpu_work_item_t* next = item->next;
+                std::atomic<uint32_t>* pending = item->pending;
+
+                item->fn(item->arg);
+
+                if (pending) {
+                    pending->fetch_sub(1, std::memory_order_release);
+                }
+
+                item = next;
+            }
+        }
+
+        KDEFERRED_ROUTINE cpu_work_queue_routine;
+
+        void cpu_work_queue_routine(PKDPC dpc, PVOID context, PVOID system_argument1, PVOID system_argument2) {
+            UNREFERENCED_PARAMETER(dpc);
+            UNREFERENCED_PARAMETER(system_argument1);
+            UNREFERENCED_PARAMETER(system_argument2);
+            cpu_work_queue_drain(*static_cast<cpu_work_queue_t*>(context));
+        }
+    }
+
     void yield_cpu() noexcept {
         YieldProcessor();
     }
@@ -20,6 +105,22 @@ namespace siren {
         return KeGetCurrentProcessorNumberEx(nullptr);
     }
 
+    bool disable_interrupts() noexcept {
+        x86::rflags_t rflags{ .storage = __readeflags() };
+        _disable();
+        return rflags.semantics.interrupt_enable_flag != 0;
+    }
+
+    void restore_interrupts(bool enabled) noexcept {
+        if (enabled) {
+            _enable();
+        }
+    }
+
+    uint32_t current_numa_node() noexcept {
+        return KeGetCurrentNodeNumber();
+    }
+
     uintptr_t ipi_broadcast(cpu_callback_t fn, uintptr_t arg) noexcept {
         return KeIpiGenericCall(fn, arg);
     }
@@ -46,4 +147,196 @@ namespace siren {
 
         return retval;
     }
+
+    expected<void, nt_status> parallel_run_at_cpus(cpu_callback_t fn, uintptr_t arg) noexcept {
+        NT_ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+        uint32_t cpu_count = active_cpu_count();
+
+        auto expt_contexts = allocate_unique_uninitialized<parallel_run_context_t[]>(npaged_pool, cpu_count);
+        if (expt_contexts.has_error()) {
+            return unexpected{ expt_contexts.error() };
+        }
+
+        auto expt_threads = allocate_unique_uninitialized<HANDLE[]>(npaged_pool, cpu_count);
+        if (expt_threads.has_error()) {
+            return unexpected{ expt_threads.error() };
+        }
+
+        auto& contexts = expt_contexts.value();
+        auto& threads = expt_threads.value();
+
+        nt_status status = nt_status_success_v;
+        uint32_t thread_count = 0;
+
+        for (; thread_count < cpu_count; ++thread_count) {
+            contexts[thread_count] = { .fn = fn, .arg = arg, .cpu_index = thread_count };
+
+            OBJECT_ATTRIBUTES object_attributes;
+            InitializeObjectAttributes(&object_attributes, nullptr, OBJ_KERNEL_HANDLE, nullptr, nullptr);
+
+            status = nt_status::cast_from(
+                PsCreateSystemThread(&threads[thread_count], THREAD_ALL_ACCESS, &object_attributes, nullptr, nullptr, parallel_run_routine, &contexts[thread_count])
+            );
+            if (!status.is_success()) {
+                break;
+            }
+        }
+
+        // contexts must outlive every created thread, wait for them even on failure
+        for (uint32_t i = 0; i < thread_count; ++i) {
+            NT_VERIFY(NT_SUCCESS(ZwWaitForSingleObject(threads[i], FALSE, nullptr)));
+            ZwClose(threads[i]);
+        }
+
+        if (status.is_success()) {
+            return {};
+        } else {
+            return unexpected{ status };
+        }
+    }
+
+    cpu_set cpu_set::active() noexcept {
+        cpu_set cpus;
+        for (uint32_t i = 0, n = active_cpu_count(); i < n; ++i) {
+            cpus.insert(i);
+        }
+        return cpus;
+    }
+
+    expected<void, nt_status> initialize_cpu_work_queues() noexcept {
+        NT_ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+        if (cpu_work_queues != nullptr) {
+            return unexpected{ nt_status_invalid_device_state_v };
+        }
+
+        uint32_t cpu_count = std::min(active_cpu_count(), cpu_set::max_cpu_count_v);
+
+        auto expt_queues = allocate_unique_uninitialized<cpu_work_queue_t[]>(npaged_pool, cpu_count);
+        if (expt_queues.has_error()) {
+            return unexpected{ expt_queues.error() };
+        }
+
+        auto& queues = expt_queues.value();
+
+        for (uint32_t i = 0; i < cpu_count; ++i) {
+            PROCESSOR_NUMBER processor_number;
+
+            auto status = nt_status::cast_from(KeGetProcessorNumberFromIndex(i, &processor_number));
+            if (!status.is_success()) {
+                return unexpected{ status };
+            }
+
+            std::construct_at(std::addressof(queues[i].head), nullptr);
+
+            KeInitializeDpc(&queues[i].dpc, cpu_work_queue_routine, &queues[i]);
+            KeSetImportanceDpc(&queues[i].dpc, HighImportance);     // targeted DPCs of lower importance may wait for the next clock tick
+
+            status = nt_status::cast_from(KeSetTargetProcessorDpcEx(&queues[i].dpc, &processor_number));
+            if (!status.is_success()) {
+                return unexpected{ status };
+            }
+        }
+
+        cpu_work_queue_count = cpu_count;
+        cpu_work_queues = queues.release();
+        return {};
+    }
+
+    void release_cpu_work_queues() noexcept {
+        NT_ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+        if (cpu_work_queues != nullptr) {
+            KeFlushQueuedDpcs();
+
+            allocator_delete<cpu_work_queue_t[]>(npaged_pool, cpu_work_queues, cpu_work_queue_count);
+            cpu_work_queues = nullptr;
+            cpu_work_queue_count = 0;
+        }
+    }
+
+    expected<void, nt_status> queue_cpu_work(uint32_t cpu_index, cpu_work_item_t& item) noexcept {
+        if (cpu_work_queues == nullptr) {
+            return unexpected{ nt_status_invalid_device_state_v };
+        }
+
+        if (cpu_work_queue_count <= cpu_index) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+
+        auto& queue = cpu_work_queues[cpu_index];
+
+        cpu_work_item_t* head = queue.head.load(std::memory_order_relaxed);
+        do {
+            item.next = head;
+        } while (!queue.head.compare_exchange_weak(head, &item, std::memory_order_release, std::memory_order_relaxed));
+
+        // already queued is fine, the DPC drains whatever is in the queue when it runs
+        KeInsertQueueDpc(&queue.dpc, nullptr, nullptr);
+        return {};
+    }
+
+    void cpu_call_completion::release() noexcept {
+        if (m_block != nullptr) {
+            wait();
+            npaged_allocator<void>::deallocate(m_block, cpu_call_block_t::size_for(m_block->item_count), std::align_val_t{ alignof(cpu_call_block_t) });
+            m_block = nullptr;
+        }
+    }
+
+    uint32_t cpu_call_completion::get_pending_count() const noexcept {
+        return m_block != nullptr ? m_block->pending.load(std::memory_order_acquire) : 0;
+    }
+
+    void cpu_call_completion::wait() noexcept {
+        while (!is_done()) {
+            if (uint32_t cpu_index = current_cpu_index(); KeGetCurrentIrql() == DISPATCH_LEVEL && cpu_index < cpu_work_queue_count) {
+                cpu_work_queue_drain(cpu_work_queues[cpu_index]);
+            }
+            yield_cpu();
+        }
+    }
+
+    expected<cpu_call_completion, nt_status> run_on_cpus_async(const cpu_set& cpus, cpu_callback_t fn, uintptr_t arg) noexcept {
+        if (cpu_work_queues == nullptr) {
+            return unexpected{ nt_status_invalid_device_state_v };
+        }
+
+        bool has_queues = true;
+        cpus.for_each([&has_queues](uint32_t cpu_index) noexcept { has_queues = has_queues && cpu_index < cpu_work_queue_count; });
+        if (!has_queues) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+
+        uint32_t item_count = cpus.count();
+
+        auto expt_block = npaged_allocator<void>::allocate(cpu_call_block_t::size_for(item_count), std::align_val_t{ alignof(cpu_call_block_t) });
+        if (expt_block.has_error()) {
+            return unexpected{ expt_block.error() };
+        }
+
+        auto* block = static_cast<cpu_call_block_t*>(expt_block.value());
+        std::construct_at(std::addressof(block->pending), item_count);
+        block->item_count = item_count;
+
+        uint32_t i = 0;
+        cpus.for_each([block, fn, arg, &i](uint32_t cpu_index) noexcept {
+            auto& item = block->items[i++];
+            item = { .next = nullptr, .fn = fn, .arg = arg, .pending = std::addressof(block->pending) };
+            NT_VERIFY(queue_cpu_work(cpu_index, item).has_value());
+        });
+
+        return cpu_call_completion{ block };
+    }
+
+    expected<void, nt_status> run_on_cpus(const cpu_set& cpus, cpu_callback_t fn, uintptr_t arg) noexcept {
+        auto expt_completion = run_on_cpus_async(cpus, fn, arg);
+        if (expt_completion.has_error()) {
+            return unexpected{ expt_completion.error() };
+        }
+
+        expt_completion.value().wait();
+        return {};
+    }
 }
@@ -1,8 +1,14 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <atomic>
+#include <bit>
 #include <memory>       // use std::addressof
 #include <type_traits>
+#include <utility>
+#include "expected.hpp"
+#include "nt_status.hpp"
+#include "irql_annotations.hpp"
 
 namespace siren {
     void yield_cpu() noexcept;
@@ -15,6 +21,16 @@ namespace siren {
     [[nodiscard]]
     uint32_t current_cpu_index() noexcept;
 
+    [[nodiscard]]
+    uint32_t current_numa_node() noexcept;
+
+    // Masks maskable interrupts on the current cpu, returns whether they were enabled before.
+    [[nodiscard]]
+    bool disable_interrupts() noexcept;
+
+    // Pairs with disable_interrupts().
+    void restore_interrupts(bool enabled) noexcept;
+
     using cpu_callback_t = uintptr_t(*)(uintptr_t arg) noexcept;
 
     uintptr_t ipi_broadcast(cpu_callback_t fn, uintptr_t arg) noexcept;
@@ -48,4 +64,187 @@ namespace siren {
         auto fn_address = reinterpret_cast<uintptr_t>(std::addressof(fn));
         run_at_cpu(cpu_index, [](uintptr_t arg) noexcept { (*reinterpret_cast<CallableTy*>(arg))(); return uintptr_t{}; }, fn_address);
     }
+
+    // Runs `fn` at PASSIVE_LEVEL on every active cpu at the same time, one system thread per cpu, and waits for all of them.
+    // Like ipi_broadcast, `fn` finds out which cpu it runs on by current_cpu_index().
+    // If a thread cannot be created, `fn` may have run on only part of the cpus when the error is returned.
+    [[nodiscard]]
+    expected<void, nt_status> parallel_run_at_cpus(cpu_callback_t fn, uintptr_t arg) noexcept;
+
+    template<typename CallableTy>
+        requires std::conjunction_v<std::is_nothrow_invocable<CallableTy>, std::is_same<void, std::invoke_result_t<CallableTy>>>
+    [[nodiscard]]
+    expected<void, nt_status> parallel_run_at_cpus(CallableTy&& fn) noexcept {
+        auto fn_address = reinterpret_cast<uintptr_t>(std::addressof(fn));
+        return parallel_run_at_cpus([](uintptr_t arg) noexcept { (*reinterpret_cast<CallableTy*>(arg))(); return uintptr_t{}; }, fn_address);
+    }
+
+    // Set of cpus by index, big enough for every processor Windows supports across all groups.
+    class cpu_set {
+    public:
+        static constexpr uint32_t max_cpu_count_v = 2048;
+
+    private:
+        static constexpr uint32_t word_bits_v = 64;
+
+        uint64_t m_words[max_cpu_count_v / word_bits_v];
+
+    public:
+        constexpr cpu_set() noexcept : m_words{} {}
+
+        // Every active cpu.
+        [[nodiscard]]
+        static cpu_set active() noexcept;
+
+        [[nodiscard]]
+        static constexpr cpu_set single(uint32_t cpu_index) noexcept {
+            cpu_set cpus;
+            cpus.insert(cpu_index);
+            return cpus;
+        }
+
+        // Indexes at or beyond max_cpu_count_v are ignored.
+        constexpr void insert(uint32_t cpu_index) noexcept {
+            if (cpu_index < max_cpu_count_v) {
+                m_words[cpu_index / word_bits_v] |= uint64_t{ 1 } << (cpu_index % word_bits_v);
+            }
+        }
+
+        constexpr void erase(uint32_t cpu_index) noexcept {
+            if (cpu_index < max_cpu_count_v) {
+                m_words[cpu_index / word_bits_v] &= ~(uint64_t{ 1 } << (cpu_index % word_bits_v));
+            }
+        }
+
+        [[nodiscard]]
+        constexpr bool contains(uint32_t cpu_index) const noexcept {
+            return cpu_index < max_cpu_count_v && (m_words[cpu_index / word_bits_v] >> (cpu_index % word_bits_v) & 1) != 0;
+        }
+
+        [[nodiscard]]
+        constexpr uint32_t count() const noexcept {
+            uint32_t n = 0;
+            for (auto word : m_words) {
+                n += static_cast<uint32_t>(std::popcount(word));
+            }
+            return n;
+        }
+
+        [[nodiscard]]
+        constexpr bool empty() const noexcept {
+            for (auto word : m_words) {
+                if (word != 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Calls `fn(cpu_index)` in ascending order.
+        template<typename CallableTy>
+            requires std::is_nothrow_invocable_v<CallableTy&, uint32_t>
+        constexpr void for_each(CallableTy&& fn) const noexcept {
+            for (uint32_t i = 0; i < max_cpu_count_v / word_bits_v; ++i) {
+                for (uint64_t word = m_words[i]; word != 0; word &= word - 1) {
+                    fn(i * word_bits_v + static_cast<uint32_t>(std::countr_zero(word)));
+                }
+            }
+        }
+    };
+
+    // Request for queue_cpu_work, owned by the caller until `fn` has returned, which `pending` reports.
+    struct cpu_work_item_t {
+        cpu_work_item_t* next;
+        cpu_callback_t fn;
+        uintptr_t arg;
+        std::atomic<uint32_t>* pending;     // decremented once `fn` has returned and the item is not touched anymore, may be null
+    };
+
+    // Every cpu has a work queue drained by a DPC targeted at that cpu, so work reaches only the cpus it is meant for
+    // and runs at DISPATCH_LEVEL instead of holding every processor at IPI level like ipi_broadcast.
+    // The queues are set up once at driver load, for the cpus active at that time.
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    [[nodiscard]]
+    expected<void, nt_status> initialize_cpu_work_queues() noexcept;
+
+    // Waits for queued work to finish and frees the queues. For driver unload.
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    void release_cpu_work_queues() noexcept;
+
+    // Runs `item.fn(item.arg)` at DISPATCH_LEVEL on `cpu_index` soon, in FIFO order with other work for that cpu.
+    // Fails with nt_status_invalid_device_state_v if the queues are not set up and nt_status_invalid_parameter_v if `cpu_index` has no queue.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    [[nodiscard]]
+    expected<void, nt_status> queue_cpu_work(uint32_t cpu_index, cpu_work_item_t& item) noexcept;
+
+    struct cpu_call_block_t;
+
+    // Completion counter of run_on_cpus_async. Owns the work items, so destroying it waits for the calls to finish.
+    class cpu_call_completion {
+        friend expected<cpu_call_completion, nt_status> run_on_cpus_async(const cpu_set& cpus, cpu_callback_t fn, uintptr_t arg) noexcept;
+
+    private:
+        cpu_call_block_t* m_block;
+
+        explicit cpu_call_completion(cpu_call_block_t* block) noexcept
+            : m_block{ block } {}
+
+        void release() noexcept;
+
+    public:
+        constexpr cpu_call_completion() noexcept
+            : m_block{ nullptr } {}
+
+        cpu_call_completion(const cpu_call_completion&) = delete;
+
+        cpu_call_completion(cpu_call_completion&& other) noexcept
+            : m_block{ std::exchange(other.m_block, nullptr) } {}
+
+        cpu_call_completion& operator=(const cpu_call_completion&) = delete;
+
+        cpu_call_completion& operator=(cpu_call_completion&& other) noexcept {
+            if (this != std::addressof(other)) {
+                release();
+                m_block = std::exchange(other.m_block, nullptr);
+            }
+            return *this;
+        }
+
+        ~cpu_call_completion() noexcept {
+            release();
+        }
+
+        // Number of cpus that have not returned from the call yet.
+        [[nodiscard]]
+        uint32_t get_pending_count() const noexcept;
+
+        [[nodiscard]]
+        bool is_done() const noexcept {
+            return get_pending_count() == 0;
+        }
+
+        // Spins until every call returned. At DISPATCH_LEVEL it runs the current cpu's own queue meanwhile,
+        // so two cpus that wait for each other do not deadlock.
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        void wait() noexcept;
+    };
+
+    // Queues `fn(arg)` to every cpu of `cpus` and returns without waiting, `fn` must stay callable until the completion is done.
+    // Return values of `fn` are dropped. Fails with nt_status_invalid_parameter_v, before anything is queued, if a cpu of `cpus` has no queue.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    [[nodiscard]]
+    expected<cpu_call_completion, nt_status> run_on_cpus_async(const cpu_set& cpus, cpu_callback_t fn, uintptr_t arg) noexcept;
+
+    // Like run_on_cpus_async, but waits for every call to return.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    [[nodiscard]]
+    expected<void, nt_status> run_on_cpus(const cpu_set& cpus, cpu_callback_t fn, uintptr_t arg) noexcept;
+
+    template<typename CallableTy>
+        requires std::is_nothrow_invocable_v<CallableTy>
+    [[nodiscard]]
+    expected<void, nt_status> run_on_cpus(const cpu_set& cpus, CallableTy&& fn) noexcept {
+        auto fn_address = reinterpret_cast<uintptr_t>(std::addressof(fn));
+        return run_on_cpus(cpus, [](uintptr_t arg) noexcept { (*reinterpret_cast<std::remove_reference_t<CallableTy>*>(arg))(); return uintptr_t{}; }, fn_address);
+    }
 }
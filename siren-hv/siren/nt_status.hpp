@@ -131,5 +131,10 @@ namespace siren {
     constexpr nt_status nt_status_not_supported_v = { 0xc00000bbu };
     constexpr nt_status nt_status_insufficient_resources_v = { 0xc000009au };
     constexpr nt_status nt_status_invalid_address_v = { 0xc0000141u };
+    constexpr nt_status nt_status_object_name_collision_v = { 0xc0000035u };
     constexpr nt_status nt_status_not_found_v = { 0xc0000225u };
+    constexpr nt_status nt_status_buffer_too_small_v = { 0xc0000023u };
+    constexpr nt_status nt_status_invalid_device_state_v = { 0xc0000184u };
+    constexpr nt_status nt_status_access_violation_v = { 0xc0000005u };
+    constexpr nt_status nt_status_io_timeout_v = { 0xc00000b5u };
 }
@@ -0,0 +1,181 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <bit>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "literals.hpp"
+#include "expected.hpp"
+#include "nt_status.hpp"
+#include "synchronization.hpp"
+
+namespace siren {
+    using namespace ::siren::size_literals;
+
+    // Allocations aligned above MEMORY_ALLOCATION_ALIGNMENT but below PAGE_SIZE, of at most 2KiB,
+    // are served by paged_allocator and npaged_allocator from power-of-two size classes carved out of whole pages.
+    constexpr size_t size_class_count_v = 7;    // slots of 32, 64, ..., 2048 bytes
+
+    struct size_class_statistics_t {
+        size_t slot_size;
+        size_t page_count;
+        size_t used_slots;
+        size_t peak_used_slots;
+        uint64_t allocation_count;
+    };
+
+    // A slot of 2^k bytes at a multiple of 2^k in a page-aligned page is aligned to anything up to 2^k,
+    // so one class serves every (size, alignment) pair that rounds up to it, instead of padding each allocation by `alignment - 1 + sizeof(void*)`.
+    // Pages stay with their class until release().
+    //
+    // `PageSourceTy` hands out the pages and the bookkeeping nodes through static allocate(size, alignment) and deallocate(ptr, size, alignment),
+    // neither request is eligible for a size class itself. `LockTy` guards one class and must be constant-initializable.
+    // Depends on nothing kernel-specific so that it can be exercised by a host build.
+    template<typename PageSourceTy, typename LockTy>
+    class size_class_pool {
+    public:
+        static constexpr size_t page_size_v = 4_Kiuz;
+        static constexpr size_t min_alignment_v = 16;      // MEMORY_ALLOCATION_ALIGNMENT on x64, the pool aligns that much by itself
+        static constexpr size_t min_slot_size_v = 32;
+        static constexpr size_t max_slot_size_v = min_slot_size_v << (size_class_count_v - 1);
+
+        static_assert(max_slot_size_v < page_size_v);
+
+    private:
+        struct free_slot_t {
+            free_slot_t* next;
+        };
+
+        struct page_node_t {
+            page_node_t* next;
+            void* page;
+        };
+
+        struct size_class_t {
+            LockTy lock;
+            free_slot_t* free_slots;
+            page_node_t* pages;
+            size_class_statistics_t statistics;
+        };
+
+        size_class_t m_classes[size_class_count_v];
+
+    public:
+        constexpr size_class_pool() noexcept
+            : m_classes{} {}
+
+        size_class_pool(const size_class_pool&) = delete;
+
+        size_class_pool& operator=(const size_class_pool&) = delete;
+
+        [[nodiscard]]
+        static constexpr bool is_eligible(std::size_t size, std::align_val_t alignment) noexcept {
+            return min_alignment_v < std::to_underlying(alignment) && std::to_underlying(alignment) < page_size_v && size <= max_slot_size_v;
+        }
+
+        [[nodiscard]]
+        static constexpr size_t class_index_of(std::size_t size, std::align_val_t alignment) noexcept {
+            size_t slot_size = std::max({ std::bit_ceil(size), std::to_underlying(alignment), min_slot_size_v });
+            return std::countr_zero(slot_size) - std::countr_zero(min_slot_size_v);
+        }
+
+        [[nodiscard]]
+        expected<void*, nt_status> allocate(size_t index) noexcept {
+            auto& size_class = m_classes[index];
+            size_t slot_size = min_slot_size_v << index;
+
+            for (;;) {
+                {
+                    lock_guard guard{ size_class.lock };
+
+                    if (free_slot_t* slot = size_class.free_slots) {
+                        size_class.free_slots = slot->next;
+
+                        auto& statistics = size_class.statistics;
+                        ++statistics.used_slots;
+                        ++statistics.allocation_count;
+                        statistics.peak_used_slots = std::max(statistics.peak_used_slots, statistics.used_slots);
+
+                        return slot;
+                    }
+                }
+
+                // no free slot, carve a new page outside of the lock
+                auto expt_page = PageSourceTy::allocate(page_size_v, std::align_val_t{ page_size_v });
+                if (expt_page.has_error()) {
+                    return unexpected{ expt_page.error() };
+                }
+
+                auto expt_node = PageSourceTy::allocate(sizeof(page_node_t), std::align_val_t{ alignof(page_node_t) });
+                if (expt_node.has_error()) {
+                    PageSourceTy::deallocate(expt_page.value(), page_size_v, std::align_val_t{ page_size_v });
+                    return unexpected{ expt_node.error() };
+                }
+
+                auto* page = static_cast<std::byte*>(expt_page.value());
+                auto* node = static_cast<page_node_t*>(expt_node.value());
+
+                free_slot_t* first = nullptr;
+                for (size_t offset = page_size_v; offset != 0; offset -= slot_size) {
+                    auto* slot = reinterpret_cast<free_slot_t*>(page + offset - slot_size);
+                    slot->next = first;
+                    first = slot;
+                }
+
+                lock_guard guard{ size_class.lock };
+
+                node->page = page;
+                node->next = size_class.pages;
+                size_class.pages = node;
+                ++size_class.statistics.page_count;
+
+                reinterpret_cast<free_slot_t*>(page + page_size_v - slot_size)->next = size_class.free_slots;
+                size_class.free_slots = first;
+            }
+        }
+
+        void deallocate(void* ptr, size_t index) noexcept {
+            auto& size_class = m_classes[index];
+            auto* slot = static_cast<free_slot_t*>(ptr);
+
+            lock_guard guard{ size_class.lock };
+
+            slot->next = size_class.free_slots;
+            size_class.free_slots = slot;
+            --size_class.statistics.used_slots;
+        }
+
+        void query(size_class_statistics_t (&statistics)[size_class_count_v]) noexcept {
+            for (size_t i = 0; i < size_class_count_v; ++i) {
+                lock_guard guard{ m_classes[i].lock };
+                statistics[i] = m_classes[i].statistics;
+                statistics[i].slot_size = min_slot_size_v << i;
+            }
+        }
+
+        // Gives every page back to `PageSourceTy` and resets the statistics.
+        // Returns false if a slot was still in use, its memory is gone all the same.
+        bool release() noexcept {
+            bool all_free = true;
+
+            for (auto& size_class : m_classes) {
+                lock_guard guard{ size_class.lock };
+
+                all_free = all_free && size_class.statistics.used_slots == 0;
+
+                while (page_node_t* node = size_class.pages) {
+                    size_class.pages = node->next;
+                    PageSourceTy::deallocate(node->page, page_size_v, std::align_val_t{ page_size_v });
+                    PageSourceTy::deallocate(node, sizeof(page_node_t), std::align_val_t{ alignof(page_node_t) });
+                }
+
+                size_class.free_slots = nullptr;
+                size_class.statistics = {};
+            }
+
+            return all_free;
+        }
+    };
+}
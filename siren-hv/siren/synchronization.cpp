@@ -0,0 +1,89 @@
+#include "synchronization.hpp"
+#include <wdm.h>
+
+namespace siren {
+    namespace {
+        struct alignas(64) queue_node_t {
+            std::atomic_uint32_t next;      // index + 1 of the node queued behind, 0 if none yet
+            std::atomic_bool waiting;
+            std::atomic_bool busy;
+        };
+
+        constinit queue_node_t queue_nodes[queued_spin_lock::node_slot_count_v * queued_spin_lock::nodes_per_slot_v] = {};
+
+        [[nodiscard]]
+        queue_node_t& queue_node_at(uint32_t index) noexcept {
+            return queue_nodes[index - 1];
+        }
+
+        // Returns 0 if every node of the current cpu's slot is in use.
+        [[nodiscard]]
+        uint32_t queue_node_claim() noexcept {
+            uint32_t first = current_cpu_index() % queued_spin_lock::node_slot_count_v * queued_spin_lock::nodes_per_slot_v;
+            for (uint32_t i = first; i < first + queued_spin_lock::nodes_per_slot_v; ++i) {
+                if (!queue_nodes[i].busy.exchange(true, std::memory_order_acquire)) {
+                    return i + 1;
+                }
+            }
+            return 0;
+        }
+    }
+
+    void queued_spin_lock::lock_slow() noexcept {
+        uint32_t self = queue_node_claim();
+        if (self == 0) {
+            unsigned wait = 0;
+            constexpr unsigned max_wait = 65536;
+
+            for (uint32_t expected = 0; !m_locked.compare_exchange_weak(expected, 1, std::memory_order_acquire); expected = 0) {
+                yield_cpu(wait);
+                wait = std::min<unsigned>(wait * 2 + 1, max_wait);
+            }
+
+            return;
+        }
+
+        queue_node_t& node = queue_node_at(self);
+        node.next.store(0, std::memory_order_relaxed);
+        node.waiting.store(true, std::memory_order_relaxed);
+
+        // the previous tail cannot leave the queue before it sees us as its next
+        uint32_t previous = m_tail.exchange(self, std::memory_order_acq_rel);
+        if (previous != 0) {
+            queue_node_at(previous).next.store(self, std::memory_order_release);
+            while (node.waiting.load(std::memory_order_acquire)) {
+                yield_cpu();
+            }
+        }
+
+        // at the head of the queue now, the only waiter that spins on the lock itself
+        for (uint32_t expected = 0; m_locked.load(std::memory_order_relaxed) != 0 || !m_locked.compare_exchange_weak(expected, 1, std::memory_order_acquire); expected = 0) {
+            yield_cpu();
+        }
+
+        uint32_t expected = self;
+        if (!m_tail.compare_exchange_strong(expected, 0, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+            uint32_t next;
+            while ((next = node.next.load(std::memory_order_acquire)) == 0) {
+                yield_cpu();
+            }
+            queue_node_at(next).waiting.store(false, std::memory_order_release);
+        }
+
+        node.busy.store(false, std::memory_order_release);
+    }
+
+    static_assert(sizeof(EX_PUSH_LOCK) == sizeof(uintptr_t));
+
+    _IRQL_requires_max_(APC_LEVEL)
+    void push_lock::lock() noexcept {
+        KeEnterCriticalRegion();
+        ExAcquirePushLockExclusiveEx(reinterpret_cast<PEX_PUSH_LOCK>(&m_value), EX_DEFAULT_PUSH_LOCK_FLAGS);
+    }
+
+    _IRQL_requires_max_(APC_LEVEL)
+    void push_lock::unlock() noexcept {
+        ExReleasePushLockExclusiveEx(reinterpret_cast<PEX_PUSH_LOCK>(&m_value), EX_DEFAULT_PUSH_LOCK_FLAGS);
+        KeLeaveCriticalRegion();
+    }
+}
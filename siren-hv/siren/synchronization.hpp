@@ -1,6 +1,8 @@
 #pragma once
 #include <atomic>
+#include <concepts>
 #include <type_traits>
+#include "irql_annotations.hpp"
 #include "multiprocessor.hpp"
 
 namespace siren {
@@ -187,7 +189,7 @@ namespace siren {
         shared_lock_guard(LockerTy& locker) noexcept
             : m_locker{ locker }, m_owns{ false }
         {
-            m_locker.lock();
+            m_locker.lock_shared();
             m_owns = true;
         }
 
@@ -239,4 +241,241 @@ namespace siren {
             return m_owns;
         }
     };
+
+    // MCS-style queued spin lock, for locks that many cpus contend for.
+    //
+    // Only the first waiter spins on the lock itself, every other waiter spins on its own queue node and is woken in FIFO order,
+    // so a release does not make every waiting cpu fetch the lock's cache line again.
+    // Queue nodes are only needed while waiting. They are borrowed from a fixed table with a few nodes per cpu, claimed by an exchange
+    // like the lanes of per_cpu_pool, so that several host threads sharing a node slot can wait at once.
+    // If every node of the cpu is taken, lock() falls back to spinning on the lock like spin_lock does.
+    //
+    // Never lock() in VM-exit context: a guest interrupted while queued on the same cpu cannot move up the queue while the handler
+    // owns the processor, so the handler would wait behind it forever. Use try_lock() there, like ept_invalidation_mailbox::take().
+    //
+    // try_lock() does not jump the queue, it fails while anyone waits.
+    class queued_spin_lock {
+    public:
+        static constexpr uint32_t node_slot_count_v = 64;   // cpus beyond share slots
+        static constexpr uint32_t nodes_per_slot_v = 4;
+
+    private:
+        std::atomic_uint32_t m_locked;
+        std::atomic_uint32_t m_tail;    // queue node index + 1 of the last waiter, 0 if nobody waits
+
+        void lock_slow() noexcept;
+
+    public:
+        constexpr queued_spin_lock() noexcept : m_locked{ 0 }, m_tail{ 0 } {}
+
+        [[nodiscard]]
+        bool is_locked() const noexcept {
+            return m_locked.load(std::memory_order_relaxed) != 0;
+        }
+
+        [[nodiscard]]
+        bool is_unlocked() const noexcept {
+            return m_locked.load(std::memory_order_relaxed) == 0;
+        }
+
+        [[nodiscard]]
+        bool try_lock() noexcept {
+            uint32_t expected = 0;
+            return m_tail.load(std::memory_order_relaxed) == 0 && m_locked.load(std::memory_order_relaxed) == expected &&
+                m_locked.compare_exchange_weak(expected, 1, std::memory_order_acquire);
+        }
+
+        void lock() noexcept {
+            if (!try_lock()) {
+                lock_slow();
+            }
+        }
+
+        void unlock() noexcept {
+            m_locked.store(0, std::memory_order_release);
+        }
+    };
+
+    // Writer-preferring reader/writer spin lock.
+    //
+    // A writer that starts waiting keeps new readers out until it has had the lock, so writers cannot be starved by a stream of readers,
+    // readers can be by a stream of writers. Writers queue on a queued_spin_lock, only the first of them spins on the state.
+    class queued_rw_lock {
+    private:
+        // state
+        //   bit 0:       a writer owns the lock
+        //   bit 1:       a writer waits for readers to leave
+        //   bits 2..31:  reader count
+        static constexpr uint32_t writer_locked_v = 0b01;
+        static constexpr uint32_t writer_waiting_v = 0b10;
+        static constexpr uint32_t reader_unit_v = 0b100;
+
+        std::atomic_uint32_t m_state;
+        queued_spin_lock m_writer_queue;
+
+    public:
+        constexpr queued_rw_lock() noexcept : m_state{ 0 }, m_writer_queue{} {}
+
+        [[nodiscard]]
+        bool is_locked() const noexcept {
+            return (m_state.load(std::memory_order_relaxed) & writer_locked_v) != 0;
+        }
+
+        [[nodiscard]]
+        bool is_locked_shared() const noexcept {
+            return m_state.load(std::memory_order_relaxed) >= reader_unit_v;
+        }
+
+        [[nodiscard]]
+        bool is_unlocked() const noexcept {
+            return (m_state.load(std::memory_order_relaxed) & ~writer_waiting_v) == 0;
+        }
+
+        [[nodiscard]]
+        bool try_lock() noexcept {
+            uint32_t expected = 0;
+            return m_state.load(std::memory_order_relaxed) == expected && m_state.compare_exchange_weak(expected, writer_locked_v, std::memory_order_acquire);
+        }
+
+        [[nodiscard]]
+        bool try_lock_shared() noexcept {
+            uint32_t state = m_state.load(std::memory_order_relaxed);
+            return (state & (writer_locked_v | writer_waiting_v)) == 0 && m_state.compare_exchange_weak(state, state + reader_unit_v, std::memory_order_acquire);
+        }
+
+        void lock() noexcept {
+            lock_guard guard{ m_writer_queue };
+
+            m_state.fetch_or(writer_waiting_v, std::memory_order_relaxed);
+
+            for (uint32_t expected = writer_waiting_v; !m_state.compare_exchange_weak(expected, writer_locked_v, std::memory_order_acquire); expected = writer_waiting_v) {
+                yield_cpu();
+            }
+        }
+
+        void lock_shared() noexcept {
+            unsigned wait = 0;
+            constexpr unsigned max_wait = 65536;
+
+            while (!try_lock_shared()) {
+                yield_cpu(wait);
+                wait = std::min<unsigned>(wait * 2 + 1, max_wait);
+            }
+        }
+
+        void unlock() noexcept {
+            m_state.fetch_and(~writer_locked_v, std::memory_order_release);
+        }
+
+        void unlock_shared() noexcept {
+            m_state.fetch_sub(reader_unit_v, std::memory_order_release);
+        }
+    };
+
+    // Exclusive kernel push lock, for PASSIVE_LEVEL and APC_LEVEL callers that may allocate, fault pages in or copy a lot while holding it.
+    // Waiters block instead of spinning, and the holder runs in a critical region so that it cannot be suspended with the lock.
+    class push_lock {
+    private:
+        uintptr_t m_value;      // EX_PUSH_LOCK
+
+    public:
+        constexpr push_lock() noexcept : m_value{ 0 } {}
+
+        push_lock(const push_lock&) = delete;
+
+        push_lock& operator=(const push_lock&) = delete;
+
+        _IRQL_requires_max_(APC_LEVEL)
+        void lock() noexcept;
+
+        _IRQL_requires_max_(APC_LEVEL)
+        void unlock() noexcept;
+    };
+
+    // Read-mostly value that readers snapshot without storing to shared memory, for state that VM-exit handlers read on every exit.
+    //
+    // Two copies of the value are kept. An update fills the copy that is not current and then publishes it by bumping a sequence,
+    // so a reader only retries if two updates overlap its read. Updates are serialized by a queued_spin_lock.
+    // `fn` passed to read() may run more than once and may be given a copy in the middle of an update, whose result is then thrown away.
+    // It must not have side effects beyond its result and must not index out of bounds whatever it reads.
+    template<typename Ty>
+        requires std::is_trivially_copyable_v<Ty>
+    class versioned {
+    private:
+        // m_copies[(sequence >> 1) & 1] is the current copy.
+        // An odd sequence means that a writer is filling the other one.
+        Ty m_copies[2];
+        std::atomic<uint64_t> m_sequence;
+        queued_spin_lock m_writer_lock;
+
+    public:
+        constexpr versioned() noexcept : m_copies{}, m_sequence{ 0 }, m_writer_lock{} {}
+
+        versioned(const versioned&) = delete;
+
+        versioned& operator=(const versioned&) = delete;
+
+        // Number of updates published so far, for readers that cache something derived from the value.
+        [[nodiscard]]
+        uint64_t get_version() const noexcept {
+            return m_sequence.load(std::memory_order_acquire) >> 1;
+        }
+
+        template<typename ReadTy>
+            requires std::is_nothrow_invocable_v<ReadTy&, const Ty&>
+        auto read(ReadTy&& fn) const noexcept {
+            for (;;) {
+                uint64_t sequence = m_sequence.load(std::memory_order_acquire);
+                auto result = fn(m_copies[(sequence >> 1) & 1]);
+
+                // the copy read is overwritten only by the writer after next, which first stores (sequence | 1) + 2
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (m_sequence.load(std::memory_order_relaxed) <= (sequence & ~uint64_t{ 1 }) + 2) {
+                    return result;
+                }
+            }
+        }
+
+        [[nodiscard]]
+        Ty load() const noexcept {
+            return read([](const Ty& value) noexcept { return value; });
+        }
+
+        // `modify` gets a copy of the current value. If it returns an expected holding an error, the copy is dropped instead of published.
+        template<typename ModifyTy>
+            requires std::is_nothrow_invocable_v<ModifyTy&, Ty&>
+        auto update(ModifyTy&& modify) noexcept {
+            lock_guard guard{ m_writer_lock };
+
+            uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+            auto& next = m_copies[((sequence >> 1) + 1) & 1];
+
+            // readers that still hold `next` from two generations ago see the odd sequence and retry
+            m_sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            next = m_copies[(sequence >> 1) & 1];
+
+            if constexpr (std::is_void_v<std::invoke_result_t<ModifyTy&, Ty&>>) {
+                modify(next);
+                m_sequence.store(sequence + 2, std::memory_order_release);
+            } else {
+                auto result = modify(next);
+
+                if constexpr (requires { { result.has_error() } -> std::convertible_to<bool>; }) {
+                    if (result.has_error()) {
+                        m_sequence.store(sequence, std::memory_order_release);
+                        return result;
+                    }
+                }
+
+                m_sequence.store(sequence + 2, std::memory_order_release);
+                return result;
+            }
+        }
+
+        void store(const Ty& value) noexcept {
+            update([&value](Ty& next) noexcept { next = value; });
+        }
+    };
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <stdint.h>
 #include <concepts>
 #include <type_traits>
 #include <new>
@@ -1,5 +1,6 @@
 #include "dynamic_ept.hpp"
 #include "../address_space.hpp"
+#include "../contiguous_arena.hpp"
 #include <wdm.h>
 
 namespace siren::vmx {
@@ -630,6 +631,30 @@ namespace siren::vmx {
         }
     }
 
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    expected<dynamic_ept::node_data*, nt_status> dynamic_ept::table_new() noexcept {
+        // A table is a single page, which is physically contiguous wherever it comes from.
+        // Once the arena is exhausted, MmAllocateContiguousMemory would only search for a range that one page does not need,
+        // and that search is what fails after long uptimes. Nonpaged pool hands out whole pages page aligned.
+        auto expt_block = reserved_contiguous_arena.allocate(sizeof(node_data), std::numeric_limits<uint64_t>::max());
+        if (expt_block.has_value()) {
+            record_allocation(node_data::allocation_category_v, sizeof(node_data));
+            return std::construct_at(static_cast<node_data*>(expt_block.value()));
+        }
+
+        return allocator_new<node_data>(npaged_pool);
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void dynamic_ept::table_free(node_data* table) noexcept {
+        if (reserved_contiguous_arena.contains(table)) {
+            record_deallocation(node_data::allocation_category_v, sizeof(node_data));
+            reserved_contiguous_arena.deallocate(table);
+        } else {
+            allocator_delete(npaged_pool, table);
+        }
+    }
+
     _IRQL_requires_max_(DISPATCH_LEVEL)
     expected<dynamic_ept::node*, nt_status> dynamic_ept::node_new() noexcept {
         KdPrint(("siren-hv: siren::dynamic_ept::node_new()\n"));
@@ -639,9 +664,10 @@ namespace siren::vmx {
             return unexpected{ unique_node.error() };
         }
 
-        auto unique_node_data = allocate_unique<node_data>(npaged_pool);
-        if (!unique_node_data.has_value()) {
-            return unexpected{ unique_node_data.error() };
+        // arena tables translate without the memory manager, pool tables through MmGetPhysicalAddress
+        auto expt_table = table_new();
+        if (!expt_table.has_value()) {
+            return unexpected{ expt_table.error() };
         }
 
         node* nd = unique_node.value().release();
@@ -651,10 +677,11 @@ namespace siren::vmx {
         nd->backward = nd;
         nd->children = nullptr;
 
-        nd->table = unique_node_data.value().release();
+        nd->table = expt_table.value();
         nd->table_level = 0;
         nd->table_index = 0;
-        nd->table_pfn = x86::address_to_pfn<4_Kiuz>(get_physical_address(nd->table));
+        auto expt_table_address = translate_virtual_address(nd->table);
+        nd->table_pfn = x86::address_to_pfn<4_Kiuz>(expt_table_address.has_value() ? expt_table_address.value() : get_physical_address(nd->table));
 
         return nd;
     }
@@ -776,7 +803,7 @@ namespace siren::vmx {
             node_free(nd->children->backward->detach());
         }
 
-        allocator_delete(npaged_pool, nd->table);
+        table_free(nd->table);
         allocator_delete(npaged_pool, nd);
     }
 
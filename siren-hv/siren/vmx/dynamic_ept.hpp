@@ -94,6 +94,8 @@ namespace siren::vmx {
         static_assert(std::is_aggregate_v<page_description>);
 
         struct node_data {
+            static constexpr allocation_category_e allocation_category_v = allocation_category_e::ept;
+
             union {
                 x86::ept_pt_t pml1;
                 x86::ept_pdt_t pml2;
@@ -106,6 +108,8 @@ namespace siren::vmx {
         static_assert(alignof(node_data) == 4_Kiuz);
 
         struct node {
+            static constexpr allocation_category_e allocation_category_v = allocation_category_e::ept;
+
             node* parent;
             node* forward;
             node* backward;
@@ -229,6 +233,14 @@ namespace siren::vmx {
         [[nodiscard]]
         size_t cache_size() const noexcept;
 
+        // Zeroed, from the reserved contiguous arena while it has room, from nonpaged pool after that.
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        [[nodiscard]]
+        static expected<node_data*, nt_status> table_new() noexcept;
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        static void table_free(node_data* table) noexcept;
+
         _IRQL_requires_max_(DISPATCH_LEVEL)
         [[nodiscard]]
         expected<node*, nt_status> node_new() noexcept;
@@ -0,0 +1,134 @@
+#include "ept_invalidation.hpp"
+#include "../literals.hpp"
+#include <algorithm>
+#include <wdm.h>
+
+namespace siren::vmx {
+    using namespace ::siren::size_literals;
+
+    ept_invalidation_mailbox::ept_invalidation_mailbox(ept_invalidation_mailbox&& other) noexcept
+        : m_lock{}, m_ranges{}, m_range_count{ other.m_range_count }, m_everything{ other.m_everything }, m_statistics{ other.m_statistics },
+          m_posted{ other.m_posted.load(std::memory_order_relaxed) }, m_completed{ other.m_completed.load(std::memory_order_relaxed) }
+    {
+        std::copy_n(other.m_ranges, max_range_count_v, m_ranges);
+    }
+
+    uint64_t ept_invalidation_mailbox::post_locked() noexcept {
+        ++m_statistics.posts;
+        return m_posted.fetch_add(1) + 1;
+    }
+
+    uint64_t ept_invalidation_mailbox::post(x86::guest_paddr_t base, uint64_t size) noexcept {
+        constexpr uint64_t page_mask_v = 4_Kiuz - 1;
+
+        if (size == 0) {
+            return m_posted.load(std::memory_order_acquire);
+        }
+
+        // a range running past the end of the address space cannot be represented, flush everything instead
+        if (size - 1 > ~base || ((base + size - 1) | page_mask_v) == ~uint64_t{ 0 }) {
+            return post_everything();
+        }
+
+        x86::guest_paddr_t start = base & ~page_mask_v;
+        x86::guest_paddr_t end = ((base + size - 1) | page_mask_v) + 1;
+
+        // a poster preempted at PASSIVE_LEVEL while holding the lock would keep the owner's take() failing
+        KIRQL old_irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+        uint64_t ticket;
+        {
+            lock_guard guard{ m_lock };
+
+            if (m_everything) {
+                ++m_statistics.coalesced_posts;
+            } else {
+                // Absorbing a range may make the union touch another one, hence the restart.
+                bool coalesced = false;
+                for (size_t i = 0; i < m_range_count; ) {
+                    auto& range = m_ranges[i];
+                    if (range.base <= end && start <= range.base + range.size) {
+                        start = std::min(start, range.base);
+                        end = std::max(end, range.base + range.size);
+                        range = m_ranges[--m_range_count];
+                        coalesced = true;
+                        i = 0;
+                    } else {
+                        ++i;
+                    }
+                }
+
+                if (coalesced) {
+                    ++m_statistics.coalesced_posts;
+                }
+
+                if (m_range_count == max_range_count_v) {
+                    ++m_statistics.overflows;
+                    m_range_count = 0;
+                    m_everything = true;
+                } else {
+                    m_ranges[m_range_count++] = { .base = start, .size = end - start };
+                }
+            }
+
+            ticket = post_locked();
+        }
+
+        KeLowerIrql(old_irql);
+        return ticket;
+    }
+
+    uint64_t ept_invalidation_mailbox::post_everything() noexcept {
+        KIRQL old_irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+        uint64_t ticket;
+        {
+            lock_guard guard{ m_lock };
+
+            if (m_everything) {
+                ++m_statistics.coalesced_posts;
+            }
+
+            m_range_count = 0;
+            m_everything = true;
+            ticket = post_locked();
+        }
+
+        KeLowerIrql(old_irql);
+        return ticket;
+    }
+
+    bool ept_invalidation_mailbox::take(batch_t& batch) noexcept {
+        lock_guard guard{ m_lock, try_to_lock_t{} };
+
+        if (!guard.owns_lock() || (m_range_count == 0 && !m_everything)) {
+            return false;
+        }
+
+        std::copy_n(m_ranges, m_range_count, batch.ranges);
+        batch.range_count = m_range_count;
+        batch.everything = m_everything;
+        batch.ticket = m_posted.load(std::memory_order_relaxed);
+
+        m_range_count = 0;
+        m_everything = false;
+        ++m_statistics.batches;
+        return true;
+    }
+
+    ept_invalidation_mailbox::statistics_t ept_invalidation_mailbox::get_statistics() noexcept {
+        KIRQL old_irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+        statistics_t statistics;
+        {
+            lock_guard guard{ m_lock };
+            statistics = m_statistics;
+        }
+
+        KeLowerIrql(old_irql);
+        return statistics;
+    }
+}
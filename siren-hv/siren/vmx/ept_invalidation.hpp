@@ -0,0 +1,93 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "../synchronization.hpp"
+#include "../x86/intel_ept.hpp"
+
+namespace siren::vmx {
+    // EPT invalidations pending for one virtual cpu. Any processor posts, the owning processor takes them on its next VM exit or VM entry.
+    // Posted ranges are widened to 4KiB pages and coalesced with overlapping or adjacent ones; once more than max_range_count_v disjoint ranges
+    // are pending the mailbox degrades to "everything". Either way a burst of posts costs the owner a single flush hypercall,
+    // HvCallFlushGuestPhysicalAddressList for the ranges or HvCallFlushGuestPhysicalAddressSpace for everything.
+    //
+    // Every post returns a ticket. A poster that must know its EPT edit is no longer cached by the owner waits for is_completed(ticket).
+    class ept_invalidation_mailbox {
+    public:
+        static constexpr size_t max_range_count_v = 8;
+
+        struct range_t {
+            x86::guest_paddr_t base;
+            uint64_t size;
+        };
+
+        struct batch_t {
+            range_t ranges[max_range_count_v];
+            size_t range_count;
+            bool everything;
+            uint64_t ticket;            // to pass to complete() once the batch is flushed
+        };
+
+        struct statistics_t {
+            uint64_t posts;
+            uint64_t coalesced_posts;   // merged into ranges already pending
+            uint64_t overflows;         // degraded to everything
+            uint64_t batches;           // taken, each one costs a flush
+        };
+
+    private:
+        queued_spin_lock m_lock;
+        range_t m_ranges[max_range_count_v];
+        size_t m_range_count;
+        bool m_everything;
+        statistics_t m_statistics;
+        std::atomic<uint64_t> m_posted;
+        std::atomic<uint64_t> m_completed;
+
+        uint64_t post_locked() noexcept;
+
+    public:
+        constexpr ept_invalidation_mailbox() noexcept
+            : m_lock{}, m_ranges{}, m_range_count{ 0 }, m_everything{ false }, m_statistics{}, m_posted{ 0 }, m_completed{ 0 } {}
+
+        ept_invalidation_mailbox(const ept_invalidation_mailbox&) = delete;
+
+        // Only while nobody posts, e.g. when the owning virtual cpu is moved into place.
+        ept_invalidation_mailbox(ept_invalidation_mailbox&& other) noexcept;
+
+        ept_invalidation_mailbox& operator=(const ept_invalidation_mailbox&) = delete;
+
+        ept_invalidation_mailbox& operator=(ept_invalidation_mailbox&&) noexcept = delete;
+
+        // Returns the ticket of the post. An empty range is not recorded and its ticket completes with whatever is already pending.
+        uint64_t post(x86::guest_paddr_t base, uint64_t size) noexcept;
+
+        uint64_t post_everything() noexcept;
+
+        // Owner only, cheap enough for every VM exit. Sequentially consistent with post(), so that an owner that publishes
+        // "in the guest" before asking either sees a post or the poster sees the owner in the guest.
+        [[nodiscard]]
+        bool has_pending() const noexcept {
+            return m_posted.load() != m_completed.load(std::memory_order_relaxed);
+        }
+
+        // Owner only. Moves everything pending into `batch` and returns false if there is nothing to flush.
+        // Never waits for the lock: the poster holding it may be the guest interrupted on this very processor. Then false is returned too
+        // and has_pending() stays true, so the next VM exit tries again.
+        [[nodiscard]]
+        bool take(batch_t& batch) noexcept;
+
+        // Owner only, after the flush covering `ticket` is done.
+        void complete(uint64_t ticket) noexcept {
+            m_completed.store(ticket, std::memory_order_release);
+        }
+
+        [[nodiscard]]
+        bool is_completed(uint64_t ticket) const noexcept {
+            return ticket <= m_completed.load(std::memory_order_acquire);
+        }
+
+        [[nodiscard]]
+        statistics_t get_statistics() noexcept;
+    };
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "guest_state.hpp"
+
+namespace siren::vmx {
+    // On-disk layout of a recorded exit trace: one exit_record_file_header_t followed by record_count exit_record_t.
+    // This header depends on nothing but guest_state.hpp so that a user-mode replayer can include it as is.
+    struct exit_record_file_header_t {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t header_size;
+        uint32_t record_size;
+        uint32_t reserved;
+        uint64_t record_count;      // records in the file
+        uint64_t capacity;          // records requested when the recording was started
+    };
+
+    static_assert(sizeof(exit_record_file_header_t) == 32);
+
+    inline constexpr uint32_t exit_record_magic_v = 0x58455253u;    // "SREX"
+    inline constexpr uint16_t exit_record_version_v = 1;
+
+    struct exit_record_t {
+        static constexpr uint32_t flag_resumed_v = 1u << 0u;    // false if the exit turned the vm off
+
+        uint64_t tsc;               // at VM exit, before the handler ran
+        uint64_t handler_ticks;     // TSC ticks spent in dispatch
+        uint32_t vcpu_index;
+        uint32_t flags;
+
+        // exit-relevant fields of the enlightened vmcs at VM exit
+        struct {
+            uint32_t exit_reason;
+            uint32_t vmexit_instruction_length;
+            uint32_t vmexit_instruction_info;
+            uint32_t vmexit_interruption_info;
+            uint32_t vmexit_exception_error_code;
+            uint32_t idt_vectoring_info;
+            uint32_t idt_vectoring_error_code;
+            uint32_t reserved;
+            uint64_t exit_qualification;
+            uint64_t guest_linear_address;
+            uint64_t guest_physical_address;
+            uint64_t guest_rip;
+            uint64_t guest_rsp;
+            uint64_t guest_rflags;
+            uint64_t guest_cr0;
+            uint64_t guest_cr3;
+            uint64_t guest_cr4;
+            uint64_t cr0_read_shadow;
+            uint64_t cr4_read_shadow;
+        } vmcs_in;
+
+        // what the handler left in the enlightened vmcs for the next VM entry
+        struct {
+            uint32_t vmentry_interruption_info;
+            uint32_t vmentry_exception_error_code;
+            uint64_t guest_rip;
+            uint64_t guest_rsp;
+            uint64_t guest_rflags;
+            uint64_t guest_cr0;
+            uint64_t guest_cr3;
+            uint64_t guest_cr4;
+            uint64_t cr0_read_shadow;
+            uint64_t cr4_read_shadow;
+        } vmcs_out;
+
+        // guest_state_t::rsp and guest_state_t::rflags are lazy, use vmcs_in and vmcs_out for them instead.
+        // A replayer stubs CPUID, RDMSR and hypercall results with guest_state_out.
+        guest_state_t guest_state_in;
+        guest_state_t guest_state_out;
+    };
+
+    static_assert(offsetof(exit_record_t, guest_state_in) % alignof(guest_state_t) == 0);
+}
@@ -0,0 +1,132 @@
+#include "exit_recorder.hpp"
+#include "../memory.hpp"
+#include <algorithm>
+
+namespace siren::vmx {
+    void exit_recorder::disarm() noexcept {
+        // Pairs with begin_record(): a writer either sees m_armed cleared or is counted in m_writers.
+        m_armed.store(false);
+        wait_for_writers();
+    }
+
+    void exit_recorder::wait_for_writers() noexcept {
+        unsigned wait = 0;
+        constexpr unsigned max_wait = 65536;
+
+        while (m_writers.load() != 0) {
+            yield_cpu(wait);
+            wait = std::min<unsigned>(wait * 2, max_wait);
+        }
+    }
+
+    void exit_recorder::free_records() noexcept {
+        if (m_records) {
+            allocator_delete<exit_record_t[]>(npaged_pool, m_records, m_capacity);
+            m_records = nullptr;
+            m_capacity = 0;
+        }
+        m_next.store(0, std::memory_order_relaxed);
+    }
+
+    exit_recorder::exit_recorder() noexcept
+        : m_records{ nullptr }, m_capacity{ 0 }, m_armed{ false }, m_next{ 0 }, m_writers{ 0 }, m_control_lock{} {}
+
+    exit_recorder::~exit_recorder() noexcept {
+        disarm();
+        free_records();
+    }
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    expected<void, nt_status> exit_recorder::start(size_t capacity) noexcept {
+        if (capacity == 0 || capacity > max_capacity_v) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+
+        lock_guard guard{ m_control_lock };
+
+        disarm();
+        free_records();
+
+        auto r = allocator_new_uninitialized<exit_record_t[]>(npaged_pool, capacity);
+        if (r.has_error()) {
+            return unexpected{ r.error() };
+        }
+
+        m_records = r.value();
+        m_capacity = capacity;
+        m_armed.store(true);
+
+        return {};
+    }
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    void exit_recorder::stop() noexcept {
+        lock_guard guard{ m_control_lock };
+        disarm();
+    }
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    expected<size_t, nt_status> exit_recorder::read(void* buffer, size_t buffer_size, uint64_t first_record) noexcept {
+        if (buffer_size < sizeof(exit_record_file_header_t)) {
+            return unexpected{ nt_status_buffer_too_small_v };
+        }
+
+        lock_guard guard{ m_control_lock };
+
+        if (m_armed.load()) {
+            return unexpected{ nt_status_invalid_device_state_v };
+        }
+
+        // A full recorder disarms itself while exits that got a record may still be filling it in.
+        wait_for_writers();
+
+        auto issued = m_next.load(std::memory_order_relaxed);
+        auto record_count = std::min(issued, m_capacity);
+
+        exit_record_file_header_t header = {
+            .magic = exit_record_magic_v,
+            .version = exit_record_version_v,
+            .header_size = sizeof(exit_record_file_header_t),
+            .record_size = sizeof(exit_record_t),
+            .reserved = 0,
+            .record_count = record_count,
+            .capacity = m_capacity
+        };
+
+        auto* p = static_cast<std::byte*>(buffer);
+        std::copy_n(reinterpret_cast<const std::byte*>(&header), sizeof(header), p);
+
+        size_t copy_count = 0;
+        if (first_record < record_count) {
+            copy_count = std::min<size_t>(record_count - static_cast<size_t>(first_record), (buffer_size - sizeof(header)) / sizeof(exit_record_t));
+            std::copy_n(reinterpret_cast<const std::byte*>(m_records + first_record), copy_count * sizeof(exit_record_t), p + sizeof(header));
+        }
+
+        return sizeof(header) + copy_count * sizeof(exit_record_t);
+    }
+
+    exit_record_t* exit_recorder::begin_record() noexcept {
+        if (!m_armed.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+
+        m_writers.fetch_add(1);
+
+        if (m_armed.load()) {
+            auto index = m_next.fetch_add(1, std::memory_order_relaxed);
+            if (index < m_capacity) {
+                return std::addressof(m_records[index]);
+            }
+
+            // full, stop taking the shared counter on every exit
+            m_armed.store(false, std::memory_order_relaxed);
+        }
+
+        m_writers.fetch_sub(1, std::memory_order_release);
+        return nullptr;
+    }
+
+    void exit_recorder::end_record([[maybe_unused]] exit_record_t* record) noexcept {
+        m_writers.fetch_sub(1, std::memory_order_release);
+    }
+}
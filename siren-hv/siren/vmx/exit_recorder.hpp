@@ -0,0 +1,82 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "../expected.hpp"
+#include "../nt_status.hpp"
+#include "../synchronization.hpp"
+
+#include "../memory.hpp"
+
+#include "exit_record.hpp"
+
+namespace siren {
+    template<>
+    inline constexpr allocation_category_e allocation_category_of_v<vmx::exit_record_t> = allocation_category_e::exit_recorder;
+}
+
+namespace siren::vmx {
+    // Records the first N VM exits after start() into a nonpaged buffer, for offline replay of mshv_vmexit_handler::dispatch.
+    // Exit handlers only pay for an atomic load while the recorder is disarmed.
+    class exit_recorder {
+    private:
+        exit_record_t* m_records;
+        size_t m_capacity;
+
+        std::atomic_bool m_armed;
+        std::atomic_size_t m_next;
+        std::atomic_uint32_t m_writers;
+
+        // Serializes start(), stop() and read(), which all run at PASSIVE_LEVEL.
+        // start() allocates and read() copies up to max_capacity_v records under it, so waiters block instead of spinning.
+        push_lock m_control_lock;
+
+        void disarm() noexcept;
+
+        // Returns once every record handed out by begin_record() has been handed back.
+        void wait_for_writers() noexcept;
+
+        void free_records() noexcept;
+
+    public:
+        static constexpr size_t max_capacity_v = 65536;
+
+        exit_recorder() noexcept;
+
+        // copy constructor is not allowed
+        exit_recorder(const exit_recorder&) = delete;
+
+        // move constructor is not allowed
+        exit_recorder(exit_recorder&&) noexcept = delete;
+
+        // copy assignment is not allowed
+        exit_recorder& operator=(const exit_recorder&) = delete;
+
+        // move assignment is not allowed
+        exit_recorder& operator=(exit_recorder&&) noexcept = delete;
+
+        ~exit_recorder() noexcept;
+
+        // Discards any previous recording and arms the recorder for `capacity` exits.
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        [[nodiscard]]
+        expected<void, nt_status> start(size_t capacity) noexcept;
+
+        // Disarms the recorder and waits for exits being recorded on other cpus. The recording is kept for read().
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        void stop() noexcept;
+
+        // Copies the file header followed by as many records, starting from `first_record`, as fit in `buffer_size`.
+        // Returns the number of bytes written. The recorder must be stopped or full, in the latter case read() waits for the last records to be filled in.
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        [[nodiscard]]
+        expected<size_t, nt_status> read(void* buffer, size_t buffer_size, uint64_t first_record) noexcept;
+
+        // Called by the exit handler. Returns null if the recorder is disarmed or full, otherwise the record to fill,
+        // which must be handed back to end_record().
+        [[nodiscard]]
+        exit_record_t* begin_record() noexcept;
+
+        void end_record(exit_record_t* record) noexcept;
+    };
+}
@@ -0,0 +1,260 @@
+#include "guest_memory.hpp"
+#include "guest_page_walker.hpp"
+#include "mshv_virtual_cpu.hpp"
+
+#include "../address_space.hpp"
+#include "../memory.hpp"
+
+#include "../x86/control_registers.hpp"
+#include "../x86/model_specific_registers.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <utility>
+#include <wdm.h>
+
+namespace siren::vmx {
+    physical_memory_map::physical_memory_map(physical_memory_map&& other) noexcept
+        : m_ranges{ std::exchange(other.m_ranges, nullptr) }, m_range_count{ std::exchange(other.m_range_count, 0) } {}
+
+    physical_memory_map::~physical_memory_map() noexcept {
+        release();
+    }
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    expected<void, nt_status> physical_memory_map::initialize() noexcept {
+        if (m_ranges) {
+            return unexpected{ nt_status_invalid_device_state_v };
+        }
+
+        // terminated by a range with zero base and size, freed with ExFreePool
+        PPHYSICAL_MEMORY_RANGE ranges = MmGetPhysicalMemoryRanges();
+        if (ranges == nullptr) {
+            return unexpected{ nt_status_insufficient_resources_v };
+        }
+
+        size_t count = 0;
+        while (ranges[count].BaseAddress.QuadPart != 0 || ranges[count].NumberOfBytes.QuadPart != 0) {
+            ++count;
+        }
+
+        // sorted and merged in place, so that a run of RAM split across ranges is found in one
+        std::sort(ranges, ranges + count, [](const PHYSICAL_MEMORY_RANGE& a, const PHYSICAL_MEMORY_RANGE& b) noexcept { return a.BaseAddress.QuadPart < b.BaseAddress.QuadPart; });
+
+        size_t merged_count = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (ranges[i].NumberOfBytes.QuadPart == 0) {
+                continue;
+            }
+
+            if (merged_count != 0) {
+                auto& last = ranges[merged_count - 1];
+                if (ranges[i].BaseAddress.QuadPart <= last.BaseAddress.QuadPart + last.NumberOfBytes.QuadPart) {
+                    last.NumberOfBytes.QuadPart = std::max(last.NumberOfBytes.QuadPart, ranges[i].BaseAddress.QuadPart + ranges[i].NumberOfBytes.QuadPart - last.BaseAddress.QuadPart);
+                    continue;
+                }
+            }
+
+            ranges[merged_count++] = ranges[i];
+        }
+
+        if (merged_count == 0) {
+            ExFreePool(ranges);
+            return unexpected{ nt_status_not_found_v };
+        }
+
+        auto expt_ranges = allocator_new_uninitialized<range_t[]>(npaged_pool, merged_count);
+        if (expt_ranges.has_error()) {
+            ExFreePool(ranges);
+            return unexpected{ expt_ranges.error() };
+        }
+
+        for (size_t i = 0; i < merged_count; ++i) {
+            x86::paddr_t base = static_cast<x86::paddr_t>(ranges[i].BaseAddress.QuadPart);
+            expt_ranges.value()[i] = { .base = base, .end = base + static_cast<x86::paddr_t>(ranges[i].NumberOfBytes.QuadPart) };
+        }
+
+        ExFreePool(ranges);
+
+        m_ranges = expt_ranges.value();
+        m_range_count = merged_count;
+        return {};
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void physical_memory_map::release() noexcept {
+        if (m_ranges) {
+            allocator_delete<range_t[]>(npaged_pool, m_ranges, m_range_count);
+            m_ranges = nullptr;
+            m_range_count = 0;
+        }
+    }
+
+    bool physical_memory_map::contains(x86::paddr_t base, size_t size) const noexcept {
+        // the last range that starts at or below `base`
+        auto* it = std::upper_bound(m_ranges, m_ranges + m_range_count, base, [](x86::paddr_t address, const range_t& range) noexcept { return address < range.base; });
+        if (it == m_ranges) {
+            return false;
+        }
+
+        --it;
+        return base < it->end && size <= it->end - base;
+    }
+
+    void guest_mapping_window::map(size_t slot, x86::paddr_t page_base) noexcept {
+        using namespace guest_paging;
+
+        std::atomic_ref<uint64_t>{ *m_ptes[slot] }.store(page_base | present_v | writable_v | accessed_v | dirty_v | execute_disable_v, std::memory_order_relaxed);
+        __invlpg(m_base + slot * 4_Kiuz);
+    }
+
+    void guest_mapping_window::unmap(size_t slot) noexcept {
+        std::atomic_ref<uint64_t>{ *m_ptes[slot] }.store(0, std::memory_order_relaxed);
+        __invlpg(m_base + slot * 4_Kiuz);
+    }
+
+    guest_mapping_window::guest_mapping_window(guest_mapping_window&& other) noexcept
+        : m_base{ std::exchange(other.m_base, nullptr) }, m_ram{ std::exchange(other.m_ram, nullptr) }, m_table_mapped{ std::exchange(other.m_table_mapped, false) }
+    {
+        std::copy(std::begin(other.m_ptes), std::end(other.m_ptes), std::begin(m_ptes));
+        std::fill(std::begin(other.m_ptes), std::end(other.m_ptes), nullptr);
+    }
+
+    guest_mapping_window::~guest_mapping_window() noexcept {
+        release();
+    }
+
+    _IRQL_requires_max_(APC_LEVEL)
+    expected<void, nt_status> guest_mapping_window::initialize(const physical_memory_map& ram) noexcept {
+        if (is_initialized()) {
+            return unexpected{ nt_status_invalid_device_state_v };
+        }
+
+        auto* base = static_cast<std::byte*>(MmAllocateMappingAddress(page_count_v * 4_Kiuz, pool_tag_v));
+        if (base == nullptr) {
+            return unexpected{ nt_status_insufficient_resources_v };
+        }
+
+        // The kernel half of every address space shares its tables, so the current CR3 is as good as the host's.
+        // A reserved mapping has its page tables in place, only the PTEs are empty.
+        auto expt_context = make_guest_paging_context(
+            x86::read_cr0().storage, x86::read_cr3().storage, x86::read_cr4().storage, x86::read_msr<x86::IA32_EFER>().storage
+        );
+
+        if (expt_context.has_error()) {
+            MmFreeMappingAddress(base, pool_tag_v);
+            return unexpected{ expt_context.error() };
+        }
+
+        for (size_t i = 0; i < page_count_v; ++i) {
+            auto expt_pte = locate_page_table_entry(expt_context.value(), reinterpret_cast<x86::vaddr64_t>(base + i * 4_Kiuz), 
+                [](x86::paddr_t table) noexcept { return get_virtual_address<uint64_t*>(table); });
+
+            if (expt_pte.has_error()) {
+                std::fill(std::begin(m_ptes), std::end(m_ptes), nullptr);
+                MmFreeMappingAddress(base, pool_tag_v);
+                return unexpected{ expt_pte.error() };
+            }
+
+            m_ptes[i] = expt_pte.value();
+        }
+
+        m_base = base;
+        m_ram = &ram;
+        return {};
+    }
+
+    _IRQL_requires_max_(APC_LEVEL)
+    void guest_mapping_window::release() noexcept {
+        if (m_base) {
+            // a reserved mapping must be empty when it is freed
+            for (size_t i = 0; i < page_count_v; ++i) {
+                unmap(i);
+            }
+
+            MmFreeMappingAddress(m_base, pool_tag_v);
+
+            m_base = nullptr;
+            std::fill(std::begin(m_ptes), std::end(m_ptes), nullptr);
+            m_ram = nullptr;
+            m_table_mapped = false;
+        }
+    }
+
+    uint64_t* guest_mapping_window::map_table(x86::paddr_t table) noexcept {
+        x86::paddr_t table_page = table & ~x86::paddr_t{ 4_Kiuz - 1 };
+        if (!is_initialized() || !m_ram->contains(table_page, 4_Kiuz)) {
+            return nullptr;
+        }
+
+        map(0, table_page);
+        m_table_mapped = true;
+        return reinterpret_cast<uint64_t*>(m_base);
+    }
+
+    void guest_mapping_window::unmap_table() noexcept {
+        if (m_table_mapped) {
+            unmap(0);
+            m_table_mapped = false;
+        }
+    }
+
+    std::byte* guest_mapping_window::map_data(x86::paddr_t first_page, size_t page_count) noexcept {
+        NT_ASSERT(is_initialized() && 0 < page_count && page_count <= data_page_count_v);
+
+        // mapped write-back, which a device frame must not be
+        if (!m_ram->contains(first_page, page_count * 4_Kiuz)) {
+            return nullptr;
+        }
+
+        for (size_t i = 0; i < page_count; ++i) {
+            map(1 + i, first_page + i * 4_Kiuz);
+        }
+
+        return m_base + 4_Kiuz;
+    }
+
+    void guest_mapping_window::unmap_data(size_t page_count) noexcept {
+        for (size_t i = 0; i < page_count; ++i) {
+            unmap(1 + i);
+        }
+    }
+
+    namespace {
+        template<guest_copy_buffer ByteTy>
+        expected<void, nt_status> copy_physical(mshv_virtual_cpu* vcpu, x86::paddr_t gpa, ByteTy* buffer, size_t size) noexcept {
+            auto& window = vcpu->get_mapping_window();
+            if (!window.is_initialized()) {
+                return unexpected{ nt_status_invalid_device_state_v };
+            }
+
+            return copy_guest_physical(window, gpa, buffer, size);
+        }
+
+        template<guest_copy_buffer ByteTy>
+        expected<void, nt_status> copy_virtual(mshv_virtual_cpu* vcpu, x86::vaddr64_t gva, ByteTy* buffer, size_t size) noexcept {
+            return copy_guest_virtual(
+                [vcpu](x86::vaddr64_t gva, guest_walk_e walk) noexcept { return vcpu->translate_guest_address(gva, walk); },
+                [vcpu](x86::paddr_t gpa, ByteTy* buffer, size_t size) noexcept { return copy_physical(vcpu, gpa, buffer, size); },
+                gva, buffer, size
+            );
+        }
+    }
+
+    expected<void, nt_status> read_guest_virtual(mshv_virtual_cpu* vcpu, x86::vaddr64_t gva, void* buffer, size_t size) noexcept {
+        return copy_virtual(vcpu, gva, static_cast<std::byte*>(buffer), size);
+    }
+
+    expected<void, nt_status> write_guest_virtual(mshv_virtual_cpu* vcpu, x86::vaddr64_t gva, const void* buffer, size_t size) noexcept {
+        return copy_virtual(vcpu, gva, static_cast<const std::byte*>(buffer), size);
+    }
+
+    expected<void, nt_status> read_guest_physical(mshv_virtual_cpu* vcpu, x86::paddr_t gpa, void* buffer, size_t size) noexcept {
+        return copy_physical(vcpu, gpa, static_cast<std::byte*>(buffer), size);
+    }
+
+    expected<void, nt_status> write_guest_physical(mshv_virtual_cpu* vcpu, x86::paddr_t gpa, const void* buffer, size_t size) noexcept {
+        return copy_physical(vcpu, gpa, static_cast<const std::byte*>(buffer), size);
+    }
+}
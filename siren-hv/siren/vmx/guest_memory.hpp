@@ -0,0 +1,214 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+#include "../expected.hpp"
+#include "../nt_status.hpp"
+#include "../irql_annotations.hpp"
+#include "../literals.hpp"
+#include "../x86/paging.hpp"
+#include "guest_page_walker.hpp"
+
+namespace siren::vmx {
+    using namespace ::siren::size_literals;
+
+    class mshv_virtual_cpu;
+
+    // The RAM of the host, a snapshot of MmGetPhysicalMemoryRanges with adjacent ranges merged.
+    // guest_mapping_window maps every frame write-back, which device memory must never be, so it only maps frames inside these ranges.
+    // Memory hot-added after initialize() is not in the snapshot and is refused.
+    class physical_memory_map {
+    public:
+        struct range_t {
+            x86::paddr_t base;
+            x86::paddr_t end;   // exclusive
+        };
+
+    private:
+        range_t* m_ranges;      // sorted by base, disjoint and not adjacent
+        size_t m_range_count;
+
+    public:
+        constexpr physical_memory_map() noexcept
+            : m_ranges{ nullptr }, m_range_count{ 0 } {}
+
+        physical_memory_map(const physical_memory_map&) = delete;
+
+        physical_memory_map(physical_memory_map&& other) noexcept;
+
+        physical_memory_map& operator=(const physical_memory_map&) = delete;
+
+        physical_memory_map& operator=(physical_memory_map&&) noexcept = delete;
+
+        ~physical_memory_map() noexcept;
+
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        [[nodiscard]]
+        expected<void, nt_status> initialize() noexcept;
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        void release() noexcept;
+
+        [[nodiscard]]
+        size_t get_range_count() const noexcept {
+            return m_range_count;
+        }
+
+        // Whether [`base`, `base + size`) is RAM from end to end. Never true before initialize().
+        [[nodiscard]]
+        bool contains(x86::paddr_t base, size_t size) const noexcept;
+    };
+
+    // A few pages of kernel address space reserved by MmAllocateMappingAddress, whose PTEs are rewritten to reach any host physical frame
+    // from VMX root operation, where the memory manager must not be called. The PTEs are located once by initialize().
+    // Slot 0 maps guest page tables for walk_guest_page_tables, the other slots map runs of data frames.
+    // One per virtual cpu and only used on its processor, so not synchronized.
+    class guest_mapping_window {
+    public:
+        static constexpr size_t page_count_v = 5;
+        static constexpr size_t data_page_count_v = page_count_v - 1;
+
+    private:
+        std::byte* m_base;
+        uint64_t* m_ptes[page_count_v];
+        const physical_memory_map* m_ram;
+        bool m_table_mapped;
+
+        void map(size_t slot, x86::paddr_t page_base) noexcept;
+
+        void unmap(size_t slot) noexcept;
+
+    public:
+        constexpr guest_mapping_window() noexcept
+            : m_base{}, m_ptes{}, m_ram{}, m_table_mapped{ false } {}
+
+        guest_mapping_window(const guest_mapping_window&) = delete;
+
+        guest_mapping_window(guest_mapping_window&& other) noexcept;
+
+        guest_mapping_window& operator=(const guest_mapping_window&) = delete;
+
+        guest_mapping_window& operator=(guest_mapping_window&&) noexcept = delete;
+
+        ~guest_mapping_window() noexcept;
+
+        // Only frames in `ram` are mapped, which must outlive the window.
+        _IRQL_requires_max_(APC_LEVEL)
+        [[nodiscard]]
+        expected<void, nt_status> initialize(const physical_memory_map& ram) noexcept;
+
+        _IRQL_requires_max_(APC_LEVEL)
+        void release() noexcept;
+
+        [[nodiscard]]
+        bool is_initialized() const noexcept {
+            return m_base != nullptr;
+        }
+
+        // Maps the 4KiB table at `table`, replacing the table mapped before. Returns nullptr if not initialized or if the table is not in RAM.
+        [[nodiscard]]
+        uint64_t* map_table(x86::paddr_t table) noexcept;
+
+        // Once a walk is over, so that guest page tables do not stay reachable from kernel address space.
+        void unmap_table() noexcept;
+
+        // Maps `page_count` physically consecutive frames from page-aligned `first_page`, at most data_page_count_v.
+        // Returns nullptr, with nothing mapped, if any of them is not in RAM.
+        [[nodiscard]]
+        std::byte* map_data(x86::paddr_t first_page, size_t page_count) noexcept;
+
+        // Pairs with map_data(), so that guest frames do not stay reachable from kernel address space.
+        void unmap_data(size_t page_count) noexcept;
+    };
+
+    // Copy between a buffer and guest memory, only in VMX root operation on the processor of `vcpu`.
+    // A virtual range is translated once per guest page by walking the page tables of `vcpu`, setting A, and D for writes, like the processor would,
+    // and each page is copied in runs of up to guest_mapping_window::data_page_count_v frames with one mapping each.
+    // Access rights are checked as for a supervisor access with CR0.WP = 1, a write to a read-only page fails with nt_status_access_violation_v.
+    // A frame outside of RAM fails with nt_status_invalid_address_v. For the other errors see walk_guest_page_tables.
+    // On failure a prefix of the range may have been copied already.
+
+    [[nodiscard]]
+    expected<void, nt_status> read_guest_virtual(mshv_virtual_cpu* vcpu, x86::vaddr64_t gva, void* buffer, size_t size) noexcept;
+
+    [[nodiscard]]
+    expected<void, nt_status> write_guest_virtual(mshv_virtual_cpu* vcpu, x86::vaddr64_t gva, const void* buffer, size_t size) noexcept;
+
+    [[nodiscard]]
+    expected<void, nt_status> read_guest_physical(mshv_virtual_cpu* vcpu, x86::paddr_t gpa, void* buffer, size_t size) noexcept;
+
+    [[nodiscard]]
+    expected<void, nt_status> write_guest_physical(mshv_virtual_cpu* vcpu, x86::paddr_t gpa, const void* buffer, size_t size) noexcept;
+
+    // A const buffer is copied to the guest, a mutable one is filled from the guest.
+    template<typename ByteTy>
+    concept guest_copy_buffer = std::is_same_v<std::remove_const_t<ByteTy>, std::byte>;
+
+    // The splitting behind the functions above. Any window with the map_data() and unmap_data() of guest_mapping_window,
+    // and any translation with the signature of mshv_virtual_cpu::translate_guest_address, so that a host build can drive it.
+
+    // EPT maps guest physical memory one to one, so a guest physical range is the same host physical range.
+    // Copies in runs of up to WindowTy::data_page_count_v frames, each mapped once.
+    template<typename WindowTy, guest_copy_buffer ByteTy>
+    [[nodiscard]]
+    expected<void, nt_status> copy_guest_physical(WindowTy& window, x86::paddr_t gpa, ByteTy* buffer, size_t size) noexcept {
+        while (size != 0) {
+            x86::paddr_t first_page = gpa & ~x86::paddr_t{ 4_Kiuz - 1 };
+            size_t offset = static_cast<size_t>(gpa - first_page);
+            size_t page_count = std::min((offset + size + 4_Kiuz - 1) / 4_Kiuz, WindowTy::data_page_count_v);
+            size_t run = std::min(size, page_count * 4_Kiuz - offset);
+
+            std::byte* mapped = window.map_data(first_page, page_count);
+            if (mapped == nullptr) {
+                return unexpected{ nt_status_invalid_address_v };
+            }
+
+            if constexpr (std::is_const_v<ByteTy>) {
+                std::copy_n(buffer, run, mapped + offset);
+            } else {
+                std::copy_n(mapped + offset, run, buffer);
+            }
+            window.unmap_data(page_count);
+
+            gpa += run;
+            buffer += run;
+            size -= run;
+        }
+
+        return {};
+    }
+
+    // Translates once per guest page, which may be a large one, and copies the rest of that page with `copy_physical`.
+    template<typename TranslateTy, typename CopyPhysicalTy, guest_copy_buffer ByteTy>
+    [[nodiscard]]
+    expected<void, nt_status> copy_guest_virtual(TranslateTy&& translate, CopyPhysicalTy&& copy_physical, x86::vaddr64_t gva, ByteTy* buffer, size_t size) noexcept {
+        constexpr bool to_guest = std::is_const_v<ByteTy>;
+
+        while (size != 0) {
+            expected<guest_translation_t, nt_status> expt_translation = translate(gva, to_guest ? guest_walk_e::set_accessed_dirty : guest_walk_e::set_accessed);
+            if (expt_translation.has_error()) {
+                return unexpected{ expt_translation.error() };
+            }
+
+            const auto& translation = expt_translation.value();
+            if (to_guest && !translation.writable) {
+                return unexpected{ nt_status_access_violation_v };
+            }
+
+            size_t run = static_cast<size_t>(std::min<uint64_t>(size, translation.page_size - (gva & (translation.page_size - 1))));
+
+            expected<void, nt_status> expt_copy = copy_physical(translation.gpa, buffer, run);
+            if (expt_copy.has_error()) {
+                return expt_copy;
+            }
+
+            gva += run;
+            buffer += run;
+            size -= run;
+        }
+
+        return {};
+    }
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <type_traits>
+#include "../expected.hpp"
+#include "../nt_status.hpp"
+#include "../x86/paging.hpp"
+
+namespace siren::vmx {
+    using namespace ::siren::size_literals;
+
+    // Guest linear address translation through the guest's own 4-level or 5-level page tables.
+    // Guest page tables are reached through a caller-provided accessor, which maps the 4KiB table at a guest physical address
+    // and returns it as 512 entries, or nullptr if it cannot. That keeps this header pure, so that walks can be replayed against synthetic tables.
+    //
+    // Translations are not cached across exits. INVLPG, INVPCID and MOV to CR3 run without exiting, so a guest that edits its page tables
+    // and flushes its own TLB leaves nothing behind that could invalidate a cached copy. Tagging by CR3 and PCID only tells address spaces apart.
+    //
+    // [*] Volume 3 (3A, 3B, 3C & 3D): System Programming Guide
+    //  |-> Chapter 4 Paging
+    //    |-> 4.5 4-Level Paging and 5-Level Paging
+
+    // Paging state of the guest, see make_guest_paging_context.
+    struct guest_paging_context_t {
+        x86::paddr_t page_table_base;   // CR3 without PCID and flag bits
+        uint16_t pcid;                  // zero unless CR4.PCIDE = 1
+        bool five_level;                // CR4.LA57
+        bool no_execute;                // IA32_EFER.NXE
+    };
+
+    // Fails with nt_status_not_supported_v unless the guest is in IA-32e mode with paging on.
+    [[nodiscard]]
+    constexpr expected<guest_paging_context_t, nt_status> make_guest_paging_context(uint64_t cr0, uint64_t cr3, uint64_t cr4, uint64_t ia32_efer) noexcept {
+        constexpr uint64_t cr0_paging_v = uint64_t{ 1 } << 31u;
+        constexpr uint64_t cr4_la57_v = uint64_t{ 1 } << 12u;
+        constexpr uint64_t cr4_pcide_v = uint64_t{ 1 } << 17u;
+        constexpr uint64_t efer_nxe_v = uint64_t{ 1 } << 11u;
+        constexpr uint64_t efer_lma_v = uint64_t{ 1 } << 10u;
+
+        if ((cr0 & cr0_paging_v) == 0 || (ia32_efer & efer_lma_v) == 0) {
+            return unexpected{ nt_status_not_supported_v };
+        }
+
+        return guest_paging_context_t{
+            .page_table_base = cr3 & 0x000f'ffff'ffff'f000u,
+            .pcid = (cr4 & cr4_pcide_v) != 0 ? static_cast<uint16_t>(cr3 & 0xfffu) : uint16_t{ 0 },
+            .five_level = (cr4 & cr4_la57_v) != 0,
+            .no_execute = (ia32_efer & efer_nxe_v) != 0
+        };
+    }
+
+    enum class guest_walk_e : uint8_t {
+        read_only,              // leave the guest page tables untouched
+        set_accessed,           // set A in every entry used, as the processor does on any access
+        set_accessed_dirty,     // also set D in a writable leaf, as the processor does on a write
+    };
+
+    struct guest_translation_t {
+        x86::paddr_t gpa;       // of the byte that was translated
+        uint64_t page_size;     // 4KiB, 2MiB or 1GiB
+        bool writable;          // R/W set at every level
+        bool user;              // U/S set at every level
+        bool executable;        // XD clear at every level, or IA32_EFER.NXE = 0
+    };
+
+    namespace guest_paging {
+        constexpr uint64_t present_v = uint64_t{ 1 } << 0u;
+        constexpr uint64_t writable_v = uint64_t{ 1 } << 1u;
+        constexpr uint64_t user_v = uint64_t{ 1 } << 2u;
+        constexpr uint64_t accessed_v = uint64_t{ 1 } << 5u;
+        constexpr uint64_t dirty_v = uint64_t{ 1 } << 6u;
+        constexpr uint64_t page_size_v = uint64_t{ 1 } << 7u;
+        constexpr uint64_t execute_disable_v = uint64_t{ 1 } << 63u;
+        constexpr uint64_t address_mask_v = 0x000f'ffff'ffff'f000u;    // MAXPHYADDR is at most 52, the bits above the real one are not checked
+    }
+
+    template<typename TableAccessorTy>
+    concept guest_table_accessor = std::is_nothrow_invocable_r_v<uint64_t*, TableAccessorTy&, x86::paddr_t>;
+
+    // Fails with
+    //   nt_status_invalid_address_v     if `gva` is not canonical or not present, the guest would take a #PF;
+    //   nt_status_invalid_parameter_v   if an entry has a reserved PS bit set, the guest would take a #PF with RSVD;
+    //   nt_status_not_found_v           if `table_accessor` cannot map a table.
+    // Access rights are reported, not enforced. A and D are set atomically since other processors walk the same tables.
+    template<guest_table_accessor TableAccessorTy>
+    [[nodiscard]]
+    expected<guest_translation_t, nt_status> walk_guest_page_tables(const guest_paging_context_t& context, x86::vaddr64_t gva, guest_walk_e walk, TableAccessorTy&& table_accessor) noexcept {
+        using namespace guest_paging;
+
+        const int top_level = context.five_level ? 5 : 4;
+        const int address_bits = 12 + 9 * top_level;
+
+        if (static_cast<x86::vaddr64_t>(static_cast<int64_t>(gva << (64 - address_bits)) >> (64 - address_bits)) != gva) {
+            return unexpected{ nt_status_invalid_address_v };
+        }
+
+        guest_translation_t translation = { .gpa = 0, .page_size = 0, .writable = true, .user = true, .executable = true };
+
+        x86::paddr_t table = context.page_table_base;
+        for (int level = top_level; ; --level) {
+            uint64_t* entries = table_accessor(table);
+            if (entries == nullptr) {
+                return unexpected{ nt_status_not_found_v };
+            }
+
+            const int shift = 12 + 9 * (level - 1);
+
+            std::atomic_ref<uint64_t> entry{ entries[(gva >> shift) & 0x1ffu] };
+            uint64_t value = entry.load(std::memory_order_relaxed);
+
+            if ((value & present_v) == 0) {
+                return unexpected{ nt_status_invalid_address_v };
+            }
+
+            bool leaf = level == 1 || (value & page_size_v) != 0;
+            if (leaf && 3 < level) {
+                return unexpected{ nt_status_invalid_parameter_v };
+            }
+
+            translation.writable = translation.writable && (value & writable_v) != 0;
+            translation.user = translation.user && (value & user_v) != 0;
+            translation.executable = translation.executable && !(context.no_execute && (value & execute_disable_v) != 0);
+
+            uint64_t set_bits = 0;
+            if (walk != guest_walk_e::read_only && (value & accessed_v) == 0) {
+                set_bits |= accessed_v;
+            }
+
+            if (leaf && walk == guest_walk_e::set_accessed_dirty && translation.writable && (value & dirty_v) == 0) {
+                set_bits |= dirty_v;
+            }
+
+            if (set_bits != 0) {
+                entry.fetch_or(set_bits, std::memory_order_relaxed);
+            }
+
+            if (leaf) {
+                translation.page_size = uint64_t{ 1 } << shift;
+                translation.gpa = (value & address_mask_v & ~(translation.page_size - 1)) | (gva & (translation.page_size - 1));     // clears PAT of large pages too
+                return translation;
+            }
+
+            table = value & address_mask_v;
+        }
+    }
+
+    // Finds the 4KiB PTE that maps `va`, present or not, for code that maps pages by writing PTEs itself.
+    // Fails with nt_status_invalid_address_v if an upper level is not present and nt_status_invalid_parameter_v if `va` is in a large page.
+    // Works on any 4-level or 5-level tables, the host's included.
+    template<guest_table_accessor TableAccessorTy>
+    [[nodiscard]]
+    expected<uint64_t*, nt_status> locate_page_table_entry(const guest_paging_context_t& context, x86::vaddr64_t va, TableAccessorTy&& table_accessor) noexcept {
+        using namespace guest_paging;
+
+        x86::paddr_t table = context.page_table_base;
+        for (int level = context.five_level ? 5 : 4; ; --level) {
+            uint64_t* entries = table_accessor(table);
+            if (entries == nullptr) {
+                return unexpected{ nt_status_not_found_v };
+            }
+
+            uint64_t* entry = &entries[(va >> (12 + 9 * (level - 1))) & 0x1ffu];
+            if (level == 1) {
+                return entry;
+            }
+
+            uint64_t value = std::atomic_ref<uint64_t>{ *entry }.load(std::memory_order_relaxed);
+            if ((value & present_v) == 0) {
+                return unexpected{ nt_status_invalid_address_v };
+            }
+
+            if ((value & page_size_v) != 0) {
+                return unexpected{ nt_status_invalid_parameter_v };
+            }
+
+            table = value & address_mask_v;
+        }
+    }
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 #include "../x86/flags_register.hpp"
 #include "../x86/simd_registers.hpp"
 
@@ -59,4 +60,26 @@ namespace siren::vmx {
     };
 
     static_assert(alignof(guest_state_t) == alignof(x86::xmm_t));
+
+    // layout is relied on by mshv_vmexit_handler.masm.asm
+    static_assert(offsetof(guest_state_t, rax) == 0x0);
+    static_assert(offsetof(guest_state_t, rdx) == 0x10);
+    static_assert(offsetof(guest_state_t, rsp) == 0x20);
+    static_assert(offsetof(guest_state_t, r8) == 0x40);
+    static_assert(offsetof(guest_state_t, r15) == 0x78);
+    static_assert(offsetof(guest_state_t, rip) == 0x80);
+    static_assert(offsetof(guest_state_t, rflags) == 0x88);
+    static_assert(offsetof(guest_state_t, xmm0) == 0x90);
+    static_assert(offsetof(guest_state_t, xmm5) == 0xe0);
+    static_assert(offsetof(guest_state_t, xmm15) == 0x180);
+    static_assert(sizeof(guest_state_t) == 0x190);
+
+    // rsp and rflags are not saved by entry_point, they stay in the VMCS until a handler asks for them.
+    // guest_state_t::rsp and guest_state_t::rflags are only valid when the corresponding bit is loaded.
+    enum class guest_lazy_register_e : uint32_t {
+        NONE = 0,
+        RSP = 1u << 0,
+        RFLAGS = 1u << 1,
+        ALL = RSP | RFLAGS
+    };
 }
@@ -0,0 +1,303 @@
+#pragma once
+#include <bit>
+#include <type_traits>
+#include "../x86/intel_vmx.hpp"
+#include "../microsoft_hv/tlfs.hpp"
+
+namespace siren::vmx {
+    // Defined in
+    // [*] Hypervisor Top Level Functional Specification
+    //  |-> Nested Virtualization
+    //    |-> Enlightened VMCS
+    //      |-> Clean Fields
+    enum class mshv_clean_field_e : uint32_t {
+        NONE = 0,
+        IO_BITMAP = 1u << 0,
+        MSR_BITMAP = 1u << 1,
+        CONTROL_GRP2 = 1u << 2,
+        CONTROL_GRP1 = 1u << 3,
+        CONTROL_PROC = 1u << 4,
+        CONTROL_EVENT = 1u << 5,
+        CONTROL_ENTRY = 1u << 6,
+        CONTROL_EXCPN = 1u << 7,
+        CRDR = 1u << 8,
+        CONTROL_XLAT = 1u << 9,
+        GUEST_BASIC = 1u << 10,
+        GUEST_GRP1 = 1u << 11,
+        GUEST_GRP2 = 1u << 12,
+        HOST_POINTER = 1u << 13,
+        HOST_GRP1 = 1u << 14,
+        ENLIGHTENMENTS_CONTROL = 1u << 15,
+        ALL = (1u << 16) - 1
+    };
+
+    constexpr size_t mshv_clean_field_count_v = std::popcount(std::to_underlying(mshv_clean_field_e::ALL));
+
+    // Maps a vmcs field encoding to the member of the enlightened vmcs that carries it and the clean field group that covers it.
+    // Fields that the enlightened vmcs (version 1) does not carry are intentionally left undefined, so using them fails to compile.
+    template<uint32_t V>
+    struct mshv_evmcs_field;
+
+#define SIREN_MSHV_EVMCS_FIELD(V, M, G)                                                             \
+    template<>                                                                                      \
+    struct mshv_evmcs_field<V> {                                                                    \
+        static constexpr auto member_v = &microsoft_hv::vmx_enlightened_vmcs_t::M;                 \
+        static constexpr mshv_clean_field_e clean_field_v = mshv_clean_field_e::G;                  \
+    }
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VPID,                                           ctrl_vpid,                                              CONTROL_XLAT);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_EPT_POINTER,                                    ctrl_ept_pointer,                                       CONTROL_XLAT);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_IO_BITMAP_A_ADDRESS,                            ctrl_io_bitmap_a_address,                               IO_BITMAP);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_IO_BITMAP_B_ADDRESS,                            ctrl_io_bitmap_b_address,                               IO_BITMAP);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_MSR_BITMAP_ADDRESS,                             ctrl_msr_bitmap_address,                                MSR_BITMAP);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_PIN_BASED_VM_EXECUTION_CONTROLS,                ctrl_pin_based_vm_execution_controls,                   CONTROL_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_SECONDARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS, ctrl_secondary_processor_based_vm_execution_controls, CONTROL_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_PRIMARY_VMEXIT_CONTROLS,                        ctrl_primary_vmexit_controls,                           CONTROL_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS,  ctrl_primary_processor_based_vm_execution_controls,     CONTROL_PROC);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_EXCEPTION_BITMAP,                               ctrl_exception_bitmap,                                  CONTROL_EXCPN);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMENTRY_CONTROLS,                               ctrl_vmentry_controls,                                  CONTROL_ENTRY);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMENTRY_INTERRUPTION_INFO,                      ctrl_vmentry_interruption_info,                         CONTROL_EVENT);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMENTRY_EXCEPTION_ERROR_CODE,                   ctrl_vmentry_exception_error_code,                      CONTROL_EVENT);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMENTRY_INSTRUCTION_LENGTH,                     ctrl_vmentry_instruction_length,                        CONTROL_EVENT);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_TSC_OFFSET,                                     ctrl_tsc_offset,                                        CONTROL_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_TSC_MULTIPLIER,                                 ctrl_tsc_multiplier,                                    CONTROL_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VIRTUAL_APIC_ADDRESS,                           ctrl_virtual_apic_address,                              CONTROL_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_TPR_THRESHOLD,                                  ctrl_tpr_threshold,                                     CONTROL_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_XSS_EXITING_BITMAP,                             ctrl_xss_exiting_bitmap,                                CONTROL_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_ENCLS_EXITING_BITMAP,                           ctrl_encls_exiting_bitmap,                              CONTROL_GRP2);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_CR0_GUEST_HOST_MASK,                            ctrl_cr0_guest_host_mask,                               CRDR);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_CR4_GUEST_HOST_MASK,                            ctrl_cr4_guest_host_mask,                               CRDR);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_CR0_READ_SHADOW,                                ctrl_cr0_read_shadow,                                   CRDR);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_CR4_READ_SHADOW,                                ctrl_cr4_read_shadow,                                   CRDR);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_CR0,                                           guest_cr0,                                              CRDR);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_CR3,                                           guest_cr3,                                              CRDR);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_CR4,                                           guest_cr4,                                              CRDR);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_DR7,                                           guest_dr7,                                              CRDR);
+
+    // The hypervisor does not cache the following fields, any change of them requires the whole enlightened vmcs to be reloaded.
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMEXIT_MSR_STORE_ADDRESS,                       ctrl_vmexit_msr_store_address,                          ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMEXIT_MSR_LOAD_ADDRESS,                        ctrl_vmexit_msr_load_address,                           ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMENTRY_MSR_LOAD_ADDRESS,                       ctrl_vmentry_msr_load_address,                          ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMEXIT_MSR_STORE_COUNT,                         ctrl_vmexit_msr_store_count,                            ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMEXIT_MSR_LOAD_COUNT,                          ctrl_vmexit_msr_load_count,                             ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_VMENTRY_MSR_LOAD_COUNT,                         ctrl_vmentry_msr_load_count,                            ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_CR3_TARGET_VALUE0,                              ctrl_cr3_target_value0,                                 ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_CR3_TARGET_VALUE1,                              ctrl_cr3_target_value1,                                 ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_CR3_TARGET_VALUE2,                              ctrl_cr3_target_value2,                                 ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_CR3_TARGET_VALUE3,                              ctrl_cr3_target_value3,                                 ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_CR3_TARGET_COUNT,                               ctrl_cr3_target_count,                                  ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_PAGEFAULT_ERROR_CODE_MASK,                      ctrl_pagefault_error_code_mask,                         ALL);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_CTRL_PAGEFAULT_ERROR_CODE_MATCH,                     ctrl_pagefault_error_code_match,                        ALL);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_RIP,                                           guest_rip,                                              NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_RSP,                                           guest_rsp,                                              GUEST_BASIC);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_RFLAGS,                                        guest_rflags,                                           GUEST_BASIC);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_INTERRUPTIBILITY_STATE,                        guest_interruptibility_state,                           GUEST_BASIC);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_VMCS_LINK_POINTER,                             guest_vmcs_link_pointer,                                GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_DEBUGCTL,                                 guest_ia32_debug_ctl,                                   GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_PAT,                                      guest_ia32_pat,                                         GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_EFER,                                     guest_ia32_efer,                                        GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_PDPTE0,                                        guest_pdpte0,                                           GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_PDPTE1,                                        guest_pdpte1,                                           GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_PDPTE2,                                        guest_pdpte2,                                           GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_PDPTE3,                                        guest_pdpte3,                                           GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_PENDING_DEBUG_EXCEPTIONS,                      guest_pending_debug_exceptions,                         GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_SYSENTER_CS,                              guest_ia32_sysenter_cs,                                 GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_SYSENTER_ESP,                             guest_ia32_sysenter_esp,                                GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_SYSENTER_EIP,                             guest_ia32_sysenter_eip,                                GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_ACTIVITY_STATE,                                guest_sleep_state,                                      GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_BNDCFGS,                                  guest_ia32_bndcfgs,                                     GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_PERF_GLOBAL_CTRL,                         guest_ia32_perf_global_ctrl,                            GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_S_CET,                                    guest_ia32_s_cet,                                       GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_SSP,                                           guest_ssp,                                              GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_INTERRUPT_SSP_TABLE_ADDR,                 guest_ia32_interrupt_ssp_table_addr,                    GUEST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IA32_LBR_CTL,                                  guest_ia32_lbr_ctl,                                     GUEST_GRP1);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_ES_SELECTOR,                                   guest_es_selector,                                      GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_CS_SELECTOR,                                   guest_cs_selector,                                      GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_SS_SELECTOR,                                   guest_ss_selector,                                      GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_DS_SELECTOR,                                   guest_ds_selector,                                      GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_FS_SELECTOR,                                   guest_fs_selector,                                      GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_GS_SELECTOR,                                   guest_gs_selector,                                      GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_LDTR_SELECTOR,                                 guest_ldtr_selector,                                    GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_TR_SELECTOR,                                   guest_tr_selector,                                      GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_ES_LIMIT,                                      guest_es_limit,                                         GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_CS_LIMIT,                                      guest_cs_limit,                                         GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_SS_LIMIT,                                      guest_ss_limit,                                         GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_DS_LIMIT,                                      guest_ds_limit,                                         GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_FS_LIMIT,                                      guest_fs_limit,                                         GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_GS_LIMIT,                                      guest_gs_limit,                                         GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_LDTR_LIMIT,                                    guest_ldtr_limit,                                       GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_TR_LIMIT,                                      guest_tr_limit,                                         GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_GDTR_LIMIT,                                    guest_gdtr_limit,                                       GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IDTR_LIMIT,                                    guest_idtr_limit,                                       GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_ES_ACCESS_RIGHTS,                              guest_es_attributes,                                    GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_CS_ACCESS_RIGHTS,                              guest_cs_attributes,                                    GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_SS_ACCESS_RIGHTS,                              guest_ss_attributes,                                    GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_DS_ACCESS_RIGHTS,                              guest_ds_attributes,                                    GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_FS_ACCESS_RIGHTS,                              guest_fs_attributes,                                    GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_GS_ACCESS_RIGHTS,                              guest_gs_attributes,                                    GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_LDTR_ACCESS_RIGHTS,                            guest_ldtr_attributes,                                  GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_TR_ACCESS_RIGHTS,                              guest_tr_attributes,                                    GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_ES_BASE,                                       guest_es_base,                                          GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_CS_BASE,                                       guest_cs_base,                                          GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_SS_BASE,                                       guest_ss_base,                                          GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_DS_BASE,                                       guest_ds_base,                                          GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_FS_BASE,                                       guest_fs_base,                                          GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_GS_BASE,                                       guest_gs_base,                                          GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_LDTR_BASE,                                     guest_ldtr_base,                                        GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_TR_BASE,                                       guest_tr_base,                                          GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_GDTR_BASE,                                     guest_gdtr_base,                                        GUEST_GRP2);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_GUEST_IDTR_BASE,                                     guest_idtr_base,                                        GUEST_GRP2);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_RSP,                                            host_rsp,                                               HOST_POINTER);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_ES_SELECTOR,                                    host_es_selector,                                       HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_CS_SELECTOR,                                    host_cs_selector,                                       HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_SS_SELECTOR,                                    host_ss_selector,                                       HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_DS_SELECTOR,                                    host_ds_selector,                                       HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_FS_SELECTOR,                                    host_fs_selector,                                       HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_GS_SELECTOR,                                    host_gs_selector,                                       HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_TR_SELECTOR,                                    host_tr_selector,                                       HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_IA32_PAT,                                       host_ia32_pat,                                          HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_IA32_EFER,                                      host_ia32_efer,                                         HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_IA32_PERF_GLOBAL_CTRL,                          host_ia32_perf_global_ctrl,                             HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_CR0,                                            host_cr0,                                               HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_CR3,                                            host_cr3,                                               HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_CR4,                                            host_cr4,                                               HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_IA32_SYSENTER_CS,                               host_ia32_sysenter_cs,                                  HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_IA32_SYSENTER_ESP,                              host_ia32_sysenter_esp,                                 HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_IA32_SYSENTER_EIP,                              host_ia32_sysenter_eip,                                 HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_RIP,                                            host_rip,                                               HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_FS_BASE,                                        host_fs_base,                                           HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_GS_BASE,                                        host_gs_base,                                           HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_TR_BASE,                                        host_tr_base,                                           HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_GDTR_BASE,                                      host_gdtr_base,                                         HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_IDTR_BASE,                                      host_idtr_base,                                         HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_IA32_S_CET,                                     host_ia32_s_cet,                                        HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_SSP,                                            host_ssp,                                               HOST_GRP1);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_HOST_IA32_INTERRUPT_SSP_TABLE_ADDR,                  host_ia32_interrupt_ssp_table_addr,                     HOST_GRP1);
+
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_GUEST_PHYSICAL_ADDRESS,                         info_guest_physical_address,                            NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_VM_INSTRUCTION_ERROR,                           info_vm_instruction_error,                              NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_EXIT_REASON,                                    info_exit_reason,                                       NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_VMEXIT_INTERRUPTION_INFO,                       info_vmexit_interruption_info,                          NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_VMEXIT_INTERRUPTION_ERROR_CODE,                 info_vmexit_exception_error_code,                       NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_IDT_VECTORING_INFO,                             info_idt_vectoring_info,                                NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_IDT_VECTORING_ERROR_CODE,                       info_idt_vectoring_error_code,                          NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_VMEXIT_INSTRUCTION_LENGTH,                      info_vmexit_instruction_length,                         NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_VMEXIT_INSTRUCTION_INFO,                        info_vmexit_instruction_info,                           NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_EXIT_QUALIFICATION,                             info_exit_qualification,                                NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_IO_RCX,                                         info_io_rcx,                                            NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_IO_RSI,                                         info_io_rsi,                                            NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_IO_RDI,                                         info_io_rdi,                                            NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_IO_RIP,                                         info_io_rip,                                            NONE);
+    SIREN_MSHV_EVMCS_FIELD(x86::VMCSF_INFO_GUEST_LINEAR_ADDRESS,                           info_guest_linear_address,                              NONE);
+
+#undef SIREN_MSHV_EVMCS_FIELD
+
+    // Typed access to an enlightened vmcs that keeps `mshv_clean_fields` honest:
+    //  1. a write that changes a field dirties exactly the clean field group covering it;
+    //  2. a write that does not change a field dirties nothing.
+    class mshv_evmcs_accessor {
+    public:
+        struct statistics_t {
+            uint64_t exit_count;
+            uint64_t invalidation_count;
+            uint64_t group_invalidation_count[mshv_clean_field_count_v];
+            uint64_t exits_by_invalidation_count[mshv_clean_field_count_v + 1];     // index is the number of groups an exit dirtied
+        };
+
+    private:
+        microsoft_hv::vmx_enlightened_vmcs_t* m_evmcs;
+        uint32_t m_exit_invalidations;
+        statistics_t m_statistics;
+
+    public:
+        mshv_evmcs_accessor() noexcept :
+            m_evmcs{ nullptr }, m_exit_invalidations{ 0 }, m_statistics{} {}
+
+        explicit mshv_evmcs_accessor(microsoft_hv::vmx_enlightened_vmcs_t* evmcs) noexcept :
+            m_evmcs{ evmcs }, m_exit_invalidations{ 0 }, m_statistics{} {}
+
+        void attach(microsoft_hv::vmx_enlightened_vmcs_t* evmcs) noexcept {
+            m_evmcs = evmcs;
+        }
+
+        [[nodiscard]]
+        microsoft_hv::vmx_enlightened_vmcs_t* get() const noexcept {
+            return m_evmcs;
+        }
+
+        template<uint32_t V>
+        [[nodiscard]]
+        x86::vmcsf_t<V> read() const noexcept {
+            return x86::vmcsf_t<V>{ .storage = static_cast<x86::vmcsf_storage_t<V>>(m_evmcs->*mshv_evmcs_field<V>::member_v) };
+        }
+
+        // Returns true if the field has been changed.
+        template<uint32_t V>
+        bool write(x86::vmcsf_t<V> value) noexcept {
+            static_assert(x86::vmcsf_encoding_t::from(V).semantics.type != std::to_underlying(x86::vmcsf_type_e::INFORMATION), "VM-exit information fields are read-only.");
+
+            auto& field = m_evmcs->*mshv_evmcs_field<V>::member_v;
+            auto new_value = static_cast<std::remove_cvref_t<decltype(field)>>(value.storage);
+
+            if (field != new_value) {
+                field = new_value;
+                invalidate(mshv_evmcs_field<V>::clean_field_v);
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+        // Unconditionally writes the field and dirties its group.
+        // Required by fields that the processor modifies on VM exit behind the back of the enlightened vmcs, e.g. VM-entry interruption-information field.
+        template<uint32_t V>
+        void overwrite(x86::vmcsf_t<V> value) noexcept {
+            static_assert(x86::vmcsf_encoding_t::from(V).semantics.type != std::to_underlying(x86::vmcsf_type_e::INFORMATION), "VM-exit information fields are read-only.");
+
+            auto& field = m_evmcs->*mshv_evmcs_field<V>::member_v;
+            field = static_cast<std::remove_cvref_t<decltype(field)>>(value.storage);
+            invalidate(mshv_evmcs_field<V>::clean_field_v);
+        }
+
+        void invalidate(mshv_clean_field_e groups) noexcept {
+            auto dirtied = m_evmcs->mshv_clean_fields.storage & std::to_underlying(groups);
+            if (dirtied) {
+                m_evmcs->mshv_clean_fields.storage &= ~dirtied;
+
+                m_exit_invalidations += std::popcount(dirtied);
+                m_statistics.invalidation_count += std::popcount(dirtied);
+                do {
+                    ++m_statistics.group_invalidation_count[std::countr_zero(dirtied)];
+                    dirtied &= dirtied - 1;
+                } while (dirtied);
+            }
+        }
+
+        // Everything in the enlightened vmcs has been consumed by the hypervisor on the last VM entry,
+        // so every group is clean when a VM exit starts being handled.
+        void begin_exit() noexcept {
+            m_evmcs->mshv_clean_fields.storage |= std::to_underlying(mshv_clean_field_e::ALL);
+            m_exit_invalidations = 0;
+            ++m_statistics.exit_count;
+        }
+
+        void end_exit() noexcept {
+            ++m_statistics.exits_by_invalidation_count[m_exit_invalidations];
+        }
+
+        [[nodiscard]]
+        const statistics_t& get_statistics() const noexcept {
+            return m_statistics;
+        }
+    };
+}
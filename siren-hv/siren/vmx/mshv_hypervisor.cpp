@@ -7,9 +7,142 @@
 
 #include "../x86/memory_caching.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <utility>
 #include <wdm.h>
 
 namespace siren::vmx {
+    void mshv_hypervisor::setup_vmcs_controls() noexcept {
+        using namespace siren::x86;
+
+        vmcsf_t<VMCSF_CTRL_PIN_BASED_VM_EXECUTION_CONTROLS> ctrl_pin_based_vm_execution_controls = {};
+        vmcsf_t<VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS> ctrl_1st_processor_based_vm_execution_controls = {};
+        vmcsf_t<VMCSF_CTRL_SECONDARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS> ctrl_2nd_processor_based_vm_execution_controls = {};
+
+        vmcsf_t<VMCSF_CTRL_PRIMARY_VMEXIT_CONTROLS> ctrl_1st_vmexit_controls = {};
+        vmcsf_t<VMCSF_CTRL_SECONDARY_VMEXIT_CONTROLS> ctrl_2nd_vmexit_controls = {};
+
+        vmcsf_t<VMCSF_CTRL_VMENTRY_CONTROLS> ctrl_vmentry_controls = {};
+
+        ctrl_pin_based_vm_execution_controls.semantics.external_interrupt_exiting = 0;
+        ctrl_pin_based_vm_execution_controls.semantics.nmi_exiting = 0;
+        ctrl_pin_based_vm_execution_controls.semantics.virtual_nmis = 0;
+        ctrl_pin_based_vm_execution_controls.semantics.activate_vmx_preemption_timer = 0;
+        ctrl_pin_based_vm_execution_controls.semantics.process_posted_interrupts = 0;
+
+        ctrl_1st_processor_based_vm_execution_controls.semantics.interrupt_window_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.use_tsc_offsetting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.hlt_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.invlpg_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.mwait_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.rdpmc_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.rdtsc_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.cr3_load_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.cr3_store_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.activate_tertiary_controls = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.cr8_load_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.cr8_store_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.use_tpr_shadow = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.nmi_window_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.mov_dr_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.unconditional_io_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.use_io_bitmaps = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.monitor_trap_flag = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.use_msr_bitmaps = 1;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.monitor_exiting = 0;
+        ctrl_1st_processor_based_vm_execution_controls.semantics.pause_exiting = m_pause_loop_parameters.enabled ? 1 : 0;    // software PLE, see pause_loop_policy
+        ctrl_1st_processor_based_vm_execution_controls.semantics.activate_secondary_controls = 1;
+
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.virtualize_apic_accesses = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_ept = 1;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.descriptor_table_exiting = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_rdtscp = 1;      // required by Windows 10
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.virtualize_x2apic_mode = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_vpid = 1;      // masked off below if unsupported
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.wbinvd_exiting = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.unrestricted_guest = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.apic_register_virtualization = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.virtual_interrupt_delivery = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.pause_loop_exiting = 0;     // enlightened vmcs has no PLE_Gap/PLE_Window
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.rdrand_exiting = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_invpcid = 1;     // required by Windows 10
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_vm_functions = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.vmcs_shadowing = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_encls_exiting = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.rdseed_exiting = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_pml = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.raise_ve_exception_when_ept_violation = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.conceal_vmx_from_pt = 1;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_xsave_xrstors = 1;   // required by Windows 10
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.mode_based_execute_control_for_ept = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.sub_page_write_permissions_for_ept = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.intel_pt_uses_guest_physical_addresses = 1;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.use_tsc_scaling = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_user_wait_and_pause = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_pconfig = 0;
+        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_enclv_exiting = 0;
+
+        ctrl_1st_vmexit_controls.semantics.save_debug_controls = 1;
+        ctrl_1st_vmexit_controls.semantics.host_address_space_size = 1;
+        ctrl_1st_vmexit_controls.semantics.load_ia32_perf_global_ctrl = 0;
+        ctrl_1st_vmexit_controls.semantics.acknowledge_interrupt_on_exit = 1;
+        ctrl_1st_vmexit_controls.semantics.save_ia32_pat = 0;
+        ctrl_1st_vmexit_controls.semantics.load_ia32_pat = 0;
+        ctrl_1st_vmexit_controls.semantics.save_ia32_efer = 0;
+        ctrl_1st_vmexit_controls.semantics.load_ia32_efer = 0;
+        ctrl_1st_vmexit_controls.semantics.save_vmx_preemption_timer_value = 0;
+        ctrl_1st_vmexit_controls.semantics.clear_ia32_bndcfgs = 0;
+        ctrl_1st_vmexit_controls.semantics.conceal_vmx_from_pt = 0;
+        ctrl_1st_vmexit_controls.semantics.clear_ia32_rtit_ctl = 0;
+        ctrl_1st_vmexit_controls.semantics.clear_ia32_lbr_ctl = 0;
+        ctrl_1st_vmexit_controls.semantics.load_cet_state = 0;
+        ctrl_1st_vmexit_controls.semantics.load_pkrs = 0;
+        ctrl_1st_vmexit_controls.semantics.save_ia32_perf_global_ctrl = 0;
+        ctrl_1st_vmexit_controls.semantics.activate_secondary_controls = 0;
+
+        ctrl_vmentry_controls.semantics.load_debug_controls = 1;
+        ctrl_vmentry_controls.semantics.ia32e_mode_guest = 1;
+        ctrl_vmentry_controls.semantics.entry_to_smm = 0;
+        ctrl_vmentry_controls.semantics.deactivate_dual_monitor_treatment = 0;
+        ctrl_vmentry_controls.semantics.load_ia32_perf_global_ctrl = 0;
+        ctrl_vmentry_controls.semantics.load_ia32_pat = 0;
+        ctrl_vmentry_controls.semantics.load_ia32_efer = 0;
+        ctrl_vmentry_controls.semantics.load_ia32_bndcfgs = 0;
+        ctrl_vmentry_controls.semantics.conceal_vmx_from_pt = 0;
+        ctrl_vmentry_controls.semantics.load_ia32_rtit_ctl = 0;
+        ctrl_vmentry_controls.semantics.load_cet_state = 0;
+        ctrl_vmentry_controls.semantics.load_guest_ia32_lbr_ctl = 0;
+        ctrl_vmentry_controls.semantics.load_pkrs = 0;
+
+        ctrl_pin_based_vm_execution_controls.storage = m_vmx_capabilities.pin_based_controls.adjust(ctrl_pin_based_vm_execution_controls.storage);
+        ctrl_1st_processor_based_vm_execution_controls.storage = m_vmx_capabilities.primary_processor_based_controls.adjust(ctrl_1st_processor_based_vm_execution_controls.storage);
+        ctrl_1st_vmexit_controls.storage = m_vmx_capabilities.primary_vmexit_controls.adjust(ctrl_1st_vmexit_controls.storage);
+        ctrl_vmentry_controls.storage = m_vmx_capabilities.vmentry_controls.adjust(ctrl_vmentry_controls.storage);
+
+        // The allowed 1-settings of an unsupported "activate secondary controls" are 0, so these conditions also cover support.
+        if (ctrl_1st_processor_based_vm_execution_controls.semantics.activate_secondary_controls) {
+            ctrl_2nd_processor_based_vm_execution_controls.storage = m_vmx_capabilities.secondary_processor_based_controls.adjust(ctrl_2nd_processor_based_vm_execution_controls.storage);
+        } else {
+            ctrl_2nd_processor_based_vm_execution_controls.storage = 0;
+        }
+
+        if (ctrl_1st_vmexit_controls.semantics.activate_secondary_controls) {
+            // VM entry allows control X (bit X of the secondary VM-exit controls) to be 1 if bit X in the MSR is set to 1; if bit X in
+            // the MSR is cleared to 0, VM entry fails if control X and the "activate secondary controls" primary VM-exit control are both 1.
+            ctrl_2nd_vmexit_controls.storage &= m_vmx_capabilities.secondary_vmexit_controls;
+        } else {
+            ctrl_2nd_vmexit_controls.storage = 0;
+        }
+
+        m_vmcs_controls.pin_based_vm_execution_controls = ctrl_pin_based_vm_execution_controls;
+        m_vmcs_controls.primary_processor_based_vm_execution_controls = ctrl_1st_processor_based_vm_execution_controls;
+        m_vmcs_controls.secondary_processor_based_vm_execution_controls = ctrl_2nd_processor_based_vm_execution_controls;
+        m_vmcs_controls.primary_vmexit_controls = ctrl_1st_vmexit_controls;
+        m_vmcs_controls.secondary_vmexit_controls = ctrl_2nd_vmexit_controls;
+        m_vmcs_controls.vmentry_controls = ctrl_vmentry_controls;
+    }
+
     expected<void, nt_status> mshv_hypervisor::setup_ept_identity_map(int level, x86::paddr_t start_hpa, x86::paddr_t max_physical_address) noexcept {
         expected<void, nt_status> retval;
 
@@ -87,14 +220,15 @@ namespace siren::vmx {
     }
 
     mshv_hypervisor::mshv_hypervisor() noexcept
-        : m_dynamic_ept{}, m_msr_bitmap{}, m_virtual_cpus {} {}
+        : m_msr_interceptor{}, m_vpid_allocator{}, m_pause_loop_parameters{ pause_loop_policy::default_parameters_v }, m_vmexit_stack_size{ mshv_virtual_cpu::vmexit_stack_size_default_v }, m_vmx_capabilities{}, m_vmcs_controls{}, m_dynamic_ept{}, m_exit_recorder{}, m_physical_memory_map{}, m_load_statistics{}, m_virtual_cpus{} {}
 
     expected<void, nt_status> mshv_hypervisor::intialize() noexcept {
         expected<void, nt_status> retval;
 
-        unique_npaged<mshv_virtual_cpu[]> virtual_cpus;
+        m_vmx_capabilities = vmx_capabilities::read();
+        setup_vmcs_controls();
 
-        retval = m_msr_bitmap.initialize();
+        retval = m_msr_interceptor.initialize();
         if (retval.has_error()) {
             return retval;
         }
@@ -108,16 +242,25 @@ namespace siren::vmx {
         if (retval.has_error()) {
             return retval;
         }
+
+        // what the mapping windows of the virtual cpus may map
+        retval = m_physical_memory_map.initialize();
+        if (retval.has_error()) {
+            return retval;
+        }
         
+        uint32_t cpu_count = active_cpu_count();
+        auto t0 = KeQueryPerformanceCounter(nullptr).QuadPart;
+
         {
-            auto expt_virtual_cpus = allocate_unique_uninitialized<mshv_virtual_cpu[]>(npaged_pool, active_cpu_count());
+            auto expt_virtual_cpus = allocate_unique_uninitialized<mshv_virtual_cpu[]>(npaged_pool, cpu_count);
             if (expt_virtual_cpus.has_value()) {
-                for (uint32_t i = 0; i < expt_virtual_cpus.value().get_deleter().count; ++i) {
+                for (uint32_t i = 0; i < cpu_count; ++i) {
                     std::construct_at(std::addressof(expt_virtual_cpus.value()[i]), this, i);
                 }
 
-                for (uint32_t i = 0; i < expt_virtual_cpus.value().get_deleter().count; ++i) {
-                    retval = expt_virtual_cpus.value()[i].intialize();
+                for (uint32_t i = 0; i < cpu_count; ++i) {
+                    retval = expt_virtual_cpus.value()[i].intialize(m_vmexit_stack_size);
                     if (retval.has_error()) {
                         return retval;
                     }
@@ -129,6 +272,44 @@ namespace siren::vmx {
             }
         }
 
+        auto t1 = KeQueryPerformanceCounter(nullptr).QuadPart;
+
+        //
+        // Prepare every virtual cpu on its own processor, all processors at the same time.
+        // Each virtual cpu allocates its block there too, so that it comes from the processor's NUMA node.
+        // Nested under Hyper-V most of the MSR reads in there trap to L0, doing them one cpu after another, or inside an IPI, does not scale.
+        //
+        {
+            std::atomic<nt_status> first_error{ nt_status_success_v };
+
+            retval = parallel_run_at_cpus(
+                [this, &first_error]() noexcept {
+                    auto r = m_virtual_cpus[current_cpu_index()].prepare();
+                    if (r.has_error()) {
+                        nt_status expected_status = nt_status_success_v;
+                        first_error.compare_exchange_strong(expected_status, r.error());
+                    }
+                }
+            );
+            if (retval.has_error()) {
+                return retval;
+            }
+
+            if (auto status = first_error.load(); !status.is_success()) {
+                return unexpected{ status };
+            }
+        }
+
+        auto t2 = KeQueryPerformanceCounter(nullptr).QuadPart;
+
+        LARGE_INTEGER frequency;
+        KeQueryPerformanceCounter(&frequency);
+
+        m_load_statistics.frequency = static_cast<uint64_t>(frequency.QuadPart);
+        m_load_statistics.cpu_count = cpu_count;
+        m_load_statistics.allocate_ticks = static_cast<uint64_t>(t1 - t0);
+        m_load_statistics.prepare_ticks = static_cast<uint64_t>(t2 - t1);
+
         return {};
     }
 
@@ -148,11 +329,171 @@ namespace siren::vmx {
         return static_cast<uint32_t>(m_virtual_cpus.get_deleter().count);
     }
 
+    const pause_loop_policy::parameters_t& mshv_hypervisor::get_pause_loop_parameters() const noexcept {
+        return m_pause_loop_parameters;
+    }
+
+    void mshv_hypervisor::set_pause_loop_parameters(const pause_loop_policy::parameters_t& parameters) noexcept {
+        m_pause_loop_parameters = parameters;
+    }
+
+    size_t mshv_hypervisor::get_vmexit_stack_size() const noexcept {
+        return m_vmexit_stack_size;
+    }
+
+    expected<void, nt_status> mshv_hypervisor::set_vmexit_stack_size(size_t size) noexcept {
+        if (size < mshv_virtual_cpu::vmexit_stack_size_min_v || mshv_virtual_cpu::vmexit_stack_size_max_v < size || size % mshv_vcpu_block_layout_t::page_size_v != 0) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+
+        m_vmexit_stack_size = size;
+        return {};
+    }
+
+    const vmx_capabilities& mshv_hypervisor::get_vmx_capabilities() const noexcept {
+        return m_vmx_capabilities;
+    }
+
+    msr_interceptor& mshv_hypervisor::get_msr_interceptor() noexcept {
+        return m_msr_interceptor;
+    }
+
+    const msr_interceptor& mshv_hypervisor::get_msr_interceptor() const noexcept {
+        return m_msr_interceptor;
+    }
+
+    exit_recorder& mshv_hypervisor::get_exit_recorder() noexcept {
+        return m_exit_recorder;
+    }
+
+    const mshv_hypervisor::load_statistics_t& mshv_hypervisor::get_load_statistics() const noexcept {
+        return m_load_statistics;
+    }
+
+    void mshv_hypervisor::post_ept_invalidation(x86::guest_paddr_t gpa, uint64_t size) noexcept {
+        for (uint32_t i = 0; i < get_virtual_cpu_count(); ++i) {
+            m_virtual_cpus[i].m_ept_mailbox.post(gpa, size);
+        }
+    }
+
+    expected<void, nt_status> mshv_hypervisor::invalidate_ept(x86::guest_paddr_t gpa, uint64_t size, uint64_t deadline_us) noexcept {
+        auto cpu_count = get_virtual_cpu_count();
+
+        auto expt_tickets = allocate_unique_uninitialized<uint64_t[]>(npaged_pool, cpu_count);
+        if (expt_tickets.has_error()) {
+            return unexpected{ expt_tickets.error() };
+        }
+
+        auto& tickets = expt_tickets.value();
+        for (uint32_t i = 0; i < cpu_count; ++i) {
+            tickets[i] = m_virtual_cpus[i].m_ept_mailbox.post(gpa, size);
+        }
+
+        // A virtual cpu out of the guest retires its mailbox before the next VM entry, see mshv_virtual_cpu::start().
+        auto is_pending = [this, &tickets](uint32_t i) noexcept {
+            auto& vcpu = m_virtual_cpus[i];
+            return std::atomic_ref<bool>{ vcpu.m_running }.load() && !vcpu.m_ept_mailbox.is_completed(tickets[i]);
+        };
+
+        // External interrupts do not exit, a processor is only made to exit by asking it to vmcall.
+        auto flush_if_in_guest = [this]() noexcept {
+            if (std::atomic_ref<bool>{ m_virtual_cpus[current_cpu_index()].m_running }.load()) {
+                siren_hypercalls::ept_flush();
+            }
+        };
+
+        // no point in waiting for this processor, it is one vmcall away
+        KIRQL old_irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+        flush_if_in_guest();
+        KeLowerIrql(old_irql);
+
+        auto deadline = KeQueryInterruptTime() + std::min(deadline_us, max_ept_invalidation_wait_us_v) * 10;  // in 100ns units
+
+        auto collect_stragglers = [cpu_count, &is_pending]() noexcept {
+            cpu_set stragglers;
+            for (uint32_t i = 0; i < cpu_count; ++i) {
+                if (is_pending(i)) {
+                    stragglers.insert(i);
+                }
+            }
+            return stragglers;
+        };
+
+        cpu_set stragglers;
+        for (unsigned wait = 0; ; ) {
+            stragglers = collect_stragglers();
+            if (stragglers.empty() || deadline <= KeQueryInterruptTime()) {
+                break;
+            }
+
+            yield_cpu(wait);
+            wait = std::min<unsigned>(wait * 2 + 1, 65536);
+        }
+
+        // A flush does not always retire the ticket: take() gives up on a mailbox whose lock a poster holds. Ask again until every ticket is done.
+        deadline = KeQueryInterruptTime() + max_ept_invalidation_wait_us_v * 10;
+        for (unsigned wait = 0; !stragglers.empty(); ) {
+            if (run_on_cpus(stragglers, flush_if_in_guest).has_error()) {
+                // the per-cpu work queues are not available, hold every processor at IPI level instead
+                ipi_broadcast([&flush_if_in_guest]() noexcept { flush_if_in_guest(); });
+            }
+
+            stragglers = collect_stragglers();
+            if (stragglers.empty()) {
+                break;
+            }
+
+            if (deadline <= KeQueryInterruptTime()) {
+                return unexpected{ nt_status_io_timeout_v };
+            }
+
+            yield_cpu(wait);
+            wait = std::min<unsigned>(wait * 2 + 1, 65536);
+        }
+
+        return {};
+    }
+
+    ept_invalidation_mailbox::statistics_t mshv_hypervisor::get_ept_invalidation_statistics() noexcept {
+        ept_invalidation_mailbox::statistics_t sum = {};
+
+        for (uint32_t i = 0; i < get_virtual_cpu_count(); ++i) {
+            auto statistics = m_virtual_cpus[i].get_ept_invalidation_statistics();
+            sum.posts += statistics.posts;
+            sum.coalesced_posts += statistics.coalesced_posts;
+            sum.overflows += statistics.overflows;
+            sum.batches += statistics.batches;
+        }
+
+        return sum;
+    }
+
     void mshv_hypervisor::start() noexcept {
+        auto t0 = KeQueryPerformanceCounter(nullptr).QuadPart;
         ipi_broadcast([this]() noexcept { get_virtual_cpu(current_cpu_index())->start(); });
+        auto t1 = KeQueryPerformanceCounter(nullptr).QuadPart;
+
+        m_load_statistics.launch_ticks = static_cast<uint64_t>(t1 - t0);
+
+        KdPrint((
+            "siren-hv: %u cpus, allocate = %llu us, prepare = %llu us, launch = %llu us\n",
+            m_load_statistics.cpu_count,
+            m_load_statistics.allocate_ticks * 1000000 / m_load_statistics.frequency,
+            m_load_statistics.prepare_ticks * 1000000 / m_load_statistics.frequency,
+            m_load_statistics.launch_ticks * 1000000 / m_load_statistics.frequency
+        ));
     }
 
     void mshv_hypervisor::stop() noexcept {
         ipi_broadcast([this]() noexcept { get_virtual_cpu(current_cpu_index())->stop(); });
     }
+
+    void mshv_hypervisor::suspend() noexcept {
+        ipi_broadcast([this]() noexcept { m_virtual_cpus[current_cpu_index()].suspend(); });
+    }
+
+    void mshv_hypervisor::resume() noexcept {
+        ipi_broadcast([this]() noexcept { m_virtual_cpus[current_cpu_index()].resume(); });
+    }
 }
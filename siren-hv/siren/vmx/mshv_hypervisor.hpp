@@ -2,26 +2,69 @@
 #include "../memory.hpp"
 #include "../expected.hpp"
 #include "../nt_status.hpp"
+#include "../irql_annotations.hpp"
 
 #include "../hypervisor.hpp"
 #include "../virtual_cpu.hpp"
 
 #include "../x86/intel_vmx.hpp"
 
-#include "msr_bitmap.hpp"
+#include "ept_invalidation.hpp"
+#include "exit_recorder.hpp"
+#include "mshv_virtual_cpu.hpp"
+#include "msr_interceptor.hpp"
+#include "pause_loop_policy.hpp"
+#include "vmx_capabilities.hpp"
+#include "vpid_allocator.hpp"
 #include "dynamic_ept.hpp"
 
 namespace siren::vmx {
     class mshv_hypervisor;
     class mshv_virtual_cpu;
 
+    // VM-execution, VM-exit and VM-entry controls shared by all virtual cpus, already adjusted to vmx_capabilities.
+    struct mshv_vmcs_controls_t {
+        x86::vmcsf_t<x86::VMCSF_CTRL_PIN_BASED_VM_EXECUTION_CONTROLS> pin_based_vm_execution_controls;
+        x86::vmcsf_t<x86::VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS> primary_processor_based_vm_execution_controls;
+        x86::vmcsf_t<x86::VMCSF_CTRL_SECONDARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS> secondary_processor_based_vm_execution_controls;   // zero if not activated
+        x86::vmcsf_t<x86::VMCSF_CTRL_PRIMARY_VMEXIT_CONTROLS> primary_vmexit_controls;
+        x86::vmcsf_t<x86::VMCSF_CTRL_SECONDARY_VMEXIT_CONTROLS> secondary_vmexit_controls;     // zero if not activated
+        x86::vmcsf_t<x86::VMCSF_CTRL_VMENTRY_CONTROLS> vmentry_controls;
+    };
+
     class mshv_hypervisor : public hypervisor {
         friend class mshv_virtual_cpu;
+    public:
+        static constexpr allocation_category_e allocation_category_v = allocation_category_e::hypervisor;
+
+        // invalidate_ept() busy-waits at up to DISPATCH_LEVEL, keep each of its two waits well below the DPC watchdog
+        static constexpr uint64_t max_ept_invalidation_wait_us_v = 5000;
+
+        // How long bringing the hypervisor up took, in KeQueryPerformanceCounter ticks.
+        struct load_statistics_t {
+            uint64_t frequency;         // ticks per second
+            uint32_t cpu_count;
+            uint64_t allocate_ticks;    // virtual cpu array and serial per-vcpu initialization
+            uint64_t prepare_ticks;     // parallel per-cpu block allocation and preparation at PASSIVE_LEVEL
+            uint64_t launch_ticks;      // the IPI that runs VMXON and VMLAUNCH on every cpu
+        };
+
     private:
-        msr_bitmap m_msr_bitmap;
+        msr_interceptor m_msr_interceptor;
+        vpid_allocator m_vpid_allocator;
+        pause_loop_policy::parameters_t m_pause_loop_parameters;
+        size_t m_vmexit_stack_size;
+        vmx_capabilities m_vmx_capabilities;
+        mshv_vmcs_controls_t m_vmcs_controls;
         dynamic_ept m_dynamic_ept;
+        exit_recorder m_exit_recorder;
+        physical_memory_map m_physical_memory_map;
+        load_statistics_t m_load_statistics;
+
         unique_npaged<mshv_virtual_cpu[]> m_virtual_cpus;
 
+        void setup_vmcs_controls() noexcept;
+
         expected<void, nt_status> setup_ept_identity_map(int level, x86::paddr_t start_hpa, x86::paddr_t max_physical_address) noexcept;
 
     public:
@@ -52,8 +95,59 @@ namespace siren::vmx {
         [[nodiscard]]
         virtual uint32_t get_virtual_cpu_count() const noexcept override;
 
+        [[nodiscard]]
+        const pause_loop_policy::parameters_t& get_pause_loop_parameters() const noexcept;
+
+        // Takes effect for virtual cpus created by intialize() afterwards.
+        void set_pause_loop_parameters(const pause_loop_policy::parameters_t& parameters) noexcept;
+
+        [[nodiscard]]
+        size_t get_vmexit_stack_size() const noexcept;
+
+        // Takes effect for virtual cpus created by intialize() afterwards.
+        // `size` must be a multiple of the page size within [vmexit_stack_size_min_v, vmexit_stack_size_max_v] of mshv_virtual_cpu.
+        [[nodiscard]]
+        expected<void, nt_status> set_vmexit_stack_size(size_t size) noexcept;
+
+        [[nodiscard]]
+        const vmx_capabilities& get_vmx_capabilities() const noexcept;
+
+        [[nodiscard]]
+        msr_interceptor& get_msr_interceptor() noexcept;
+
+        [[nodiscard]]
+        const msr_interceptor& get_msr_interceptor() const noexcept;
+
+        [[nodiscard]]
+        exit_recorder& get_exit_recorder() noexcept;
+
+        [[nodiscard]]
+        const load_statistics_t& get_load_statistics() const noexcept;
+
+        // Posts an invalidation of the EPT translations of [gpa, gpa + size) to every virtual cpu and returns at once,
+        // each virtual cpu retires it on its next VM exit or VM entry. Enough for EPT edits that may take effect lazily.
+        void post_ept_invalidation(x86::guest_paddr_t gpa, uint64_t size) noexcept;
+
+        // Like post_ept_invalidation, but returns only once no virtual cpu in the guest can use a stale translation anymore.
+        // This processor exits right away, the others get `deadline_us` microseconds, at most max_ept_invalidation_wait_us_v, to exit on their own
+        // before targeted DPCs make them. Returns nt_status_io_timeout_v if some are still pending after another max_ept_invalidation_wait_us_v of that;
+        // their invalidation stays posted and is retired on their next VM exit. Must not race with stop() or suspend().
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        [[nodiscard]]
+        expected<void, nt_status> invalidate_ept(x86::guest_paddr_t gpa, uint64_t size, uint64_t deadline_us) noexcept;
+
+        // Summed over every virtual cpu.
+        [[nodiscard]]
+        ept_invalidation_mailbox::statistics_t get_ept_invalidation_statistics() noexcept;
+
         virtual void start() noexcept override;
 
         virtual void stop() noexcept override;
+
+        // Takes every processor out of the guest while keeping all virtual cpu state, see mshv_virtual_cpu::suspend.
+        void suspend() noexcept;
+
+        // Puts every suspended processor back into the guest, see mshv_virtual_cpu::resume.
+        void resume() noexcept;
     };
 }
@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "../literals.hpp"
+
+namespace siren::vmx {
+    using namespace ::siren::size_literals;
+
+    // Everything a virtual cpu hands to the processor or to Hyper-V by address lives in one physically contiguous block,
+    // so there is one allocation and one physical address lookup per virtual cpu, and each physical address is the block's plus an offset.
+    //
+    //   offset 0                     +--------------------------------+
+    //                                | vmexit stack                   |  grows down
+    //                                |            ...                 |
+    //                                | vmexit_stack_top_t             |  <- HOST_RSP, last 1KiB of the stack
+    //   evmcs_offset                 +--------------------------------+
+    //                                | enlightened vmcs               |  read and written on every exit
+    //   partition_assist_page_offset +--------------------------------+
+    //                                | partition assist page          |  read by Hyper-V on nested TLB flushes
+    //   vmxon_region_offset          +--------------------------------+
+    //                                | vmxon region                   |  only touched by VMXON
+    //   size                         +--------------------------------+
+    //
+    // The exit path touches the top of the stack and the enlightened vmcs, which are adjacent,
+    // the cold regions are at the end.
+    //
+    // Depends on nothing but literals.hpp so that the layout can be checked by a host build.
+    struct mshv_vcpu_block_layout_t {
+        static constexpr size_t page_size_v = 4_Kiuz;
+
+        size_t vmexit_stack_offset;
+        size_t vmexit_stack_size;
+        size_t evmcs_offset;
+        size_t partition_assist_page_offset;
+        size_t vmxon_region_offset;
+        size_t size;
+
+        // `vmexit_stack_size` must be a non-zero multiple of page_size_v.
+        [[nodiscard]]
+        static constexpr mshv_vcpu_block_layout_t compute(size_t vmexit_stack_size) noexcept {
+            mshv_vcpu_block_layout_t layout = {};
+
+            layout.vmexit_stack_offset = 0;
+            layout.vmexit_stack_size = vmexit_stack_size;
+            layout.evmcs_offset = layout.vmexit_stack_offset + layout.vmexit_stack_size;
+            layout.partition_assist_page_offset = layout.evmcs_offset + page_size_v;
+            layout.vmxon_region_offset = layout.partition_assist_page_offset + page_size_v;
+            layout.size = layout.vmxon_region_offset + page_size_v;
+
+            return layout;
+        }
+
+        // Every region is page aligned, in bounds and disjoint from the others.
+        [[nodiscard]]
+        constexpr bool is_valid() const noexcept {
+            constexpr auto page_aligned = [](size_t offset) { return offset % page_size_v == 0; };
+
+            if (vmexit_stack_size == 0 || !page_aligned(vmexit_stack_size)) {
+                return false;
+            }
+
+            if (!page_aligned(vmexit_stack_offset) || !page_aligned(evmcs_offset) || !page_aligned(partition_assist_page_offset) || !page_aligned(vmxon_region_offset) || !page_aligned(size)) {
+                return false;
+            }
+
+            return vmexit_stack_offset + vmexit_stack_size <= evmcs_offset
+                && evmcs_offset + page_size_v <= partition_assist_page_offset
+                && partition_assist_page_offset + page_size_v <= vmxon_region_offset
+                && vmxon_region_offset + page_size_v <= size;
+        }
+
+        [[nodiscard]]
+        constexpr size_t page_count() const noexcept {
+            return size / page_size_v;
+        }
+    };
+
+    static_assert(mshv_vcpu_block_layout_t::compute(16_Kiuz).is_valid());
+    static_assert(mshv_vcpu_block_layout_t::compute(1_Miuz).is_valid());
+    static_assert(mshv_vcpu_block_layout_t::compute(16_Kiuz).size == 16_Kiuz + 3 * 4_Kiuz);
+    static_assert(mshv_vcpu_block_layout_t::compute(16_Kiuz).evmcs_offset == 16_Kiuz);   // the stack top and the enlightened vmcs are neighbours
+    static_assert(!mshv_vcpu_block_layout_t::compute(16_Kiuz + 1).is_valid());
+}
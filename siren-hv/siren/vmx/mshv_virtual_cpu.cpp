@@ -13,6 +13,10 @@
 #include "../x86/memory_caching.hpp"
 #include "../x86/model_specific_registers.hpp"
 
+#include "../microsoft_hv/tlfs.hypercalls.hpp"
+
+#include <algorithm>
+
 namespace siren::vmx {
     template<x86::segment_register_e SegmentReg>
     void mshv_virtual_cpu::evmcs_setup_segment(const x86::gdtr_t& gdtr, const x86::segment_selector_t& ldtr, auto seg_selector, auto seg_base, auto seg_limit, auto seg_access_rights) noexcept {
@@ -76,14 +80,14 @@ namespace siren::vmx {
     void mshv_virtual_cpu::evmcs_setup_guest() noexcept {
         using namespace siren::x86;
 
-        vmcsf_t<VMCSF_GUEST_CR0> guest_cr0 = {};
-        vmcsf_t<VMCSF_GUEST_CR3> guest_cr3 = {};
-        vmcsf_t<VMCSF_GUEST_CR4> guest_cr4 = {};
-        vmcsf_t<VMCSF_GUEST_DR7> guest_dr7 = {};
+        //vmcsf_t<VMCSF_GUEST_CR0> guest_cr0 = {};     // will be setup in evmcs_setup_guest_context() function.
+        //vmcsf_t<VMCSF_GUEST_CR3> guest_cr3 = {};     // will be setup in evmcs_setup_guest_context() function.
+        //vmcsf_t<VMCSF_GUEST_CR4> guest_cr4 = {};     // will be setup in evmcs_setup_guest_context() function.
+        //vmcsf_t<VMCSF_GUEST_DR7> guest_dr7 = {};     // will be setup in evmcs_setup_guest_context() function.
 
         //vmcsf_t<VMCSF_GUEST_RSP> guest_rsp = {};     // will be setup in launch() function.
         //vmcsf_t<VMCSF_GUEST_RIP> guest_rip = {};     // will be setup in launch() function.
-        vmcsf_t<VMCSF_GUEST_RFLAGS> guest_rflags = {};
+        //vmcsf_t<VMCSF_GUEST_RFLAGS> guest_rflags = {};   // will be setup in evmcs_setup_guest_context() function.
 
         vmcsf_t<VMCSF_GUEST_CS_SELECTOR> guest_cs_selector = {};
         vmcsf_t<VMCSF_GUEST_SS_SELECTOR> guest_ss_selector = {};
@@ -98,7 +102,7 @@ namespace siren::vmx {
         vmcsf_t<VMCSF_GUEST_SS_BASE> guest_ss_base = {};
         vmcsf_t<VMCSF_GUEST_DS_BASE> guest_ds_base = {};
         vmcsf_t<VMCSF_GUEST_ES_BASE> guest_es_base = {};
-        vmcsf_t<VMCSF_GUEST_FS_BASE> guest_fs_base = {};
+        //vmcsf_t<VMCSF_GUEST_FS_BASE> guest_fs_base = {};   // will be setup in evmcs_setup_guest_context() function.
         vmcsf_t<VMCSF_GUEST_GS_BASE> guest_gs_base = {};
         vmcsf_t<VMCSF_GUEST_LDTR_BASE> guest_ldtr_base = {};
         vmcsf_t<VMCSF_GUEST_TR_BASE> guest_tr_base = {};
@@ -127,7 +131,7 @@ namespace siren::vmx {
         vmcsf_t<VMCSF_GUEST_GDTR_LIMIT> guest_gdtr_limit = {};
         vmcsf_t<VMCSF_GUEST_IDTR_LIMIT> guest_idtr_limit = {};
 
-        vmcsf_t<VMCSF_GUEST_IA32_DEBUGCTL> guest_ia32_debugctl = {};
+        //vmcsf_t<VMCSF_GUEST_IA32_DEBUGCTL> guest_ia32_debugctl = {};  // will be setup in evmcs_setup_guest_context() function.
         vmcsf_t<VMCSF_GUEST_IA32_SYSENTER_CS> guest_ia32_sysenter_cs = {};
         vmcsf_t<VMCSF_GUEST_IA32_SYSENTER_ESP> guest_ia32_sysenter_esp = {};
         vmcsf_t<VMCSF_GUEST_IA32_SYSENTER_EIP> guest_ia32_sysenter_eip = {};
@@ -160,17 +164,11 @@ namespace siren::vmx {
         auto idtr = read_idtr();
         auto ldtr = read_segment_selector<x86::segment_register_e::LDTR>();
 
-        guest_cr0.storage = read_cr0().storage;
-        guest_cr3.storage = read_cr3().storage;
-        guest_cr4.storage = read_cr4().storage;
-        guest_dr7.storage = read_dr7().storage;
-        guest_rflags.storage = __readeflags();
-
         evmcs_setup_segment<x86::segment_register_e::CS>(gdtr, ldtr, &guest_cs_selector, &guest_cs_base, &guest_cs_limit, &guest_cs_access_rights);
         evmcs_setup_segment<x86::segment_register_e::SS>(gdtr, ldtr, &guest_ss_selector, &guest_ss_base, &guest_ss_limit, &guest_ss_access_rights);
         evmcs_setup_segment<x86::segment_register_e::DS>(gdtr, ldtr, &guest_ds_selector, &guest_ds_base, &guest_ds_limit, &guest_ds_access_rights);
         evmcs_setup_segment<x86::segment_register_e::ES>(gdtr, ldtr, &guest_es_selector, &guest_es_base, &guest_es_limit, &guest_es_access_rights);
-        evmcs_setup_segment<x86::segment_register_e::FS>(gdtr, ldtr, &guest_fs_selector, &guest_fs_base, &guest_fs_limit, &guest_fs_access_rights);
+        evmcs_setup_segment<x86::segment_register_e::FS>(gdtr, ldtr, &guest_fs_selector, nullptr, &guest_fs_limit, &guest_fs_access_rights);
         evmcs_setup_segment<x86::segment_register_e::GS>(gdtr, ldtr, &guest_gs_selector, &guest_gs_base, &guest_gs_limit, &guest_gs_access_rights);
         evmcs_setup_segment<x86::segment_register_e::LDTR>(gdtr, ldtr, &guest_ldtr_selector, &guest_ldtr_base, &guest_ldtr_limit, &guest_ldtr_access_rights);
         evmcs_setup_segment<x86::segment_register_e::TR>(gdtr, ldtr, &guest_tr_selector, &guest_tr_base, &guest_tr_limit, &guest_tr_access_rights);
@@ -181,7 +179,6 @@ namespace siren::vmx {
         guest_gdtr_limit.storage = gdtr.semantics.limit;
         guest_idtr_limit.storage = idtr.semantics.limit;
 
-        guest_ia32_debugctl.storage = read_msr<IA32_DEBUGCTL>().storage;
         guest_ia32_sysenter_cs.storage = static_cast<uint32_t>(read_msr<IA32_SYSENTER_CS>().storage);
         guest_ia32_sysenter_esp.storage = read_msr<IA32_SYSENTER_ESP>().storage;
         guest_ia32_sysenter_eip.storage = read_msr<IA32_SYSENTER_EIP>().storage;
@@ -189,15 +186,6 @@ namespace siren::vmx {
 
         guest_vmcs_link_pointer.storage = ~x86::paddr_t{ 0 };
 
-        m_evmcs_region->guest_cr0 = guest_cr0.storage;
-        m_evmcs_region->guest_cr3 = guest_cr3.storage;
-        m_evmcs_region->guest_cr4 = guest_cr4.storage;
-        m_evmcs_region->guest_dr7 = guest_dr7.storage;
-
-        //m_evmcs_region->guest_rsp = guest_rsp.storage;
-        //m_evmcs_region->guest_rip = guest_rip.storage;
-        m_evmcs_region->guest_rflags = guest_rflags.storage;
-
         m_evmcs_region->guest_cs_selector = guest_cs_selector.storage;
         m_evmcs_region->guest_ss_selector = guest_ss_selector.storage;
         m_evmcs_region->guest_ds_selector = guest_ds_selector.storage;
@@ -211,7 +199,6 @@ namespace siren::vmx {
         m_evmcs_region->guest_ss_base = guest_ss_base.storage;
         m_evmcs_region->guest_ds_base = guest_ds_base.storage;
         m_evmcs_region->guest_es_base = guest_es_base.storage;
-        m_evmcs_region->guest_fs_base = guest_fs_base.storage;
         m_evmcs_region->guest_gs_base = guest_gs_base.storage;
         m_evmcs_region->guest_ldtr_base = guest_ldtr_base.storage;
         m_evmcs_region->guest_tr_base = guest_tr_base.storage;
@@ -240,7 +227,6 @@ namespace siren::vmx {
         m_evmcs_region->guest_gdtr_limit = guest_gdtr_limit.storage;
         m_evmcs_region->guest_idtr_limit = guest_idtr_limit.storage;
 
-        m_evmcs_region->guest_ia32_debug_ctl = guest_ia32_debugctl.storage;
         m_evmcs_region->guest_ia32_sysenter_cs = guest_ia32_sysenter_cs.storage;
         m_evmcs_region->guest_ia32_sysenter_esp = guest_ia32_sysenter_esp.storage;
         m_evmcs_region->guest_ia32_sysenter_eip = guest_ia32_sysenter_eip.storage;
@@ -249,6 +235,47 @@ namespace siren::vmx {
         m_evmcs_region->guest_vmcs_link_pointer = guest_vmcs_link_pointer.storage;
     }
 
+    void mshv_virtual_cpu::evmcs_setup_guest_context() noexcept {
+        using namespace siren::x86;
+
+        // Guest state that belongs to the thread or process interrupted by start(), it cannot be captured ahead of time by prepare().
+
+        vmcsf_t<VMCSF_GUEST_CR0> guest_cr0 = {};
+        vmcsf_t<VMCSF_GUEST_CR3> guest_cr3 = {};
+        vmcsf_t<VMCSF_GUEST_CR4> guest_cr4 = {};
+        vmcsf_t<VMCSF_GUEST_DR7> guest_dr7 = {};
+
+        vmcsf_t<VMCSF_GUEST_RFLAGS> guest_rflags = {};
+
+        vmcsf_t<VMCSF_GUEST_FS_BASE> guest_fs_base = {};
+
+        vmcsf_t<VMCSF_GUEST_IA32_DEBUGCTL> guest_ia32_debugctl = {};
+
+        auto gdtr = read_gdtr();
+        auto ldtr = read_segment_selector<x86::segment_register_e::LDTR>();
+
+        guest_cr0.storage = read_cr0().storage;
+        guest_cr3.storage = read_cr3().storage;
+        guest_cr4.storage = read_cr4().storage;
+        guest_dr7.storage = read_dr7().storage;
+        guest_rflags.storage = __readeflags();
+
+        evmcs_setup_segment<x86::segment_register_e::FS>(gdtr, ldtr, nullptr, &guest_fs_base, nullptr, nullptr);
+
+        guest_ia32_debugctl.storage = read_msr<IA32_DEBUGCTL>().storage;
+
+        m_evmcs_region->guest_cr0 = guest_cr0.storage;
+        m_evmcs_region->guest_cr3 = guest_cr3.storage;
+        m_evmcs_region->guest_cr4 = guest_cr4.storage;
+        m_evmcs_region->guest_dr7 = guest_dr7.storage;
+
+        m_evmcs_region->guest_rflags = guest_rflags.storage;
+
+        m_evmcs_region->guest_fs_base = guest_fs_base.storage;
+
+        m_evmcs_region->guest_ia32_debug_ctl = guest_ia32_debugctl.storage;
+    }
+
     void mshv_virtual_cpu::evmcs_setup_host() noexcept {
         using namespace siren::x86;
 
@@ -289,12 +316,13 @@ namespace siren::vmx {
         auto idtr = read_idtr();
         auto ldtr = read_segment_selector<x86::segment_register_e::LDTR>();
 
-        host_cr0.storage = read_cr0().storage;
+        // start() sets the VMX fixed bits before VMXON, the host must run with them as well.
+        host_cr0.storage = (read_cr0().storage | m_ia32_vmx_cr0_fixed0.semantics.mask_value) & m_ia32_vmx_cr0_fixed1.semantics.mask_value;
+        // prepare() runs in a system thread, so this is the address space of the system process rather than of whatever process start() interrupts.
         host_cr3.storage = read_cr3().storage;
-        host_cr4.storage = read_cr4().storage;
+        host_cr4.storage = (read_cr4().storage | m_ia32_vmx_cr4_fixed0.semantics.mask_value) & m_ia32_vmx_cr4_fixed1.semantics.mask_value;
 
-        m_vmexit_stack->self = this;
-        host_rsp.storage = reinterpret_cast<uintptr_t>(std::end(m_vmexit_stack->in_use));
+        host_rsp.storage = reinterpret_cast<uintptr_t>(get_vmexit_stack_top());
         host_rip.storage = reinterpret_cast<uintptr_t>(&mshv_vmexit_handler::entry_point);
 
         evmcs_setup_segment<x86::segment_register_e::CS>(gdtr, ldtr, &host_cs_selector, nullptr, nullptr, nullptr);
@@ -384,11 +412,9 @@ namespace siren::vmx {
     void mshv_virtual_cpu::evmcs_setup_controls_execution() noexcept {
         using namespace siren::x86;
 
-        vmcsf_t<VMCSF_CTRL_PIN_BASED_VM_EXECUTION_CONTROLS> ctrl_pin_based_vm_execution_controls = {};
-
-        vmcsf_t<VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS> ctrl_1st_processor_based_vm_execution_controls = {};
-        vmcsf_t<VMCSF_CTRL_SECONDARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS> ctrl_2nd_processor_based_vm_execution_controls = {};
-        vmcsf_t<VMCSF_CTRL_TERTIARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS> ctrl_3rd_processor_based_vm_execution_controls = {};
+        const auto& ctrl_pin_based_vm_execution_controls = m_hv->m_vmcs_controls.pin_based_vm_execution_controls;
+        const auto& ctrl_1st_processor_based_vm_execution_controls = m_hv->m_vmcs_controls.primary_processor_based_vm_execution_controls;
+        const auto& ctrl_2nd_processor_based_vm_execution_controls = m_hv->m_vmcs_controls.secondary_processor_based_vm_execution_controls;
 
         vmcsf_t<VMCSF_CTRL_EXCEPTION_BITMAP> ctrl_exception_bitmap = {};
 
@@ -452,130 +478,25 @@ namespace siren::vmx {
 
         vmcsf_t<VMCSF_CTRL_HLATP> ctrl_hlatp = {};
 
-        ctrl_pin_based_vm_execution_controls.semantics.external_interrupt_exiting = 0;
-        ctrl_pin_based_vm_execution_controls.semantics.nmi_exiting = 0;
-        ctrl_pin_based_vm_execution_controls.semantics.virtual_nmis = 0;
-        ctrl_pin_based_vm_execution_controls.semantics.activate_vmx_preemption_timer = 0;
-        ctrl_pin_based_vm_execution_controls.semantics.process_posted_interrupts = 0;
-
-        ctrl_1st_processor_based_vm_execution_controls.semantics.interrupt_window_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.use_tsc_offsetting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.hlt_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.invlpg_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.mwait_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.rdpmc_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.rdtsc_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.cr3_load_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.cr3_store_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.activate_tertiary_controls = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.cr8_load_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.cr8_store_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.use_tpr_shadow = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.nmi_window_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.mov_dr_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.unconditional_io_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.use_io_bitmaps = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.monitor_trap_flag = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.use_msr_bitmaps = 1;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.monitor_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.pause_exiting = 0;
-        ctrl_1st_processor_based_vm_execution_controls.semantics.activate_secondary_controls = 1;
-
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.virtualize_apic_accesses = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_ept = 1;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.descriptor_table_exiting = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_rdtscp = 1;      // required by Windows 10
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.virtualize_x2apic_mode = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_vpid = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.wbinvd_exiting = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.unrestricted_guest = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.apic_register_virtualization = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.virtual_interrupt_delivery = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.pause_loop_exiting = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.rdrand_exiting = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_invpcid = 1;     // required by Windows 10
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_vm_functions = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.vmcs_shadowing = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_encls_exiting = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.rdseed_exiting = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_pml = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.raise_ve_exception_when_ept_violation = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.conceal_vmx_from_pt = 1;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_xsave_xrstors = 1;   // required by Windows 10
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.mode_based_execute_control_for_ept = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.sub_page_write_permissions_for_ept = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.intel_pt_uses_guest_physical_addresses = 1;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.use_tsc_scaling = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_user_wait_and_pause = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_pconfig = 0;
-        ctrl_2nd_processor_based_vm_execution_controls.semantics.enable_enclv_exiting = 0;
-
         ctrl_cr0_guest_host_mask.storage = 0;
         ctrl_cr0_read_shadow.storage = 0;
 
         ctrl_cr4_guest_host_mask.storage = cr4_t{ .semantics = { .page_size_extension = 1, .physical_address_extension = 1, .page_global_enable = 1 } }.storage;
         ctrl_cr4_read_shadow.storage = read_cr4().storage;
 
-        ctrl_msr_bitmap_address.storage = m_hv->m_msr_bitmap.get_address();
+        ctrl_msr_bitmap_address.storage = m_hv->m_msr_interceptor.get_bitmap().get_address();
 
         ctrl_ept_pointer.semantics.memory_type = memory_type_write_back_v.value;
         ctrl_ept_pointer.semantics.page_walk_length = 4 - 1;
         ctrl_ept_pointer.semantics.enable_accessed_and_dirty_flag = 1;
         ctrl_ept_pointer.semantics.pml4_physical_address = address_to_pfn<4_Kiuz>(m_hv->m_dynamic_ept.get_top_level_address());
 
-        ctrl_vpid.semantics.vpid = 1;
-
-        auto ia32_vmx_basic = read_msr<IA32_VMX_BASIC>();
-        bool ctrl_2nd_processor_based_vm_execution_controls_support;
-        bool ctrl_3rd_processor_based_vm_execution_controls_support;
-
-        if (ia32_vmx_basic.semantics.default1_controls_can_be_zero) {
-            auto ia32_vmx_true_pinbased_ctls = read_msr<IA32_VMX_TRUE_PINBASED_CTLS>();
-            auto ia32_vmx_true_procbased_ctls = read_msr<IA32_VMX_TRUE_PROCBASED_CTLS>();
-
-            ctrl_2nd_processor_based_vm_execution_controls_support =
-                vmcsf_t<VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS>{ .storage = ia32_vmx_true_procbased_ctls.semantics.mask1 }.semantics.activate_secondary_controls != 0;
-
-            ctrl_3rd_processor_based_vm_execution_controls_support =
-                vmcsf_t<VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS>{ .storage = ia32_vmx_true_procbased_ctls.semantics.mask1 }.semantics.activate_tertiary_controls != 0;
-
-            ctrl_pin_based_vm_execution_controls.storage |= ia32_vmx_true_pinbased_ctls.semantics.mask0;
-            ctrl_pin_based_vm_execution_controls.storage &= ia32_vmx_true_pinbased_ctls.semantics.mask1;
-
-            ctrl_1st_processor_based_vm_execution_controls.storage |= ia32_vmx_true_procbased_ctls.semantics.mask0;
-            ctrl_1st_processor_based_vm_execution_controls.storage &= ia32_vmx_true_procbased_ctls.semantics.mask1;
-        } else {
-            auto ia32_vmx_pinbased_ctls = read_msr<IA32_VMX_PINBASED_CTLS>();
-            auto ia32_vmx_procbased_ctls = read_msr<IA32_VMX_PROCBASED_CTLS>();
-
-            ctrl_2nd_processor_based_vm_execution_controls_support =
-                vmcsf_t<VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS>{ .storage = ia32_vmx_procbased_ctls.semantics.mask1 }.semantics.activate_secondary_controls != 0;
-
-            ctrl_3rd_processor_based_vm_execution_controls_support =
-                vmcsf_t<VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS>{ .storage = ia32_vmx_procbased_ctls.semantics.mask1 }.semantics.activate_tertiary_controls != 0;
-
-            ctrl_pin_based_vm_execution_controls.storage |= ia32_vmx_pinbased_ctls.semantics.mask0;
-            ctrl_pin_based_vm_execution_controls.storage &= ia32_vmx_pinbased_ctls.semantics.mask1;
-
-            ctrl_1st_processor_based_vm_execution_controls.storage |= ia32_vmx_procbased_ctls.semantics.mask0;
-            ctrl_1st_processor_based_vm_execution_controls.storage &= ia32_vmx_procbased_ctls.semantics.mask1;
-        }
-
-        if (ctrl_1st_processor_based_vm_execution_controls.semantics.activate_secondary_controls && ctrl_2nd_processor_based_vm_execution_controls_support) {
-            auto ia32_vmx_procbased_ctls2 = read_msr<IA32_VMX_PROCBASED_CTLS2>();
-            ctrl_2nd_processor_based_vm_execution_controls.storage |= ia32_vmx_procbased_ctls2.semantics.mask0;
-            ctrl_2nd_processor_based_vm_execution_controls.storage &= ia32_vmx_procbased_ctls2.semantics.mask1;
-        }
-
-        if (ctrl_1st_processor_based_vm_execution_controls.semantics.activate_tertiary_controls && ctrl_3rd_processor_based_vm_execution_controls_support) {
-            auto ia32_vmx_procbased_ctls3 = read_msr<IA32_VMX_PROCBASED_CTLS3>();
-            ctrl_3rd_processor_based_vm_execution_controls.storage &= ia32_vmx_procbased_ctls3.semantics.mask;
-        }
+        ctrl_vpid.semantics.vpid = m_vpid;
 
         m_evmcs_region->ctrl_pin_based_vm_execution_controls = ctrl_pin_based_vm_execution_controls.storage;
         m_evmcs_region->ctrl_primary_processor_based_vm_execution_controls = ctrl_1st_processor_based_vm_execution_controls.storage;
 
-        if (ctrl_1st_processor_based_vm_execution_controls.semantics.activate_secondary_controls && ctrl_2nd_processor_based_vm_execution_controls_support) {
+        if (ctrl_1st_processor_based_vm_execution_controls.semantics.activate_secondary_controls) {
             m_evmcs_region->ctrl_secondary_processor_based_vm_execution_controls = ctrl_2nd_processor_based_vm_execution_controls.storage;
         }
 
@@ -601,73 +522,23 @@ namespace siren::vmx {
     void mshv_virtual_cpu::evmcs_setup_controls_exit() noexcept {
         using namespace siren::x86;
 
-        vmcsf_t<VMCSF_CTRL_PRIMARY_VMEXIT_CONTROLS> ctrl_1st_vmexit_controls = {};
-        vmcsf_t<VMCSF_CTRL_SECONDARY_VMEXIT_CONTROLS> ctrl_2nd_vmexit_controls = {};
+        const auto& ctrl_1st_vmexit_controls = m_hv->m_vmcs_controls.primary_vmexit_controls;
+        [[maybe_unused]] const auto& ctrl_2nd_vmexit_controls = m_hv->m_vmcs_controls.secondary_vmexit_controls;
 
         vmcsf_t<VMCSF_CTRL_VMEXIT_MSR_STORE_COUNT> ctrl_vmexit_msr_store_count = {};
         vmcsf_t<VMCSF_CTRL_VMEXIT_MSR_STORE_ADDRESS> ctrl_vmexit_msr_store_address = {};
         vmcsf_t<VMCSF_CTRL_VMEXIT_MSR_LOAD_COUNT> ctrl_vmexit_msr_load_count = {};
         vmcsf_t<VMCSF_CTRL_VMEXIT_MSR_LOAD_ADDRESS> ctrl_vmexit_msr_load_address = {};
 
-        ctrl_1st_vmexit_controls.semantics.save_debug_controls = 1;
-        ctrl_1st_vmexit_controls.semantics.host_address_space_size = 1;
-        ctrl_1st_vmexit_controls.semantics.load_ia32_perf_global_ctrl = 0;
-        ctrl_1st_vmexit_controls.semantics.acknowledge_interrupt_on_exit = 1;
-        ctrl_1st_vmexit_controls.semantics.save_ia32_pat = 0;
-        ctrl_1st_vmexit_controls.semantics.load_ia32_pat = 0;
-        ctrl_1st_vmexit_controls.semantics.save_ia32_efer = 0;
-        ctrl_1st_vmexit_controls.semantics.load_ia32_efer = 0;
-        ctrl_1st_vmexit_controls.semantics.save_vmx_preemption_timer_value = 0;
-        ctrl_1st_vmexit_controls.semantics.clear_ia32_bndcfgs = 0;
-        ctrl_1st_vmexit_controls.semantics.conceal_vmx_from_pt = 0;
-        ctrl_1st_vmexit_controls.semantics.clear_ia32_rtit_ctl = 0;
-        ctrl_1st_vmexit_controls.semantics.clear_ia32_lbr_ctl = 0;
-        ctrl_1st_vmexit_controls.semantics.load_cet_state = 0;
-        ctrl_1st_vmexit_controls.semantics.load_pkrs = 0;
-        ctrl_1st_vmexit_controls.semantics.save_ia32_perf_global_ctrl = 0;
-        ctrl_1st_vmexit_controls.semantics.activate_secondary_controls = 0;
-
         ctrl_vmexit_msr_store_count.semantics.count = 0;
         ctrl_vmexit_msr_store_address.semantics.physical_address = 0;
 
         ctrl_vmexit_msr_load_count.semantics.count = 0;
         ctrl_vmexit_msr_load_address.semantics.physical_address = 0;
 
-        auto ia32_vmx_basic = read_msr<IA32_VMX_BASIC>();
-        bool ctrl_2nd_vmexit_controls_supports;
-
-        if (ia32_vmx_basic.semantics.default1_controls_can_be_zero) {
-            auto ia32_vmx_true_exit_ctls = read_msr<IA32_VMX_TRUE_EXIT_CTLS>();
-
-            // The IA32_VMX_EXIT_CTLS2 MSR exists only on processors that support the 1-setting of the "activate secondary
-            // controls" VM-exit control (only if bit 63 of the IA32_VMX_EXIT_CTLS MSR is 1).
-            ctrl_2nd_vmexit_controls_supports =
-                vmcsf_t<VMCSF_CTRL_PRIMARY_VMEXIT_CONTROLS>{ .storage = ia32_vmx_true_exit_ctls.semantics.mask1 }.semantics.activate_secondary_controls != 0;
-
-            ctrl_1st_vmexit_controls.storage |= ia32_vmx_true_exit_ctls.semantics.mask0;
-            ctrl_1st_vmexit_controls.storage &= ia32_vmx_true_exit_ctls.semantics.mask1;
-        } else {
-            auto ia32_vmx_exit_ctls = read_msr<IA32_VMX_EXIT_CTLS>();
-
-            // The IA32_VMX_EXIT_CTLS2 MSR exists only on processors that support the 1-setting of the "activate secondary
-            // controls" VM-exit control (only if bit 63 of the IA32_VMX_EXIT_CTLS MSR is 1).
-            ctrl_2nd_vmexit_controls_supports =
-                vmcsf_t<VMCSF_CTRL_PRIMARY_VMEXIT_CONTROLS>{ .storage = ia32_vmx_exit_ctls.semantics.mask1 }.semantics.activate_secondary_controls != 0;
-
-            ctrl_1st_vmexit_controls.storage |= ia32_vmx_exit_ctls.semantics.mask0;
-            ctrl_1st_vmexit_controls.storage &= ia32_vmx_exit_ctls.semantics.mask1;
-        }
-
-        if (ctrl_2nd_vmexit_controls_supports && ctrl_1st_vmexit_controls.semantics.activate_secondary_controls) {
-            // VM entry allows control X (bit X of the secondary VM-exit controls) to be 1 if bit X in the MSR is set to 1; if bit X in
-            // the MSR is cleared to 0, VM entry fails if control X and the activate secondary controls primary VM-exit control are both 1.
-            auto ia32_vmx_exit_ctls2 = read_msr<IA32_VMX_EXIT_CTLS2>();
-            ctrl_2nd_vmexit_controls.storage &= ia32_vmx_exit_ctls2.semantics.mask;
-        }
-
         m_evmcs_region->ctrl_primary_vmexit_controls = ctrl_1st_vmexit_controls.storage;
 
-        //if (ctrl_2nd_vmexit_controls_supports) {
+        //if (ctrl_1st_vmexit_controls.semantics.activate_secondary_controls) {
         //    m_evmcs_region->ctrl_2nd_vmexit_controls = ctrl_2nd_vmexit_controls.storage;
         //}
 
@@ -680,7 +551,7 @@ namespace siren::vmx {
     void mshv_virtual_cpu::evmcs_setup_controls_entry() noexcept {
         using namespace siren::x86;
 
-        vmcsf_t<VMCSF_CTRL_VMENTRY_CONTROLS> ctrl_vmentry_controls = {};
+        const auto& ctrl_vmentry_controls = m_hv->m_vmcs_controls.vmentry_controls;
 
         vmcsf_t<VMCSF_CTRL_VMENTRY_MSR_LOAD_COUNT> ctrl_vmentry_msr_load_count = {};
         vmcsf_t<VMCSF_CTRL_VMENTRY_MSR_LOAD_ADDRESS> ctrl_vmentry_msr_load_address = {};
@@ -689,40 +560,56 @@ namespace siren::vmx {
         //vmcsf_t<VMCSF_CTRL_VMENTRY_EXCEPTION_ERROR_CODE> ctrl_vmentry_exception_error_code = {};
         //vmcsf_t<VMCSF_CTRL_VMENTRY_INSTRUCTION_LENGTH> ctrl_vmentry_instruction_length = {};
 
-        ctrl_vmentry_controls.semantics.load_debug_controls = 1;
-        ctrl_vmentry_controls.semantics.ia32e_mode_guest = 1;
-        ctrl_vmentry_controls.semantics.entry_to_smm = 0;
-        ctrl_vmentry_controls.semantics.deactivate_dual_monitor_treatment = 0;
-        ctrl_vmentry_controls.semantics.load_ia32_perf_global_ctrl = 0;
-        ctrl_vmentry_controls.semantics.load_ia32_pat = 0;
-        ctrl_vmentry_controls.semantics.load_ia32_efer = 0;
-        ctrl_vmentry_controls.semantics.load_ia32_bndcfgs = 0;
-        ctrl_vmentry_controls.semantics.conceal_vmx_from_pt = 0;
-        ctrl_vmentry_controls.semantics.load_ia32_rtit_ctl = 0;
-        ctrl_vmentry_controls.semantics.load_cet_state = 0;
-        ctrl_vmentry_controls.semantics.load_guest_ia32_lbr_ctl = 0;
-        ctrl_vmentry_controls.semantics.load_pkrs = 0;
-
         ctrl_vmentry_msr_load_count.semantics.count = 0;
         ctrl_vmentry_msr_load_address.semantics.physical_address = 0;
 
-        auto ia32_vmx_basic = read_msr<IA32_VMX_BASIC>();
-
-        if (ia32_vmx_basic.semantics.default1_controls_can_be_zero) {
-            auto ia32_vmx_true_entry_ctls = read_msr<IA32_VMX_TRUE_ENTRY_CTLS>();
-            ctrl_vmentry_controls.storage |= ia32_vmx_true_entry_ctls.semantics.mask0;
-            ctrl_vmentry_controls.storage &= ia32_vmx_true_entry_ctls.semantics.mask1;
-        } else {
-            auto ia32_vmx_entry_ctls = read_msr<IA32_VMX_ENTRY_CTLS>();
-            ctrl_vmentry_controls.storage |= ia32_vmx_entry_ctls.semantics.mask0;
-            ctrl_vmentry_controls.storage &= ia32_vmx_entry_ctls.semantics.mask1;
-        }
-
         m_evmcs_region->ctrl_vmentry_controls = ctrl_vmentry_controls.storage;
         m_evmcs_region->ctrl_vmentry_msr_load_count = ctrl_vmentry_msr_load_count.storage;
         m_evmcs_region->ctrl_vmentry_msr_load_address = ctrl_vmentry_msr_load_address.storage;
     }
 
+    void mshv_virtual_cpu::flush_vpid() noexcept {
+        microsoft_hv::vp_set_t processor_set{};
+        processor_set.add(m_vp_index);
+        auto result_value = microsoft_hv::hypercalls::flush_virtual_address_space_ex(0, { .semantics = { .all_virtual_address_spaces = 1 } }, processor_set);
+        if (result_value.semantics.result != microsoft_hv::hypercalls::status_code_e::HV_STATUS_SUCCESS) {
+            invoke_debugger_noreturn();
+        }
+    }
+
+    void mshv_virtual_cpu::process_ept_invalidations() noexcept {
+        ept_invalidation_mailbox::batch_t batch;
+
+        if (m_ept_mailbox.has_pending() && m_ept_mailbox.take(batch)) {
+            using namespace microsoft_hv::hypercalls;
+
+            auto address_space = m_hv->m_dynamic_ept.get_top_level_address();
+
+            // Ranges that do not fit in one fast hypercall are flushed with the whole address space.
+            microsoft_hv::gpa_page_range_t page_ranges[max_fast_gpa_page_range_count_v];
+            size_t page_range_count = 0;
+            bool everything = batch.everything;
+            for (size_t i = 0; i < batch.range_count && !everything; ++i) {
+                everything = !microsoft_hv::append_gpa_page_ranges(batch.ranges[i].base, batch.ranges[i].size, page_ranges, page_range_count, max_fast_gpa_page_range_count_v);
+            }
+
+            bool flushed;
+            if (everything) {
+                flushed = flush_guest_physical_address_space(address_space).semantics.result == status_code_e::HV_STATUS_SUCCESS;
+            } else {
+                auto result_value = flush_guest_physical_address_list(address_space, page_ranges, page_range_count);
+                flushed = result_value.semantics.result == status_code_e::HV_STATUS_SUCCESS && result_value.semantics.reps_completed == page_range_count;
+            }
+
+            // without the enlightenment INVEPT does the job, at the cost of a trap to the parent hypervisor
+            if (!flushed && x86::vmx_invept(m_evmcs_region->ctrl_ept_pointer).is_failure() && x86::vmx_invept().is_failure()) {
+                invoke_debugger_noreturn();
+            }
+
+            m_ept_mailbox.complete(batch.ticket);
+        }
+    }
+
     [[msvc::noinline]]
     void mshv_virtual_cpu::launch() noexcept {
         using namespace siren::x86;
@@ -736,7 +623,8 @@ namespace siren::vmx {
         m_evmcs_region->guest_rsp = guest_rsp.storage;
         m_evmcs_region->guest_rip = guest_rip.storage;
 
-        m_evmcs_region->mshv_clean_fields.storage = 0;  // reload every evmcs fields
+        m_evmcs_region->mshv_clean_fields.storage = 0;  // VMLAUNCH must load every evmcs fields, afterwards mshv_evmcs_accessor tracks what is dirty.
+        m_msr_bitmap_generation = m_hv->m_msr_interceptor.get_bitmap_generation();
 
         if (vmx_launch().is_failure()) {
             invoke_debugger_noreturn();
@@ -746,65 +634,129 @@ namespace siren::vmx {
     mshv_virtual_cpu::mshv_virtual_cpu(mshv_hypervisor* hv, uint32_t index) noexcept :
         m_hv{ hv },
         m_index{ index },
+        m_vp_index{ microsoft_hv::vp_index_self_v },
+        m_vpid{ vpid_allocator::invalid_vpid_v },
         m_running{ false },
+        m_suspended{ false },
+        m_ia32_vmx_cr0_fixed0{},
+        m_ia32_vmx_cr0_fixed1{},
+        m_ia32_vmx_cr4_fixed0{},
+        m_ia32_vmx_cr4_fixed1{},
         m_hypercall_page{ nullptr },
         m_hypercall_page_physical_address{ 0 },
         m_vp_assist_page{ nullptr },
         m_vp_assist_page_physical_address{ 0 },
-        m_partition_assist_page{},
+        m_block_layout{},
+        m_block{},
+        m_block_physical_address{ 0 },
+        m_partition_assist_page{ nullptr },
         m_partition_assist_page_physical_address{ 0 },
-        m_vmxon_region{},
+        m_vmxon_region{ nullptr },
         m_vmxon_region_physical_address{ 0 },
-        m_evmcs_region{},
+        m_evmcs_region{ nullptr },
         m_evmcs_region_physical_address{ 0 },
-        m_vmexit_stack{},
-        m_vmexit_stack_physical_address{ 0 }
+        m_evmcs_accessor{},
+        m_guest_registers_loaded{ 0 },
+        m_guest_registers_dirty{ 0 },
+        m_msr_shadows{},
+        m_msr_bitmap_generation{ 0 },
+        m_halt_poll_policy{},
+        m_pause_loop_policy{ hv->m_pause_loop_parameters },
+        m_mapping_window{},
+        m_ept_mailbox{},
+        m_vmexit_stack{ nullptr }
     {
         // nothing to do
     }
 
     mshv_virtual_cpu::~mshv_virtual_cpu() noexcept {
-        if (m_running) {
+        if (m_running || m_suspended) {
             invoke_debugger_noreturn();
         }
+
+        m_hv->m_vpid_allocator.release(m_vpid);
+    }
+
+    mshv_virtual_cpu::vmexit_stack_top_t* mshv_virtual_cpu::get_vmexit_stack_top() const noexcept {
+        return reinterpret_cast<vmexit_stack_top_t*>(m_vmexit_stack + m_block_layout.vmexit_stack_size - sizeof(vmexit_stack_top_t));
+    }
+
+    expected<void, nt_status> mshv_virtual_cpu::intialize(size_t vmexit_stack_size) noexcept {
+        if (m_vpid == vpid_allocator::invalid_vpid_v) {
+            auto r = m_hv->m_vpid_allocator.allocate();
+            if (r.has_value()) {
+                m_vpid = r.value();
+            } else {
+                return unexpected{ r.error() };
+            }
+        }
+
+        m_block_layout = mshv_vcpu_block_layout_t::compute(vmexit_stack_size);
+        if (!m_block_layout.is_valid()) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+
+        return {};
     }
 
-    expected<void, nt_status> mshv_virtual_cpu::intialize() noexcept {
-        void* hypercall_page = nullptr;
-        x86::paddr_t hypercall_page_physical_address = 0;
+    expected<void, nt_status> mshv_virtual_cpu::prepare() noexcept {
+        using namespace siren::x86;
 
-        microsoft_hv::vp_assist_page_t* vp_assist_page = nullptr;
+        x86::paddr_t hypercall_page_physical_address = 0;
         x86::paddr_t vp_assist_page_physical_address = 0;
 
-        unique_npaged<microsoft_hv::partition_assist_page_t> partition_assist_page;
-        x86::paddr_t partition_assist_page_physical_address = 0;
+        if (!m_block) {
+            contiguous_allocator<block_page_t> allocator{ contiguous_pool };
 
-        unique_npaged<microsoft_hv::vmx_enlightened_vmcs_t> vmxon_region;
-        x86::paddr_t vmxon_region_physical_address = 0;
+            auto r = allocator.allocate_on_node(m_block_layout.page_count(), current_numa_node());
+            if (r.has_error()) {
+                return unexpected{ r.error() };
+            }
 
-        unique_npaged<microsoft_hv::vmx_enlightened_vmcs_t> evmcs_region;
-        x86::paddr_t evmcs_region_physical_address = 0;
+            m_block = unique_contiguous<block_page_t[]>{ r.value(), { allocator, m_block_layout.page_count() } };
+            m_block_physical_address = get_physical_address(m_block.get());
 
-        unique_npaged<vmexit_stack_t> vmexit_stack;
-        x86::paddr_t vmexit_stack_physical_address = 0;
+            auto* block = reinterpret_cast<uint8_t*>(m_block.get());
 
-        run_at_cpu(
-            m_index, 
-            [&hypercall_page_physical_address, &vp_assist_page_physical_address]() noexcept {
-                auto msr_hypercall = x86::read_msr<microsoft_hv::HV_X64_MSR_HYPERCALL>();
-                if (msr_hypercall.semantics.enable) {
-                    hypercall_page_physical_address = x86::pfn_to_address<4_Kiuz>(msr_hypercall.semantics.hypercall_pfn);
-                }
+            // contiguous memory is not zeroed, the vmx regions must be
+            std::fill(block + m_block_layout.evmcs_offset, block + m_block_layout.size, uint8_t{ 0 });
 
-                auto msr_vp_assist_page = x86::read_msr<microsoft_hv::HV_X64_MSR_VP_ASSIST_PAGE>();
-                if (msr_vp_assist_page.semantics.enable) {
-                    vp_assist_page_physical_address = x86::pfn_to_address<4_Kiuz>(msr_vp_assist_page.semantics.physical_address);
-                }
+            m_evmcs_region = reinterpret_cast<microsoft_hv::vmx_enlightened_vmcs_t*>(block + m_block_layout.evmcs_offset);
+            m_evmcs_region->version_number = 1;
+            m_evmcs_region_physical_address = m_block_physical_address + m_block_layout.evmcs_offset;
+            m_evmcs_accessor.attach(m_evmcs_region);
+
+            m_partition_assist_page = reinterpret_cast<microsoft_hv::partition_assist_page_t*>(block + m_block_layout.partition_assist_page_offset);
+            m_partition_assist_page_physical_address = m_block_physical_address + m_block_layout.partition_assist_page_offset;
+
+            m_vmxon_region = reinterpret_cast<microsoft_hv::vmx_enlightened_vmcs_t*>(block + m_block_layout.vmxon_region_offset);
+            m_vmxon_region->version_number = 1;
+            m_vmxon_region_physical_address = m_block_physical_address + m_block_layout.vmxon_region_offset;
+
+            m_vmexit_stack = block + m_block_layout.vmexit_stack_offset;
+            get_vmexit_stack_top()->self = this;
+        }
+
+        if (!m_mapping_window.is_initialized()) {
+            auto r = m_mapping_window.initialize(m_hv->m_physical_memory_map);
+            if (r.has_error()) {
+                return r;
             }
-        );
+        }
+
+        auto msr_hypercall = read_msr<microsoft_hv::HV_X64_MSR_HYPERCALL>();
+        if (msr_hypercall.semantics.enable) {
+            hypercall_page_physical_address = pfn_to_address<4_Kiuz>(msr_hypercall.semantics.hypercall_pfn);
+        }
+
+        auto msr_vp_assist_page = read_msr<microsoft_hv::HV_X64_MSR_VP_ASSIST_PAGE>();
+        if (msr_vp_assist_page.semantics.enable) {
+            vp_assist_page_physical_address = pfn_to_address<4_Kiuz>(msr_vp_assist_page.semantics.physical_address);
+        }
 
         if (hypercall_page_physical_address) {
-            hypercall_page = get_virtual_address<uint8_t*>(hypercall_page_physical_address);
+            m_hypercall_page = get_virtual_address<uint8_t*>(hypercall_page_physical_address);
+            m_hypercall_page_physical_address = hypercall_page_physical_address;
         } else {
 #if DBG
             // We should establish the hypercall interface manually. But I don't think we would run here since OS should have done it.
@@ -815,7 +767,8 @@ namespace siren::vmx {
         }
 
         if (vp_assist_page_physical_address) {
-            vp_assist_page = get_virtual_address<microsoft_hv::vp_assist_page_t*>(vp_assist_page_physical_address);
+            m_vp_assist_page = get_virtual_address<microsoft_hv::vp_assist_page_t*>(vp_assist_page_physical_address);
+            m_vp_assist_page_physical_address = vp_assist_page_physical_address;
         } else {
 #if DBG
             // We should allocate and map a vp-assist-page manually. But I don't think we would run here since OS should have done it.
@@ -825,65 +778,26 @@ namespace siren::vmx {
             return unexpected{ nt_status_not_implemented_v };
         }
 
-        {
-            auto r = allocate_unique<microsoft_hv::partition_assist_page_t>(npaged_pool);
-            if (r.has_value()) {
-                partition_assist_page = std::move(r.value());
-                partition_assist_page_physical_address = get_physical_address(partition_assist_page.get());
-            } else {
-                return unexpected{ r.error() };
-            }
-        }
+        // the hypervisor's index of this virtual processor, required by hypercalls taking processor sets
+        m_vp_index = static_cast<microsoft_hv::vp_index_t>(read_msr(microsoft_hv::HV_X64_MSR_VP_INDEX));
 
-        {
-            auto r = allocate_unique<microsoft_hv::vmx_enlightened_vmcs_t>(npaged_pool);
-            if (r.has_value()) {
-                vmxon_region = std::move(r.value());
-                vmxon_region->version_number = 1;
-                vmxon_region_physical_address = get_physical_address(vmxon_region.get());
-            } else {
-                return unexpected{ r.error() };
-            }
-        }
+        m_ia32_vmx_cr0_fixed0 = m_hv->m_vmx_capabilities.cr0_fixed0;
+        m_ia32_vmx_cr0_fixed1 = m_hv->m_vmx_capabilities.cr0_fixed1;
+        m_ia32_vmx_cr4_fixed0 = m_hv->m_vmx_capabilities.cr4_fixed0;
+        m_ia32_vmx_cr4_fixed1 = m_hv->m_vmx_capabilities.cr4_fixed1;
 
-        {
-            auto r = allocate_unique<microsoft_hv::vmx_enlightened_vmcs_t>(npaged_pool);
-            if (r.has_value()) {
-                evmcs_region = std::move(r.value());
-                evmcs_region->version_number = 1;
-                evmcs_region_physical_address = get_physical_address(evmcs_region.get());
-            } else {
-                return unexpected{ r.error() };
-            }
-        }
-
-        {
-            auto r = allocate_unique<vmexit_stack_t>(npaged_pool);
-            if (r.has_value()) {
-                vmexit_stack = std::move(r.value());
-                vmexit_stack_physical_address = get_physical_address(vmexit_stack.get());
-            } else {
-                return unexpected{ r.error() };
-            }
-        }
+        std::fill_n(reinterpret_cast<uint64_t*>(m_vmexit_stack), (m_block_layout.vmexit_stack_size - sizeof(vmexit_stack_top_t)) / sizeof(uint64_t), vmexit_stack_canary_v);
 
-        m_hypercall_page = hypercall_page;
-        m_hypercall_page_physical_address = hypercall_page_physical_address;
+        evmcs_setup_guest();
+        evmcs_setup_host();
+        evmcs_setup_controls_execution();
+        evmcs_setup_controls_exit();
+        evmcs_setup_controls_entry();
 
-        m_vp_assist_page = vp_assist_page;
-        m_vp_assist_page_physical_address = vp_assist_page_physical_address;
-
-        m_partition_assist_page = std::move(partition_assist_page);
-        m_partition_assist_page_physical_address = partition_assist_page_physical_address;
-
-        m_vmxon_region = std::move(vmxon_region);
-        m_vmxon_region_physical_address = vmxon_region_physical_address;
-
-        m_evmcs_region = std::move(evmcs_region);
-        m_evmcs_region_physical_address = evmcs_region_physical_address;
-
-        m_vmexit_stack = std::move(vmexit_stack);
-        m_vmexit_stack_physical_address = vmexit_stack_physical_address;
+        m_evmcs_region->mshv_vp_id = m_index;
+        m_evmcs_region->mshv_vm_id = reinterpret_cast<uintptr_t>(m_hv);
+        m_evmcs_region->mshv_partition_assist_page = microsoft_hv::gpa_t{ m_partition_assist_page_physical_address };
+        m_evmcs_region->mshv_enlightenments_control.semantics.nested_flush_virtual_hypercall = 1;
 
         return {};
     }
@@ -903,20 +817,15 @@ namespace siren::vmx {
     void mshv_virtual_cpu::start() noexcept {
         using namespace siren::x86;
 
+        // everything else has been set up by prepare()
         if (!m_running) {
             auto vmx_cr0 = read_cr0();
-            auto ia32_vmx_cr0_fixed0 = read_msr<IA32_VMX_CR0_FIXED0>();
-            auto ia32_vmx_cr0_fixed1 = read_msr<IA32_VMX_CR0_FIXED1>();
-
-            vmx_cr0.storage |= ia32_vmx_cr0_fixed0.semantics.mask_value;
-            vmx_cr0.storage &= ia32_vmx_cr0_fixed1.semantics.mask_value;
+            vmx_cr0.storage |= m_ia32_vmx_cr0_fixed0.semantics.mask_value;
+            vmx_cr0.storage &= m_ia32_vmx_cr0_fixed1.semantics.mask_value;
 
             auto vmx_cr4 = read_cr4();
-            auto ia32_vmx_cr4_fixed0 = read_msr<IA32_VMX_CR4_FIXED0>();
-            auto ia32_vmx_cr4_fixed1 = read_msr<IA32_VMX_CR4_FIXED1>();
-
-            vmx_cr4.storage |= ia32_vmx_cr4_fixed0.semantics.mask_value;
-            vmx_cr4.storage &= ia32_vmx_cr4_fixed1.semantics.mask_value;
+            vmx_cr4.storage |= m_ia32_vmx_cr4_fixed0.semantics.mask_value;
+            vmx_cr4.storage &= m_ia32_vmx_cr4_fixed1.semantics.mask_value;
 
             write_cr0(vmx_cr0);
             write_cr4(vmx_cr4);
@@ -933,44 +842,162 @@ namespace siren::vmx {
             m_vp_assist_page->current_nested_vmcs = m_evmcs_region_physical_address;
             m_vp_assist_page->enlighten_vm_entry = true;
 
-            evmcs_setup_guest();
-            evmcs_setup_host();
-            evmcs_setup_controls_execution();
-            evmcs_setup_controls_exit();
-            evmcs_setup_controls_entry();
+            m_vp_assist_page->nested_enlightenments_control.features.semantics.direct_hypercall = 1;
 
-            m_evmcs_region->mshv_vp_id = m_index;
-            m_evmcs_region->mshv_vm_id = reinterpret_cast<uintptr_t>(m_hv);
-            m_evmcs_region->mshv_partition_assist_page = microsoft_hv::gpa_t{ m_partition_assist_page_physical_address };
+            evmcs_setup_guest_context();
 
-            m_vp_assist_page->nested_enlightenments_control.features.semantics.direct_hypercall = 1;
-            m_evmcs_region->mshv_enlightenments_control.semantics.nested_flush_virtual_hypercall = 1;
+            // A recycled vpid may still tag translations of its previous owner, flush them once before the first VM entry.
+            if (m_hv->m_vpid_allocator.consume_stale(m_vpid)) {
+                flush_vpid();
+            }
+
+            process_ept_invalidations();
 
             launch();
 
-            m_running = true;
+            // A poster that saw m_running still false does not wait for this virtual cpu, so what it posted after the flush above is retired from the guest.
+            // The seq_cst store pairs with the fetch_add of ept_invalidation_mailbox::post.
+            std::atomic_ref<bool>{ m_running }.store(true);
+            if (m_ept_mailbox.has_pending()) {
+                siren_hypercalls::ept_flush();
+            }
         }
     }
 
     void mshv_virtual_cpu::stop() noexcept {
+        using namespace siren::x86;
+
         if (m_running) {
             siren_hypercalls::turn_off_vm();
-            m_running = false;
+            std::atomic_ref<bool>{ m_running }.store(false);    // read by mshv_hypervisor::invalidate_ept() from other processors
+        } else if (m_suspended) {
+            // already out of the guest, only VMX is left to turn off
+            vmx_off();
+
+            auto cr4 = read_cr4();
+            cr4.semantics.vmx_enable = 0;
+            write_cr4(cr4);
+
+            m_suspended = false;
+        }
+    }
+
+    void mshv_virtual_cpu::suspend() noexcept {
+        if (m_running) {
+            siren_hypercalls::suspend_vm();
+            std::atomic_ref<bool>{ m_running }.store(false);    // see stop()
+            m_suspended = true;
+        }
+    }
+
+    void mshv_virtual_cpu::resume() noexcept {
+        if (m_suspended) {
+            // The enlightened vmcs is still current but launched, VMCLEAR it so that launch() can VMLAUNCH again.
+            if (x86::vmx_clear(m_evmcs_region_physical_address).is_failure()) {
+                invoke_debugger_noreturn();
+            }
+
+            m_vp_assist_page->current_nested_vmcs = m_evmcs_region_physical_address;
+            m_vp_assist_page->enlighten_vm_entry = true;
+
+            // host state and controls are kept, only the guest has moved on
+            evmcs_setup_guest();
+            evmcs_setup_guest_context();
+
+            // The guest ran outside of its vpid meanwhile, so its own INVLPGs and CR3 writes did not reach the translations tagged with it.
+            flush_vpid();
+
+            m_suspended = false;
+
+            process_ept_invalidations();
+
+            launch();
+
+            // see start()
+            std::atomic_ref<bool>{ m_running }.store(true);
+            if (m_ept_mailbox.has_pending()) {
+                siren_hypercalls::ept_flush();
+            }
         }
     }
 
     microsoft_hv::vmx_enlightened_vmcs_t* mshv_virtual_cpu::get_enlightened_vmcs() noexcept {
-        return m_evmcs_region.get();
+        return m_evmcs_region;
     }
 
     const microsoft_hv::vmx_enlightened_vmcs_t* mshv_virtual_cpu::get_enlightened_vmcs() const noexcept {
-        return m_evmcs_region.get();
+        return m_evmcs_region;
+    }
+
+    mshv_evmcs_accessor& mshv_virtual_cpu::get_evmcs_accessor() noexcept {
+        return m_evmcs_accessor;
+    }
+
+    const mshv_evmcs_accessor& mshv_virtual_cpu::get_evmcs_accessor() const noexcept {
+        return m_evmcs_accessor;
     }
 
     const void* mshv_virtual_cpu::get_hypercall_page() const noexcept {
         return m_hypercall_page;
     }
 
+    expected<guest_translation_t, nt_status> mshv_virtual_cpu::translate_guest_address(x86::vaddr64_t gva, guest_walk_e walk) noexcept {
+        using namespace siren::x86;
+
+        auto expt_context = make_guest_paging_context(
+            m_evmcs_accessor.read<VMCSF_GUEST_CR0>().storage,
+            m_evmcs_accessor.read<VMCSF_GUEST_CR3>().storage,
+            m_evmcs_accessor.read<VMCSF_GUEST_CR4>().storage,
+            m_evmcs_accessor.read<VMCSF_GUEST_IA32_EFER>().storage
+        );
+
+        if (expt_context.has_error()) {
+            return unexpected{ expt_context.error() };
+        }
+
+        // EPT maps guest physical memory one to one, a guest page table is at the same host physical address
+        auto expt_translation = walk_guest_page_tables(expt_context.value(), gva, walk, [this](x86::paddr_t table) noexcept { return m_mapping_window.map_table(table); });
+        m_mapping_window.unmap_table();
+
+        return expt_translation;
+    }
+
+    guest_mapping_window& mshv_virtual_cpu::get_mapping_window() noexcept {
+        return m_mapping_window;
+    }
+
+    ept_invalidation_mailbox::statistics_t mshv_virtual_cpu::get_ept_invalidation_statistics() noexcept {
+        return m_ept_mailbox.get_statistics();
+    }
+
+    const halt_poll_policy::statistics_t& mshv_virtual_cpu::get_halt_poll_statistics() const noexcept {
+        return m_halt_poll_policy.get_statistics();
+    }
+
+    const pause_loop_policy::statistics_t& mshv_virtual_cpu::get_pause_loop_statistics() const noexcept {
+        return m_pause_loop_policy.get_statistics();
+    }
+
+    mshv_virtual_cpu::vmexit_stack_usage_t mshv_virtual_cpu::get_vmexit_stack_usage() const noexcept {
+        if (m_vmexit_stack == nullptr) {
+            return { .size = m_block_layout.vmexit_stack_size - sizeof(vmexit_stack_top_t), .high_water_mark = 0 };
+        }
+
+        // the stack grows down, the lowest slot that was ever written is the high-water mark
+        const volatile uint64_t* bottom = reinterpret_cast<const uint64_t*>(m_vmexit_stack);
+        const volatile uint64_t* top = reinterpret_cast<const uint64_t*>(get_vmexit_stack_top());
+
+        const volatile uint64_t* p = bottom;
+        while (p < top && *p == vmexit_stack_canary_v) {
+            ++p;
+        }
+
+        return {
+            .size = m_block_layout.vmexit_stack_size - sizeof(vmexit_stack_top_t),
+            .high_water_mark = static_cast<size_t>(top - p) * sizeof(uint64_t)
+        };
+    }
+
     void mshv_virtual_cpu::inject_bp_exception() noexcept {
         using namespace siren::x86;
 
@@ -981,9 +1008,8 @@ namespace siren::vmx {
         ctrl_vmentry_interruption_info.semantics.deliver_error_code = 0;
         ctrl_vmentry_interruption_info.semantics.valid = 1;
 
-        m_evmcs_region->ctrl_vmentry_interruption_info = ctrl_vmentry_interruption_info.storage;
-        m_evmcs_region->ctrl_vmentry_instruction_length = m_evmcs_region->info_vmexit_instruction_length;
-        m_evmcs_region->mshv_clean_fields.semantics.control_event = 0;
+        m_evmcs_accessor.overwrite<VMCSF_CTRL_VMENTRY_INTERRUPTION_INFO>(ctrl_vmentry_interruption_info);
+        m_evmcs_accessor.write<VMCSF_CTRL_VMENTRY_INSTRUCTION_LENGTH>({ .storage = m_evmcs_accessor.read<VMCSF_INFO_VMEXIT_INSTRUCTION_LENGTH>().storage });
     }
 
     void mshv_virtual_cpu::inject_ud_exception() noexcept {
@@ -996,8 +1022,7 @@ namespace siren::vmx {
         ctrl_vmentry_interruption_info.semantics.deliver_error_code = 0;
         ctrl_vmentry_interruption_info.semantics.valid = 1;
 
-        m_evmcs_region->ctrl_vmentry_interruption_info = ctrl_vmentry_interruption_info.storage;
-        m_evmcs_region->mshv_clean_fields.semantics.control_event = 0;
+        m_evmcs_accessor.overwrite<VMCSF_CTRL_VMENTRY_INTERRUPTION_INFO>(ctrl_vmentry_interruption_info);
     }
 
     void mshv_virtual_cpu::inject_gp_exception(uint32_t error_code) noexcept {
@@ -1010,9 +1035,8 @@ namespace siren::vmx {
         ctrl_vmentry_interruption_info.semantics.deliver_error_code = 1;
         ctrl_vmentry_interruption_info.semantics.valid = 1;
 
-        m_evmcs_region->ctrl_vmentry_interruption_info = ctrl_vmentry_interruption_info.storage;
-        m_evmcs_region->ctrl_vmentry_exception_error_code = error_code;
-        m_evmcs_region->ctrl_vmentry_instruction_length = m_evmcs_region->info_vmexit_instruction_length;
-        m_evmcs_region->mshv_clean_fields.semantics.control_event = 0;
+        m_evmcs_accessor.overwrite<VMCSF_CTRL_VMENTRY_INTERRUPTION_INFO>(ctrl_vmentry_interruption_info);
+        m_evmcs_accessor.write<VMCSF_CTRL_VMENTRY_EXCEPTION_ERROR_CODE>({ .storage = error_code });
+        m_evmcs_accessor.write<VMCSF_CTRL_VMENTRY_INSTRUCTION_LENGTH>({ .storage = m_evmcs_accessor.read<VMCSF_INFO_VMEXIT_INSTRUCTION_LENGTH>().storage });
     }
 }
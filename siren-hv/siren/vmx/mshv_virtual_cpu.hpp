@@ -1,4 +1,5 @@
 #pragma once
+#include "../literals.hpp"
 #include "../memory.hpp"
 
 #include "../hypervisor.hpp"
@@ -11,27 +12,71 @@
 #include "../microsoft_hv/tlfs.hpp"
 #include "../microsoft_hv/tlfs.model_specific_registers.hpp"
 
+#include "ept_invalidation.hpp"
+#include "guest_memory.hpp"
+#include "guest_page_walker.hpp"
+#include "guest_state.hpp"
+#include "halt_poll_policy.hpp"
+#include "pause_loop_policy.hpp"
+#include "mshv_evmcs_accessor.hpp"
+#include "mshv_vcpu_block.hpp"
+#include "msr_interceptor.hpp"
+#include "vpid_allocator.hpp"
+
 namespace siren::vmx {
+    using namespace ::siren::size_literals;
+
     class mshv_hypervisor;
     class mshv_virtual_cpu;
 
     class mshv_virtual_cpu : public virtual_cpu {
         friend class mshv_hypervisor;
+        friend class mshv_vmexit_handler;
+        friend class exit_replayer;    // sets up the enlightened vmcs on the host, see tests/vmx/exit_replayer.hpp
     public:
-        struct alignas(uintptr_t) vmexit_stack_t {
-            uint8_t in_use[1_Miuz - 1_Kiuz];
+        static constexpr allocation_category_e allocation_category_v = allocation_category_e::virtual_cpu;
+
+        // A vmexit stack is vmexit_stack_size bytes at the start of the virtual cpu's block, the last 1KiB of which is vmexit_stack_top_t.
+        // HOST_RSP points at `self`, mshv_vmexit_handler::entry_point reads it relative to its initial rsp, so it does not depend on the stack size.
+        struct alignas(16) vmexit_stack_top_t {
             mshv_virtual_cpu* self;
             uint8_t reserved[1_Kiuz - sizeof(self)];
         };
 
-        static_assert(sizeof(vmexit_stack_t) == 1_Miuz);
-        static_assert(alignof(vmexit_stack_t) == alignof(uintptr_t));
+        static_assert(sizeof(vmexit_stack_top_t) == 1_Kiuz);
+
+        static constexpr size_t vmexit_stack_size_min_v = 16_Kiuz;
+        static constexpr size_t vmexit_stack_size_max_v = 1_Miuz;
+        static constexpr size_t vmexit_stack_size_default_v = 1_Miuz;
+
+        // fills the unused part of a vmexit stack, see get_vmexit_stack_usage()
+        static constexpr uint64_t vmexit_stack_canary_v = 0x5f4b434154535f58u;   // "X_STACK_"
+
+        struct vmexit_stack_usage_t {
+            size_t size;                // in bytes, vmexit_stack_top_t excluded
+            size_t high_water_mark;     // deepest use in bytes since prepare(), measured from the top
+        };
 
     private:
+        struct alignas(mshv_vcpu_block_layout_t::page_size_v) block_page_t {
+            static constexpr allocation_category_e allocation_category_v = allocation_category_e::virtual_cpu;
+
+            uint8_t bytes[mshv_vcpu_block_layout_t::page_size_v];
+        };
+
         mshv_hypervisor* m_hv;
 
         uint32_t m_index;
+        microsoft_hv::vp_index_t m_vp_index;
+        vpid_allocator::vpid_t m_vpid;
         bool m_running;
+        bool m_suspended;   // left the guest by suspend(), still in VMX root operation
+
+        // cached by prepare(), guest control registers must respect them too
+        x86::msr_t<x86::IA32_VMX_CR0_FIXED0> m_ia32_vmx_cr0_fixed0;
+        x86::msr_t<x86::IA32_VMX_CR0_FIXED1> m_ia32_vmx_cr0_fixed1;
+        x86::msr_t<x86::IA32_VMX_CR4_FIXED0> m_ia32_vmx_cr4_fixed0;
+        x86::msr_t<x86::IA32_VMX_CR4_FIXED1> m_ia32_vmx_cr4_fixed1;
 
         void* m_hypercall_page;
         x86::paddr_t m_hypercall_page_physical_address;
@@ -39,23 +84,49 @@ namespace siren::vmx {
         microsoft_hv::vp_assist_page_t* m_vp_assist_page;
         x86::paddr_t m_vp_assist_page_physical_address;
 
-        unique_npaged<microsoft_hv::partition_assist_page_t> m_partition_assist_page;
+        // allocated by prepare() on the NUMA node of this virtual cpu, see mshv_vcpu_block_layout_t
+        mshv_vcpu_block_layout_t m_block_layout;
+        unique_contiguous<block_page_t[]> m_block;
+        x86::paddr_t m_block_physical_address;
+
+        // the following regions are inside m_block
+        microsoft_hv::partition_assist_page_t* m_partition_assist_page;
         x86::paddr_t m_partition_assist_page_physical_address;
 
-        unique_npaged<microsoft_hv::vmx_enlightened_vmcs_t> m_vmxon_region;
+        microsoft_hv::vmx_enlightened_vmcs_t* m_vmxon_region;
         x86::paddr_t m_vmxon_region_physical_address;
 
-        unique_npaged<microsoft_hv::vmx_enlightened_vmcs_t> m_evmcs_region;
+        microsoft_hv::vmx_enlightened_vmcs_t* m_evmcs_region;
         x86::paddr_t m_evmcs_region_physical_address;
 
-        unique_npaged<vmexit_stack_t> m_vmexit_stack;
-        x86::paddr_t m_vmexit_stack_physical_address;
+        mshv_evmcs_accessor m_evmcs_accessor;
+
+        // per-exit lazy state of guest_state_t, see guest_lazy_register_e
+        uint32_t m_guest_registers_loaded;
+        uint32_t m_guest_registers_dirty;
+
+        msr_interceptor::shadow_storage_t m_msr_shadows;
+        uint32_t m_msr_bitmap_generation;
+
+        halt_poll_policy m_halt_poll_policy;
+        pause_loop_policy m_pause_loop_policy;
+
+        guest_mapping_window m_mapping_window;  // set up by prepare()
+
+        ept_invalidation_mailbox m_ept_mailbox; // posted to by mshv_hypervisor, see process_ept_invalidations()
+
+        uint8_t* m_vmexit_stack;    // inside m_block
 
         template<x86::segment_register_e SegmentReg>
         void evmcs_setup_segment(const x86::gdtr_t& gdtr, const x86::segment_selector_t& ldtr, auto seg_selector, auto seg_base, auto seg_limit, auto seg_access_rights) noexcept;
 
+        [[nodiscard]]
+        vmexit_stack_top_t* get_vmexit_stack_top() const noexcept;
+
         void evmcs_setup_guest() noexcept;
 
+        void evmcs_setup_guest_context() noexcept;
+
         void evmcs_setup_host() noexcept;
 
         void evmcs_setup_controls_execution() noexcept;
@@ -64,6 +135,12 @@ namespace siren::vmx {
 
         void evmcs_setup_controls_entry() noexcept;
 
+        // Flushes every translation tagged with m_vpid on this processor.
+        void flush_vpid() noexcept;
+
+        // Retires whatever is pending in m_ept_mailbox with one flush hypercall. Runs at the start of every VM exit and before VM entry.
+        void process_ept_invalidations() noexcept;
+
         [[msvc::noinline]]
         void launch() noexcept;
 
@@ -73,8 +150,8 @@ namespace siren::vmx {
         // copy constructor is not allowed
         mshv_virtual_cpu(const mshv_virtual_cpu&) = delete;
 
-        // move constructor
-        mshv_virtual_cpu(mshv_virtual_cpu&& other) noexcept = default;
+        // move constructor is not allowed, the vpid and the vmexit stack's back pointer belong to this object
+        mshv_virtual_cpu(mshv_virtual_cpu&&) noexcept = delete;
 
         // copy assignment is not allowed
         mshv_virtual_cpu& operator=(const mshv_virtual_cpu&) = delete;
@@ -84,8 +161,14 @@ namespace siren::vmx {
 
         virtual ~mshv_virtual_cpu() noexcept override;
 
+        // `vmexit_stack_size` is a multiple of the page size.
+        [[nodiscard]]
+        expected<void, nt_status> intialize(size_t vmexit_stack_size) noexcept;
+
+        // Must run at PASSIVE_LEVEL on the processor of this virtual cpu, in a system thread, before start().
+        // Allocates the block of this virtual cpu on the NUMA node of the processor and fills everything in the enlightened vmcs that does not depend on the interrupted context, so that start() is left with VMXON, VMPTRLD and VMLAUNCH.
         [[nodiscard]]
-        expected<void, nt_status> intialize() noexcept;
+        expected<void, nt_status> prepare() noexcept;
 
         [[nodiscard]]
         virtual hypervisor* get_hypervisor() noexcept override;
@@ -100,15 +183,49 @@ namespace siren::vmx {
 
         virtual void stop() noexcept override;
 
+        // Leaves the guest but keeps VMX on and the enlightened vmcs current, must run on the processor of this virtual cpu.
+        // While suspended the processor stays in VMX root operation, where INIT is blocked, so keep it short.
+        void suspend() noexcept;
+
+        // Refreshes the guest-state fields only and launches again, must run on the processor of this virtual cpu.
+        void resume() noexcept;
+
         [[nodiscard]]
         microsoft_hv::vmx_enlightened_vmcs_t* get_enlightened_vmcs() noexcept;
 
         [[nodiscard]]
         const microsoft_hv::vmx_enlightened_vmcs_t* get_enlightened_vmcs() const noexcept;
 
+        [[nodiscard]]
+        mshv_evmcs_accessor& get_evmcs_accessor() noexcept;
+
+        [[nodiscard]]
+        const mshv_evmcs_accessor& get_evmcs_accessor() const noexcept;
+
         [[nodiscard]]
         const void* get_hypercall_page() const noexcept;
 
+        // Walks the guest page tables of the current guest CR3.
+        // Only in VMX root operation on the processor of this virtual cpu, see walk_guest_page_tables for the errors.
+        [[nodiscard]]
+        expected<guest_translation_t, nt_status> translate_guest_address(x86::vaddr64_t gva, guest_walk_e walk) noexcept;
+
+        [[nodiscard]]
+        guest_mapping_window& get_mapping_window() noexcept;
+
+        [[nodiscard]]
+        ept_invalidation_mailbox::statistics_t get_ept_invalidation_statistics() noexcept;
+
+        [[nodiscard]]
+        const halt_poll_policy::statistics_t& get_halt_poll_statistics() const noexcept;
+
+        [[nodiscard]]
+        const pause_loop_policy::statistics_t& get_pause_loop_statistics() const noexcept;
+
+        // Scans the vmexit stack for the deepest slot that no longer holds the canary, may be called while the virtual cpu runs.
+        [[nodiscard]]
+        vmexit_stack_usage_t get_vmexit_stack_usage() const noexcept;
+
         void inject_bp_exception() noexcept;
 
         void inject_ud_exception() noexcept;
@@ -14,9 +14,135 @@
 
 #include "../debugging.hpp"
 
+#include <array>
+
 namespace siren::vmx {
-    void mshv_vmexit_handler::advance_rip(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
-        guest_state->rip += vcpu->get_enlightened_vmcs()->info_vmexit_instruction_length;
+    void mshv_vmexit_handler::advance_rip(mshv_virtual_cpu* vcpu, [[maybe_unused]] guest_state_t* guest_state) noexcept {
+        // guest rip belongs to no clean-field group, so a plain add is the cheapest way to skip the instruction.
+        auto evmcs = vcpu->get_enlightened_vmcs();
+        evmcs->guest_rip += evmcs->info_vmexit_instruction_length;
+    }
+
+    [[nodiscard]]
+    uint64_t mshv_vmexit_handler::read_guest_rsp(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
+        constexpr auto rsp_bit = std::to_underlying(guest_lazy_register_e::RSP);
+        if ((vcpu->m_guest_registers_loaded & rsp_bit) == 0) {
+            guest_state->rsp = vcpu->get_evmcs_accessor().read<x86::VMCSF_GUEST_RSP>().storage;
+            vcpu->m_guest_registers_loaded |= rsp_bit;
+        }
+        return guest_state->rsp;
+    }
+
+    void mshv_vmexit_handler::write_guest_rsp(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, uint64_t value) noexcept {
+        constexpr auto rsp_bit = std::to_underlying(guest_lazy_register_e::RSP);
+        guest_state->rsp = value;
+        vcpu->m_guest_registers_loaded |= rsp_bit;
+        vcpu->m_guest_registers_dirty |= rsp_bit;
+    }
+
+    [[nodiscard]]
+    x86::rflags_t mshv_vmexit_handler::read_guest_rflags(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
+        constexpr auto rflags_bit = std::to_underlying(guest_lazy_register_e::RFLAGS);
+        if ((vcpu->m_guest_registers_loaded & rflags_bit) == 0) {
+            guest_state->rflags.storage = vcpu->get_evmcs_accessor().read<x86::VMCSF_GUEST_RFLAGS>().storage;
+            vcpu->m_guest_registers_loaded |= rflags_bit;
+        }
+        return guest_state->rflags;
+    }
+
+    void mshv_vmexit_handler::write_guest_rflags(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::rflags_t value) noexcept {
+        constexpr auto rflags_bit = std::to_underlying(guest_lazy_register_e::RFLAGS);
+        guest_state->rflags = value;
+        vcpu->m_guest_registers_loaded |= rflags_bit;
+        vcpu->m_guest_registers_dirty |= rflags_bit;
+    }
+
+    [[nodiscard]]
+    uint64_t mshv_vmexit_handler::read_guest_gpr(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, uint32_t index) noexcept {
+        switch (index) {
+            case 0: return guest_state->rax;
+            case 1: return guest_state->rcx;
+            case 2: return guest_state->rdx;
+            case 3: return guest_state->rbx;
+            case 4: return read_guest_rsp(vcpu, guest_state);
+            case 5: return guest_state->rbp;
+            case 6: return guest_state->rsi;
+            case 7: return guest_state->rdi;
+            case 8: return guest_state->r8;
+            case 9: return guest_state->r9;
+            case 10: return guest_state->r10;
+            case 11: return guest_state->r11;
+            case 12: return guest_state->r12;
+            case 13: return guest_state->r13;
+            case 14: return guest_state->r14;
+            case 15: return guest_state->r15;
+            default: std::unreachable();
+        }
+    }
+
+    void mshv_vmexit_handler::write_guest_gpr(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, uint32_t index, uint64_t value) noexcept {
+        switch (index) {
+            case 0: guest_state->rax = value; break;
+            case 1: guest_state->rcx = value; break;
+            case 2: guest_state->rdx = value; break;
+            case 3: guest_state->rbx = value; break;
+            case 4: write_guest_rsp(vcpu, guest_state, value); break;
+            case 5: guest_state->rbp = value; break;
+            case 6: guest_state->rsi = value; break;
+            case 7: guest_state->rdi = value; break;
+            case 8: guest_state->r8 = value; break;
+            case 9: guest_state->r9 = value; break;
+            case 10: guest_state->r10 = value; break;
+            case 11: guest_state->r11 = value; break;
+            case 12: guest_state->r12 = value; break;
+            case 13: guest_state->r13 = value; break;
+            case 14: guest_state->r14 = value; break;
+            case 15: guest_state->r15 = value; break;
+            default: std::unreachable();
+        }
+    }
+
+    void mshv_vmexit_handler::materialize_guest_state(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
+        [[maybe_unused]] auto rsp = read_guest_rsp(vcpu, guest_state);
+        [[maybe_unused]] auto rflags = read_guest_rflags(vcpu, guest_state);
+        guest_state->rip = vcpu->get_evmcs_accessor().read<x86::VMCSF_GUEST_RIP>().storage;
+    }
+
+    void mshv_vmexit_handler::commit_guest_state(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
+        auto& evmcs = vcpu->get_evmcs_accessor();
+
+        if (vcpu->m_guest_registers_dirty & std::to_underlying(guest_lazy_register_e::RSP)) {
+            evmcs.write<x86::VMCSF_GUEST_RSP>({ .storage = guest_state->rsp });
+        }
+
+        if (vcpu->m_guest_registers_dirty & std::to_underlying(guest_lazy_register_e::RFLAGS)) {
+            evmcs.write<x86::VMCSF_GUEST_RFLAGS>({ .storage = guest_state->rflags.storage });
+        }
+
+        vcpu->m_guest_registers_loaded = 0;
+        vcpu->m_guest_registers_dirty = 0;
+    }
+
+    [[nodiscard]]
+    uint32_t mshv_vmexit_handler::lowest_deliverable_vector() noexcept {
+        // Only a vector whose priority class is above PPR[7:4] is delivered. Vectors 0-31 are reserved.
+        auto ppr = static_cast<uint32_t>(x86::read_msr(x86::IA32_X2APIC_PPR));
+        return std::max<uint32_t>(32, ((ppr >> 4 & 0xf) + 1) * 16);
+    }
+
+    [[nodiscard]]
+    bool mshv_vmexit_handler::has_pending_interrupt(uint32_t lowest_vector) noexcept {
+        // Each read traps to L0. The words are read from the top, where the clock and IPI vectors are, and the first hit ends the scan.
+        for (uint32_t word = 8; word-- > lowest_vector / 32; ) {
+            auto irr = static_cast<uint32_t>(x86::read_msr(x86::IA32_X2APIC_IRR0 + word));
+            if (word == lowest_vector / 32) {
+                irr &= ~uint32_t{ 0 } << lowest_vector % 32;
+            }
+            if (irr != 0) {
+                return true;
+            }
+        }
+        return false;
     }
 
     [[nodiscard]]
@@ -26,8 +152,7 @@ namespace siren::vmx {
         return true;
     }
 
-    [[nodiscard]]
-    bool mshv_vmexit_handler::siren_hypercall_turn_off_vm(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept  {
+    void mshv_vmexit_handler::leave_guest(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
         x86::cr3_t guest_cr3{ .storage = vcpu->get_enlightened_vmcs()->guest_cr3 };
 
         x86::gdtr_t guest_gdtr{
@@ -61,6 +186,19 @@ namespace siren::vmx {
 
         advance_rip(vcpu, guest_state);
 
+        // entry_point restores rsp, rip and rflags from guest_state when we stop virtualization
+        materialize_guest_state(vcpu, guest_state);
+
+        // guest_state is handed back as is, so nothing is left to commit. After resume() the lazy registers must come from the
+        // enlightened vmcs again, not from the guest_state of this exit.
+        vcpu->m_guest_registers_loaded = 0;
+        vcpu->m_guest_registers_dirty = 0;
+    }
+
+    [[nodiscard]]
+    bool mshv_vmexit_handler::siren_hypercall_turn_off_vm(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept  {
+        leave_guest(vcpu, guest_state);
+
         x86::vmx_off();
 
         auto host_cr4 = x86::read_cr4();
@@ -70,6 +208,14 @@ namespace siren::vmx {
         return false;
     }
 
+    [[nodiscard]]
+    bool mshv_vmexit_handler::siren_hypercall_suspend_vm(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
+        // Unlike turn_off_vm, stay in VMX root operation with the enlightened vmcs still current,
+        // so that mshv_virtual_cpu::resume() gets away with VMCLEAR and VMLAUNCH.
+        leave_guest(vcpu, guest_state);
+        return false;
+    }
+
     //[[nodiscard]]
     //bool mshv_vmexit_handler::siren_hypercall_ept_commit_1gb_page(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
     //    x86::guest_paddr_t guest_page_base{ guest_state->rcx };
@@ -148,17 +294,12 @@ namespace siren::vmx {
     //    return true;
     //}
 
-    //[[nodiscard]]
-    //bool mshv_vmexit_handler::siren_hypercall_ept_flush(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
-    //    auto pml4_physical_address = static_cast<mshv_hypervisor_t&>(vcpu->get_hypervisor()).get_ept_manager().get_pml4_physical_address();
-
-    //    if (microsoft_hv::hypercalls::flush_guest_physical_address_space(pml4_physical_address).semantics.result != microsoft_hv::hypercalls::status_code_e::HV_STATUS_SUCCESS) {
-    //        vcpu->inject_gp_exception();
-    //    }
-
-    //    advance_rip(vcpu, guest_state);
-    //    return true;
-    //}
+    [[nodiscard]]
+    bool mshv_vmexit_handler::siren_hypercall_ept_flush(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
+        // nothing left to do, dispatch() has already retired the EPT invalidations pending for this virtual cpu
+        advance_rip(vcpu, guest_state);
+        return true;
+    }
 
     [[nodiscard]]
     bool mshv_vmexit_handler::siren_hypercall_not_implemented(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
@@ -171,27 +312,41 @@ namespace siren::vmx {
     bool mshv_vmexit_handler::dispatch(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
         using namespace siren::x86;
 
-        guest_state->rsp = vcpu->get_enlightened_vmcs()->guest_rsp;
-        guest_state->rip = vcpu->get_enlightened_vmcs()->guest_rip;
-        guest_state->rflags = rflags_t{ .storage = vcpu->get_enlightened_vmcs()->guest_rflags };
+        auto& evmcs = vcpu->get_evmcs_accessor();
+        evmcs.begin_exit();
+
+        vcpu->process_ept_invalidations();
+
+        auto* record = vcpu->m_hv->get_exit_recorder().begin_record();
+        if (record) {
+            record_exit_input(vcpu, guest_state, *record);
+        }
+
+        // the msr bitmap is shared by all virtual cpus, but every enlightened vmcs caches it on its own
+        if (auto generation = vcpu->m_hv->get_msr_interceptor().get_bitmap_generation(); vcpu->m_msr_bitmap_generation != generation) {
+            evmcs.invalidate(mshv_clean_field_e::MSR_BITMAP);
+            vcpu->m_msr_bitmap_generation = generation;
+        }
 
         bool resume;
-        vmcsf_t<VMCSF_INFO_EXIT_REASON> info_exit_reason{ .storage = vcpu->get_enlightened_vmcs()->info_exit_reason };
+        auto info_exit_reason = evmcs.read<VMCSF_INFO_EXIT_REASON>();
         
         if (info_exit_reason.semantics.vm_entry_failure == 0) {
             switch (info_exit_reason.semantics.basic_exit_reason) {
                 case x86::vmx_exit_reason_e::CR_ACCESS:
-                    return on_cr_access(vcpu, guest_state);
+                    resume = on_cr_access(vcpu, guest_state); break;
                 case x86::vmx_exit_reason_e::INSTRUCTION_VMCALL:
                     resume = on_instruction_vmcall(vcpu, guest_state); break;
                 case x86::vmx_exit_reason_e::INSTRUCTION_CPUID:
                     resume = on_instruction_cpuid(vcpu, guest_state); break;
                 case x86::vmx_exit_reason_e::INSTRUCTION_HLT:
                     resume = on_instruction_hlt(vcpu, guest_state); break;
-                //case x86::vmx_exit_reason_e::INSTRUCTION_INVLPG:
-                //    return handle_invlpg(vcpu, guest_state);
+                case x86::vmx_exit_reason_e::INSTRUCTION_INVLPG:
+                    resume = on_instruction_invlpg(vcpu, guest_state); break;
                 //case x86::vmx_exit_reason_e::INSTRUCTION_WBINVD_OR_WBNOINVD:
                 //    return handle_wbinvd(vcpu, guest_state);
+                case x86::vmx_exit_reason_e::INSTRUCTION_PAUSE:
+                    resume = on_instruction_pause(vcpu, guest_state); break;
                 case x86::vmx_exit_reason_e::INSTRUCTION_RDMSR:
                     resume = on_instruction_rdmsr(vcpu, guest_state); break;
                 case x86::vmx_exit_reason_e::INSTRUCTION_WRMSR:
@@ -209,79 +364,258 @@ namespace siren::vmx {
         }
 
         if (resume) {
-            if (vcpu->get_enlightened_vmcs()->guest_rsp != guest_state->rsp) {
-                vcpu->get_enlightened_vmcs()->guest_rsp = guest_state->rsp;
-                vcpu->get_enlightened_vmcs()->mshv_clean_fields.semantics.guest_basic = 0;
-            }
+            commit_guest_state(vcpu, guest_state);
+        }
 
-            vcpu->get_enlightened_vmcs()->guest_rip = guest_state->rip;
+        if (record) {
+            record_exit_output(vcpu, guest_state, resume, *record);
+            vcpu->m_hv->get_exit_recorder().end_record(record);
+        }
 
-            if (vcpu->get_enlightened_vmcs()->guest_rflags != guest_state->rflags.storage) {
-                vcpu->get_enlightened_vmcs()->guest_rflags = guest_state->rflags.storage;
-                vcpu->get_enlightened_vmcs()->mshv_clean_fields.semantics.guest_basic = 0;
-            }
+        if (resume) {
+            evmcs.end_exit();
         }
 
         return resume;
     }
 
+    void mshv_vmexit_handler::record_exit_input(mshv_virtual_cpu* vcpu, const guest_state_t* guest_state, exit_record_t& record) noexcept {
+        const auto* vmcs = vcpu->get_enlightened_vmcs();
+
+        record.tsc = __rdtsc();
+        record.handler_ticks = 0;
+        record.vcpu_index = vcpu->m_index;
+        record.flags = 0;
+
+        record.vmcs_in.exit_reason = vmcs->info_exit_reason;
+        record.vmcs_in.vmexit_instruction_length = vmcs->info_vmexit_instruction_length;
+        record.vmcs_in.vmexit_instruction_info = vmcs->info_vmexit_instruction_info;
+        record.vmcs_in.vmexit_interruption_info = vmcs->info_vmexit_interruption_info;
+        record.vmcs_in.vmexit_exception_error_code = vmcs->info_vmexit_exception_error_code;
+        record.vmcs_in.idt_vectoring_info = vmcs->info_idt_vectoring_info;
+        record.vmcs_in.idt_vectoring_error_code = vmcs->info_idt_vectoring_error_code;
+        record.vmcs_in.reserved = 0;
+        record.vmcs_in.exit_qualification = vmcs->info_exit_qualification;
+        record.vmcs_in.guest_linear_address = vmcs->info_guest_linear_address;
+        record.vmcs_in.guest_physical_address = vmcs->info_guest_physical_address;
+        record.vmcs_in.guest_rip = vmcs->guest_rip;
+        record.vmcs_in.guest_rsp = vmcs->guest_rsp;
+        record.vmcs_in.guest_rflags = vmcs->guest_rflags;
+        record.vmcs_in.guest_cr0 = vmcs->guest_cr0;
+        record.vmcs_in.guest_cr3 = vmcs->guest_cr3;
+        record.vmcs_in.guest_cr4 = vmcs->guest_cr4;
+        record.vmcs_in.cr0_read_shadow = vmcs->ctrl_cr0_read_shadow;
+        record.vmcs_in.cr4_read_shadow = vmcs->ctrl_cr4_read_shadow;
+
+        record.guest_state_in = *guest_state;
+    }
+
+    void mshv_vmexit_handler::record_exit_output(mshv_virtual_cpu* vcpu, const guest_state_t* guest_state, bool resume, exit_record_t& record) noexcept {
+        const auto* vmcs = vcpu->get_enlightened_vmcs();
+
+        record.handler_ticks = __rdtsc() - record.tsc;
+        record.flags = resume ? exit_record_t::flag_resumed_v : 0;
+
+        record.vmcs_out.vmentry_interruption_info = vmcs->ctrl_vmentry_interruption_info;
+        record.vmcs_out.vmentry_exception_error_code = vmcs->ctrl_vmentry_exception_error_code;
+        record.vmcs_out.guest_rip = vmcs->guest_rip;
+        record.vmcs_out.guest_rsp = vmcs->guest_rsp;
+        record.vmcs_out.guest_rflags = vmcs->guest_rflags;
+        record.vmcs_out.guest_cr0 = vmcs->guest_cr0;
+        record.vmcs_out.guest_cr3 = vmcs->guest_cr3;
+        record.vmcs_out.guest_cr4 = vmcs->guest_cr4;
+        record.vmcs_out.cr0_read_shadow = vmcs->ctrl_cr0_read_shadow;
+        record.vmcs_out.cr4_read_shadow = vmcs->ctrl_cr4_read_shadow;
+
+        record.guest_state_out = *guest_state;
+    }
+
+    void mshv_vmexit_handler::flush_current_processor_tlb(mshv_virtual_cpu* vcpu, microsoft_hv::address_space_id_t address_space, microsoft_hv::flush_flags_t flags) noexcept {
+        microsoft_hv::vp_set_t processor_set{};
+        processor_set.add(vcpu->m_vp_index);
+
+        auto result_value = microsoft_hv::hypercalls::flush_virtual_address_space_ex(address_space, flags, processor_set);
+        if (result_value.semantics.result != microsoft_hv::hypercalls::status_code_e::HV_STATUS_SUCCESS) {
+            vcpu->inject_gp_exception();
+        }
+    }
+
     [[nodiscard]]
     bool mshv_vmexit_handler::on_cr_access(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
         using namespace siren::x86;
 
-        vmcsf_t<VMCSF_INFO_EXIT_QUALIFICATION> info_exit_qualification
-            { .storage = vcpu->get_enlightened_vmcs()->info_exit_qualification };
-
-        if (info_exit_qualification.semantics.cr_access.cr_number == 4 && info_exit_qualification.semantics.cr_access.access_type == 0) { // MOV to CR4
-            cr4_t old_cr4;
-            cr4_t new_cr4;
-
-            old_cr4.storage = vcpu->get_enlightened_vmcs()->guest_cr4;
-
-            switch (info_exit_qualification.semantics.cr_access.related_gpr) {
-                case 0: new_cr4.storage = guest_state->rax; break;
-                case 1: new_cr4.storage = guest_state->rcx; break;
-                case 2: new_cr4.storage = guest_state->rdx; break;
-                case 3: new_cr4.storage = guest_state->rbx; break;
-                case 4: new_cr4.storage = guest_state->rsp; break;
-                case 5: new_cr4.storage = guest_state->rbp; break;
-                case 6: new_cr4.storage = guest_state->rsi; break;
-                case 7: new_cr4.storage = guest_state->rdi; break;
-                case 8: new_cr4.storage = guest_state->r8; break;
-                case 9: new_cr4.storage = guest_state->r9; break;
-                case 10: new_cr4.storage = guest_state->r10; break;
-                case 11: new_cr4.storage = guest_state->r11; break;
-                case 12: new_cr4.storage = guest_state->r12; break;
-                case 13: new_cr4.storage = guest_state->r13; break;
-                case 14: new_cr4.storage = guest_state->r14; break;
-                case 15: new_cr4.storage = guest_state->r15; break;
-                default: std::unreachable();
+        using handler_t = bool(*)(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, vmcsf_t<VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept;
+
+        // indexed by [access type][control register number]
+        // Only the MOV to CR4 entry is reachable today. evmcs_setup_controls_execution leaves the CR0 guest/host mask 0 and
+        // setup_vmcs_controls clears cr3_load_exiting and cr3_store_exiting, the other entries are for replayed traces and later controls.
+        static constexpr auto handlers = []() {
+            std::array<std::array<handler_t, 16>, 4> table{};
+            for (auto& row : table) {
+                row.fill(&on_cr_access_unexpected);
             }
+            table[0][0] = &on_mov_to_cr0;
+            table[0][3] = &on_mov_to_cr3;
+            table[0][4] = &on_mov_to_cr4;
+            table[1][3] = &on_mov_from_cr3;
+            table[2][0] = &on_clts;
+            table[3][0] = &on_lmsw;
+            return table;
+        }();
+
+        auto info_exit_qualification = vcpu->get_evmcs_accessor().read<VMCSF_INFO_EXIT_QUALIFICATION>();
+        return handlers[info_exit_qualification.semantics.cr_access.access_type][info_exit_qualification.semantics.cr_access.cr_number](vcpu, guest_state, info_exit_qualification);
+    }
 
-            // A MOV to CR4 instruction that modifies the CR4.PGE (global page enable) bit, the CR4.PSE (page
-            // size extensions) bit, or CR4.PAE (page address extensions) bit invalidates all translations (global
-            // and non-global) within the processors TLB.
+    [[nodiscard]]
+    bool mshv_vmexit_handler::on_cr_access_unexpected(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, [[maybe_unused]] x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept {
+        invoke_debugger();  // todo
+        advance_rip(vcpu, guest_state);
+        return true;
+    }
 
-            if (auto cpu_index = vcpu->get_index(); cpu_index < 64) {
-                auto result_value = microsoft_hv::hypercalls::flush_virtual_address_space(0, microsoft_hv::flush_flags_t{ .semantics = { .all_virtual_address_spaces = 1 } }, uint64_t{ 1 } << cpu_index);
-                if (result_value.semantics.result != microsoft_hv::hypercalls::status_code_e::HV_STATUS_SUCCESS) {
-                    vcpu->inject_gp_exception();
-                }
-            } else {
-                invoke_debugger();  // todo
-            }
+    [[nodiscard]]
+    bool mshv_vmexit_handler::on_mov_to_cr0(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept {
+        using namespace siren::x86;
 
-            vcpu->get_enlightened_vmcs()->guest_cr4 = new_cr4.storage;
-            vcpu->get_enlightened_vmcs()->ctrl_cr4_read_shadow = new_cr4.storage;
-            vcpu->get_enlightened_vmcs()->mshv_clean_fields.semantics.crdr = 0;
-        } else {
-            invoke_debugger();  // todo
+        // Never enabled: the CR0 guest/host mask is 0, so the guest owns every CR0 bit and MOV to CR0 does not exit.
+        auto& evmcs = vcpu->get_evmcs_accessor();
+
+        cr0_t old_cr0{ .storage = evmcs.read<VMCSF_GUEST_CR0>().storage };
+        cr0_t new_cr0{ .storage = read_guest_gpr(vcpu, guest_state, exit_qualification.semantics.cr_access.related_gpr) };
+
+        cr0_t guest_cr0 = new_cr0;
+        guest_cr0.storage |= vcpu->m_ia32_vmx_cr0_fixed0.semantics.mask_value;
+        guest_cr0.storage &= vcpu->m_ia32_vmx_cr0_fixed1.semantics.mask_value;
+
+        evmcs.write<VMCSF_GUEST_CR0>({ .storage = guest_cr0.storage });
+        evmcs.write<VMCSF_CTRL_CR0_READ_SHADOW>({ .storage = new_cr0.storage });
+
+        // The instruction invalidates all TLB entries (including global entries) and all entries in all paging-structure
+        // caches (for all PCIDs) if it changes the value of CR0.PG from 1 to 0.
+        if (old_cr0.semantics.paging == 1 && new_cr0.semantics.paging == 0) {
+            flush_current_processor_tlb(vcpu, 0, { .semantics = { .all_virtual_address_spaces = 1 } });
+        }
+
+        advance_rip(vcpu, guest_state);
+        return true;
+    }
+
+    [[nodiscard]]
+    bool mshv_vmexit_handler::on_mov_to_cr3(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept {
+        using namespace siren::x86;
+
+        constexpr uint64_t no_invalidation_bit = uint64_t{ 1 } << 63u;
+
+        // Never enabled: setup_vmcs_controls clears cr3_load_exiting and sets no CR3-target values.
+        auto& evmcs = vcpu->get_evmcs_accessor();
+
+        cr4_t guest_cr4{ .storage = evmcs.read<VMCSF_GUEST_CR4>().storage };
+        auto source = read_guest_gpr(vcpu, guest_state, exit_qualification.semantics.cr_access.related_gpr);
+        auto new_cr3 = source & ~no_invalidation_bit;
+
+        evmcs.write<VMCSF_GUEST_CR3>({ .storage = new_cr3 });
+
+        // If CR4.PCIDE = 1 and bit 63 of the instruction's source operand is 1, the instruction is not required to invalidate any TLB entries.
+        // Otherwise it invalidates non-global entries of the new PCID.
+        if (guest_cr4.semantics.pcid_enable == 0 || (source & no_invalidation_bit) == 0) {
+            flush_current_processor_tlb(vcpu, new_cr3, { .semantics = { .non_global_mappings_only = 1 } });
+        }
+
+        advance_rip(vcpu, guest_state);
+        return true;
+    }
+
+    [[nodiscard]]
+    bool mshv_vmexit_handler::on_mov_to_cr4(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept {
+        using namespace siren::x86;
+
+        auto& evmcs = vcpu->get_evmcs_accessor();
+
+        cr4_t old_cr4{ .storage = evmcs.read<VMCSF_GUEST_CR4>().storage };
+        cr4_t new_cr4{ .storage = read_guest_gpr(vcpu, guest_state, exit_qualification.semantics.cr_access.related_gpr) };
+
+        cr4_t guest_cr4 = new_cr4;
+        guest_cr4.storage |= vcpu->m_ia32_vmx_cr4_fixed0.semantics.mask_value;
+        guest_cr4.storage &= vcpu->m_ia32_vmx_cr4_fixed1.semantics.mask_value;
+
+        evmcs.write<VMCSF_GUEST_CR4>({ .storage = guest_cr4.storage });
+        evmcs.write<VMCSF_CTRL_CR4_READ_SHADOW>({ .storage = new_cr4.storage });
+
+        // The instruction invalidates all TLB entries (including global entries) and all entries in all paging-structure
+        // caches (for all PCIDs) if (1) it changes the value of CR4.PGE; or (2) it changes the value of the CR4.PCIDE from 1 to 0.
+        // The instruction invalidates all TLB entries and all entries in all paging-structure caches for the current PCID
+        // if (1) it changes the value of CR4.PAE or CR4.PSE; or (2) it changes CR4.SMEP from 0 to 1.
+        // Anything else needs no flush at all, e.g. Windows toggling CR4 bits unrelated to paging.
+        // Only PSE, PAE and PGE are in the CR4 guest/host mask, so a PCIDE or SMEP change arrives here only together with one of them.
+        if (old_cr4.semantics.page_global_enable != new_cr4.semantics.page_global_enable ||
+            (old_cr4.semantics.pcid_enable == 1 && new_cr4.semantics.pcid_enable == 0)) {
+            flush_current_processor_tlb(vcpu, 0, { .semantics = { .all_virtual_address_spaces = 1 } });
+        } else if (old_cr4.semantics.physical_address_extension != new_cr4.semantics.physical_address_extension ||
+            old_cr4.semantics.page_size_extension != new_cr4.semantics.page_size_extension ||
+            (old_cr4.semantics.supervisor_mode_execution_prevention == 0 && new_cr4.semantics.supervisor_mode_execution_prevention == 1)) {
+            flush_current_processor_tlb(vcpu, evmcs.read<VMCSF_GUEST_CR3>().storage, {});
         }
 
         advance_rip(vcpu, guest_state);
         return true;
     }
 
+    [[nodiscard]]
+    bool mshv_vmexit_handler::on_mov_from_cr3(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept {
+        write_guest_gpr(vcpu, guest_state, exit_qualification.semantics.cr_access.related_gpr, vcpu->get_evmcs_accessor().read<x86::VMCSF_GUEST_CR3>().storage);
+        advance_rip(vcpu, guest_state);
+        return true;
+    }
+
+    [[nodiscard]]
+    bool mshv_vmexit_handler::on_clts(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, [[maybe_unused]] x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept {
+        using namespace siren::x86;
+
+        // Never enabled: CLTS only exits when the host owns CR0.TS, and the CR0 guest/host mask is 0.
+        auto& evmcs = vcpu->get_evmcs_accessor();
+
+        cr0_t guest_cr0{ .storage = evmcs.read<VMCSF_GUEST_CR0>().storage };
+        cr0_t cr0_read_shadow{ .storage = evmcs.read<VMCSF_CTRL_CR0_READ_SHADOW>().storage };
+
+        guest_cr0.semantics.task_switched = 0;
+        cr0_read_shadow.semantics.task_switched = 0;
+
+        evmcs.write<VMCSF_GUEST_CR0>({ .storage = guest_cr0.storage });
+        evmcs.write<VMCSF_CTRL_CR0_READ_SHADOW>({ .storage = cr0_read_shadow.storage });
+
+        advance_rip(vcpu, guest_state);
+        return true;
+    }
+
+    [[nodiscard]]
+    bool mshv_vmexit_handler::on_lmsw(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept {
+        using namespace siren::x86;
+
+        // LMSW loads CR0.PE, CR0.MP, CR0.EM and CR0.TS, and can set CR0.PE but never clear it.
+        // Never enabled: it only exits for those bits the host owns, and the CR0 guest/host mask is 0.
+        constexpr uint64_t lmsw_mask = 0xf;
+
+        auto& evmcs = vcpu->get_evmcs_accessor();
+
+        uint64_t source = exit_qualification.semantics.cr_access.lmsw_source_data;
+
+        cr0_t guest_cr0{ .storage = evmcs.read<VMCSF_GUEST_CR0>().storage };
+        cr0_t cr0_read_shadow{ .storage = evmcs.read<VMCSF_CTRL_CR0_READ_SHADOW>().storage };
+
+        guest_cr0.storage = (guest_cr0.storage & ~lmsw_mask) | (source & lmsw_mask) | (guest_cr0.storage & 1);
+        cr0_read_shadow.storage = (cr0_read_shadow.storage & ~lmsw_mask) | (source & lmsw_mask) | (cr0_read_shadow.storage & 1);
+
+        guest_cr0.storage |= vcpu->m_ia32_vmx_cr0_fixed0.semantics.mask_value;
+        guest_cr0.storage &= vcpu->m_ia32_vmx_cr0_fixed1.semantics.mask_value;
+
+        evmcs.write<VMCSF_GUEST_CR0>({ .storage = guest_cr0.storage });
+        evmcs.write<VMCSF_CTRL_CR0_READ_SHADOW>({ .storage = cr0_read_shadow.storage });
+
+        advance_rip(vcpu, guest_state);
+        return true;
+    }
+
     [[nodiscard]]
     bool mshv_vmexit_handler::on_instruction_cpuid(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
         auto eax = static_cast<uint32_t>(guest_state->rax);
@@ -304,17 +638,36 @@ namespace siren::vmx {
         return true;
     }
 
+    [[nodiscard]]
+    bool mshv_vmexit_handler::on_instruction_pause(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
+        auto& policy = vcpu->m_pause_loop_policy;
+
+        if (policy.on_pause(__rdtsc())) {
+            // Let L0 run another virtual processor, hopefully the lock holder. Failure only means we keep spinning.
+            [[maybe_unused]]
+            auto _ = microsoft_hv::hypercalls::notify_long_spin_wait(policy.get_loop_pause_count());
+        }
+
+        advance_rip(vcpu, guest_state);
+        return true;
+    }
+
     [[nodiscard]]
     bool mshv_vmexit_handler::on_instruction_rdmsr(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
-        uint32_t msr_address = static_cast<uint32_t>(guest_state->rcx);
+        auto msr_address = static_cast<uint32_t>(guest_state->rcx);
         uint64_t msr_value = 0;
 
-        if (msr_bitmap::low_msr_address_interval_v.contains(msr_address)) {
-            invoke_debugger();  // should not happen, since we cleared msr bitmap
-        } else if (msr_bitmap::high_msr_address_interval_v.contains(msr_address)) {
-            invoke_debugger();  // should not happen, since we cleared msr bitmap
-        } else {
-            msr_value = x86::read_msr(msr_address);
+        switch (vcpu->m_hv->get_msr_interceptor().on_read(vcpu, vcpu->m_msr_shadows, msr_address, msr_value)) {
+            case msr_interceptor::result_e::NOT_INTERCEPTED:
+                msr_value = x86::read_msr(msr_address);
+                break;
+            case msr_interceptor::result_e::HANDLED:
+                break;
+            case msr_interceptor::result_e::FAULT:
+                vcpu->inject_gp_exception();
+                return true;
+            default:
+                std::unreachable();
         }
 
         guest_state->rax = static_cast<uint32_t>(msr_value);
@@ -329,12 +682,17 @@ namespace siren::vmx {
         auto msr_address = static_cast<uint32_t>(guest_state->rcx);
         auto msr_value = (guest_state->rdx << 32u) | (guest_state->rax & 0xffffffffu);
 
-        if (msr_bitmap::low_msr_address_interval_v.contains(msr_address)) {
-            invoke_debugger();  // should not happen, since we cleared msr bitmap
-        } else if (msr_bitmap::high_msr_address_interval_v.contains(msr_address)) {
-            invoke_debugger();  // should not happen, since we cleared msr bitmap
-        } else {
-            x86::write_msr(msr_address, msr_value);
+        switch (vcpu->m_hv->get_msr_interceptor().on_write(vcpu, vcpu->m_msr_shadows, msr_address, msr_value)) {
+            case msr_interceptor::result_e::NOT_INTERCEPTED:
+                x86::write_msr(msr_address, msr_value);
+                break;
+            case msr_interceptor::result_e::HANDLED:
+                break;
+            case msr_interceptor::result_e::FAULT:
+                vcpu->inject_gp_exception();
+                return true;
+            default:
+                std::unreachable();
         }
 
         advance_rip(vcpu, guest_state);
@@ -367,8 +725,10 @@ namespace siren::vmx {
                     //    return siren_hypercall_ept_uncommit_2mb_page(vcpu, guest_state);
                     //case 7:
                     //    return siren_hypercall_ept_uncommit_4kb_page(vcpu, guest_state);
-                    //case 8:
-                    //    return siren_hypercall_ept_flush(vcpu, guest_state);
+                    case 8:
+                        return siren_hypercall_ept_flush(vcpu, guest_state);
+                    case 9:
+                        return siren_hypercall_suspend_vm(vcpu, guest_state);
                     default:
                         return siren_hypercall_not_implemented(vcpu, guest_state);
                 }
@@ -376,41 +736,28 @@ namespace siren::vmx {
                 auto input_value = microsoft_hv::hypercalls::input_value_t{ .storage = guest_state->rcx };
                 auto result_value = microsoft_hv::hypercalls::result_value_t{};
 
-                if (input_value.semantics.fast) {
-                    struct {
-                        uint64_t rdx;
-                        uint64_t r8;
-                        x86::xmm_t xmm0;
-                        x86::xmm_t xmm1;
-                        x86::xmm_t xmm2;
-                        x86::xmm_t xmm3;
-                        x86::xmm_t xmm4;
-                        x86::xmm_t xmm5;
-                    } input_output_block;
-
-                    input_output_block.rdx = guest_state->rdx;
-                    input_output_block.r8 = guest_state->r8;
-                    input_output_block.xmm0 = guest_state->xmm0;
-                    input_output_block.xmm1 = guest_state->xmm1;
-                    input_output_block.xmm2 = guest_state->xmm2;
-                    input_output_block.xmm3 = guest_state->xmm3;
-                    input_output_block.xmm4 = guest_state->xmm4;
-                    input_output_block.xmm5 = guest_state->xmm5;
-
-                    guest_state->rax = microsoft_fast_hypercall_ex(vcpu->get_hypercall_page(), input_value, &input_output_block).storage;
-
-                    guest_state->rdx = input_output_block.rdx;
-                    guest_state->r8 = input_output_block.r8;
-                    guest_state->xmm0 = input_output_block.xmm0;
-                    guest_state->xmm1 = input_output_block.xmm1;
-                    guest_state->xmm2 = input_output_block.xmm2;
-                    guest_state->xmm3 = input_output_block.xmm3;
-                    guest_state->xmm4 = input_output_block.xmm4;
-                    guest_state->xmm5 = input_output_block.xmm5;
-                } else {
-                    guest_state->rax = microsoft_hypercall(vcpu->get_hypercall_page(), input_value, guest_state->rdx, guest_state->r8).storage;
+                for (;;) {
+                    if (input_value.semantics.fast) {
+                        result_value = microsoft_fast_hypercall_ex(vcpu->get_hypercall_page(), input_value, guest_state);
+                    } else {
+                        result_value = microsoft_hypercall(vcpu->get_hypercall_page(), input_value, guest_state->rdx, guest_state->r8);
+                    }
+
+                    // A rep hypercall may return before all reps are done, e.g. to let pending interrupts be delivered.
+                    // Continue it here rather than bouncing the continuation through the guest.
+                    // A continuation that made no progress is handed back to the guest as is, otherwise we could spin here forever.
+                    if (input_value.semantics.rep_count != 0 &&
+                        result_value.semantics.result == microsoft_hv::hypercalls::status_code_e::HV_STATUS_SUCCESS &&
+                        result_value.semantics.reps_completed < input_value.semantics.rep_count &&
+                        result_value.semantics.reps_completed > input_value.semantics.rep_start_index) {
+                        input_value.semantics.rep_start_index = result_value.semantics.reps_completed;
+                    } else {
+                        break;
+                    }
                 }
 
+                guest_state->rax = result_value.storage;
+
                 advance_rip(vcpu, guest_state);
                 return true;
             }
@@ -422,11 +769,68 @@ namespace siren::vmx {
 
     [[nodiscard]]
     bool mshv_vmexit_handler::on_instruction_hlt(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
-        // A partition which possesses the AccessGuestIdleMsr privilege (refer to section 4.2.2) may trigger entry
-        // into the virtual processor idle sleep state through a read to the hypervisor-defined MSR HV_X64_MSR_GUEST_IDLE.
-        // The virtual processor will be woken when an interrupt arrives, regardless of whether the interrupt is enabled on the virtual processor or not.
-        [[maybe_unused]]
-        auto _ = x86::read_msr<microsoft_hv::HV_X64_MSR_GUEST_IDLE>();
+        auto& policy = vcpu->m_halt_poll_policy;
+
+        auto hlt_tsc = __rdtsc();
+        auto window = policy.get_window();
+
+        // Only an interrupt can end the HLT, so there is nothing to poll for if the guest cannot take one.
+        // The pending interrupt check relies on x2APIC MSRs, xAPIC mode is never polled.
+        bool pollable =
+            policy.get_parameters().max_window != 0 &&
+            read_guest_rflags(vcpu, guest_state).semantics.interrupt_enable_flag != 0 &&
+            x86::read_msr<x86::IA32_APIC_BASE>().semantics.enable_x2apic_mode != 0;
+
+        // The guest cannot change its PPR while halted, so it is read once per HLT and limits the IRR words each scan reads.
+        uint32_t lowest_vector = pollable ? lowest_deliverable_vector() : 0;
+        pollable = pollable && lowest_vector < 256;
+
+        bool woke_in_poll = false;
+        uint64_t polled_ticks = 0;
+
+        // A pollable HLT with an empty window still feeds the policy, which is how the window opens in the first place.
+        if (pollable && window != 0) {
+            for (auto now = hlt_tsc; now - hlt_tsc < window; now = __rdtsc()) {
+                if (has_pending_interrupt(lowest_vector)) {
+                    woke_in_poll = true;
+                    break;
+                }
+
+                // Pause as long as the scan took, which keeps at most half of the window trapping to L0.
+                auto scan_ticks = __rdtsc() - now;
+                do {
+                    _mm_pause();
+                } while (__rdtsc() - now < 2 * scan_ticks);
+            }
+            polled_ticks = std::min<uint64_t>(__rdtsc() - hlt_tsc, window);
+        }
+
+        if (!woke_in_poll) {
+            // A partition which possesses the AccessGuestIdleMsr privilege (refer to section 4.2.2) may trigger entry
+            // into the virtual processor idle sleep state through a read to the hypervisor-defined MSR HV_X64_MSR_GUEST_IDLE.
+            // The virtual processor will be woken when an interrupt arrives, regardless of whether the interrupt is enabled on the virtual processor or not.
+            [[maybe_unused]]
+            auto _ = x86::read_msr<microsoft_hv::HV_X64_MSR_GUEST_IDLE>();
+        }
+
+        if (pollable) {
+            policy.update(polled_ticks, woke_in_poll, __rdtsc() - hlt_tsc);
+        }
+
+        advance_rip(vcpu, guest_state);
+        return true;
+    }
+
+    [[nodiscard]]
+    bool mshv_vmexit_handler::on_instruction_invlpg(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept {
+        using namespace siren::x86;
+
+        auto& evmcs = vcpu->get_evmcs_accessor();
+
+        // Never enabled: setup_vmcs_controls clears invlpg_exiting.
+        // INVLPG drops the page in every PCID, global translations included.
+        // There is no flush of a single address of the current processor, the whole address space of the current CR3 goes instead.
+        flush_current_processor_tlb(vcpu, evmcs.read<VMCSF_GUEST_CR3>().storage, {});
 
         advance_rip(vcpu, guest_state);
         return true;
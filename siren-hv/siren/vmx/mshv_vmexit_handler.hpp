@@ -1,5 +1,7 @@
 #pragma once
+#include "exit_record.hpp"
 #include "guest_state.hpp"
+#include "../x86/intel_vmx.hpp"
 #include "../microsoft_hv/tlfs.hypercalls.hpp"
 
 namespace siren::vmx {
@@ -7,16 +9,56 @@ namespace siren::vmx {
     class mshv_virtual_cpu;
 
     class mshv_vmexit_handler {
+        friend class exit_replayer;    // drives dispatch() on the host, see tests/vmx/exit_replayer.hpp
     private:
         static void advance_rip(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
 
+        [[nodiscard]]
+        static uint64_t read_guest_rsp(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
+
+        static void write_guest_rsp(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, uint64_t value) noexcept;
+
+        [[nodiscard]]
+        static x86::rflags_t read_guest_rflags(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
+
+        static void write_guest_rflags(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::rflags_t value) noexcept;
+
+        [[nodiscard]]
+        static uint64_t read_guest_gpr(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, uint32_t index) noexcept;
+
+        static void write_guest_gpr(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, uint32_t index, uint64_t value) noexcept;
+
+        // Loads every lazy register into guest_state, for code paths that leave through guest_state instead of VMRESUME.
+        static void materialize_guest_state(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
+
+        // Writes dirty lazy registers back to the enlightened vmcs.
+        static void commit_guest_state(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
+
         static microsoft_hv::hypercalls::result_value_t microsoft_hypercall(const void* hypercall_page, microsoft_hv::hypercalls::input_value_t input_value, microsoft_hv::gpa_t input_param_address, microsoft_hv::gpa_t output_param_address) noexcept;
 
-        static microsoft_hv::hypercalls::result_value_t microsoft_fast_hypercall_ex(const void* hypercall_page, microsoft_hv::hypercalls::input_value_t input_value, void* input_output_param_block) noexcept;
+        // Fast hypercall input and output registers (rdx, r8, xmm0-xmm5) are loaded from and stored to guest_state in place.
+        static microsoft_hv::hypercalls::result_value_t microsoft_fast_hypercall_ex(const void* hypercall_page, microsoft_hv::hypercalls::input_value_t input_value, void* guest_state) noexcept;
+
+        [[nodiscard]]
+        static uint32_t lowest_deliverable_vector() noexcept;
+
+        [[nodiscard]]
+        static bool has_pending_interrupt(uint32_t lowest_vector) noexcept;
+
+        // Flushes the TLB of the current virtual processor only.
+        static void flush_current_processor_tlb(mshv_virtual_cpu* vcpu, microsoft_hv::address_space_id_t address_space, microsoft_hv::flush_flags_t flags) noexcept;
+
+        // Fill the exit_recorder record around dispatch, straight from the enlightened vmcs so that clean fields stay untouched.
+        static void record_exit_input(mshv_virtual_cpu* vcpu, const guest_state_t* guest_state, exit_record_t& record) noexcept;
+
+        static void record_exit_output(mshv_virtual_cpu* vcpu, const guest_state_t* guest_state, bool resume, exit_record_t& record) noexcept;
 
         [[nodiscard]]
         static bool siren_hypercall_echo(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
 
+        // Hands the processor back to the guest context in VMX root operation, shared by turn_off_vm and suspend_vm.
+        static void leave_guest(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
+
         [[nodiscard]]
         static bool siren_hypercall_turn_off_vm(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
 
@@ -41,6 +83,9 @@ namespace siren::vmx {
         [[nodiscard]]
         static bool siren_hypercall_ept_flush(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
 
+        [[nodiscard]]
+        static bool siren_hypercall_suspend_vm(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
+
         [[nodiscard]]
         static bool siren_hypercall_not_implemented(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
 
@@ -50,6 +95,27 @@ namespace siren::vmx {
         [[nodiscard]]
         static bool on_cr_access(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
 
+        [[nodiscard]]
+        static bool on_cr_access_unexpected(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept;
+
+        [[nodiscard]]
+        static bool on_mov_to_cr0(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept;
+
+        [[nodiscard]]
+        static bool on_mov_to_cr3(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept;
+
+        [[nodiscard]]
+        static bool on_mov_to_cr4(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept;
+
+        [[nodiscard]]
+        static bool on_mov_from_cr3(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept;
+
+        [[nodiscard]]
+        static bool on_clts(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept;
+
+        [[nodiscard]]
+        static bool on_lmsw(mshv_virtual_cpu* vcpu, guest_state_t* guest_state, x86::vmcsf_t<x86::VMCSF_INFO_EXIT_QUALIFICATION> exit_qualification) noexcept;
+
         [[nodiscard]]
         static bool on_instruction_cpuid(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
 
@@ -62,6 +128,9 @@ namespace siren::vmx {
         [[nodiscard]]
         static bool on_instruction_wbinvd(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
 
+        [[nodiscard]]
+        static bool on_instruction_pause(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
+
         [[nodiscard]]
         static bool on_instruction_rdmsr(mshv_virtual_cpu* vcpu, guest_state_t* guest_state) noexcept;
 
@@ -142,27 +142,27 @@ stop_virtualization:
     push rbx
     mov rax, rcx
     mov rcx, rdx
-    mov rbx, r8
+    mov rbx, r8     ; rbx -> guest_state_t
     
-    mov rdx, qword ptr [rbx]
-    mov r8, qword ptr [rbx + 8h]
-    movaps xmm0, xmmword ptr [rbx + 10h]
-    movaps xmm1, xmmword ptr [rbx + 20h]
-    movaps xmm2, xmmword ptr [rbx + 30h]
-    movaps xmm3, xmmword ptr [rbx + 40h]
-    movaps xmm4, xmmword ptr [rbx + 50h]
-    movaps xmm5, xmmword ptr [rbx + 60h]
+    mov rdx, qword ptr [rbx + 10h]
+    mov r8, qword ptr [rbx + 40h]
+    movaps xmm0, xmmword ptr [rbx + 90h]
+    movaps xmm1, xmmword ptr [rbx + 0a0h]
+    movaps xmm2, xmmword ptr [rbx + 0b0h]
+    movaps xmm3, xmmword ptr [rbx + 0c0h]
+    movaps xmm4, xmmword ptr [rbx + 0d0h]
+    movaps xmm5, xmmword ptr [rbx + 0e0h]
 
     call rax
 
-    movaps xmmword ptr [rbx + 60h], xmm5
-    movaps xmmword ptr [rbx + 50h], xmm4
-    movaps xmmword ptr [rbx + 40h], xmm3
-    movaps xmmword ptr [rbx + 30h], xmm2
-    movaps xmmword ptr [rbx + 20h], xmm1
-    movaps xmmword ptr [rbx + 10h], xmm0
-    mov qword ptr [rbx + 8h], r8
-    mov qword ptr [rbx], rdx
+    movaps xmmword ptr [rbx + 0e0h], xmm5
+    movaps xmmword ptr [rbx + 0d0h], xmm4
+    movaps xmmword ptr [rbx + 0c0h], xmm3
+    movaps xmmword ptr [rbx + 0b0h], xmm2
+    movaps xmmword ptr [rbx + 0a0h], xmm1
+    movaps xmmword ptr [rbx + 90h], xmm0
+    mov qword ptr [rbx + 40h], r8
+    mov qword ptr [rbx + 10h], rdx
 
     pop rbx
     ret
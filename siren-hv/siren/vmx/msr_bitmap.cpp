@@ -4,16 +4,42 @@
 namespace siren::vmx {
     expected<void, nt_status> msr_bitmap::initialize() noexcept {
         auto expt_bitmap = allocate_unique<x86::vmx_msr_bitmap_t>(npaged_pool);
-        if (expt_bitmap.has_value()) {
-            m_bitmap = std::move(expt_bitmap.value());
-            return {};
-        } else {
+        if (expt_bitmap.has_error()) {
             return unexpected{ expt_bitmap.error() };
         }
+
+        // a page-sized nonpaged allocation is one page, hence physically contiguous
+        auto expt_status = register_address_region(expt_bitmap.value().get(), sizeof(x86::vmx_msr_bitmap_t));
+        if (expt_status.has_error()) {
+            return unexpected{ expt_status.error() };
+        }
+
+        release();
+        m_bitmap = std::move(expt_bitmap.value());
+        return {};
+    }
+
+    void msr_bitmap::release() noexcept {
+        if (m_bitmap) {
+            unregister_address_region(m_bitmap.get());
+            m_bitmap.reset();
+        }
+    }
+
+    msr_bitmap& msr_bitmap::operator=(msr_bitmap&& other) noexcept {
+        if (this != std::addressof(other)) {
+            release();
+            m_bitmap = std::move(other.m_bitmap);
+        }
+        return *this;
+    }
+
+    msr_bitmap::~msr_bitmap() noexcept {
+        release();
     }
 
     x86::paddr_t msr_bitmap::get_address() const noexcept {
-        return get_physical_address(m_bitmap.get());
+        return translate_virtual_address(m_bitmap.get()).value();
     }
 
     expected<void, nt_status> msr_bitmap::set(uint32_t msr_address, setting_flags flags) noexcept {
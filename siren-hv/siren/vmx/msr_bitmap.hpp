@@ -6,10 +6,17 @@
 
 #include "../x86/intel_vmx.hpp"
 
+namespace siren {
+    template<>
+    inline constexpr allocation_category_e allocation_category_of_v<x86::vmx_msr_bitmap_t> = allocation_category_e::msr_bitmap;
+}
+
 namespace siren::vmx {
     class msr_bitmap {
     private:
-        unique_npaged<x86::vmx_msr_bitmap_t> m_bitmap;
+        unique_npaged<x86::vmx_msr_bitmap_t> m_bitmap;    // registered by register_address_region
+
+        void release() noexcept;
 
     public:
         struct setting_flags {
@@ -19,8 +26,8 @@ namespace siren::vmx {
             uint8_t write : 1;
         };
 
-        static constexpr closed_interval_t low_msr_address_interval_v = { 0x00000000ui32, 0x00001fffui32 };
-        static constexpr closed_interval_t high_msr_address_interval_v = { 0xc0000000ui32, 0xc0001fffui32 };
+        static constexpr closed_interval_t low_msr_address_interval_v = { 0x00000000u, 0x00001fffu };
+        static constexpr closed_interval_t high_msr_address_interval_v = { 0xc0000000u, 0xc0001fffu };
 
         msr_bitmap() noexcept = default;
 
@@ -34,13 +41,14 @@ namespace siren::vmx {
         msr_bitmap& operator=(const msr_bitmap&) = delete;
 
         // move assignment
-        msr_bitmap& operator=(msr_bitmap&&) noexcept = default;
+        msr_bitmap& operator=(msr_bitmap&& other) noexcept;
 
-        ~msr_bitmap() noexcept = default;
+        ~msr_bitmap() noexcept;
 
         [[nodiscard]]
         expected<void, nt_status> initialize() noexcept;
 
+        // Pure arithmetic, safe at any IRQL.
         [[nodiscard]]
         x86::paddr_t get_address() const noexcept;
 
@@ -0,0 +1,224 @@
+#include "msr_interceptor.hpp"
+#include "../multiprocessor.hpp"
+#include <algorithm>
+#include <bit>
+
+#include <wdm.h>
+
+namespace siren::vmx {
+    const msr_interceptor::entry_t* msr_interceptor::lookup(const state_t& state, uint32_t msr_address) noexcept {
+        auto slot = state.table[hash(msr_address, state.seed)];
+        if (slot != empty_slot_v && slot <= max_entry_count_v && state.entries[slot - 1].msr_address == msr_address) {
+            return std::addressof(state.entries[slot - 1]);
+        } else {
+            return nullptr;
+        }
+    }
+
+    msr_interceptor::entry_t* msr_interceptor::lookup(state_t& state, uint32_t msr_address) noexcept {
+        return const_cast<entry_t*>(lookup(std::as_const(state), msr_address));
+    }
+
+    bool msr_interceptor::find(uint32_t msr_address, entry_t& entry) const noexcept {
+        return m_state.read([msr_address, &entry](const state_t& state) noexcept {
+            auto found = lookup(state, msr_address);
+            if (found != nullptr) {
+                entry = *found;
+            }
+            return found != nullptr;
+        });
+    }
+
+    expected<void, nt_status> msr_interceptor::rebuild_table(state_t& state) noexcept {
+        uint8_t table[table_length_v];
+
+        for (uint32_t attempt = 0; attempt < max_seed_attempts_v; ++attempt) {
+            uint32_t seed = 0x9e3779b1u + attempt * 0x632be5aau;   // stays odd, so multiplication by seed is a bijection
+
+            std::fill(std::begin(table), std::end(table), empty_slot_v);
+
+            bool collided = false;
+            for (size_t i = 0; i < state.entry_count; ++i) {
+                auto& slot = table[hash(state.entries[i].msr_address, seed)];
+                if (slot == empty_slot_v) {
+                    slot = static_cast<uint8_t>(i + 1);
+                } else {
+                    collided = true;
+                    break;
+                }
+            }
+
+            if (!collided) {
+                std::copy(std::begin(table), std::end(table), std::begin(state.table));
+                state.seed = seed;
+                return {};
+            }
+        }
+
+        return unexpected{ nt_status_insufficient_resources_v };
+    }
+
+    expected<void, nt_status> msr_interceptor::insert(state_t& state, const entry_t& entry) noexcept {
+        if (lookup(state, entry.msr_address) != nullptr) {
+            return unexpected{ nt_status_object_name_collision_v };
+        }
+
+        if (state.entry_count == max_entry_count_v) {
+            return unexpected{ nt_status_insufficient_resources_v };
+        }
+
+        state.entries[state.entry_count++] = entry;
+        return rebuild_table(state);
+    }
+
+    void msr_interceptor::update_bitmap(uint32_t msr_address, bool intercept_read, bool intercept_write) noexcept {
+        // MSRs outside of the bitmap ranges always cause VM exits, there is nothing to update for them.
+        auto retval = m_bitmap.set(msr_address, { .activate_read = 1, .activate_write = 1, .read = intercept_read ? uint8_t{ 1 } : uint8_t{ 0 }, .write = intercept_write ? uint8_t{ 1 } : uint8_t{ 0 } });
+        if (retval.has_value()) {
+            m_bitmap_generation.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    msr_interceptor::msr_interceptor() noexcept
+        : m_bitmap{}, m_state{}, m_bitmap_generation{ 0 } {}
+
+    expected<void, nt_status> msr_interceptor::initialize() noexcept {
+        return m_bitmap.initialize();
+    }
+
+    const msr_bitmap& msr_interceptor::get_bitmap() const noexcept {
+        return m_bitmap;
+    }
+
+    uint32_t msr_interceptor::get_bitmap_generation() const noexcept {
+        return m_bitmap_generation.load(std::memory_order_acquire);
+    }
+
+    expected<void, nt_status> msr_interceptor::register_handler(uint32_t msr_address, read_handler_t on_read, write_handler_t on_write, void* context) noexcept {
+        if (on_read == nullptr && on_write == nullptr) {
+            return unexpected{ nt_status_invalid_parameter_v };
+        }
+
+        // other writers on this cpu would spin forever if we got preempted in the middle of an update
+        KIRQL old_irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+        auto retval = m_state.update([&](state_t& state) noexcept -> expected<void, nt_status> {
+            auto expt_status = insert(state, { .msr_address = msr_address, .shadow_slot = no_shadow_slot_v, .shadow_epoch = 0, .shadow_initial_value = 0, .on_read = on_read, .on_write = on_write, .context = context });
+            if (expt_status.has_value()) {
+                update_bitmap(msr_address, on_read != nullptr, on_write != nullptr);
+            }
+            return expt_status;
+        });
+
+        KeLowerIrql(old_irql);
+        return retval;
+    }
+
+    expected<void, nt_status> msr_interceptor::register_shadow(uint32_t msr_address, uint64_t initial_value) noexcept {
+        KIRQL old_irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+        auto retval = m_state.update([&](state_t& state) noexcept -> expected<void, nt_status> {
+            auto free_slots = ~state.shadow_slots_used & ((uint64_t{ 1 } << max_shadow_count_v) - 1);
+            if (free_slots == 0) {
+                return unexpected{ nt_status_insufficient_resources_v };
+            }
+
+            auto slot = static_cast<uint32_t>(std::countr_zero(free_slots));
+
+            auto expt_status = insert(state, { .msr_address = msr_address, .shadow_slot = slot, .shadow_epoch = ++state.shadow_epoch, .shadow_initial_value = initial_value, .on_read = nullptr, .on_write = nullptr, .context = nullptr });
+            if (expt_status.has_value()) {
+                state.shadow_slots_used |= uint32_t{ 1 } << slot;
+                update_bitmap(msr_address, true, true);
+            }
+            return expt_status;
+        });
+
+        KeLowerIrql(old_irql);
+        return retval;
+    }
+
+    expected<void, nt_status> msr_interceptor::unregister(uint32_t msr_address) noexcept {
+        KIRQL old_irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+        bool had_handler = false;
+
+        auto retval = m_state.update([&](state_t& state) noexcept -> expected<void, nt_status> {
+            auto entry = lookup(state, msr_address);
+            if (entry == nullptr) {
+                return unexpected{ nt_status_not_found_v };
+            }
+
+            if (entry->shadow_slot != no_shadow_slot_v) {
+                state.shadow_slots_used &= ~(uint32_t{ 1 } << entry->shadow_slot);
+            } else {
+                had_handler = true;
+            }
+
+            *entry = state.entries[--state.entry_count];
+
+            // removing an entry never introduces a collision, so the current seed is still perfect
+            std::fill(std::begin(state.table), std::end(state.table), empty_slot_v);
+            for (size_t i = 0; i < state.entry_count; ++i) {
+                state.table[hash(state.entries[i].msr_address, state.seed)] = static_cast<uint8_t>(i + 1);
+            }
+
+            update_bitmap(msr_address, false, false);
+            return {};
+        });
+
+        KeLowerIrql(old_irql);
+
+        // A cpu runs a DPC only in the guest, so once every cpu has run one
+        // none of them can still be calling the handler from a snapshot taken before the update.
+        if (had_handler && run_on_cpus(cpu_set::active(), []() noexcept {}).has_error()) {
+            ipi_broadcast([]() noexcept {});
+        }
+
+        return retval;
+    }
+
+    msr_interceptor::result_e msr_interceptor::on_read(mshv_virtual_cpu* vcpu, shadow_storage_t& shadows, uint32_t msr_address, uint64_t& value) const noexcept {
+        entry_t entry;
+        if (!find(msr_address, entry)) {
+            return result_e::NOT_INTERCEPTED;
+        }
+
+        if (entry.shadow_slot != no_shadow_slot_v) {
+            if (shadows.epochs[entry.shadow_slot] != entry.shadow_epoch) {
+                shadows.values[entry.shadow_slot] = entry.shadow_initial_value;
+                shadows.epochs[entry.shadow_slot] = entry.shadow_epoch;
+            }
+
+            value = shadows.values[entry.shadow_slot];
+            return result_e::HANDLED;
+        }
+
+        if (entry.on_read == nullptr) {
+            return result_e::NOT_INTERCEPTED;
+        }
+
+        return entry.on_read(vcpu, msr_address, value, entry.context) ? result_e::HANDLED : result_e::FAULT;
+    }
+
+    msr_interceptor::result_e msr_interceptor::on_write(mshv_virtual_cpu* vcpu, shadow_storage_t& shadows, uint32_t msr_address, uint64_t value) const noexcept {
+        entry_t entry;
+        if (!find(msr_address, entry)) {
+            return result_e::NOT_INTERCEPTED;
+        }
+
+        if (entry.shadow_slot != no_shadow_slot_v) {
+            shadows.values[entry.shadow_slot] = value;
+            shadows.epochs[entry.shadow_slot] = entry.shadow_epoch;
+            return result_e::HANDLED;
+        }
+
+        if (entry.on_write == nullptr) {
+            return result_e::NOT_INTERCEPTED;
+        }
+
+        return entry.on_write(vcpu, msr_address, value, entry.context) ? result_e::HANDLED : result_e::FAULT;
+    }
+}
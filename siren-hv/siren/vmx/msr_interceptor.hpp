@@ -0,0 +1,147 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "../expected.hpp"
+#include "../nt_status.hpp"
+#include "../synchronization.hpp"
+
+#include "msr_bitmap.hpp"
+
+namespace siren::vmx {
+    class mshv_virtual_cpu;
+
+    class msr_interceptor {
+    public:
+        // Handlers run in VMX root on a snapshot of the registration, no lock is held.
+        // unregister() returns only after no cpu can still be calling the handler it removed, so its context can be freed then.
+        // Returning false makes the exit handler inject #GP(0) into the guest.
+        using read_handler_t = bool(*)(mshv_virtual_cpu* vcpu, uint32_t msr_address, uint64_t& value, void* context) noexcept;
+        using write_handler_t = bool(*)(mshv_virtual_cpu* vcpu, uint32_t msr_address, uint64_t value, void* context) noexcept;
+
+        enum class result_e {
+            NOT_INTERCEPTED,
+            HANDLED,
+            FAULT,
+        };
+
+        static constexpr size_t max_entry_count_v = 32;
+        static constexpr size_t max_shadow_count_v = 16;
+
+        // Lives in every virtual cpu. A slot is valid only if its epoch matches the epoch of the entry owning the slot,
+        // so a zero-initialized storage, or one left behind by an unregistered MSR, falls back to the initial value.
+        struct shadow_storage_t {
+            uint64_t values[max_shadow_count_v];
+            uint32_t epochs[max_shadow_count_v];
+        };
+
+    private:
+        static constexpr uint32_t table_bits_v = 6;
+        static constexpr size_t table_length_v = size_t{ 1 } << table_bits_v;
+        static constexpr uint32_t max_seed_attempts_v = 4096;
+        static constexpr uint8_t empty_slot_v = 0;
+        static constexpr uint32_t no_shadow_slot_v = ~uint32_t{ 0 };
+
+        static_assert(max_entry_count_v < table_length_v);
+        static_assert(max_entry_count_v < UINT8_MAX);
+        static_assert(max_shadow_count_v <= 32);
+
+        struct entry_t {
+            uint32_t msr_address;
+            uint32_t shadow_slot;
+            uint32_t shadow_epoch;
+            uint64_t shadow_initial_value;
+            read_handler_t on_read;
+            write_handler_t on_write;
+            void* context;
+        };
+
+        // entries[0, entry_count) are registered entries, table maps hash(msr_address) to entry index + 1.
+        // The seed is searched whenever the entry set changes so that every registered MSR owns a distinct table slot,
+        // which makes lookup a single probe.
+        struct state_t {
+            entry_t entries[max_entry_count_v];
+            size_t entry_count;
+            uint8_t table[table_length_v];
+            uint32_t seed;
+
+            uint32_t shadow_slots_used;
+            uint32_t shadow_epoch;
+        };
+
+        msr_bitmap m_bitmap;
+
+        // exit handlers only read it, registration goes through update()
+        versioned<state_t> m_state;
+
+        std::atomic_uint32_t m_bitmap_generation;
+
+        [[nodiscard]]
+        static constexpr uint32_t hash(uint32_t msr_address, uint32_t seed) noexcept {
+            return ((msr_address ^ (msr_address >> 15u)) * seed) >> (32u - table_bits_v);
+        }
+
+        // Safe on a state in the middle of an update, the result is garbage then but stays in bounds.
+        [[nodiscard]]
+        static const entry_t* lookup(const state_t& state, uint32_t msr_address) noexcept;
+
+        [[nodiscard]]
+        static entry_t* lookup(state_t& state, uint32_t msr_address) noexcept;
+
+        // Copies the entry of `msr_address` out of a consistent snapshot, returns false if there is none.
+        [[nodiscard]]
+        bool find(uint32_t msr_address, entry_t& entry) const noexcept;
+
+        [[nodiscard]]
+        static expected<void, nt_status> rebuild_table(state_t& state) noexcept;
+
+        [[nodiscard]]
+        static expected<void, nt_status> insert(state_t& state, const entry_t& entry) noexcept;
+
+        void update_bitmap(uint32_t msr_address, bool intercept_read, bool intercept_write) noexcept;
+
+    public:
+        msr_interceptor() noexcept;
+
+        // copy constructor is not allowed
+        msr_interceptor(const msr_interceptor&) = delete;
+
+        // move constructor is not allowed
+        msr_interceptor(msr_interceptor&&) noexcept = delete;
+
+        // copy assignment is not allowed
+        msr_interceptor& operator=(const msr_interceptor&) = delete;
+
+        // move assignment is not allowed
+        msr_interceptor& operator=(msr_interceptor&&) noexcept = delete;
+
+        ~msr_interceptor() noexcept = default;
+
+        [[nodiscard]]
+        expected<void, nt_status> initialize() noexcept;
+
+        [[nodiscard]]
+        const msr_bitmap& get_bitmap() const noexcept;
+
+        // Bumped whenever the msr bitmap changes; virtual cpus compare it on VM exit to dirty the MSR_BITMAP clean field.
+        [[nodiscard]]
+        uint32_t get_bitmap_generation() const noexcept;
+
+        // A null handler leaves that direction to the hardware.
+        [[nodiscard]]
+        expected<void, nt_status> register_handler(uint32_t msr_address, read_handler_t on_read, write_handler_t on_write, void* context = nullptr) noexcept;
+
+        // Shadow-only MSR: reads and writes are served from per-vcpu storage and never touch the real MSR.
+        [[nodiscard]]
+        expected<void, nt_status> register_shadow(uint32_t msr_address, uint64_t initial_value) noexcept;
+
+        [[nodiscard]]
+        expected<void, nt_status> unregister(uint32_t msr_address) noexcept;
+
+        [[nodiscard]]
+        result_e on_read(mshv_virtual_cpu* vcpu, shadow_storage_t& shadows, uint32_t msr_address, uint64_t& value) const noexcept;
+
+        [[nodiscard]]
+        result_e on_write(mshv_virtual_cpu* vcpu, shadow_storage_t& shadows, uint32_t msr_address, uint64_t value) const noexcept;
+    };
+}
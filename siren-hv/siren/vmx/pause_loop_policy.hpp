@@ -0,0 +1,130 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+
+namespace siren::vmx {
+    // Software pause-loop exiting.
+    // Enlightened VMCS v1 has no PLE_Gap/PLE_Window fields, so hardware PLE cannot be programmed under Hyper-V.
+    // Instead PAUSE exiting is turned on and every PAUSE exit is fed to this class, which applies the SDM's PLE rules:
+    // two PAUSEs no more than `gap` ticks apart belong to the same spin loop, and a loop that lasts `window` ticks is a long spin wait.
+    // All durations are in TSC ticks.
+    class pause_loop_policy {
+    public:
+        struct parameters_t {
+            bool enabled;
+            uint64_t gap;
+            uint64_t window;            // initial window
+            uint64_t min_window;
+            uint64_t max_window;
+            uint32_t grow_factor;
+            uint32_t shrink_factor;
+        };
+
+        struct statistics_t {
+            uint64_t pause_exits;
+            uint64_t spin_loops;
+            uint64_t long_spin_waits;   // number of HvCallNotifyLongSpinWait issued
+            uint64_t grow_count;
+            uint64_t shrink_count;
+        };
+
+        // Every PAUSE becomes a VM exit when enabled, which is only worth it on oversubscribed hosts, so it is off by default.
+        // The gap and window are the tick equivalents of KVM's ple_gap = 128 cycles and ple_window = 4096 cycles,
+        // scaled up since a PAUSE exit through L0 is far slower than a PAUSE.
+        static constexpr parameters_t default_parameters_v = {
+            .enabled = false,
+            .gap = 20'000,
+            .window = 200'000,
+            .min_window = 50'000,
+            .max_window = 3'200'000,
+            .grow_factor = 2,
+            .shrink_factor = 2
+        };
+
+    private:
+        parameters_t m_parameters;
+        uint64_t m_window;
+        uint64_t m_loop_start;
+        uint64_t m_last_pause;
+        uint64_t m_loop_pauses;
+        uint32_t m_loop_yields;
+        statistics_t m_statistics;
+
+        constexpr void grow() noexcept {
+            auto window = std::min(m_window * m_parameters.grow_factor, m_parameters.max_window);
+            if (window != m_window) {
+                m_window = window;
+                ++m_statistics.grow_count;
+            }
+        }
+
+        constexpr void shrink() noexcept {
+            auto window = std::max(m_parameters.shrink_factor ? m_window / m_parameters.shrink_factor : m_parameters.min_window, m_parameters.min_window);
+            if (window != m_window) {
+                m_window = window;
+                ++m_statistics.shrink_count;
+            }
+        }
+
+    public:
+        constexpr pause_loop_policy() noexcept
+            : pause_loop_policy{ default_parameters_v } {}
+
+        constexpr explicit pause_loop_policy(const parameters_t& parameters) noexcept
+            : m_parameters{ parameters }, m_window{ parameters.window }, m_loop_start{ 0 }, m_last_pause{ 0 }, m_loop_pauses{ 0 }, m_loop_yields{ 0 }, m_statistics{} {}
+
+        [[nodiscard]]
+        constexpr const parameters_t& get_parameters() const noexcept {
+            return m_parameters;
+        }
+
+        [[nodiscard]]
+        constexpr uint64_t get_window() const noexcept {
+            return m_window;
+        }
+
+        // PAUSE exits seen in the current spin loop
+        [[nodiscard]]
+        constexpr uint64_t get_loop_pause_count() const noexcept {
+            return m_loop_pauses;
+        }
+
+        [[nodiscard]]
+        constexpr const statistics_t& get_statistics() const noexcept {
+            return m_statistics;
+        }
+
+        // Feeds one PAUSE exit at `now`. Returns true if the vcpu has spun for a whole window and should yield.
+        [[nodiscard]]
+        constexpr bool on_pause(uint64_t now) noexcept {
+            ++m_statistics.pause_exits;
+
+            if (m_statistics.pause_exits == 1 || now - m_last_pause > m_parameters.gap) {
+                // A new spin loop. If the previous one ended soon after a yield, the yield let the lock holder run: yield earlier.
+                if (m_loop_yields != 0) {
+                    shrink();
+                }
+                ++m_statistics.spin_loops;
+                m_loop_start = now;
+                m_loop_pauses = 0;
+                m_loop_yields = 0;
+            }
+
+            m_last_pause = now;
+            ++m_loop_pauses;
+
+            if (now - m_loop_start >= m_window) {
+                // Still spinning after a yield means the wait is legitimately long: yield less often, like KVM growing ple_window.
+                if (m_loop_yields != 0) {
+                    grow();
+                }
+                ++m_statistics.long_spin_waits;
+                ++m_loop_yields;
+                m_loop_start = now;
+                return true;
+            } else {
+                return false;
+            }
+        }
+    };
+}
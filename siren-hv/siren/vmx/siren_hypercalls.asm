@@ -11,4 +11,26 @@
     ret
 ?turn_off_vm@siren_hypercalls@vmx@siren@@YAXXZ ENDP
 
+?ept_flush@siren_hypercalls@vmx@siren@@YAXXZ PROC
+    push rbx
+
+    mov eax, 'vhrs'
+    mov ebx, 8h
+    vmcall
+
+    pop rbx
+    ret
+?ept_flush@siren_hypercalls@vmx@siren@@YAXXZ ENDP
+
+?suspend_vm@siren_hypercalls@vmx@siren@@YAXXZ PROC
+    push rbx
+
+    mov eax, 'vhrs'
+    mov ebx, 9h
+    vmcall
+
+    pop rbx
+    ret
+?suspend_vm@siren_hypercalls@vmx@siren@@YAXXZ ENDP
+
 END
\ No newline at end of file
@@ -42,7 +42,13 @@ namespace siren::vmx {
         nt_status ept_uncommit_4kb_page(uint64_t guest_page_base) noexcept;
 
         // function id: 8
+        // Exits and returns, the exit retires the EPT invalidations pending for the calling virtual cpu.
         [[nodiscard]]
         void ept_flush() noexcept;
+
+        // function id: 9
+        // Leaves the guest like turn_off_vm, but stays in VMX root operation.
+        [[nodiscard]]
+        void suspend_vm() noexcept;
     };
 }
@@ -0,0 +1,65 @@
+#include "vmx_capabilities.hpp"
+#include "../x86/intel_vmx.hpp"
+
+namespace siren::vmx {
+    vmx_capabilities vmx_capabilities::read() noexcept {
+        using namespace siren::x86;
+
+        vmx_capabilities caps = {};
+
+        caps.basic = read_msr<IA32_VMX_BASIC>();
+
+        if (caps.basic.semantics.default1_controls_can_be_zero) {
+            auto ia32_vmx_true_pinbased_ctls = read_msr<IA32_VMX_TRUE_PINBASED_CTLS>();
+            auto ia32_vmx_true_procbased_ctls = read_msr<IA32_VMX_TRUE_PROCBASED_CTLS>();
+            auto ia32_vmx_true_exit_ctls = read_msr<IA32_VMX_TRUE_EXIT_CTLS>();
+            auto ia32_vmx_true_entry_ctls = read_msr<IA32_VMX_TRUE_ENTRY_CTLS>();
+
+            caps.pin_based_controls = { ia32_vmx_true_pinbased_ctls.semantics.mask0, ia32_vmx_true_pinbased_ctls.semantics.mask1 };
+            caps.primary_processor_based_controls = { ia32_vmx_true_procbased_ctls.semantics.mask0, ia32_vmx_true_procbased_ctls.semantics.mask1 };
+            caps.primary_vmexit_controls = { ia32_vmx_true_exit_ctls.semantics.mask0, ia32_vmx_true_exit_ctls.semantics.mask1 };
+            caps.vmentry_controls = { ia32_vmx_true_entry_ctls.semantics.mask0, ia32_vmx_true_entry_ctls.semantics.mask1 };
+        } else {
+            auto ia32_vmx_pinbased_ctls = read_msr<IA32_VMX_PINBASED_CTLS>();
+            auto ia32_vmx_procbased_ctls = read_msr<IA32_VMX_PROCBASED_CTLS>();
+            auto ia32_vmx_exit_ctls = read_msr<IA32_VMX_EXIT_CTLS>();
+            auto ia32_vmx_entry_ctls = read_msr<IA32_VMX_ENTRY_CTLS>();
+
+            caps.pin_based_controls = { ia32_vmx_pinbased_ctls.semantics.mask0, ia32_vmx_pinbased_ctls.semantics.mask1 };
+            caps.primary_processor_based_controls = { ia32_vmx_procbased_ctls.semantics.mask0, ia32_vmx_procbased_ctls.semantics.mask1 };
+            caps.primary_vmexit_controls = { ia32_vmx_exit_ctls.semantics.mask0, ia32_vmx_exit_ctls.semantics.mask1 };
+            caps.vmentry_controls = { ia32_vmx_entry_ctls.semantics.mask0, ia32_vmx_entry_ctls.semantics.mask1 };
+        }
+
+        caps.secondary_processor_based_controls_support =
+            vmcsf_t<VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS>{ .storage = caps.primary_processor_based_controls.mask1 }.semantics.activate_secondary_controls != 0;
+
+        caps.tertiary_processor_based_controls_support =
+            vmcsf_t<VMCSF_CTRL_PRIMARY_PROCESSOR_BASED_VM_EXECUTION_CONTROLS>{ .storage = caps.primary_processor_based_controls.mask1 }.semantics.activate_tertiary_controls != 0;
+
+        // The IA32_VMX_EXIT_CTLS2 MSR exists only on processors that support the 1-setting of the "activate secondary
+        // controls" VM-exit control (only if bit 63 of the IA32_VMX_EXIT_CTLS MSR is 1).
+        caps.secondary_vmexit_controls_support =
+            vmcsf_t<VMCSF_CTRL_PRIMARY_VMEXIT_CONTROLS>{ .storage = caps.primary_vmexit_controls.mask1 }.semantics.activate_secondary_controls != 0;
+
+        if (caps.secondary_processor_based_controls_support) {
+            auto ia32_vmx_procbased_ctls2 = read_msr<IA32_VMX_PROCBASED_CTLS2>();
+            caps.secondary_processor_based_controls = { ia32_vmx_procbased_ctls2.semantics.mask0, ia32_vmx_procbased_ctls2.semantics.mask1 };
+        }
+
+        if (caps.tertiary_processor_based_controls_support) {
+            caps.tertiary_processor_based_controls = read_msr<IA32_VMX_PROCBASED_CTLS3>().semantics.mask;
+        }
+
+        if (caps.secondary_vmexit_controls_support) {
+            caps.secondary_vmexit_controls = read_msr<IA32_VMX_EXIT_CTLS2>().semantics.mask;
+        }
+
+        caps.cr0_fixed0 = read_msr<IA32_VMX_CR0_FIXED0>();
+        caps.cr0_fixed1 = read_msr<IA32_VMX_CR0_FIXED1>();
+        caps.cr4_fixed0 = read_msr<IA32_VMX_CR4_FIXED0>();
+        caps.cr4_fixed1 = read_msr<IA32_VMX_CR4_FIXED1>();
+
+        return caps;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include "../x86/model_specific_registers.hpp"
+
+namespace siren::vmx {
+    // Snapshot of the VMX capability MSRs.
+    // Nested under Hyper-V every RDMSR is a trap to L0, so they are read once at hypervisor initialization and shared by all virtual cpus.
+    // The capability MSRs report the same values on every logical processor, so reading them on any one processor is enough.
+    struct vmx_capabilities {
+        // Allowed 0-settings and 1-settings of a 32-bit control field.
+        // Defined in
+        // [*] Volume 3 (3A, 3B, 3C & 3D): System Programming Guide
+        //  |-> Appendix A VMX Capability Reporting Facility
+        //    |-> A.3 VM-Execution Controls
+        struct allowed_settings_t {
+            uint32_t mask0;     // bit X is 1: control X must be 1
+            uint32_t mask1;     // bit X is 0: control X must be 0
+
+            [[nodiscard]]
+            constexpr uint32_t adjust(uint32_t desired) const noexcept {
+                return (desired | mask0) & mask1;
+            }
+        };
+
+        x86::msr_t<x86::IA32_VMX_BASIC> basic;
+
+        // The TRUE_* MSRs are used instead when IA32_VMX_BASIC[55] says they exist.
+        allowed_settings_t pin_based_controls;
+        allowed_settings_t primary_processor_based_controls;
+        allowed_settings_t secondary_processor_based_controls;  // all zero if not supported
+        uint64_t tertiary_processor_based_controls;             // allowed 1-settings, zero if not supported
+        allowed_settings_t primary_vmexit_controls;
+        uint64_t secondary_vmexit_controls;                     // allowed 1-settings, zero if not supported
+        allowed_settings_t vmentry_controls;
+
+        bool secondary_processor_based_controls_support;
+        bool tertiary_processor_based_controls_support;
+        bool secondary_vmexit_controls_support;
+
+        x86::msr_t<x86::IA32_VMX_CR0_FIXED0> cr0_fixed0;
+        x86::msr_t<x86::IA32_VMX_CR0_FIXED1> cr0_fixed1;
+        x86::msr_t<x86::IA32_VMX_CR4_FIXED0> cr4_fixed0;
+        x86::msr_t<x86::IA32_VMX_CR4_FIXED1> cr4_fixed1;
+
+        // Must run on a processor that supports VMX.
+        [[nodiscard]]
+        static vmx_capabilities read() noexcept;
+    };
+}
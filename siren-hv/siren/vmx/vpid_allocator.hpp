@@ -0,0 +1,96 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <bit>
+#include "../expected.hpp"
+#include "../nt_status.hpp"
+
+namespace siren::vmx {
+    // Lock-free VPID allocator backed by an atomic bitmap.
+    // VPID 0 belongs to VMX root operation and is never handed out.
+    // A VPID that has been released is marked stale: the next owner must flush it once before its first VM entry,
+    // because translations cached under the previous owner may still be tagged with it.
+    class vpid_allocator {
+    public:
+        using vpid_t = uint16_t;
+
+        static constexpr vpid_t invalid_vpid_v = 0;
+        static constexpr size_t capacity_v = size_t{ 1 } << 16u;
+
+    private:
+        static constexpr size_t word_bits_v = 64;
+        static constexpr size_t word_count_v = capacity_v / word_bits_v;
+
+        std::atomic_uint64_t m_used[word_count_v];
+        std::atomic_uint64_t m_stale[word_count_v];
+        std::atomic_size_t m_hint;
+
+    public:
+        vpid_allocator() noexcept
+            : m_hint{ 0 }
+        {
+            for (size_t i = 0; i < word_count_v; ++i) {
+                m_used[i].store(0, std::memory_order_relaxed);
+                m_stale[i].store(0, std::memory_order_relaxed);
+            }
+            m_used[0].store(uint64_t{ 1 } << invalid_vpid_v, std::memory_order_relaxed);
+        }
+
+        // copy constructor is not allowed
+        vpid_allocator(const vpid_allocator&) = delete;
+
+        // move constructor is not allowed
+        vpid_allocator(vpid_allocator&&) noexcept = delete;
+
+        // copy assignment is not allowed
+        vpid_allocator& operator=(const vpid_allocator&) = delete;
+
+        // move assignment is not allowed
+        vpid_allocator& operator=(vpid_allocator&&) noexcept = delete;
+
+        ~vpid_allocator() noexcept = default;
+
+        [[nodiscard]]
+        expected<vpid_t, nt_status> allocate() noexcept {
+            // start from where the last allocation succeeded so that concurrent allocators rarely fight over one word
+            size_t start = m_hint.load(std::memory_order_relaxed);
+
+            for (size_t n = 0; n < word_count_v; ++n) {
+                size_t i = (start + n) % word_count_v;
+                uint64_t used = m_used[i].load(std::memory_order_relaxed);
+
+                while (used != ~uint64_t{ 0 }) {
+                    uint64_t bit = uint64_t{ 1 } << std::countr_one(used);
+                    if (m_used[i].compare_exchange_weak(used, used | bit, std::memory_order_acquire, std::memory_order_relaxed)) {
+                        m_hint.store(i, std::memory_order_relaxed);
+                        return static_cast<vpid_t>(i * word_bits_v + std::countr_zero(bit));
+                    }
+                }
+            }
+
+            return unexpected{ nt_status_insufficient_resources_v };
+        }
+
+        void release(vpid_t vpid) noexcept {
+            if (vpid != invalid_vpid_v) {
+                uint64_t bit = uint64_t{ 1 } << (vpid % word_bits_v);
+                m_stale[vpid / word_bits_v].fetch_or(bit, std::memory_order_relaxed);
+                m_used[vpid / word_bits_v].fetch_and(~bit, std::memory_order_release);
+            }
+        }
+
+        // Returns true, once, if the vpid was used by a previous owner and must be flushed before use.
+        [[nodiscard]]
+        bool consume_stale(vpid_t vpid) noexcept {
+            uint64_t bit = uint64_t{ 1 } << (vpid % word_bits_v);
+            return (m_stale[vpid / word_bits_v].fetch_and(~bit, std::memory_order_acq_rel) & bit) != 0;
+        }
+
+        [[nodiscard]]
+        bool is_allocated(vpid_t vpid) const noexcept {
+            uint64_t bit = uint64_t{ 1 } << (vpid % word_bits_v);
+            return (m_used[vpid / word_bits_v].load(std::memory_order_acquire) & bit) != 0;
+        }
+    };
+}
@@ -0,0 +1,31 @@
+.CODE
+
+; INVEPT type 2, all-context. The descriptor is ignored but still read, so it is zeroed in the home space.
+?vmx_invept@x86@siren@@YA?AUvmx_result_t@12@XZ PROC
+	xor eax, eax
+	mov qword ptr [rsp + 8h], rax
+	mov qword ptr [rsp + 10h], rax
+	mov ecx, 2h
+	invept rcx, oword ptr [rsp + 8h]
+	setz al
+	setc cl
+	add cl, cl
+	or al, cl
+	ret
+?vmx_invept@x86@siren@@YA?AUvmx_result_t@12@XZ ENDP
+
+; INVEPT type 1, single-context, with the descriptor { eptp, 0 } built in the home space.
+; Returns 1 on VMfailValid and 2 on VMfailInvalid, like the __vmx_* intrinsics.
+?vmx_invept@x86@siren@@YA?AUvmx_result_t@12@_K@Z PROC
+	mov qword ptr [rsp + 8h], rcx
+	mov qword ptr [rsp + 10h], 0
+	mov ecx, 1h
+	invept rcx, oword ptr [rsp + 8h]
+	setz al
+	setc cl
+	add cl, cl
+	or al, cl
+	ret
+?vmx_invept@x86@siren@@YA?AUvmx_result_t@12@_K@Z ENDP
+
+END
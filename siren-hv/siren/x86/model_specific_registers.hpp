@@ -1511,6 +1511,29 @@ namespace siren::x86 {
         uint64_t storage;
     };
 
+    // Defined in
+    // [*] Volume 3 (3A, 3B, 3C & 3D): System Programming Guide
+    //  |-> Chapter 10 Advanced Programmable Interrupt Controller (APIC)
+    //    |-> 10.12.1 Detecting and Enabling x2APIC Mode
+    //      |-> Figure 10-26. IA32_APIC_BASE MSR Supporting x2APIC
+    template<>
+    struct msr_t<IA32_APIC_BASE> {
+        union {
+            uint64_t storage;
+            struct {
+                uint64_t reserved0 : 8;
+                uint64_t bsp : 1;
+                uint64_t reserved1 : 1;
+                uint64_t enable_x2apic_mode : 1;
+                uint64_t apic_global_enable : 1;
+                uint64_t apic_base : 52;
+            } semantics;
+        };
+    };
+
+    static_assert(sizeof(msr_t<IA32_APIC_BASE>) == sizeof(uint64_t));
+    static_assert(sizeof(msr_t<IA32_APIC_BASE>::storage) == sizeof(msr_t<IA32_APIC_BASE>::semantics));
+
     template<>
     struct msr_t<IA32_FEATURE_CONTROL> {
         union {
@@ -0,0 +1,124 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "allocation_telemetry.hpp"
+#include "memory.hpp"
+#include <thread>
+
+using siren::allocation_category_e;
+using siren::allocation_category_count_v;
+using siren::allocation_statistics_t;
+
+namespace {
+    // The counters are global, the tests look at what changed.
+    allocation_statistics_t query(allocation_category_e category) {
+        allocation_statistics_t statistics[allocation_category_count_v];
+        siren::query_allocation_statistics(statistics);
+        return statistics[static_cast<size_t>(category)];
+    }
+
+    void test_categories_are_separate() {
+        auto ept = query(allocation_category_e::ept);
+        auto msr_bitmap = query(allocation_category_e::msr_bitmap);
+
+        siren::record_allocation(allocation_category_e::ept, 4096);
+        siren::record_allocation(allocation_category_e::ept, 100);
+        siren::record_deallocation(allocation_category_e::ept, 100);
+
+        auto now = query(allocation_category_e::ept);
+        SIREN_CHECK(now.live_bytes == ept.live_bytes + 4096);
+        SIREN_CHECK(now.allocation_count == ept.allocation_count + 2);
+        SIREN_CHECK(now.deallocation_count == ept.deallocation_count + 1);
+
+        auto untouched = query(allocation_category_e::msr_bitmap);
+        SIREN_CHECK(untouched.live_bytes == msr_bitmap.live_bytes && untouched.allocation_count == msr_bitmap.allocation_count);
+
+        siren::record_deallocation(allocation_category_e::ept, 4096);
+        SIREN_CHECK(query(allocation_category_e::ept).live_bytes == ept.live_bytes);
+    }
+
+    // Memory may be freed on another cpu than it was allocated on, only the sum over the cpus counts.
+    void test_freed_on_another_cpu() {
+        auto before = query(allocation_category_e::exit_recorder);
+
+        siren::tests::set_current_processor(1);
+        siren::record_allocation(allocation_category_e::exit_recorder, 512);
+        siren::tests::set_current_processor(2);
+        SIREN_CHECK(query(allocation_category_e::exit_recorder).live_bytes == before.live_bytes + 512);
+        siren::record_deallocation(allocation_category_e::exit_recorder, 512);
+        siren::tests::set_current_processor(0);
+
+        auto after = query(allocation_category_e::exit_recorder);
+        SIREN_CHECK(after.live_bytes == before.live_bytes);
+        SIREN_CHECK(after.deallocation_count == before.deallocation_count + 1);
+
+        // cpus beyond the slot count share slots, their counters are not lost
+        std::thread{ [] {
+            siren::tests::set_current_processor(64 + 1);
+            siren::record_allocation(allocation_category_e::exit_recorder, 8);
+            siren::record_deallocation(allocation_category_e::exit_recorder, 8);
+        } }.join();
+
+        after = query(allocation_category_e::exit_recorder);
+        SIREN_CHECK(after.live_bytes == before.live_bytes);
+        SIREN_CHECK(after.allocation_count == before.allocation_count + 2 && after.deallocation_count == before.deallocation_count + 2);
+    }
+
+    // The peak is sampled by allocations every so often and by every query.
+    void test_peak_is_sampled() {
+        auto before = query(allocation_category_e::virtual_cpu);
+
+        siren::record_allocation(allocation_category_e::virtual_cpu, 1 << 20);
+        auto peak = query(allocation_category_e::virtual_cpu);
+        SIREN_CHECK(peak.peak_bytes >= before.live_bytes + (1 << 20));
+
+        siren::record_deallocation(allocation_category_e::virtual_cpu, 1 << 20);
+        auto after = query(allocation_category_e::virtual_cpu);
+        SIREN_CHECK(after.live_bytes == before.live_bytes);
+        SIREN_CHECK(after.peak_bytes == peak.peak_bytes);       // the peak stays
+    }
+
+    struct base_t {
+        virtual ~base_t() noexcept = default;
+    };
+
+    struct derived_t : base_t {
+        static constexpr allocation_category_e allocation_category_v = allocation_category_e::hypervisor;
+
+        uint64_t payload[16];
+    };
+
+    // What the typed allocators record: the allocated type's category and size, taken back by a delete of that same type.
+    void test_typed_allocators() {
+        auto hypervisor = query(allocation_category_e::hypervisor);
+        auto general = query(allocation_category_e::general);
+
+        auto expt_object = siren::allocate_unique<derived_t>(siren::npaged_pool);
+        SIREN_CHECK(expt_object.has_value());
+
+        auto now = query(allocation_category_e::hypervisor);
+        SIREN_CHECK(now.live_bytes == hypervisor.live_bytes + sizeof(derived_t));
+        SIREN_CHECK(now.allocation_count == hypervisor.allocation_count + 1);
+
+        // held by a base pointer like g_SirenHypervisor, deleted as what it is
+        base_t* object = expt_object.value().release();
+        siren::allocator_delete(siren::npaged_pool, static_cast<derived_t*>(object));
+
+        now = query(allocation_category_e::hypervisor);
+        SIREN_CHECK(now.live_bytes == hypervisor.live_bytes);
+        SIREN_CHECK(now.deallocation_count == hypervisor.deallocation_count + 1);
+        SIREN_CHECK(query(allocation_category_e::general).live_bytes == general.live_bytes);
+        SIREN_CHECK(query(allocation_category_e::general).deallocation_count == general.deallocation_count);
+    }
+}
+
+int main() {
+    siren::tests::host_machine.processor_count = 4;
+
+    test_categories_are_separate();
+    test_freed_on_another_cpu();
+    test_peak_is_sampled();
+    test_typed_allocators();
+
+    siren::tests::reset_host_machine();
+    return siren::tests::check_result();
+}
@@ -0,0 +1,45 @@
+#include "buddy_arena.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// buddy_arena_bench
+// Allocates and frees batches of blocks of one size from a 2 MiB region, the size of a contiguous_arena region.
+int main() {
+    constexpr size_t page_count = 512;
+    constexpr size_t batch_size = 256;
+    constexpr size_t round_count = 20000;
+
+    void* base = aligned_alloc(siren::buddy_arena::page_size_v, page_count * siren::buddy_arena::page_size_v);
+    std::vector<uint8_t> page_states(page_count);
+
+    for (size_t block_pages : { 1u, 2u, 4u }) {
+        siren::buddy_arena arena;
+        if (arena.initialize(base, 0, page_count, page_states.data()).has_error()) {
+            fprintf(stderr, "buddy_arena setup failed\n");
+            return 1;
+        }
+
+        size_t count = std::min(batch_size, page_count / block_pages);
+        std::vector<void*> blocks(count);
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < round_count; ++round) {
+            for (auto& block : blocks) {
+                block = arena.allocate(block_pages).value();
+            }
+            for (auto* block : blocks) {
+                arena.deallocate(block);
+            }
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%zu page blocks: %6.1f ns per allocate and deallocate pair\n", block_pages, ns / static_cast<double>(round_count * count));
+        arena.reset();
+    }
+
+    free(base);
+    return 0;
+}
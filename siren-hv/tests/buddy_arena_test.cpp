@@ -0,0 +1,216 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "buddy_arena.hpp"
+#include "contiguous_arena.hpp"
+#include <stdlib.h>
+#include <wdm.h>
+#include <bit>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+using siren::buddy_arena;
+using siren::contiguous_arena;
+
+namespace {
+    constexpr size_t page_size_v = buddy_arena::page_size_v;
+
+    struct region_t {
+        size_t page_count;
+        void* base;
+        std::vector<uint8_t> page_states;
+
+        explicit region_t(size_t n)
+            : page_count{ n }, base{ aligned_alloc(page_size_v, n * page_size_v) }, page_states(n) {}
+
+        region_t(const region_t&) = delete;
+
+        ~region_t() {
+            free(base);
+        }
+    };
+
+    void test_initialize_refuses_bad_regions() {
+        region_t region{ 8 };
+        buddy_arena arena;
+
+        SIREN_CHECK(arena.initialize(nullptr, 0, 8, region.page_states.data()).has_error());
+        SIREN_CHECK(arena.initialize(static_cast<uint8_t*>(region.base) + 8, 0, 8, region.page_states.data()).has_error());
+        SIREN_CHECK(arena.initialize(region.base, 0x1008, 8, region.page_states.data()).has_error());
+        SIREN_CHECK(arena.initialize(region.base, 0, 0, region.page_states.data()).has_error());
+        SIREN_CHECK(arena.initialize(region.base, 0, 8, nullptr).has_error());
+
+        SIREN_CHECK(arena.initialize(region.base, 0, 8, region.page_states.data()).has_value());
+        SIREN_CHECK(arena.initialize(region.base, 0, 8, region.page_states.data()).has_error());    // once only
+    }
+
+    // A region that is not a power of two pages is covered by naturally aligned blocks, largest first.
+    void test_odd_region_is_covered_by_aligned_blocks() {
+        region_t region{ 13 };
+        buddy_arena arena;
+        SIREN_CHECK(arena.initialize(region.base, 0, region.page_count, region.page_states.data()).has_value());
+
+        auto statistics = arena.get_statistics();
+        SIREN_CHECK(statistics.total_pages == 13);
+        SIREN_CHECK(statistics.free_pages == 13);
+        SIREN_CHECK(statistics.largest_free_block_pages == 8);
+        SIREN_CHECK(statistics.free_blocks[3] == 1 && statistics.free_blocks[2] == 1 && statistics.free_blocks[0] == 1);
+
+        SIREN_CHECK(arena.allocate(16).has_error());
+        SIREN_CHECK(arena.allocate(0).has_error());
+
+        // 5 pages round up to the block of 8
+        auto expt_block = arena.allocate(5);
+        SIREN_CHECK(expt_block.has_value() && expt_block.value() == region.base);
+        SIREN_CHECK(arena.get_statistics().free_pages == 5);
+    }
+
+    void test_buddies_merge_back() {
+        region_t region{ 16 };
+        buddy_arena arena;
+        SIREN_CHECK(arena.initialize(region.base, 0, region.page_count, region.page_states.data()).has_value());
+
+        std::vector<void*> blocks;
+        for (size_t i = 0; i < 16; ++i) {
+            auto expt_block = arena.allocate(1);
+            SIREN_CHECK(expt_block.has_value());
+            if (expt_block.has_value()) {
+                blocks.push_back(expt_block.value());
+            }
+        }
+        SIREN_CHECK(arena.allocate(1).has_error());
+        SIREN_CHECK(arena.get_statistics().allocated_blocks == 16);
+
+        // freeing every other page leaves nothing to merge
+        for (size_t i = 0; i < blocks.size(); i += 2) {
+            arena.deallocate(blocks[i]);
+        }
+        SIREN_CHECK(arena.get_statistics().free_blocks[0] == 8);
+        SIREN_CHECK(arena.allocate(2).has_error());
+
+        for (size_t i = 1; i < blocks.size(); i += 2) {
+            arena.deallocate(blocks[i]);
+        }
+
+        auto statistics = arena.get_statistics();
+        SIREN_CHECK(statistics.free_pages == 16);
+        SIREN_CHECK(statistics.allocated_blocks == 0);
+        SIREN_CHECK(statistics.largest_free_block_pages == 16);
+        SIREN_CHECK(statistics.free_blocks[4] == 1);
+    }
+
+    void test_address_translation() {
+        region_t region{ 4 };
+        buddy_arena arena;
+        SIREN_CHECK(arena.initialize(region.base, 0x100000000, region.page_count, region.page_states.data()).has_value());
+
+        auto* end = static_cast<uint8_t*>(region.base) + region.page_count * page_size_v;
+        SIREN_CHECK(arena.contains(region.base));
+        SIREN_CHECK(arena.contains(end - 1));
+        SIREN_CHECK(!arena.contains(end));
+        SIREN_CHECK(arena.contains_physical(0x100000000 + 4 * page_size_v - 1));
+        SIREN_CHECK(!arena.contains_physical(0x100000000 + 4 * page_size_v));
+        SIREN_CHECK(arena.physical_address_of(end - 1) == 0x100000000 + 4 * page_size_v - 1);
+        SIREN_CHECK(arena.virtual_address_of(0x100000000 + page_size_v) == static_cast<uint8_t*>(region.base) + page_size_v);
+    }
+
+    // Random allocations and frees, checked against a model of the live blocks, then everything coalesces again.
+    void test_random_workload(size_t page_count) {
+        region_t region{ page_count };
+        buddy_arena arena;
+        SIREN_CHECK(arena.initialize(region.base, 0x100000000, region.page_count, region.page_states.data()).has_value());
+
+        auto* base = static_cast<uint8_t*>(region.base);
+        std::mt19937 rng{ 1 };
+        std::vector<std::pair<uint8_t*, size_t>> live;
+
+        for (size_t i = 0; i < 50000; ++i) {
+            if (live.empty() || rng() % 2) {
+                size_t requested = 1 + rng() % 8;
+                auto expt_block = arena.allocate(requested);
+                if (expt_block.has_value()) {
+                    auto* block = static_cast<uint8_t*>(expt_block.value());
+                    size_t block_pages = std::bit_ceil(requested);
+
+                    SIREN_CHECK(arena.contains(block) && arena.contains(block + block_pages * page_size_v - 1));
+                    SIREN_CHECK((block - base) / page_size_v % block_pages == 0);
+                    SIREN_CHECK(arena.virtual_address_of(arena.physical_address_of(block)) == block);
+                    for (auto& [other, other_pages] : live) {
+                        SIREN_CHECK(block + block_pages * page_size_v <= other || other + other_pages * page_size_v <= block);
+                    }
+
+                    live.emplace_back(block, block_pages);
+                }
+            } else {
+                size_t k = rng() % live.size();
+                arena.deallocate(live[k].first);
+                live.erase(live.begin() + static_cast<ptrdiff_t>(k));
+            }
+        }
+
+        for (auto& [block, block_pages] : live) {
+            arena.deallocate(block);
+        }
+
+        auto statistics = arena.get_statistics();
+        SIREN_CHECK(statistics.free_pages == page_count);
+        SIREN_CHECK(statistics.allocated_blocks == 0);
+
+        // the same cover initialize() started with
+        size_t free_block_count = 0;
+        for (auto count : statistics.free_blocks) {
+            free_block_count += count;
+        }
+        SIREN_CHECK(free_block_count == static_cast<size_t>(std::popcount(page_count)));
+        SIREN_CHECK(statistics.largest_free_block_pages == std::bit_floor(page_count));
+    }
+
+    // contiguous_arena puts its regions behind one lock and falls back to the kernel for what does not fit.
+    void test_contiguous_arena() {
+        siren::tests::reset_host_machine();
+
+        auto arena = std::make_unique<contiguous_arena>();
+        SIREN_CHECK(arena->allocate(page_size_v, ~uint64_t{ 0 }).has_error());     // nothing reserved yet
+        SIREN_CHECK(arena->reserve(contiguous_arena::region_size_v + page_size_v).has_error());
+        SIREN_CHECK(arena->reserve(2 * contiguous_arena::region_size_v).has_value());
+
+        auto expt_block = arena->allocate(3 * page_size_v, ~uint64_t{ 0 });
+        SIREN_CHECK(expt_block.has_value());
+        SIREN_CHECK(KeGetCurrentIrql() == PASSIVE_LEVEL);
+        SIREN_CHECK(expt_block.has_value() && arena->contains(expt_block.value()));
+
+        auto statistics = arena->get_statistics();
+        SIREN_CHECK(KeGetCurrentIrql() == PASSIVE_LEVEL);
+        SIREN_CHECK(statistics.region_count == 2);
+        SIREN_CHECK(statistics.allocated_blocks == 1);
+        SIREN_CHECK(statistics.free_pages == statistics.total_pages - 4);
+
+        // too large, or no region below the limit
+        SIREN_CHECK(arena->allocate(contiguous_arena::region_size_v + page_size_v, ~uint64_t{ 0 }).has_error());
+        SIREN_CHECK(arena->allocate(page_size_v, 0).has_error());
+        SIREN_CHECK(KeGetCurrentIrql() == PASSIVE_LEVEL);
+        SIREN_CHECK(arena->get_statistics().missed_allocations == 2);     // the one before reserve() does not count
+
+        int outside = 0;
+        SIREN_CHECK(!arena->deallocate(&outside));
+        SIREN_CHECK(arena->deallocate(expt_block.value()));
+        SIREN_CHECK(KeGetCurrentIrql() == PASSIVE_LEVEL);
+        SIREN_CHECK(arena->get_statistics().allocated_blocks == 0);
+
+        arena->release();
+        SIREN_CHECK(arena->get_statistics().region_count == 0);
+    }
+}
+
+int main() {
+    test_initialize_refuses_bad_regions();
+    test_odd_region_is_covered_by_aligned_blocks();
+    test_buddies_merge_back();
+    test_address_translation();
+    test_random_workload(512);
+    test_random_workload(1000);
+    test_random_workload(7);
+    test_contiguous_arena();
+    return siren::tests::check_result();
+}
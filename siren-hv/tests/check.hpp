@@ -0,0 +1,24 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+
+// Minimal checks for the host tests. A failed check is reported and the test keeps going, main() returns check_result().
+namespace siren::tests {
+    inline int check_failures = 0;
+
+    inline void check_failed(const char* file, int line, const char* expression) noexcept {
+        fprintf(stderr, "%s(%d): check failed: %s\n", file, line, expression);
+        ++check_failures;
+    }
+
+    [[nodiscard]]
+    inline int check_result() noexcept {
+        if (check_failures != 0) {
+            fprintf(stderr, "%d check(s) failed\n", check_failures);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+}
+
+#define SIREN_CHECK(expr) ((expr) ? (void)0 : ::siren::tests::check_failed(__FILE__, __LINE__, #expr))
@@ -0,0 +1,94 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "microsoft_hv/tlfs.hypercalls.hpp"
+#include <vector>
+
+using namespace siren::size_literals;
+using siren::microsoft_hv::gpa_page_range_t;
+using siren::microsoft_hv::append_gpa_page_ranges;
+using namespace siren::microsoft_hv::hypercalls;
+
+namespace {
+    uint64_t make_result(status_code_e status, uint32_t reps_completed) {
+        return result_value_t{ .semantics = { .result = status, .reserved0 = 0, .reps_completed = reps_completed } }.storage;
+    }
+
+    void test_append_gpa_page_ranges() {
+        gpa_page_range_t ranges[4];
+        size_t range_count = 0;
+
+        // unaligned at both ends, three pages touched
+        SIREN_CHECK(append_gpa_page_ranges(0x1fff, 0x1002, ranges, range_count, 4));
+        SIREN_CHECK(range_count == 1);
+        SIREN_CHECK(ranges[0].semantics.base_pfn == 1 && ranges[0].semantics.additional_pages == 2 && ranges[0].semantics.large_page == 0);
+
+        SIREN_CHECK(append_gpa_page_ranges(0x1000, 0, ranges, range_count, 4));
+        SIREN_CHECK(range_count == 1);
+
+        // one page more than a range holds
+        SIREN_CHECK(append_gpa_page_ranges(0x100000000, (gpa_page_range_t::max_page_count_v + 1) * 4_Kiuz, ranges, range_count, 4));
+        SIREN_CHECK(range_count == 3);
+        SIREN_CHECK(ranges[1].semantics.base_pfn == 0x100000 && ranges[1].semantics.additional_pages == gpa_page_range_t::max_page_count_v - 1);
+        SIREN_CHECK(ranges[2].semantics.base_pfn == 0x100000 + gpa_page_range_t::max_page_count_v && ranges[2].semantics.additional_pages == 0);
+
+        // 16MiB needs 4 more
+        SIREN_CHECK(!append_gpa_page_ranges(0, 16_Miuz, ranges, range_count, 4));
+    }
+
+    void test_flush_guest_physical_address_list() {
+        gpa_page_range_t ranges[3];
+        size_t range_count = 0;
+        SIREN_CHECK(append_gpa_page_ranges(0x5000, 0x1000, ranges, range_count, 3));
+        SIREN_CHECK(append_gpa_page_ranges(0x9000, 0x3000, ranges, range_count, 3));
+        SIREN_CHECK(append_gpa_page_ranges(0x20000, 0x1000, ranges, range_count, 3));
+
+        // the hypervisor stops after each rep
+        std::vector<input_value_t> calls;
+        siren::tests::host_machine.hypercall = [&](uint64_t input_value, const uint64_t* input_block, size_t input_qword_count) -> uint64_t {
+            calls.push_back(input_value_t{ .storage = input_value });
+            SIREN_CHECK(input_qword_count == 5);
+            SIREN_CHECK(input_block[0] == 0x7000 && input_block[1] == 0);
+            SIREN_CHECK(input_block[3] == ranges[1].storage);
+            return make_result(status_code_e::HV_STATUS_SUCCESS, calls.back().semantics.rep_start_index + 1u);
+        };
+
+        auto result_value = flush_guest_physical_address_list(0x7000, ranges, range_count);
+        SIREN_CHECK(result_value.semantics.result == status_code_e::HV_STATUS_SUCCESS && result_value.semantics.reps_completed == 3);
+        SIREN_CHECK(calls.size() == 3);
+        for (size_t i = 0; i < calls.size(); ++i) {
+            SIREN_CHECK(calls[i].semantics.call_code == call_code_e::HvCallFlushGuestPhysicalAddressList);
+            SIREN_CHECK(calls[i].semantics.fast == 1 && calls[i].semantics.rep_count == 3 && calls[i].semantics.rep_start_index == i);
+        }
+
+        // no progress, handed back as it is
+        calls.clear();
+        siren::tests::host_machine.hypercall = [&](uint64_t input_value, const uint64_t*, size_t) -> uint64_t {
+            calls.push_back(input_value_t{ .storage = input_value });
+            return make_result(status_code_e::HV_STATUS_SUCCESS, 1);
+        };
+        result_value = flush_guest_physical_address_list(0x7000, ranges, range_count);
+        SIREN_CHECK(result_value.semantics.reps_completed == 1 && calls.size() == 2);
+
+        calls.clear();
+        siren::tests::host_machine.hypercall = [&](uint64_t input_value, const uint64_t*, size_t) -> uint64_t {
+            calls.push_back(input_value_t{ .storage = input_value });
+            return make_result(status_code_e::HV_STATUS_INVALID_HYPERCALL_CODE, 0);
+        };
+        result_value = flush_guest_physical_address_list(0x7000, ranges, range_count);
+        SIREN_CHECK(result_value.semantics.result == status_code_e::HV_STATUS_INVALID_HYPERCALL_CODE && calls.size() == 1);
+
+        // more than one fast hypercall holds
+        gpa_page_range_t too_many[max_fast_gpa_page_range_count_v + 1] = {};
+        calls.clear();
+        result_value = flush_guest_physical_address_list(0x7000, too_many, max_fast_gpa_page_range_count_v + 1);
+        SIREN_CHECK(result_value.semantics.result == status_code_e::HV_STATUS_INVALID_PARAMETER && calls.empty());
+
+        siren::tests::reset_host_machine();
+    }
+}
+
+int main() {
+    test_append_gpa_page_ranges();
+    test_flush_guest_physical_address_list();
+    return siren::tests::check_result();
+}
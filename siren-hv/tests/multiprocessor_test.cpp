@@ -0,0 +1,182 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "multiprocessor.hpp"
+#include <wdm.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using siren::cpu_set;
+using siren::cpu_work_item_t;
+
+namespace {
+    void test_cpu_set() {
+        cpu_set cpus;
+        SIREN_CHECK(cpus.empty() && cpus.count() == 0);
+
+        cpus.insert(70);
+        cpus.insert(3);
+        cpus.insert(cpu_set::max_cpu_count_v - 1);
+        cpus.insert(cpu_set::max_cpu_count_v);      // ignored
+        SIREN_CHECK(cpus.count() == 3);
+        SIREN_CHECK(cpus.contains(3) && cpus.contains(70) && cpus.contains(cpu_set::max_cpu_count_v - 1));
+        SIREN_CHECK(!cpus.contains(4) && !cpus.contains(cpu_set::max_cpu_count_v));
+
+        std::vector<uint32_t> visited;
+        cpus.for_each([&visited](uint32_t cpu_index) noexcept { visited.push_back(cpu_index); });
+        SIREN_CHECK((visited == std::vector<uint32_t>{ 3, 70, cpu_set::max_cpu_count_v - 1 }));
+
+        cpus.erase(70);
+        cpus.erase(cpu_set::max_cpu_count_v + 5);
+        SIREN_CHECK(cpus.count() == 2 && !cpus.contains(70));
+
+        SIREN_CHECK(cpu_set::single(9).count() == 1 && cpu_set::single(9).contains(9));
+        SIREN_CHECK(cpu_set::active().count() == siren::tests::host_machine.processor_count);
+    }
+
+    void test_not_initialized() {
+        cpu_work_item_t item = { .next = nullptr, .fn = [](uintptr_t) noexcept { return uintptr_t{}; }, .arg = 0, .pending = nullptr };
+        SIREN_CHECK(siren::queue_cpu_work(0, item).error() == siren::nt_status_invalid_device_state_v);
+        SIREN_CHECK(siren::run_on_cpus_async(cpu_set::single(0), item.fn, 0).error() == siren::nt_status_invalid_device_state_v);
+    }
+
+    // Work for one cpu runs in the order it was queued, on that cpu, at DISPATCH_LEVEL.
+    void test_fifo_per_cpu() {
+        // aligned, the low bits of arg carry the item number
+        struct alignas(16) record_t {
+            uint32_t order[8];
+            uint32_t count;
+        } record = {};
+
+        auto fn = [](uintptr_t arg) noexcept -> uintptr_t {
+            auto* record = reinterpret_cast<record_t*>(arg & ~uintptr_t{ 0xf });
+            SIREN_CHECK(siren::current_cpu_index() == 2);
+            SIREN_CHECK(KeGetCurrentIrql() == DISPATCH_LEVEL);
+            record->order[record->count++] = static_cast<uint32_t>(arg & 0xf);
+            return 0;
+        };
+
+        std::atomic<uint32_t> pending = 5;
+        cpu_work_item_t items[5];
+        for (uint32_t i = 0; i < 5; ++i) {
+            items[i] = { .next = nullptr, .fn = fn, .arg = reinterpret_cast<uintptr_t>(&record) | i, .pending = &pending };
+            SIREN_CHECK(siren::queue_cpu_work(2, items[i]).has_value());
+        }
+
+        SIREN_CHECK(record.count == 0 && pending == 5);
+        SIREN_CHECK(siren::tests::run_queued_dpcs(1) == 0);
+        SIREN_CHECK(siren::tests::run_queued_dpcs(2) == 1);     // one DPC drains all of them
+
+        SIREN_CHECK(record.count == 5 && pending == 0);
+        for (uint32_t i = 0; i < record.count; ++i) {
+            SIREN_CHECK(record.order[i] == i);
+        }
+    }
+
+    void test_pending_count() {
+        static std::atomic<uint32_t> calls;
+        calls = 0;
+        auto fn = [](uintptr_t) noexcept -> uintptr_t { calls.fetch_add(1); return 0; };
+
+        cpu_set cpus;
+        cpus.insert(0);
+        cpus.insert(1);
+        cpus.insert(3);
+
+        auto expt_completion = siren::run_on_cpus_async(cpus, fn, 0);
+        SIREN_CHECK(expt_completion.has_value());
+        if (expt_completion.has_value()) {
+            auto& completion = expt_completion.value();
+            SIREN_CHECK(completion.get_pending_count() == 3 && !completion.is_done());
+
+            siren::tests::run_queued_dpcs(3);
+            SIREN_CHECK(completion.get_pending_count() == 2);
+            siren::tests::run_queued_dpcs(2);
+            SIREN_CHECK(completion.get_pending_count() == 2);
+            siren::tests::run_queued_dpcs(0);
+            siren::tests::run_queued_dpcs(1);
+            SIREN_CHECK(completion.is_done() && calls == 3);
+        }
+
+        // nothing to call, done from the start
+        auto expt_empty = siren::run_on_cpus_async(cpu_set{}, fn, 0);
+        SIREN_CHECK(expt_empty.has_value() && expt_empty.value().is_done());
+        SIREN_CHECK(siren::run_on_cpus(cpu_set{}, fn, 0).has_value());
+        SIREN_CHECK(calls == 3);
+    }
+
+    void test_cpus_without_a_queue() {
+        cpu_work_item_t item = { .next = nullptr, .fn = [](uintptr_t) noexcept { return uintptr_t{}; }, .arg = 0, .pending = nullptr };
+        uint32_t cpu_count = siren::tests::host_machine.processor_count;
+
+        SIREN_CHECK(siren::queue_cpu_work(cpu_count, item).error() == siren::nt_status_invalid_parameter_v);
+
+        // nothing is queued for the cpus that do have one
+        cpu_set cpus;
+        cpus.insert(0);
+        cpus.insert(cpu_count);
+        SIREN_CHECK(siren::run_on_cpus_async(cpus, item.fn, 0).error() == siren::nt_status_invalid_parameter_v);
+        SIREN_CHECK(siren::run_on_cpus(cpu_set::single(cpu_set::max_cpu_count_v - 1), item.fn, 0).error() == siren::nt_status_invalid_parameter_v);
+        SIREN_CHECK(siren::tests::run_queued_dpcs(0) == 0);
+    }
+
+    // Two cpus at DISPATCH_LEVEL call each other. Neither gets to run its DPC, each has to run the other's call while it waits.
+    void test_cpus_calling_each_other() {
+        static std::atomic<uint32_t> ran_on[2];
+        ran_on[0] = ran_on[1] = 0;
+
+        std::atomic<uint32_t> ready = 0;
+        std::vector<std::thread> threads;
+        for (uint32_t cpu = 0; cpu < 2; ++cpu) {
+            threads.emplace_back([&ready, cpu] {
+                siren::tests::set_current_processor(cpu);
+
+                KIRQL old_irql;
+                KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+                // both are at DISPATCH_LEVEL before either calls
+                ready.fetch_add(1);
+                while (ready.load() != 2) {
+                    std::this_thread::yield();
+                }
+
+                auto fn = [](uintptr_t) noexcept -> uintptr_t {
+                    ran_on[siren::current_cpu_index()].fetch_add(1);
+                    return 0;
+                };
+                SIREN_CHECK(siren::run_on_cpus(cpu_set::single(1 - cpu), fn, 0).has_value());
+
+                KeLowerIrql(old_irql);
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        SIREN_CHECK(ran_on[0] == 1 && ran_on[1] == 1);
+    }
+}
+
+int main() {
+    siren::tests::host_machine.processor_count = 4;
+    siren::tests::host_machine.defer_dpcs = true;
+
+    test_cpu_set();
+    test_not_initialized();
+
+    SIREN_CHECK(siren::initialize_cpu_work_queues().has_value());
+    SIREN_CHECK(siren::initialize_cpu_work_queues().error() == siren::nt_status_invalid_device_state_v);
+
+    test_fifo_per_cpu();
+    test_pending_count();
+    test_cpus_without_a_queue();
+    test_cpus_calling_each_other();
+
+    // runs the DPCs still queued for the cpus that drained their queue by hand
+    siren::release_cpu_work_queues();
+    test_not_initialized();
+
+    siren::tests::reset_host_machine();
+    return siren::tests::check_result();
+}
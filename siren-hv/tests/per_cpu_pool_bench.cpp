@@ -0,0 +1,70 @@
+#include "stubs/host_machine.hpp"
+#include "memory.hpp"
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// per_cpu_pool_bench
+// Allocates and frees batches of objects on 1 to 16 cpus at once, through a per_cpu_pool and through npaged_pool for comparison.
+// On the host npaged_pool is the C runtime heap, so the comparison only says how the magazines do against a general purpose allocator.
+namespace {
+    struct object_t {
+        uint64_t payload[8];
+    };
+
+    constexpr size_t iteration_count_v = 2000000;
+    constexpr size_t batch_size_v = 64;
+
+    template<typename AllocateFn, typename DeallocateFn>
+    double run(uint32_t cpu_count, AllocateFn&& allocate, DeallocateFn&& deallocate) {
+        std::vector<std::thread> threads;
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t cpu = 0; cpu < cpu_count; ++cpu) {
+            threads.emplace_back([&, cpu] {
+                siren::tests::set_current_processor(cpu);
+
+                object_t* objects[batch_size_v];
+                for (size_t i = 0; i < iteration_count_v / batch_size_v; ++i) {
+                    for (auto& object : objects) {
+                        object = allocate();
+                    }
+                    for (auto* object : objects) {
+                        deallocate(object);
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        // per allocate and deallocate pair, per cpu
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iteration_count_v;
+    }
+}
+
+int main() {
+    for (uint32_t cpu_count : { 1u, 2u, 4u, 8u, 16u }) {
+        siren::tests::host_machine.processor_count = cpu_count;
+
+        siren::per_cpu_pool<object_t> pool;
+        if (pool.initialize(cpu_count * 4096).has_error() || pool.refill(cpu_count * 4096 / pool.magazine_size_v).has_error()) {
+            fprintf(stderr, "per_cpu_pool setup failed\n");
+            return 1;
+        }
+
+        double pool_ns = run(cpu_count,
+            [&] { return pool.allocate().value(); },
+            [&](object_t* object) { pool.deallocate(object); });
+
+        double npaged_ns = run(cpu_count,
+            [] { return siren::allocator_new_uninitialized<object_t>(siren::npaged_pool).value(); },
+            [](object_t* object) { siren::allocator_delete<object_t>(siren::npaged_pool, object); });
+
+        printf("%2u cpus: per_cpu_pool %6.1f ns, npaged_pool %6.1f ns, allocation failures %llu\n",
+            cpu_count, pool_ns, npaged_ns, static_cast<unsigned long long>(pool.get_statistics().allocation_failures));
+    }
+    return 0;
+}
@@ -0,0 +1,258 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "memory.hpp"
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+using siren::per_cpu_pool;
+using siren::per_cpu_pool_allocator;
+
+namespace {
+    struct object_t {
+        uint64_t owner;
+        uint64_t payload[7];
+    };
+
+    constexpr size_t magazine_size_v = 4;
+
+    using pool_t = per_cpu_pool<object_t, magazine_size_v>;
+
+    void test_initialize_refuses_bad_capacity() {
+        siren::tests::reset_host_machine();
+
+        pool_t pool;
+        SIREN_CHECK(pool.initialize(0).has_error());
+        SIREN_CHECK(pool.initialize(64).has_value());
+        SIREN_CHECK(pool.initialize(64).has_error());      // once only
+
+        auto statistics = pool.get_statistics();
+        SIREN_CHECK(statistics.capacity == 64);
+        SIREN_CHECK(statistics.object_count == 0);
+        SIREN_CHECK(statistics.full_magazine_count == 0);
+    }
+
+    void test_allocate_fails_rather_than_grow() {
+        siren::tests::reset_host_machine();
+
+        pool_t pool;
+        SIREN_CHECK(pool.initialize(64).has_value());
+
+        auto expt_object = pool.allocate();
+        SIREN_CHECK(expt_object.has_error() && expt_object.error() == siren::nt_status_insufficient_resources_v);
+        SIREN_CHECK(pool.get_statistics().allocation_failures == 1);
+        SIREN_CHECK(pool.get_statistics().object_count == 0);
+    }
+
+    void test_refill_stops_at_capacity() {
+        siren::tests::reset_host_machine();
+
+        pool_t pool;
+        SIREN_CHECK(pool.initialize(3 * magazine_size_v).has_value());
+        SIREN_CHECK(pool.refill(2).has_value());
+        SIREN_CHECK(pool.get_statistics().full_magazine_count == 2);
+        SIREN_CHECK(pool.get_statistics().object_count == 2 * magazine_size_v);
+
+        auto expt_refill = pool.refill(4);
+        SIREN_CHECK(expt_refill.has_error() && expt_refill.error() == siren::nt_status_insufficient_resources_v);
+        SIREN_CHECK(pool.get_statistics().full_magazine_count == 3);
+        SIREN_CHECK(pool.get_statistics().object_count == 3 * magazine_size_v);
+    }
+
+    // Drains a cpu through its own magazines and then the depot, every object exactly once.
+    void test_allocates_every_object_once() {
+        siren::tests::reset_host_machine();
+
+        constexpr size_t magazine_count = 5;
+
+        pool_t pool;
+        SIREN_CHECK(pool.initialize(magazine_count * magazine_size_v).has_value());
+        SIREN_CHECK(pool.refill(magazine_count).has_value());
+
+        std::set<object_t*> objects;
+        for (size_t i = 0; i < magazine_count * magazine_size_v; ++i) {
+            auto expt_object = pool.allocate();
+            SIREN_CHECK(expt_object.has_value());
+            if (expt_object.has_value()) {
+                SIREN_CHECK(objects.insert(expt_object.value()).second);
+            }
+        }
+
+        SIREN_CHECK(pool.allocate().has_error());
+        SIREN_CHECK(pool.get_statistics().full_magazine_count == 0);
+
+        // freed objects fill the cpu's magazines first, then go to the depot as full magazines
+        for (auto* object : objects) {
+            pool.deallocate(object);
+        }
+        SIREN_CHECK(pool.get_statistics().full_magazine_count == magazine_count - 2);
+        SIREN_CHECK(pool.get_statistics().object_count == magazine_count * magazine_size_v);
+
+        for (size_t i = 0; i < magazine_count * magazine_size_v; ++i) {
+            auto expt_object = pool.allocate();
+            SIREN_CHECK(expt_object.has_value() && objects.contains(expt_object.value()));
+        }
+
+        // the pool only frees the objects it holds
+        for (auto* object : objects) {
+            pool.deallocate(object);
+        }
+    }
+
+    // Objects freed on another cpu are cached there and reach the first cpu through the depot.
+    void test_objects_move_between_cpus() {
+        siren::tests::reset_host_machine();
+        siren::tests::host_machine.processor_count = 2;
+
+        pool_t pool;
+        SIREN_CHECK(pool.initialize(4 * magazine_size_v).has_value());
+        SIREN_CHECK(pool.refill(4).has_value());
+
+        std::vector<object_t*> objects;
+        for (size_t i = 0; i < 4 * magazine_size_v; ++i) {
+            objects.push_back(pool.allocate().value());
+        }
+
+        siren::tests::set_current_processor(1);
+        for (auto* object : objects) {
+            pool.deallocate(object);
+        }
+        SIREN_CHECK(pool.get_statistics().full_magazine_count == 2);
+
+        siren::tests::set_current_processor(0);
+        objects.clear();
+        for (size_t i = 0; i < 2 * magazine_size_v; ++i) {
+            auto expt_object = pool.allocate();
+            SIREN_CHECK(expt_object.has_value());
+            if (expt_object.has_value()) {
+                objects.push_back(expt_object.value());
+            }
+        }
+        SIREN_CHECK(pool.allocate().has_error());       // the rest stays in the magazines of cpu 1
+
+        for (auto* object : objects) {
+            pool.deallocate(object);
+        }
+
+        siren::tests::reset_host_machine();
+    }
+
+    void test_trim_leaves_cpu_caches_alone() {
+        siren::tests::reset_host_machine();
+
+        pool_t pool;
+        SIREN_CHECK(pool.initialize(6 * magazine_size_v).has_value());
+        SIREN_CHECK(pool.refill(6).has_value());
+
+        // cpu 0 loads one full magazine and keeps one object of it
+        auto* object = pool.allocate().value();
+
+        pool.trim(1);
+        auto statistics = pool.get_statistics();
+        SIREN_CHECK(statistics.full_magazine_count == 1);
+        SIREN_CHECK(statistics.object_count == 2 * magazine_size_v);
+
+        pool.deallocate(object);
+        pool.trim(0);
+        SIREN_CHECK(pool.get_statistics().object_count == magazine_size_v);
+
+        // room for new objects again
+        SIREN_CHECK(pool.refill(5).has_value());
+        SIREN_CHECK(pool.get_statistics().object_count == 6 * magazine_size_v);
+    }
+
+    void test_allocate_unique_goes_through_the_pool() {
+        siren::tests::reset_host_machine();
+
+        pool_t pool;
+        SIREN_CHECK(pool.initialize(magazine_size_v).has_value());
+        SIREN_CHECK(pool.refill(1).has_value());
+
+        per_cpu_pool_allocator<object_t, magazine_size_v> allocator{ pool };
+        {
+            auto expt_object = siren::allocate_unique<object_t>(allocator, object_t{ .owner = 42, .payload = {} });
+            SIREN_CHECK(expt_object.has_value());
+            SIREN_CHECK(expt_object.has_value() && expt_object.value()->owner == 42);
+            SIREN_CHECK(allocator.allocate(2).has_error());
+        }
+
+        // the unique_ptr gave its object back
+        std::vector<object_t*> objects;
+        for (size_t i = 0; i < magazine_size_v; ++i) {
+            objects.push_back(pool.allocate().value());
+        }
+        SIREN_CHECK(pool.allocate().has_error());
+        for (auto* object : objects) {
+            pool.deallocate(object);
+        }
+    }
+
+    // Every host thread plays its own cpu, objects are tagged to catch one handed out twice.
+    void test_concurrent_cpus_never_share_an_object() {
+        siren::tests::reset_host_machine();
+
+        constexpr uint32_t cpu_count = 4;
+        constexpr size_t batch_size = 3 * magazine_size_v;
+        constexpr size_t round_count = 20000;
+
+        siren::tests::host_machine.processor_count = cpu_count;
+
+        pool_t pool;
+        SIREN_CHECK(pool.initialize(cpu_count * 4 * batch_size).has_value());
+        SIREN_CHECK(pool.refill(cpu_count * 4 * batch_size / magazine_size_v).has_value());
+
+        std::atomic<uint64_t> collisions = 0;
+        std::atomic<uint64_t> failures = 0;
+        std::vector<std::thread> threads;
+
+        for (uint32_t cpu = 0; cpu < cpu_count; ++cpu) {
+            threads.emplace_back([&, cpu] {
+                siren::tests::set_current_processor(cpu);
+
+                object_t* objects[batch_size];
+                for (size_t round = 0; round < round_count; ++round) {
+                    size_t count = 0;
+                    for (; count < batch_size; ++count) {
+                        auto expt_object = pool.allocate();
+                        if (expt_object.has_error()) {
+                            failures.fetch_add(1, std::memory_order_relaxed);
+                            break;
+                        }
+                        objects[count] = expt_object.value();
+                        objects[count]->owner = cpu + 1;
+                    }
+
+                    for (size_t i = 0; i < count; ++i) {
+                        if (objects[i]->owner != cpu + 1) {
+                            collisions.fetch_add(1, std::memory_order_relaxed);
+                        }
+                        pool.deallocate(objects[i]);
+                    }
+                }
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        SIREN_CHECK(collisions == 0);
+        SIREN_CHECK(failures == 0);
+        SIREN_CHECK(pool.get_statistics().object_count == cpu_count * 4 * batch_size);
+
+        siren::tests::reset_host_machine();
+    }
+}
+
+int main() {
+    test_initialize_refuses_bad_capacity();
+    test_allocate_fails_rather_than_grow();
+    test_refill_stops_at_capacity();
+    test_allocates_every_object_once();
+    test_objects_move_between_cpus();
+    test_trim_leaves_cpu_caches_alone();
+    test_allocate_unique_goes_through_the_pool();
+    test_concurrent_cpus_never_share_an_object();
+    return siren::tests::check_result();
+}
@@ -0,0 +1,189 @@
+#include "check.hpp"
+#include "memory.hpp"
+#include "size_class_pool.hpp"
+#include "synchronization.hpp"
+#include <bit>
+#include <set>
+#include <utility>
+#include <vector>
+
+using siren::size_class_count_v;
+using siren::size_class_statistics_t;
+
+namespace {
+    // npaged_allocator of host_memory.cpp, counting what is out
+    struct counting_page_source {
+        static inline size_t pages;
+        static inline size_t nodes;
+        static inline bool fail_nodes;
+
+        [[nodiscard]]
+        static siren::expected<void*, siren::nt_status> allocate(std::size_t size, std::align_val_t alignment) noexcept {
+            bool page = size == 4096 && std::to_underlying(alignment) == 4096;
+            if (!page && fail_nodes) {
+                return siren::unexpected{ siren::nt_status_insufficient_resources_v };
+            }
+
+            auto expt = siren::npaged_allocator<void>::allocate(size, alignment);
+            if (expt.has_value()) {
+                ++(page ? pages : nodes);
+            }
+            return expt;
+        }
+
+        static void deallocate(void* ptr, std::size_t size, std::align_val_t alignment) noexcept {
+            bool page = size == 4096 && std::to_underlying(alignment) == 4096;
+            --(page ? pages : nodes);
+            siren::npaged_allocator<void>::deallocate(ptr, size, alignment);
+        }
+    };
+
+    using pool_t = siren::size_class_pool<counting_page_source, siren::spin_lock>;
+
+    constexpr std::align_val_t align(size_t alignment) noexcept {
+        return std::align_val_t{ alignment };
+    }
+
+    void test_eligibility() {
+        SIREN_CHECK(!pool_t::is_eligible(64, align(8)));
+        SIREN_CHECK(!pool_t::is_eligible(64, align(16)));      // the pool aligns that much by itself
+        SIREN_CHECK(pool_t::is_eligible(64, align(32)));
+        SIREN_CHECK(pool_t::is_eligible(1, align(2048)));
+        SIREN_CHECK(!pool_t::is_eligible(1, align(4096)));
+        SIREN_CHECK(pool_t::is_eligible(2048, align(64)));
+        SIREN_CHECK(!pool_t::is_eligible(2049, align(64)));
+    }
+
+    // Each (size, alignment) pair goes to the smallest slot that holds the size and is as aligned.
+    void test_class_index_of() {
+        for (size_t alignment = 32; alignment < 4096; alignment *= 2) {
+            for (size_t size = 0; size <= pool_t::max_slot_size_v; ++size) {
+                if (!pool_t::is_eligible(size, align(alignment))) {
+                    continue;
+                }
+
+                size_t index = pool_t::class_index_of(size, align(alignment));
+                size_t slot_size = pool_t::min_slot_size_v << index;
+
+                SIREN_CHECK(index < size_class_count_v);
+                SIREN_CHECK(slot_size >= size && slot_size >= alignment);
+                SIREN_CHECK(index == 0 || (slot_size / 2 < size || slot_size / 2 < alignment));
+            }
+        }
+
+        SIREN_CHECK(pool_t::class_index_of(0, align(32)) == 0);
+        SIREN_CHECK(pool_t::class_index_of(33, align(32)) == 1);
+        SIREN_CHECK(pool_t::class_index_of(8, align(256)) == 3);
+        SIREN_CHECK(pool_t::class_index_of(300, align(64)) == 4);
+        SIREN_CHECK(pool_t::class_index_of(2048, align(2048)) == size_class_count_v - 1);
+    }
+
+    // A page yields page_size_v / slot_size slots, each at a multiple of its slot size, then a second page is carved.
+    void test_slot_alignment() {
+        pool_t pool;
+
+        for (size_t index = 0; index < size_class_count_v; ++index) {
+            size_t slot_size = pool_t::min_slot_size_v << index;
+            size_t slots_per_page = pool_t::page_size_v / slot_size;
+
+            std::set<void*> slots;
+            for (size_t i = 0; i < slots_per_page + 1; ++i) {
+                auto expt_slot = pool.allocate(index);
+                SIREN_CHECK(expt_slot.has_value());
+                if (expt_slot.has_value()) {
+                    SIREN_CHECK(reinterpret_cast<uintptr_t>(expt_slot.value()) % slot_size == 0);
+                    slots.insert(expt_slot.value());
+                }
+            }
+            SIREN_CHECK(slots.size() == slots_per_page + 1);
+
+            for (void* slot : slots) {
+                pool.deallocate(slot, index);
+            }
+        }
+
+        SIREN_CHECK(counting_page_source::pages == 2 * size_class_count_v);
+        SIREN_CHECK(pool.release());
+        SIREN_CHECK(counting_page_source::pages == 0 && counting_page_source::nodes == 0);
+    }
+
+    void test_reuse_after_free() {
+        pool_t pool;
+
+        auto expt_first = pool.allocate(2);
+        auto expt_second = pool.allocate(2);
+        SIREN_CHECK(expt_first.has_value() && expt_second.has_value());
+
+        // last freed, first handed out
+        pool.deallocate(expt_first.value(), 2);
+        auto expt_again = pool.allocate(2);
+        SIREN_CHECK(expt_again.has_value() && expt_again.value() == expt_first.value());
+        SIREN_CHECK(counting_page_source::pages == 1);
+
+        pool.deallocate(expt_again.value(), 2);
+        pool.deallocate(expt_second.value(), 2);
+        SIREN_CHECK(pool.release());
+    }
+
+    void test_statistics() {
+        pool_t pool;
+        size_class_statistics_t statistics[size_class_count_v];
+
+        std::vector<void*> slots;
+        for (size_t i = 0; i < 3; ++i) {
+            slots.push_back(pool.allocate(1).value());
+        }
+        pool.deallocate(slots.back(), 1);
+        slots.pop_back();
+        slots.push_back(pool.allocate(1).value());
+        pool.deallocate(slots.back(), 1);
+        slots.pop_back();
+
+        pool.query(statistics);
+        for (size_t i = 0; i < size_class_count_v; ++i) {
+            SIREN_CHECK(statistics[i].slot_size == pool_t::min_slot_size_v << i);
+        }
+        SIREN_CHECK(statistics[1].page_count == 1);
+        SIREN_CHECK(statistics[1].used_slots == 2);
+        SIREN_CHECK(statistics[1].peak_used_slots == 3);
+        SIREN_CHECK(statistics[1].allocation_count == 4);
+        SIREN_CHECK(statistics[0].page_count == 0 && statistics[0].allocation_count == 0);
+
+        // a slot still in use is reported, the pages go back all the same
+        SIREN_CHECK(!pool.release());
+        SIREN_CHECK(counting_page_source::pages == 0 && counting_page_source::nodes == 0);
+
+        pool.query(statistics);
+        SIREN_CHECK(statistics[1].page_count == 0 && statistics[1].used_slots == 0 && statistics[1].allocation_count == 0);
+
+        // usable again after release()
+        auto expt_slot = pool.allocate(1);
+        SIREN_CHECK(expt_slot.has_value() && counting_page_source::pages == 1);
+        pool.deallocate(expt_slot.value(), 1);
+        SIREN_CHECK(pool.release());
+    }
+
+    void test_page_source_failure() {
+        pool_t pool;
+
+        counting_page_source::fail_nodes = true;
+        SIREN_CHECK(pool.allocate(0).error() == siren::nt_status_insufficient_resources_v);
+        SIREN_CHECK(counting_page_source::pages == 0);     // the page is given back
+        counting_page_source::fail_nodes = false;
+
+        size_class_statistics_t statistics[size_class_count_v];
+        pool.query(statistics);
+        SIREN_CHECK(statistics[0].page_count == 0 && statistics[0].allocation_count == 0);
+        SIREN_CHECK(pool.release());
+    }
+}
+
+int main() {
+    test_eligibility();
+    test_class_index_of();
+    test_slot_alignment();
+    test_reuse_after_free();
+    test_statistics();
+    test_page_source_failure();
+    return siren::tests::check_result();
+}
@@ -0,0 +1,74 @@
+#include "host_machine.hpp"
+#include "x86/segmentation.hpp"
+#include "x86/intel_vmx.hpp"
+#include "vmx/siren_hypercalls.hpp"
+#include "vmx/mshv_vmexit_handler.hpp"
+
+// Stand-ins for the MASM routines of siren.
+namespace siren::x86 {
+    template<segment_register_e SegmentReg>
+    segment_selector_t read_segment_selector() noexcept {
+        return {};
+    }
+
+    template segment_selector_t read_segment_selector<segment_register_e::CS>() noexcept;
+    template segment_selector_t read_segment_selector<segment_register_e::SS>() noexcept;
+    template segment_selector_t read_segment_selector<segment_register_e::DS>() noexcept;
+    template segment_selector_t read_segment_selector<segment_register_e::ES>() noexcept;
+    template segment_selector_t read_segment_selector<segment_register_e::FS>() noexcept;
+    template segment_selector_t read_segment_selector<segment_register_e::GS>() noexcept;
+    template segment_selector_t read_segment_selector<segment_register_e::LDTR>() noexcept;
+    template segment_selector_t read_segment_selector<segment_register_e::TR>() noexcept;
+
+    segment_limit_t read_segment_unscrambled_limit(segment_selector_t) noexcept {
+        return 0xfffff000;
+    }
+
+    segment_access_rights_t read_segment_access_rights(segment_selector_t) noexcept {
+        return {};
+    }
+
+    vmx_result_t vmx_invept() noexcept {
+        return vmx_result_success_v;
+    }
+
+    vmx_result_t vmx_invept(paddr_t) noexcept {
+        return vmx_result_success_v;
+    }
+}
+
+namespace siren::vmx {
+    namespace siren_hypercalls {
+        namespace {
+            void issue(uint32_t function_id) noexcept {
+                if (tests::host_machine.siren_hypercall) {
+                    tests::host_machine.siren_hypercall(function_id);
+                }
+            }
+        }
+
+        void turn_off_vm() noexcept {
+            issue(1);
+        }
+
+        void ept_flush() noexcept {
+            issue(8);
+        }
+
+        void suspend_vm() noexcept {
+            issue(9);
+        }
+    }
+
+    void mshv_vmexit_handler::entry_point() noexcept {}
+
+    microsoft_hv::hypercalls::result_value_t mshv_vmexit_handler::microsoft_hypercall(const void*, microsoft_hv::hypercalls::input_value_t input_value, microsoft_hv::gpa_t, microsoft_hv::gpa_t) noexcept {
+        auto& hypercall = tests::host_machine.guest_hypercall;
+        return { .storage = hypercall ? hypercall(input_value.storage, nullptr) : 0 };
+    }
+
+    microsoft_hv::hypercalls::result_value_t mshv_vmexit_handler::microsoft_fast_hypercall_ex(const void*, microsoft_hv::hypercalls::input_value_t input_value, void* guest_state) noexcept {
+        auto& hypercall = tests::host_machine.guest_hypercall;
+        return { .storage = hypercall ? hypercall(input_value.storage, static_cast<guest_state_t*>(guest_state)) : 0 };
+    }
+}
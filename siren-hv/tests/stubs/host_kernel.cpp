@@ -0,0 +1,392 @@
+#include "host_machine.hpp"
+#include <wdm.h>
+#include <intrin.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Just enough of the kernel, the intrinsics and the assembly routines of siren to link it into host tests.
+namespace siren::tests {
+    namespace {
+        thread_local uint32_t current_processor = 0;
+        thread_local KIRQL current_irql = PASSIVE_LEVEL;
+
+        struct dpc_t {
+            PKDEFERRED_ROUTINE routine;
+            PVOID context;
+            uint32_t target;
+            bool queued;
+        };
+
+        static_assert(sizeof(dpc_t) <= sizeof(KDPC));
+
+        // DPCs deferred by host_machine.defer_dpcs, in queueing order.
+        std::mutex deferred_dpcs_lock;
+        std::deque<PRKDPC> deferred_dpcs;
+
+        // Runs `fn` as processor `index` at `irql`, then goes back to what the thread played before.
+        template<typename Fn>
+        auto run_as(uint32_t index, KIRQL irql, Fn&& fn) {
+            auto previous_processor = std::exchange(current_processor, index);
+            auto previous_irql = std::exchange(current_irql, irql);
+            auto retval = fn();
+            current_processor = previous_processor;
+            current_irql = previous_irql;
+            return retval;
+        }
+
+        uint64_t monotonic_ns() noexcept {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void* allocate_pages(size_t size) noexcept {
+            size = (size + PAGE_SIZE - 1) & ~size_t{ PAGE_SIZE - 1 };
+            void* p = aligned_alloc(PAGE_SIZE, size);
+            if (p) {
+                memset(p, 0, size);
+            }
+            return p;
+        }
+
+        // 4-level page tables of the kernel half, identity mapped like the rest of host memory. They only cover reserved
+        // mapping addresses, down to empty PTEs, which is all guest_mapping_window looks for. Never freed, CR3 keeps them reachable.
+        uint64_t* kernel_page_table_root() noexcept {
+            static auto* root = static_cast<uint64_t*>(allocate_pages(PAGE_SIZE));
+            return root;
+        }
+
+        void reserve_page_tables(uintptr_t va) noexcept {
+            constexpr uint64_t present_writable_v = 0x3;
+            auto* table = kernel_page_table_root();
+            for (int level = 4; level > 1; --level) {
+                auto& entry = table[(va >> (12 + 9 * (level - 1))) & 0x1ffu];
+                if ((entry & present_writable_v) == 0) {
+                    entry = reinterpret_cast<uintptr_t>(allocate_pages(PAGE_SIZE)) | present_writable_v;
+                }
+                table = reinterpret_cast<uint64_t*>(entry & ~uint64_t{ PAGE_SIZE - 1 });
+            }
+        }
+
+        constexpr uint32_t ia32_efer_v = 0xc0000080;
+    }
+
+    uint64_t read_default_msr(uint32_t address) noexcept {
+        // IA-32e mode with NX, as Windows runs
+        return address == ia32_efer_v ? (1u << 8u | 1u << 10u | 1u << 11u) : 0;
+    }
+
+    void set_current_processor(uint32_t index) noexcept {
+        current_processor = index;
+    }
+
+    size_t run_queued_dpcs(uint32_t index) noexcept {
+        size_t count = 0;
+        for (;;) {
+            PRKDPC dpc = nullptr;
+            {
+                std::lock_guard guard{ deferred_dpcs_lock };
+                for (auto it = deferred_dpcs.begin(); it != deferred_dpcs.end(); ++it) {
+                    if (reinterpret_cast<dpc_t*>(*it)->target == index) {
+                        dpc = *it;
+                        deferred_dpcs.erase(it);
+                        reinterpret_cast<dpc_t*>(dpc)->queued = false;
+                        break;
+                    }
+                }
+            }
+
+            if (dpc == nullptr) {
+                return count;
+            }
+
+            auto* p = reinterpret_cast<dpc_t*>(dpc);
+            run_as(index, DISPATCH_LEVEL, [&] {
+                p->routine(dpc, p->context, nullptr, nullptr);
+                return 0;
+            });
+            ++count;
+        }
+    }
+
+    void reset_host_machine() noexcept {
+        host_machine.processor_count = 1;
+        host_machine.read_msr = nullptr;
+        host_machine.write_msr = nullptr;
+        host_machine.cpuid = nullptr;
+        host_machine.hypercall = nullptr;
+        host_machine.guest_hypercall = nullptr;
+        host_machine.siren_hypercall = nullptr;
+        host_machine.physical_memory_ranges.clear();
+        host_machine.defer_dpcs = false;
+        host_machine.debugger_breaks = 0;
+        current_processor = 0;
+        current_irql = PASSIVE_LEVEL;
+    }
+}
+
+using siren::tests::host_machine;
+
+extern "C" {
+    KIRQL KeGetCurrentIrql() {
+        return siren::tests::current_irql;
+    }
+
+    void KeRaiseIrql(KIRQL new_irql, PKIRQL old_irql) {
+        *old_irql = std::exchange(siren::tests::current_irql, new_irql);
+    }
+
+    // Dropping below DISPATCH_LEVEL runs what was deferred for this processor meanwhile.
+    void KeLowerIrql(KIRQL new_irql) {
+        siren::tests::current_irql = new_irql;
+        if (new_irql < DISPATCH_LEVEL && host_machine.defer_dpcs) {
+            siren::tests::run_queued_dpcs(siren::tests::current_processor);
+        }
+    }
+
+    ULONG KeGetCurrentProcessorNumberEx(PPROCESSOR_NUMBER processor_number) {
+        if (processor_number) {
+            *processor_number = { .Group = 0, .Number = static_cast<UCHAR>(siren::tests::current_processor), .Reserved = 0 };
+        }
+        return siren::tests::current_processor;
+    }
+
+    ULONG KeQueryActiveProcessorCountEx(USHORT) {
+        return host_machine.processor_count;
+    }
+
+    NTSTATUS KeGetProcessorNumberFromIndex(ULONG index, PPROCESSOR_NUMBER processor_number) {
+        if (index >= host_machine.processor_count) {
+            return STATUS_INVALID_PARAMETER;
+        }
+        *processor_number = { .Group = 0, .Number = static_cast<UCHAR>(index), .Reserved = 0 };
+        return STATUS_SUCCESS;
+    }
+
+    USHORT KeGetCurrentNodeNumber() {
+        return 0;
+    }
+
+    // The affinity migrates the thread at once, the previous processor is kept in the reserved words.
+    void KeSetSystemGroupAffinityThread(PGROUP_AFFINITY affinity, PGROUP_AFFINITY previous_affinity) {
+        if (previous_affinity) {
+            *previous_affinity = { .Mask = KAFFINITY{ 1 } << siren::tests::current_processor, .Group = 0, .Reserved = {} };
+        }
+        siren::tests::current_processor = static_cast<uint32_t>(std::countr_zero(affinity->Mask));
+    }
+
+    void KeRevertToUserGroupAffinityThread(PGROUP_AFFINITY previous_affinity) {
+        siren::tests::current_processor = static_cast<uint32_t>(std::countr_zero(previous_affinity->Mask));
+    }
+
+    ULONG_PTR KeIpiGenericCall(PKIPI_BROADCAST_WORKER worker, ULONG_PTR context) {
+        ULONG_PTR retval = 0;
+        for (uint32_t i = 0; i < host_machine.processor_count; ++i) {
+            retval = siren::tests::run_as(i, IPI_LEVEL, [&] { return worker(context); });
+        }
+        return retval;
+    }
+
+    void KeInitializeDpc(PRKDPC dpc, PKDEFERRED_ROUTINE routine, PVOID context) {
+        auto* p = reinterpret_cast<siren::tests::dpc_t*>(dpc);
+        *p = { .routine = routine, .context = context, .target = siren::tests::current_processor, .queued = false };
+    }
+
+    void KeSetImportanceDpc(PRKDPC, KDPC_IMPORTANCE) {}
+
+    NTSTATUS KeSetTargetProcessorDpcEx(PKDPC dpc, PPROCESSOR_NUMBER processor_number) {
+        reinterpret_cast<siren::tests::dpc_t*>(dpc)->target = processor_number->Number;
+        return STATUS_SUCCESS;
+    }
+
+    BOOLEAN KeInsertQueueDpc(PRKDPC dpc, PVOID argument1, PVOID argument2) {
+        auto* p = reinterpret_cast<siren::tests::dpc_t*>(dpc);
+
+        // deferred DPCs drop their arguments, siren passes none
+        if (host_machine.defer_dpcs) {
+            std::lock_guard guard{ siren::tests::deferred_dpcs_lock };
+            if (p->queued) {
+                return FALSE;
+            }
+            p->queued = true;
+            siren::tests::deferred_dpcs.push_back(dpc);
+            return TRUE;
+        }
+
+        return siren::tests::run_as(p->target, DISPATCH_LEVEL, [&] {
+            p->routine(dpc, p->context, argument1, argument2);
+            return BOOLEAN{ TRUE };
+        });
+    }
+
+    void KeFlushQueuedDpcs() {
+        for (uint32_t i = 0; i < host_machine.processor_count; ++i) {
+            siren::tests::run_queued_dpcs(i);
+        }
+    }
+
+    LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER frequency) {
+        if (frequency) {
+            frequency->QuadPart = 1'000'000'000;
+        }
+        return LARGE_INTEGER{ .QuadPart = static_cast<LONGLONG>(siren::tests::monotonic_ns()) };
+    }
+
+    ULONGLONG KeQueryInterruptTime() {
+        return siren::tests::monotonic_ns() / 100;
+    }
+
+    // Host threads cannot be suspended by kernel APCs, a critical region changes nothing.
+    void KeEnterCriticalRegion() {}
+    void KeLeaveCriticalRegion() {}
+
+    // A push lock is a word that is 0 when free, waiters give the host scheduler their time slice.
+    void ExAcquirePushLockExclusiveEx(PEX_PUSH_LOCK push_lock, ULONG) {
+        std::atomic_ref<ULONG_PTR> value{ *push_lock };
+        for (ULONG_PTR expected = 0; !value.compare_exchange_weak(expected, 1, std::memory_order_acquire); expected = 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    void ExReleasePushLockExclusiveEx(PEX_PUSH_LOCK push_lock, ULONG) {
+        std::atomic_ref<ULONG_PTR>{ *push_lock }.store(0, std::memory_order_release);
+    }
+
+    PVOID MmAllocateContiguousMemory(SIZE_T size, PHYSICAL_ADDRESS) {
+        return siren::tests::allocate_pages(size);
+    }
+
+    void MmFreeContiguousMemory(PVOID p) {
+        free(p);
+    }
+
+    // Host memory is identity mapped.
+    PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID p) {
+        return PHYSICAL_ADDRESS{ .QuadPart = static_cast<LONGLONG>(reinterpret_cast<uintptr_t>(p)) };
+    }
+
+    PVOID MmGetVirtualForPhysical(PHYSICAL_ADDRESS physical_address) {
+        return reinterpret_cast<PVOID>(static_cast<uintptr_t>(physical_address.QuadPart));
+    }
+
+    // Allocated with malloc, like what ExFreePool is given on the host.
+    PPHYSICAL_MEMORY_RANGE MmGetPhysicalMemoryRanges() {
+        std::vector<std::pair<uint64_t, uint64_t>> ranges = host_machine.physical_memory_ranges;
+        if (ranges.empty()) {
+            ranges.emplace_back(0, uint64_t{ 1 } << 47);     // the user half, where host allocations live
+        }
+
+        auto* p = static_cast<PPHYSICAL_MEMORY_RANGE>(calloc(ranges.size() + 1, sizeof(PHYSICAL_MEMORY_RANGE)));
+        for (size_t i = 0; p && i < ranges.size(); ++i) {
+            p[i].BaseAddress.QuadPart = static_cast<LONGLONG>(ranges[i].first);
+            p[i].NumberOfBytes.QuadPart = static_cast<LONGLONG>(ranges[i].second);
+        }
+        return p;
+    }
+
+    void ExFreePool(PVOID p) {
+        free(p);
+    }
+
+    PVOID MmAllocateMappingAddress(SIZE_T size, ULONG) {
+        auto* p = static_cast<uint8_t*>(siren::tests::allocate_pages(size));
+        for (SIZE_T offset = 0; p && offset < size; offset += PAGE_SIZE) {
+            siren::tests::reserve_page_tables(reinterpret_cast<uintptr_t>(p + offset));
+        }
+        return p;
+    }
+
+    void MmFreeMappingAddress(PVOID p, ULONG) {
+        free(p);
+    }
+
+    // A system thread is a std::thread, its handle a pointer to it.
+    NTSTATUS PsCreateSystemThread(PHANDLE handle, ULONG, POBJECT_ATTRIBUTES, HANDLE, PVOID, PKSTART_ROUTINE routine, PVOID context) {
+        *handle = new std::thread{ routine, context };
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS PsTerminateSystemThread(NTSTATUS) {
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS ZwWaitForSingleObject(HANDLE handle, BOOLEAN, PLARGE_INTEGER) {
+        static_cast<std::thread*>(handle)->join();
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS ZwClose(HANDLE handle) {
+        delete static_cast<std::thread*>(handle);
+        return STATUS_SUCCESS;
+    }
+
+    void DbgBreakPoint() {
+        ++host_machine.debugger_breaks;
+    }
+
+    void DbgRaiseAssertionFailure() {
+        abort();
+    }
+
+    UINT64 HvlInvokeFastExtendedHypercall(UINT64 input_value, PVOID input_block, ULONG input_block_size, PVOID, ULONG) {
+        return host_machine.hypercall ? host_machine.hypercall(input_value, static_cast<const uint64_t*>(input_block), input_block_size / sizeof(uint64_t)) : 0;
+    }
+
+    uint64_t __readmsr(unsigned long address) {
+        return host_machine.read_msr ? host_machine.read_msr(static_cast<uint32_t>(address)) : siren::tests::read_default_msr(static_cast<uint32_t>(address));
+    }
+
+    void __writemsr(unsigned long address, uint64_t value) {
+        if (host_machine.write_msr) {
+            host_machine.write_msr(static_cast<uint32_t>(address), value);
+        }
+    }
+
+    void __cpuidex(int* registers, int leaf, int subleaf) {
+        uint32_t values[4] = {};
+        if (host_machine.cpuid) {
+            host_machine.cpuid(static_cast<uint32_t>(leaf), static_cast<uint32_t>(subleaf), values);
+        }
+        memcpy(registers, values, sizeof(values));
+    }
+
+    void __cpuid(int* registers, int leaf) {
+        __cpuidex(registers, leaf, 0);
+    }
+
+    // Paging is on with the kernel page tables above. Other control, debug and descriptor table registers read zero and ignore writes.
+    uint64_t __readcr0() { return 1u << 0u | 1u << 31u; }
+    uint64_t __readcr3() { return reinterpret_cast<uintptr_t>(siren::tests::kernel_page_table_root()); }
+    uint64_t __readcr4() { return 1u << 5u; }
+    void __writecr0(uint64_t) {}
+    void __writecr3(uint64_t) {}
+    void __writecr4(uint64_t) {}
+    uint64_t __readdr(unsigned) { return 0; }
+    void _sgdt(void* p) { memset(p, 0, 10); }
+    void _lgdt(void*) {}
+    void __sidt(void* p) { memset(p, 0, 10); }
+    void __lidt(void*) {}
+    void __invlpg(void*) {}
+
+    // VMX instructions succeed without doing anything.
+    unsigned char __vmx_on(uint64_t*) { return 0; }
+    unsigned char __vmx_vmclear(uint64_t*) { return 0; }
+    unsigned char __vmx_vmlaunch() { return 0; }
+    void __vmx_off() {}
+
+    void* _AddressOfReturnAddress() { return __builtin_frame_address(0); }
+    void* _ReturnAddress() { return __builtin_return_address(0); }
+
+    // Host threads are preempted by the host scheduler, let it run the one we are waiting for.
+    void YieldProcessor() {
+        std::this_thread::yield();
+    }
+}
+
+void _disable() {}
+void _enable() {}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "vmx/guest_state.hpp"
+
+// The machine that the kernel and intrinsic stubs in host_kernel.cpp pretend to run on.
+// Each host thread plays one processor at a time, PASSIVE_LEVEL on processor 0 unless told otherwise.
+// DPCs and IPIs run synchronously on the calling thread, which plays their target processor meanwhile.
+namespace siren::tests {
+    struct host_machine_t {
+        uint32_t processor_count = 1;
+
+        // Unset hooks read read_default_msr(), zeros and drop writes.
+        std::function<uint64_t(uint32_t address)> read_msr;
+        std::function<void(uint32_t address, uint64_t value)> write_msr;
+        std::function<void(uint32_t leaf, uint32_t subleaf, uint32_t (&registers)[4])> cpuid;
+
+        // Hypercalls siren issues on its own behalf, e.g. TLB flushes, with their fast input block. Unset, they succeed.
+        std::function<uint64_t(uint64_t input_value, const uint64_t* input_block, size_t input_qword_count)> hypercall;
+
+        // Hypercalls forwarded from the guest by the vmcall exit handler. guest_state is null unless the hypercall is fast.
+        std::function<uint64_t(uint64_t input_value, vmx::guest_state_t* guest_state)> guest_hypercall;
+
+        // siren_hypercalls issued from VMX non-root operation, by function id.
+        std::function<void(uint32_t function_id)> siren_hypercall;
+
+        // The RAM MmGetPhysicalMemoryRanges reports, as (base, size). Empty, all of the identity mapped host memory.
+        std::vector<std::pair<uint64_t, uint64_t>> physical_memory_ranges;
+
+        // Queued DPCs wait until their processor drops below DISPATCH_LEVEL, or for run_queued_dpcs() or KeFlushQueuedDpcs, instead of running on the spot.
+        bool defer_dpcs = false;
+
+        std::atomic<uint64_t> debugger_breaks = 0;
+    };
+
+    inline host_machine_t host_machine;
+
+    // Makes the calling thread play processor `index`.
+    void set_current_processor(uint32_t index) noexcept;
+
+    // Runs the DPCs deferred for processor `index` as that processor at DISPATCH_LEVEL, in the order they were queued. Returns how many ran.
+    size_t run_queued_dpcs(uint32_t index) noexcept;
+
+    // What an MSR reads when no hook is set: IA32_EFER says IA-32e mode, everything else is zero. For hooks to fall back on.
+    uint64_t read_default_msr(uint32_t address) noexcept;
+
+    // Forgets every hook and counter, for tests that share one process.
+    void reset_host_machine() noexcept;
+}
@@ -0,0 +1,79 @@
+#include "memory.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cstddef>
+
+// The pool allocators of siren on top of the host heap.
+// memory.cpp is left out of host builds: its size class locks need the kernel and its global operator delete fails fast.
+// The size classes themselves are in size_class_pool.hpp and tested against these allocators.
+namespace siren {
+    namespace {
+        constexpr std::size_t host_page_size_v = 4096;
+
+        expected<void*, nt_status> host_allocate(std::size_t size, std::size_t alignment, bool zero) noexcept {
+            alignment = std::max<std::size_t>(alignment, alignof(std::max_align_t));
+            size = (std::max<std::size_t>(size, 1) + alignment - 1) & ~(alignment - 1);
+
+            void* p = aligned_alloc(alignment, size);
+            if (p == nullptr) {
+                return unexpected{ nt_status_insufficient_resources_v };
+            }
+
+            if (zero) {
+                memset(p, 0, size);
+            }
+
+            return expected<void*, nt_status>{ p };
+        }
+
+        expected<void*, nt_status> host_allocate(std::size_t size, std::size_t count, std::size_t alignment, bool zero) noexcept {
+            std::size_t total_size;
+            if (__builtin_mul_overflow(size, count, &total_size)) {
+                return unexpected{ nt_status_invalid_parameter_v };
+            }
+            return host_allocate(total_size, alignment, zero);
+        }
+    }
+
+    expected<void*, nt_status> paged_allocator<void>::allocate(std::size_t size, std::align_val_t alignment) noexcept {
+        return host_allocate(size, static_cast<std::size_t>(alignment), false);
+    }
+
+    expected<void*, nt_status> paged_allocator<void>::allocate(std::size_t size, std::size_t count, std::align_val_t alignment) noexcept {
+        return host_allocate(size, count, static_cast<std::size_t>(alignment), false);
+    }
+
+    void paged_allocator<void>::deallocate(void* ptr, std::size_t, std::align_val_t) noexcept {
+        free(ptr);
+    }
+
+    expected<void*, nt_status> npaged_allocator<void>::allocate(std::size_t size, std::align_val_t alignment) noexcept {
+        return host_allocate(size, static_cast<std::size_t>(alignment), false);
+    }
+
+    expected<void*, nt_status> npaged_allocator<void>::allocate(std::size_t size, std::size_t count, std::align_val_t alignment) noexcept {
+        return host_allocate(size, count, static_cast<std::size_t>(alignment), false);
+    }
+
+    void npaged_allocator<void>::deallocate(void* ptr, std::size_t, std::align_val_t) noexcept {
+        free(ptr);
+    }
+
+    // Contiguous memory is page aligned and zeroed, like fresh pages from MmAllocateContiguousMemory.
+    expected<void*, nt_status> contiguous_allocator<void>::allocate(std::size_t size, uint64_t) {
+        return host_allocate(size, host_page_size_v, true);
+    }
+
+    expected<void*, nt_status> contiguous_allocator<void>::allocate(std::size_t size, std::size_t count, uint64_t) {
+        return host_allocate(size, count, host_page_size_v, true);
+    }
+
+    expected<void*, nt_status> contiguous_allocator<void>::allocate_on_node(std::size_t size, std::size_t count, uint64_t, uint32_t) {
+        return host_allocate(size, count, host_page_size_v, true);
+    }
+
+    void contiguous_allocator<void>::deallocate(void* p) noexcept {
+        free(p);
+    }
+}
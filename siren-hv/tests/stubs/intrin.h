@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <climits>
+#include <x86intrin.h>
+#define __forceinline inline
+extern "C" {
+uint64_t __readcr0(); uint64_t __readcr3(); uint64_t __readcr4(); uint64_t __readcr8();
+uint64_t __readcr2(); void __writecr2(uint64_t);
+void __writecr0(uint64_t); void __writecr3(uint64_t); void __writecr4(uint64_t); void __writecr8(uint64_t);
+uint64_t __readmsr(unsigned long); void __writemsr(unsigned long, uint64_t);
+uint64_t __readdr(unsigned); void __writedr(unsigned, uint64_t);
+
+void __cpuidex(int*, int, int); void __cpuid(int*, int);
+unsigned char __vmx_on(uint64_t*); unsigned char __vmx_vmclear(uint64_t*); unsigned char __vmx_vmptrld(uint64_t*);
+unsigned char __vmx_vmread(size_t, size_t*); unsigned char __vmx_vmwrite(size_t, size_t); unsigned char __vmx_vmlaunch(); unsigned char __vmx_vmresume(); void __vmx_off();
+void __invlpg(void*); void __halt(); void __debugbreak(); void __wbinvd();
+void* _AddressOfReturnAddress(); void* _ReturnAddress();
+void _sgdt(void*); void _lgdt(void*); void __sidt(void*); void __lidt(void*);
+
+void __stosq(uint64_t*, uint64_t, size_t);
+void __movsb(unsigned char*, const unsigned char*, size_t);
+void __vmx_vmptrst(uint64_t*);
+}
+void _disable(); void _enable();
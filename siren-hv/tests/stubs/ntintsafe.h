@@ -0,0 +1,4 @@
+#pragma once
+#include <stddef.h>
+int RtlSizeTAdd(size_t, size_t, size_t*);
+int RtlSizeTMult(size_t, size_t, size_t*);
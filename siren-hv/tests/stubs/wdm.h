@@ -0,0 +1,205 @@
+#pragma once
+#include <intrin.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <climits>
+#define _IRQL_requires_max_(x)
+#define _IRQL_requires_(x)
+#define _IRQL_raises_(x)
+#define _IRQL_saves_
+#define _IRQL_restores_
+#define _IRQL_saves_global_(a,b)
+#define _IRQL_restores_global_(a,b)
+#define _IRQL_requires_same_
+#define _When_(a,b)
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Out_opt_
+#define _Use_decl_annotations_
+#define _Function_class_(x)
+#define _Dispatch_type_(x)
+#define _Must_inspect_result_
+#define _Post_maybenull_
+#define _Ret_maybenull_
+#define _Success_(x)
+#define __drv_allocatesMem(x)
+#define __drv_freesMem(x)
+#define __drv_aliasesMem
+#define NTAPI
+#define NTKERNELAPI
+typedef uint64_t UINT64;
+#define DECLSPEC_ALIGN(x) alignas(x)
+#define PASSIVE_LEVEL 0
+#define APC_LEVEL 1
+#define DISPATCH_LEVEL 2
+#define HIGH_LEVEL 15
+#define IPI_LEVEL 14
+#define PAGE_SIZE 0x1000
+#define PAGE_SHIFT 12
+#define MEMORY_ALLOCATION_ALIGNMENT 16
+#define MAXIMUM_WAIT_OBJECTS 64
+#define POOL_FLAG_PAGED 0x100
+#define POOL_FLAG_NON_PAGED 0x40
+#define POOL_FLAG_UNINITIALIZED 0x2
+#define TRUE 1
+#define FALSE 0
+#define NT_SUCCESS(s) (((NTSTATUS)(s)) >= 0)
+#define STATUS_SUCCESS ((NTSTATUS)0)
+#define STATUS_UNSUCCESSFUL ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES ((NTSTATUS)0xC000009AL)
+#define STATUS_NOT_FOUND ((NTSTATUS)0xC0000225L)
+#define STATUS_NOT_SUPPORTED ((NTSTATUS)0xC00000BBL)
+#define STATUS_INVALID_ADDRESS ((NTSTATUS)0xC0000141L)
+#define STATUS_BUFFER_TOO_SMALL ((NTSTATUS)0xC0000023L)
+#define STATUS_TIMEOUT ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING ((NTSTATUS)0x00000103L)
+#define STATUS_INVALID_DEVICE_REQUEST ((NTSTATUS)0xC0000010L)
+#define STATUS_ALREADY_REGISTERED ((NTSTATUS)0xC0000718L)
+#define STATUS_DEVICE_BUSY ((NTSTATUS)0x80000011L)
+#define STATUS_OBJECT_NAME_COLLISION ((NTSTATUS)0xC0000035L)
+#define KdPrint(x)
+#define UNREFERENCED_PARAMETER(x) (void)(x)
+#define FILE_DEVICE_UNKNOWN 0x22
+#define METHOD_BUFFERED 0
+#define FILE_ANY_ACCESS 0
+#define FILE_READ_DATA 1
+#define CTL_CODE(DeviceType, Function, Method, Access) (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+#define ALL_PROCESSOR_GROUPS 0xffff
+#define MM_ANY_NODE_OK 0x80000000
+#define PAGE_READWRITE 4
+#define LOW_PRIORITY 0
+#define IO_NO_INCREMENT 0
+#define RTL_QUERY_REGISTRY_DIRECT 0x20
+#define RTL_QUERY_REGISTRY_TYPECHECK 0x100
+#define RTL_REGISTRY_ABSOLUTE 0
+#define REG_DWORD 4
+#define RTL_QUERY_REGISTRY_TYPECHECK_SHIFT 24
+#define THREAD_ALL_ACCESS 0x1fffff
+#define KernelMode 0
+#define OBJ_KERNEL_HANDLE 0x200
+#define EX_DEFAULT_PUSH_LOCK_FLAGS 0
+typedef int NTSTATUS;
+typedef unsigned char UCHAR, BOOLEAN, KIRQL, *PKIRQL;
+typedef unsigned short USHORT, WCHAR, *PWCH, *PWSTR;
+typedef const WCHAR* PCWSTR;
+typedef unsigned int ULONG, *PULONG, DWORD;
+typedef int LONG, *PLONG;
+typedef uint64_t ULONG64, ULONGLONG, ULONG_PTR, SIZE_T, KAFFINITY, *PULONG_PTR, POOL_FLAGS;
+typedef int64_t LONG64, LONGLONG, LONG_PTR;
+typedef void VOID, *PVOID, *HANDLE, **PHANDLE;
+typedef char CCHAR, CHAR;
+typedef USHORT NODE_REQUIREMENT;
+typedef ULONG LOGICAL;
+typedef ULONG_PTR EX_PUSH_LOCK, *PEX_PUSH_LOCK;
+typedef union _LARGE_INTEGER { struct { ULONG LowPart; LONG HighPart; } u; LONGLONG QuadPart; } LARGE_INTEGER, *PLARGE_INTEGER, PHYSICAL_ADDRESS, *PPHYSICAL_ADDRESS;
+typedef struct _UNICODE_STRING { USHORT Length; USHORT MaximumLength; PWSTR Buffer; } UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+typedef struct _PROCESSOR_NUMBER { USHORT Group; UCHAR Number; UCHAR Reserved; } PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+typedef struct _GROUP_AFFINITY { KAFFINITY Mask; USHORT Group; USHORT Reserved[3]; } GROUP_AFFINITY, *PGROUP_AFFINITY;
+typedef struct _KDPC { char opaque[64]; } KDPC, *PKDPC, *PRKDPC;
+typedef struct _KEVENT { char opaque[24]; } KEVENT, *PKEVENT, *PRKEVENT;
+typedef struct _KTIMER { char opaque[64]; } KTIMER, *PKTIMER;
+typedef struct _KAPC_STATE { char opaque[48]; } KAPC_STATE, *PKAPC_STATE, *PRKAPC_STATE;
+typedef struct _KPROCESS* PEPROCESS, *PKPROCESS, *PRKPROCESS;
+typedef struct _KTHREAD* PKTHREAD, *PETHREAD;
+typedef struct _DRIVER_OBJECT* PDRIVER_OBJECT;
+typedef struct _DEVICE_OBJECT* PDEVICE_OBJECT;
+typedef struct _IO_STACK_LOCATION { UCHAR MajorFunction; UCHAR MinorFunction; union { struct { ULONG OutputBufferLength; ULONG InputBufferLength; ULONG IoControlCode; PVOID Type3InputBuffer; } DeviceIoControl; } Parameters; } IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+typedef struct _IO_STATUS_BLOCK { NTSTATUS Status; ULONG_PTR Information; } IO_STATUS_BLOCK;
+typedef struct _IRP { IO_STATUS_BLOCK IoStatus; union { PVOID SystemBuffer; } AssociatedIrp; } IRP, *PIRP;
+typedef struct _MDL MDL, *PMDL;
+typedef struct _RTL_QUERY_REGISTRY_TABLE { PVOID QueryRoutine; ULONG Flags; PWSTR Name; PVOID EntryContext; ULONG DefaultType; PVOID DefaultData; ULONG DefaultLength; } RTL_QUERY_REGISTRY_TABLE, *PRTL_QUERY_REGISTRY_TABLE;
+typedef struct _OBJECT_ATTRIBUTES { ULONG Length; } OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
+typedef void KSTART_ROUTINE(PVOID);
+typedef KSTART_ROUTINE* PKSTART_ROUTINE;
+typedef void KDEFERRED_ROUTINE(PKDPC, PVOID, PVOID, PVOID);
+typedef KDEFERRED_ROUTINE* PKDEFERRED_ROUTINE;
+typedef ULONG_PTR KIPI_BROADCAST_WORKER(ULONG_PTR);
+typedef KIPI_BROADCAST_WORKER* PKIPI_BROADCAST_WORKER;
+typedef enum _POOL_TYPE { NonPagedPool, PagedPool, NonPagedPoolNx = 512 } POOL_TYPE;
+typedef enum _MEMORY_CACHING_TYPE { MmNonCached, MmCached, MmWriteCombined } MEMORY_CACHING_TYPE;
+typedef enum _KWAIT_REASON { Executive } KWAIT_REASON;
+typedef enum _EVENT_TYPE { NotificationEvent, SynchronizationEvent } EVENT_TYPE;
+typedef enum _KPROFILE_SOURCE { ProfileTime } KPROFILE_SOURCE;
+typedef struct _PHYSICAL_MEMORY_RANGE { PHYSICAL_ADDRESS BaseAddress; LARGE_INTEGER NumberOfBytes; } PHYSICAL_MEMORY_RANGE, *PPHYSICAL_MEMORY_RANGE;
+#define InitializeObjectAttributes(p, n, a, r, s) ((p)->Length = sizeof(OBJECT_ATTRIBUTES))
+extern "C" {
+PVOID ExAllocatePool2(POOL_FLAGS, SIZE_T, ULONG);
+void ExFreePoolWithTag(PVOID, ULONG);
+void ExFreePool(PVOID);
+PVOID MmAllocateContiguousMemory(SIZE_T, PHYSICAL_ADDRESS);
+PVOID MmAllocateContiguousMemorySpecifyCache(SIZE_T, PHYSICAL_ADDRESS, PHYSICAL_ADDRESS, PHYSICAL_ADDRESS, MEMORY_CACHING_TYPE);
+PVOID MmAllocateContiguousNodeMemory(SIZE_T, PHYSICAL_ADDRESS, PHYSICAL_ADDRESS, PHYSICAL_ADDRESS, ULONG, NODE_REQUIREMENT);
+void MmFreeContiguousMemory(PVOID);
+PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID);
+PVOID MmGetVirtualForPhysical(PHYSICAL_ADDRESS);
+PPHYSICAL_MEMORY_RANGE MmGetPhysicalMemoryRanges();
+PVOID MmAllocateMappingAddress(SIZE_T, ULONG);
+void MmFreeMappingAddress(PVOID, ULONG);
+KIRQL KeGetCurrentIrql();
+void KeRaiseIrql(KIRQL, PKIRQL);
+void KeLowerIrql(KIRQL);
+KIRQL KeRaiseIrqlToDpcLevel();
+ULONG KeGetCurrentProcessorNumberEx(PPROCESSOR_NUMBER);
+ULONG KeQueryActiveProcessorCountEx(USHORT);
+ULONG KeQueryMaximumProcessorCountEx(USHORT);
+NTSTATUS KeGetProcessorNumberFromIndex(ULONG, PPROCESSOR_NUMBER);
+ULONG KeGetProcessorIndexFromNumber(PPROCESSOR_NUMBER);
+void KeSetSystemGroupAffinityThread(PGROUP_AFFINITY, PGROUP_AFFINITY);
+void KeRevertToUserGroupAffinityThread(PGROUP_AFFINITY);
+ULONG_PTR KeIpiGenericCall(PKIPI_BROADCAST_WORKER, ULONG_PTR);
+void KeInitializeDpc(PRKDPC, PKDEFERRED_ROUTINE, PVOID);
+NTSTATUS KeSetTargetProcessorDpcEx(PKDPC, PPROCESSOR_NUMBER);
+BOOLEAN KeInsertQueueDpc(PRKDPC, PVOID, PVOID);
+BOOLEAN KeRemoveQueueDpc(PRKDPC);
+void KeFlushQueuedDpcs();
+typedef enum _KDPC_IMPORTANCE { LowImportance, MediumImportance, HighImportance, MediumHighImportance } KDPC_IMPORTANCE;
+void KeSetImportanceDpc(PRKDPC, KDPC_IMPORTANCE);
+void KeInitializeEvent(PRKEVENT, EVENT_TYPE, BOOLEAN);
+LONG KeSetEvent(PRKEVENT, LONG, BOOLEAN);
+NTSTATUS KeWaitForSingleObject(PVOID, KWAIT_REASON, CCHAR, BOOLEAN, PLARGE_INTEGER);
+NTSTATUS KeDelayExecutionThread(CCHAR, BOOLEAN, PLARGE_INTEGER);
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER);
+ULONGLONG KeQueryInterruptTime();
+USHORT KeQueryHighestNodeNumber();
+void KeQueryNodeActiveAffinity(USHORT, PGROUP_AFFINITY, USHORT*);
+USHORT KeGetCurrentNodeNumber();
+void KeStackAttachProcess(PRKPROCESS, PRKAPC_STATE);
+void KeUnstackDetachProcess(PRKAPC_STATE);
+void KeEnterCriticalRegion();
+void KeLeaveCriticalRegion();
+void ExAcquirePushLockExclusiveEx(PEX_PUSH_LOCK, ULONG);
+void ExReleasePushLockExclusiveEx(PEX_PUSH_LOCK, ULONG);
+void KeBugCheck(ULONG);
+void KeBugCheckEx(ULONG, ULONG_PTR, ULONG_PTR, ULONG_PTR, ULONG_PTR);
+NTSTATUS PsCreateSystemThread(PHANDLE, ULONG, POBJECT_ATTRIBUTES, HANDLE, PVOID, PKSTART_ROUTINE, PVOID);
+NTSTATUS PsTerminateSystemThread(NTSTATUS);
+NTSTATUS ObReferenceObjectByHandle(HANDLE, ULONG, PVOID, CCHAR, PVOID*, PVOID);
+void ObfDereferenceObject(PVOID);
+#define ObDereferenceObject ObfDereferenceObject
+NTSTATUS ZwClose(HANDLE);
+NTSTATUS ZwWaitForSingleObject(HANDLE, BOOLEAN, PLARGE_INTEGER);
+#ifndef NT_VERIFY
+#define NT_VERIFY(x) ((void)(x))
+#define NT_ASSERT(x) ((void)(x))
+#endif
+void YieldProcessor();
+NTSTATUS RtlQueryRegistryValues(ULONG, PCWSTR, PRTL_QUERY_REGISTRY_TABLE, PVOID, PVOID);
+void RtlInitUnicodeString(PUNICODE_STRING, PCWSTR);
+void IofCompleteRequest(PIRP, CCHAR);
+#define IoCompleteRequest IofCompleteRequest
+PIO_STACK_LOCATION IoGetCurrentIrpStackLocation(PIRP);
+extern PEPROCESS PsInitialSystemProcess;
+void DbgBreakPoint();
+void DbgRaiseAssertionFailure();
+ULONG DbgPrint(const char*, ...);
+}
+inline void RtlCopyMemory(void* d, const void* s, size_t n) { memcpy(d, s, n); }
+inline void RtlZeroMemory(void* d, size_t n) { memset(d, 0, n); }
+#define RtlFillMemory(d, n, v) memset((d), (v), (n))
+#define MAXLONGLONG 0x7fffffffffffffffll
@@ -0,0 +1,68 @@
+#include "stubs/host_machine.hpp"
+#include "synchronization.hpp"
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// synchronization_bench
+// Times lock and unlock pairs of spin_lock, queued_spin_lock and queued_rw_lock on 1 to 64 cpus at once,
+// exclusive only and with one write in 16. Host threads play the cpus, so oversubscribing the host shows up as lock holder preemption.
+namespace {
+    template<typename LockTy, bool SharedV>
+    void run(const char* name, uint32_t cpu_count, uint64_t iteration_count, uint64_t write_every = 1) {
+        static LockTy lock;
+        static uint64_t counter;
+        counter = 0;
+
+        std::atomic<bool> go = false;
+        std::vector<std::thread> threads;
+
+        for (uint32_t cpu = 0; cpu < cpu_count; ++cpu) {
+            threads.emplace_back([&, cpu] {
+                siren::tests::set_current_processor(cpu);
+                while (!go.load(std::memory_order_acquire)) {}
+
+                for (uint64_t i = 0; i < iteration_count; ++i) {
+                    if constexpr (SharedV) {
+                        if (i % write_every == 0) {
+                            siren::lock_guard guard{ lock };
+                            counter = counter + 1;
+                        } else {
+                            siren::shared_lock_guard guard{ lock };
+                            static_cast<void>(*static_cast<volatile uint64_t*>(&counter));
+                        }
+                    } else {
+                        siren::lock_guard guard{ lock };
+                        counter = counter + 1;
+                    }
+                }
+            });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        uint64_t expected = cpu_count * (SharedV ? (iteration_count + write_every - 1) / write_every : iteration_count);
+        printf("%-24s cpus=%2u  %8.1f ms  %8.1f ns/op  %s\n",
+            name, cpu_count, ms, ms * 1e6 / (static_cast<double>(cpu_count) * static_cast<double>(iteration_count)), counter == expected ? "ok" : "MISMATCH");
+    }
+}
+
+int main() {
+    siren::tests::host_machine.processor_count = 64;
+
+    for (uint32_t cpu_count : { 1u, 2u, 4u, 8u, 16u, 32u, 64u }) {
+        uint64_t iteration_count = 200000 / cpu_count + 20;
+        run<siren::spin_lock, false>("spin_lock", cpu_count, iteration_count);
+        run<siren::queued_spin_lock, false>("queued_spin_lock", cpu_count, iteration_count);
+        run<siren::spin_lock, true>("spin_lock 1/16 writes", cpu_count, iteration_count, 16);
+        run<siren::queued_rw_lock, true>("queued_rw_lock 1/16 writes", cpu_count, iteration_count, 16);
+    }
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "synchronization.hpp"
+#include "expected.hpp"
+#include "nt_status.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using siren::lock_guard;
+using siren::shared_lock_guard;
+
+namespace {
+    // Runs `fn(thread_index)` on `thread_count` host threads at once, thread i playing cpu `cpu_of(i)`.
+    template<typename CpuOfTy, typename Fn>
+    void run_threads(uint32_t thread_count, CpuOfTy&& cpu_of, Fn&& fn) {
+        std::atomic<bool> go = false;
+        std::vector<std::thread> threads;
+
+        for (uint32_t i = 0; i < thread_count; ++i) {
+            threads.emplace_back([&, i] {
+                siren::tests::set_current_processor(cpu_of(i));
+                while (!go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                fn(i);
+            });
+        }
+
+        go.store(true, std::memory_order_release);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // A plain counter only adds up if no two increments overlap.
+    // Holders give up their host cpu now and then, so that waiters pile up even on a host with few cpus.
+    template<typename LockTy>
+    void test_mutual_exclusion(uint32_t thread_count, uint32_t cpu_count) {
+        constexpr uint64_t iteration_count = 4000;
+
+        static LockTy lock;
+        static uint64_t counter;
+        counter = 0;
+
+        run_threads(thread_count, [cpu_count](uint32_t i) { return i % cpu_count; }, [](uint32_t) {
+            for (uint64_t i = 0; i < iteration_count; ++i) {
+                lock_guard guard{ lock };
+                uint64_t value = counter;
+                if (i % 64 == 0) {
+                    std::this_thread::yield();
+                }
+                counter = value + 1;
+            }
+        });
+
+        SIREN_CHECK(counter == thread_count * iteration_count);
+        SIREN_CHECK(lock.is_unlocked());
+    }
+
+    void test_queued_spin_lock_try_lock() {
+        siren::queued_spin_lock lock;
+
+        SIREN_CHECK(lock.try_lock());
+        SIREN_CHECK(lock.is_locked());
+        SIREN_CHECK(!lock.try_lock());
+        lock.unlock();
+        SIREN_CHECK(lock.is_unlocked());
+
+        lock_guard guard{ lock, siren::try_to_lock_t{} };
+        SIREN_CHECK(guard.owns_lock());
+        SIREN_CHECK(!lock.try_lock());
+    }
+
+    void test_queued_rw_lock_readers_share() {
+        siren::queued_rw_lock lock;
+
+        SIREN_CHECK(lock.try_lock_shared());
+        SIREN_CHECK(lock.try_lock_shared());
+        SIREN_CHECK(lock.is_locked_shared());
+        SIREN_CHECK(!lock.try_lock());
+        lock.unlock_shared();
+        lock.unlock_shared();
+
+        SIREN_CHECK(lock.try_lock());
+        SIREN_CHECK(lock.is_locked());
+        SIREN_CHECK(!lock.try_lock_shared());
+        lock.unlock();
+        SIREN_CHECK(lock.is_unlocked());
+    }
+
+    // A writer that waits for readers to leave keeps new readers out.
+    void test_queued_rw_lock_prefers_writers() {
+        siren::queued_rw_lock lock;
+        lock.lock_shared();
+
+        std::atomic<bool> written = false;
+        std::thread writer([&] {
+            siren::tests::set_current_processor(1);
+            lock_guard guard{ lock };
+            written.store(true, std::memory_order_release);
+        });
+
+        // the writer announces itself before it spins on the readers
+        bool readers_kept_out = false;
+        for (auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 }; std::chrono::steady_clock::now() < deadline;) {
+            if (!lock.try_lock_shared()) {
+                readers_kept_out = true;
+                break;
+            }
+            lock.unlock_shared();
+            std::this_thread::yield();
+        }
+
+        SIREN_CHECK(readers_kept_out);
+        SIREN_CHECK(!written.load(std::memory_order_acquire));
+
+        lock.unlock_shared();
+        writer.join();
+        SIREN_CHECK(written.load(std::memory_order_acquire));
+        SIREN_CHECK(lock.is_unlocked());
+    }
+
+    // Writers hold the lock alone, readers never see a write half done.
+    void test_queued_rw_lock_under_contention() {
+        constexpr uint32_t thread_count = 4;
+        constexpr uint64_t iteration_count = 20000;
+
+        static siren::queued_rw_lock lock;
+        static uint64_t values[2];
+        values[0] = values[1] = 0;
+
+        std::atomic<uint64_t> torn_reads = 0;
+
+        run_threads(thread_count, [](uint32_t i) { return i; }, [&](uint32_t) {
+            for (uint64_t i = 0; i < iteration_count; ++i) {
+                if (i % 8 == 0) {
+                    lock_guard guard{ lock };
+                    values[0] = values[0] + 1;
+                    values[1] = values[0];
+                } else {
+                    shared_lock_guard guard{ lock };
+                    if (values[0] != values[1]) {
+                        torn_reads.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+        });
+
+        SIREN_CHECK(torn_reads == 0);
+        SIREN_CHECK(values[0] == thread_count * iteration_count / 8);
+        SIREN_CHECK(lock.is_unlocked());
+    }
+
+    struct wide_t {
+        uint64_t words[64];
+    };
+
+    // Readers never get a copy that mixes two updates, and updates that fail are not published.
+    void test_versioned() {
+        static siren::versioned<wide_t> value;
+
+        std::atomic<bool> stop = false;
+        std::atomic<uint64_t> torn_reads = 0;
+        std::vector<std::thread> readers;
+
+        for (uint32_t cpu = 1; cpu <= 3; ++cpu) {
+            readers.emplace_back([&, cpu] {
+                siren::tests::set_current_processor(cpu);
+                while (!stop.load(std::memory_order_relaxed)) {
+                    auto snapshot = value.load();
+                    for (auto word : snapshot.words) {
+                        if (word != snapshot.words[0]) {
+                            torn_reads.fetch_add(1, std::memory_order_relaxed);
+                            break;
+                        }
+                    }
+                }
+            });
+        }
+
+        uint64_t published = 0;
+        for (uint64_t i = 1; i <= 20000; ++i) {
+            if (i % 3 == 0) {
+                auto expt_status = value.update([](wide_t& next) noexcept -> siren::expected<void, siren::nt_status> {
+                    for (auto& word : next.words) {
+                        word = ~uint64_t{ 0 };
+                    }
+                    return siren::unexpected{ siren::nt_status_not_found_v };
+                });
+                SIREN_CHECK(expt_status.has_error());
+            } else {
+                value.update([i](wide_t& next) noexcept {
+                    for (auto& word : next.words) {
+                        word = i;
+                    }
+                });
+                published = i;
+            }
+        }
+
+        stop.store(true, std::memory_order_relaxed);
+        for (auto& reader : readers) {
+            reader.join();
+        }
+
+        SIREN_CHECK(torn_reads == 0);
+        SIREN_CHECK(value.get_version() == 20000 - 20000 / 3);
+        SIREN_CHECK(value.load().words[63] == published);
+    }
+}
+
+int main() {
+    siren::tests::host_machine.processor_count = 8;
+
+    test_mutual_exclusion<siren::spin_lock>(4, 4);
+    test_mutual_exclusion<siren::queued_spin_lock>(4, 4);
+
+    // more waiters on one cpu than it has queue nodes, the rest spin on the lock
+    test_mutual_exclusion<siren::queued_spin_lock>(2 * siren::queued_spin_lock::nodes_per_slot_v, 1);
+
+    test_queued_spin_lock_try_lock();
+    test_queued_rw_lock_readers_share();
+    test_queued_rw_lock_prefers_writers();
+    test_queued_rw_lock_under_contention();
+    test_versioned();
+
+    siren::tests::reset_host_machine();
+    return siren::tests::check_result();
+}
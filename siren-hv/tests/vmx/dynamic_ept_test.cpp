@@ -0,0 +1,95 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "contiguous_arena.hpp"
+#include "vmx/dynamic_ept.hpp"
+#include <memory>
+#include <vector>
+
+using namespace siren::size_literals;
+using siren::contiguous_arena;
+using siren::reserved_contiguous_arena;
+using siren::vmx::dynamic_ept;
+
+namespace {
+    constexpr uint64_t pfn_mask_v = 0x000ffffffffff000;
+
+    // Walks the tables down to the 4-KiB entry of `gpa` like the processor does, through physical addresses. Zero if a level is missing.
+    uint64_t walk(const dynamic_ept& ept, uint64_t gpa) {
+        uint64_t table = ept.get_top_level_address();
+        for (int level = 4; level >= 1; --level) {
+            // host memory is identity mapped
+            uint64_t entry = reinterpret_cast<const uint64_t*>(table)[(gpa >> (12 + 9 * (level - 1))) & 0x1ff];
+            if ((entry & 0x7) == 0) {
+                return 0;
+            }
+            if (level == 1) {
+                return entry;
+            }
+            table = entry & pfn_mask_v;
+        }
+        return 0;
+    }
+
+    void commit_and_check(dynamic_ept& ept, uint64_t gpa) {
+        uint64_t hpa = 0x7654000 + gpa;
+        SIREN_CHECK(ept.commit_page(4_Kiuz, gpa, hpa, { .read_access = 1, .write_access = 1, .execute_access = 1, .memory_type = 6 }, false).has_value());
+        SIREN_CHECK((walk(ept, gpa) & pfn_mask_v) == hpa);
+    }
+
+    // Tables come from the reserved arena while it has room and from nonpaged pool after that, both reachable by physical address.
+    void test_tables_fall_back_to_pool_when_the_arena_is_full() {
+        siren::tests::reset_host_machine();
+        SIREN_CHECK(reserved_contiguous_arena.reserve(contiguous_arena::region_size_v).has_value());
+
+        // leave room for two tables
+        std::vector<void*> fillers;
+        for (;;) {
+            auto expt_block = reserved_contiguous_arena.allocate(4_Kiuz, ~uint64_t{ 0 });
+            if (expt_block.has_error()) {
+                break;
+            }
+            fillers.push_back(expt_block.value());
+        }
+        for (int i = 0; i < 2; ++i) {
+            reserved_contiguous_arena.deallocate(fillers.back());
+            fillers.pop_back();
+        }
+
+        {
+            auto ept = std::make_unique<dynamic_ept>();
+            SIREN_CHECK(ept->initialize().has_value());
+            SIREN_CHECK(reserved_contiguous_arena.contains(reinterpret_cast<void*>(ept->get_top_level_address())));
+
+            // one PDPT from the arena, a PD and a PT from the pool
+            commit_and_check(*ept, 0x1000);
+            SIREN_CHECK(reserved_contiguous_arena.get_statistics().free_pages == 0);
+
+            // a second branch, all from the pool
+            commit_and_check(*ept, 0x80'0000'0000);
+            SIREN_CHECK((walk(*ept, 0x1000) & pfn_mask_v) == 0x7654000 + 0x1000);
+        }
+
+        // every table went back to where it came from
+        SIREN_CHECK(reserved_contiguous_arena.get_statistics().free_pages == 2);
+
+        for (auto* filler : fillers) {
+            reserved_contiguous_arena.deallocate(filler);
+        }
+        reserved_contiguous_arena.release();
+    }
+
+    void test_tables_come_from_the_pool_without_an_arena() {
+        siren::tests::reset_host_machine();
+
+        auto ept = std::make_unique<dynamic_ept>();
+        SIREN_CHECK(ept->initialize().has_value());
+        commit_and_check(*ept, 0x20'0000);
+        commit_and_check(*ept, 0x4000'0000);
+    }
+}
+
+int main() {
+    test_tables_fall_back_to_pool_when_the_arena_is_full();
+    test_tables_come_from_the_pool_without_an_arena();
+    return siren::tests::check_result();
+}
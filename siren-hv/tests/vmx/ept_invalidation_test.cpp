@@ -0,0 +1,166 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "vmx/ept_invalidation.hpp"
+#include <wdm.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using siren::vmx::ept_invalidation_mailbox;
+
+namespace {
+    constexpr uint64_t page_count_v = 64;
+
+    void test_posts_coalesce() {
+        ept_invalidation_mailbox mailbox;
+        ept_invalidation_mailbox::batch_t batch;
+
+        SIREN_CHECK(!mailbox.has_pending());
+        SIREN_CHECK(!mailbox.take(batch));
+
+        // an empty range completes with whatever is pending, here nothing
+        auto ticket = mailbox.post(0x1000, 0);
+        SIREN_CHECK(ticket == 0 && mailbox.is_completed(ticket));
+
+        // pages 1, 2, 5 and 3-4 end up as one range
+        auto first_ticket = mailbox.post(0x1010, 1);
+        mailbox.post(0x2000, 0x1000);
+        mailbox.post(0x5000, 0x10);
+        ticket = mailbox.post(0x3fff, 0x1001);
+        SIREN_CHECK(ticket == 4 && mailbox.has_pending());
+        SIREN_CHECK(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+        SIREN_CHECK(mailbox.take(batch));
+        SIREN_CHECK(!batch.everything && batch.range_count == 1 && batch.ticket == 4);
+        SIREN_CHECK(batch.ranges[0].base == 0x1000 && batch.ranges[0].size == 0x5000);
+
+        SIREN_CHECK(!mailbox.is_completed(first_ticket));
+        mailbox.complete(batch.ticket);
+        SIREN_CHECK(mailbox.is_completed(first_ticket) && !mailbox.has_pending());
+
+        // one disjoint range too many
+        for (uint64_t i = 0; i <= ept_invalidation_mailbox::max_range_count_v; ++i) {
+            mailbox.post(i * 0x10000, 1);
+        }
+        SIREN_CHECK(mailbox.take(batch) && batch.everything && batch.range_count == 0);
+        mailbox.complete(batch.ticket);
+
+        // running past the end of the address space
+        mailbox.post(~uint64_t{ 0 } - 0x10, 0x100);
+        SIREN_CHECK(mailbox.take(batch) && batch.everything);
+        mailbox.complete(batch.ticket);
+
+        auto statistics = mailbox.get_statistics();
+        SIREN_CHECK(KeGetCurrentIrql() == PASSIVE_LEVEL);
+        SIREN_CHECK(statistics.posts == 14);
+        SIREN_CHECK(statistics.coalesced_posts == 2);
+        SIREN_CHECK(statistics.overflows == 1);
+        SIREN_CHECK(statistics.batches == 3);
+
+        ept_invalidation_mailbox moved{ std::move(mailbox) };
+        SIREN_CHECK(moved.get_statistics().posts == 14 && !moved.has_pending());
+    }
+
+    // Taking a batch does not complete its tickets, only complete() does.
+    void test_tickets_pending_until_completed() {
+        ept_invalidation_mailbox mailbox;
+        ept_invalidation_mailbox::batch_t batch;
+
+        mailbox.post_everything();
+        SIREN_CHECK(mailbox.take(batch));
+        mailbox.complete(batch.ticket);
+
+        auto ticket = mailbox.post(0x1000, 0x1000);
+        SIREN_CHECK(mailbox.take(batch) && batch.ticket == ticket);
+        SIREN_CHECK(!mailbox.take(batch));     // nothing left, but not completed either
+        SIREN_CHECK(mailbox.has_pending() && !mailbox.is_completed(ticket));
+        mailbox.complete(batch.ticket);
+        SIREN_CHECK(mailbox.is_completed(ticket));
+    }
+
+    // Every poster that waits for its ticket finds its pages flushed after it posted.
+    void test_posters_against_the_owner() {
+        static ept_invalidation_mailbox mailbox;
+        static std::atomic<uint64_t> flushes[page_count_v];
+
+        std::atomic<bool> stop = false;
+        std::atomic<uint64_t> missed_flushes = 0;
+
+        std::thread owner([&] {
+            siren::tests::set_current_processor(0);
+
+            ept_invalidation_mailbox::batch_t batch;
+            while (!stop.load()) {
+                if (!mailbox.has_pending() || !mailbox.take(batch)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                for (uint64_t page = 0; page < page_count_v; ++page) {
+                    bool covered = batch.everything;
+                    for (size_t i = 0; i < batch.range_count; ++i) {
+                        covered |= batch.ranges[i].base <= page * 4096 && page * 4096 < batch.ranges[i].base + batch.ranges[i].size;
+                    }
+                    if (covered) {
+                        flushes[page].fetch_add(1);
+                    }
+                }
+                mailbox.complete(batch.ticket);
+            }
+        });
+
+        std::vector<std::thread> posters;
+        for (uint32_t cpu = 1; cpu <= 3; ++cpu) {
+            posters.emplace_back([&, cpu] {
+                siren::tests::set_current_processor(cpu);
+
+                uint32_t x = cpu * 7;
+                for (int i = 0; i < 300; ++i) {
+                    x = x * 1103515245 + 12345;
+                    uint64_t page = (x >> 8) % page_count_v;
+                    uint64_t n = std::min<uint64_t>(1 + (x >> 20) % 3, page_count_v - page);
+
+                    uint64_t before[3];
+                    for (uint64_t k = 0; k < n; ++k) {
+                        before[k] = flushes[page + k].load();
+                    }
+
+                    // unaligned at both ends, still covers every page it touches
+                    auto ticket = mailbox.post(page * 4096 + 123, n * 4096 - 200);
+                    while (!mailbox.is_completed(ticket)) {
+                        std::this_thread::yield();
+                    }
+
+                    for (uint64_t k = 0; k < n; ++k) {
+                        if (flushes[page + k].load() <= before[k]) {
+                            missed_flushes.fetch_add(1);
+                        }
+                    }
+                }
+            });
+        }
+
+        for (auto& poster : posters) {
+            poster.join();
+        }
+        stop.store(true);
+        owner.join();
+
+        SIREN_CHECK(missed_flushes == 0);
+        SIREN_CHECK(mailbox.get_statistics().posts == 900);
+        SIREN_CHECK(!mailbox.has_pending());
+    }
+}
+
+int main() {
+    siren::tests::host_machine.processor_count = 4;
+
+    test_posts_coalesce();
+    test_tickets_pending_until_completed();
+    test_posters_against_the_owner();
+
+    siren::tests::reset_host_machine();
+    return siren::tests::check_result();
+}
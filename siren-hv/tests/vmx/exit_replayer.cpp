@@ -0,0 +1,309 @@
+#include "exit_replayer.hpp"
+#include "stubs/host_machine.hpp"
+#include "vmx/mshv_hypervisor.hpp"
+#include "vmx/mshv_virtual_cpu.hpp"
+#include "vmx/mshv_vmexit_handler.hpp"
+#include "x86/intel_vmx.hpp"
+#include <stdio.h>
+#include <string.h>
+
+namespace siren::vmx {
+    namespace {
+        using vmcs_out_t = decltype(exit_record_t::vmcs_out);
+
+        // What the handler leaves behind, compared between the recorded and the replayed exit.
+        struct field_t {
+            const char* name;
+            uint64_t (*get)(const exit_record_t& record);
+        };
+
+        template<auto Member>
+        uint64_t vmcs_out_field(const exit_record_t& record) {
+            return record.vmcs_out.*Member;
+        }
+
+        template<auto Member>
+        uint64_t guest_state_out_field(const exit_record_t& record) {
+            return record.guest_state_out.*Member;
+        }
+
+        template<size_t Index, size_t Half>
+        uint64_t guest_xmm_out_field(const exit_record_t& record) {
+            uint64_t halves[2];
+            memcpy(halves, &(&record.guest_state_out.xmm0)[Index], sizeof(halves));
+            return halves[Half];
+        }
+
+        constexpr uint32_t interruption_info_deliver_error_code_v = 1u << 11u;
+        constexpr uint32_t interruption_info_valid_v = 1u << 31u;
+        constexpr uint32_t ud_exception_interruption_info_v = interruption_info_valid_v | 3u << 8u | 6u;
+
+        // VM entry clears the valid bit only, the rest of an injection that was delivered is left over.
+        uint64_t vmentry_interruption_info_field(const exit_record_t& record) {
+            auto info = record.vmcs_out.vmentry_interruption_info;
+            return (info & interruption_info_valid_v) != 0 ? info : 0;
+        }
+
+        // guest_state_t::rsp and guest_state_t::rflags are lazy, their recorded value depends on whether a handler happened to load them.
+        constexpr field_t compared_fields[] = {
+            { "flags", [](const exit_record_t& record) -> uint64_t { return record.flags; } },
+            { "vmcs_out.vmentry_interruption_info", &vmentry_interruption_info_field },
+            { "vmcs_out.guest_rip", &vmcs_out_field<&vmcs_out_t::guest_rip> },
+            { "vmcs_out.guest_rsp", &vmcs_out_field<&vmcs_out_t::guest_rsp> },
+            { "vmcs_out.guest_rflags", &vmcs_out_field<&vmcs_out_t::guest_rflags> },
+            { "vmcs_out.guest_cr0", &vmcs_out_field<&vmcs_out_t::guest_cr0> },
+            { "vmcs_out.guest_cr3", &vmcs_out_field<&vmcs_out_t::guest_cr3> },
+            { "vmcs_out.guest_cr4", &vmcs_out_field<&vmcs_out_t::guest_cr4> },
+            { "vmcs_out.cr0_read_shadow", &vmcs_out_field<&vmcs_out_t::cr0_read_shadow> },
+            { "vmcs_out.cr4_read_shadow", &vmcs_out_field<&vmcs_out_t::cr4_read_shadow> },
+            { "guest_state_out.rax", &guest_state_out_field<&guest_state_t::rax> },
+            { "guest_state_out.rcx", &guest_state_out_field<&guest_state_t::rcx> },
+            { "guest_state_out.rdx", &guest_state_out_field<&guest_state_t::rdx> },
+            { "guest_state_out.rbx", &guest_state_out_field<&guest_state_t::rbx> },
+            { "guest_state_out.rbp", &guest_state_out_field<&guest_state_t::rbp> },
+            { "guest_state_out.rsi", &guest_state_out_field<&guest_state_t::rsi> },
+            { "guest_state_out.rdi", &guest_state_out_field<&guest_state_t::rdi> },
+            { "guest_state_out.r8", &guest_state_out_field<&guest_state_t::r8> },
+            { "guest_state_out.r9", &guest_state_out_field<&guest_state_t::r9> },
+            { "guest_state_out.r10", &guest_state_out_field<&guest_state_t::r10> },
+            { "guest_state_out.r11", &guest_state_out_field<&guest_state_t::r11> },
+            { "guest_state_out.r12", &guest_state_out_field<&guest_state_t::r12> },
+            { "guest_state_out.r13", &guest_state_out_field<&guest_state_t::r13> },
+            { "guest_state_out.r14", &guest_state_out_field<&guest_state_t::r14> },
+            { "guest_state_out.r15", &guest_state_out_field<&guest_state_t::r15> },
+            { "guest_state_out.rip", &guest_state_out_field<&guest_state_t::rip> },
+            { "guest_state_out.xmm0[63:0]", &guest_xmm_out_field<0, 0> },
+            { "guest_state_out.xmm0[127:64]", &guest_xmm_out_field<0, 1> },
+            { "guest_state_out.xmm1[63:0]", &guest_xmm_out_field<1, 0> },
+            { "guest_state_out.xmm1[127:64]", &guest_xmm_out_field<1, 1> },
+            { "guest_state_out.xmm2[63:0]", &guest_xmm_out_field<2, 0> },
+            { "guest_state_out.xmm2[127:64]", &guest_xmm_out_field<2, 1> },
+            { "guest_state_out.xmm3[63:0]", &guest_xmm_out_field<3, 0> },
+            { "guest_state_out.xmm3[127:64]", &guest_xmm_out_field<3, 1> },
+            { "guest_state_out.xmm4[63:0]", &guest_xmm_out_field<4, 0> },
+            { "guest_state_out.xmm4[127:64]", &guest_xmm_out_field<4, 1> },
+            { "guest_state_out.xmm5[63:0]", &guest_xmm_out_field<5, 0> },
+            { "guest_state_out.xmm5[127:64]", &guest_xmm_out_field<5, 1> },
+        };
+    }
+
+    struct exit_replayer::vcpu_slot_t {
+        microsoft_hv::vmx_enlightened_vmcs_t evmcs;
+        mshv_virtual_cpu vcpu;
+
+        vcpu_slot_t(mshv_hypervisor* hv, uint32_t index) noexcept : evmcs{}, vcpu{ hv, index } {}
+    };
+
+    exit_replayer::exit_replayer() : m_hv{ std::make_unique<mshv_hypervisor>() } {
+        if (m_hv->get_msr_interceptor().initialize().has_error()) {
+            fprintf(stderr, "exit_replayer: msr_interceptor::initialize failed\n");
+            abort();
+        }
+    }
+
+    exit_replayer::~exit_replayer() {
+        // virtual cpus give their vpid back to the hypervisor
+        m_vcpus.clear();
+        tests::reset_host_machine();
+    }
+
+    mshv_virtual_cpu& exit_replayer::get_vcpu(uint32_t vcpu_index) {
+        auto& slot = m_vcpus[vcpu_index];
+        if (!slot) {
+            slot = std::make_unique<vcpu_slot_t>(m_hv.get(), vcpu_index);
+
+            // what prepare() would have set up on the processor of the virtual cpu
+            auto& vcpu = slot->vcpu;
+            vcpu.m_vp_index = vcpu_index;
+            vcpu.m_evmcs_region = &slot->evmcs;
+            vcpu.m_evmcs_accessor.attach(&slot->evmcs);
+
+            // the recorded control registers already respect the fixed bits of the recording machine
+            vcpu.m_ia32_vmx_cr0_fixed0.storage = 0;
+            vcpu.m_ia32_vmx_cr0_fixed1.storage = ~uint64_t{ 0 };
+            vcpu.m_ia32_vmx_cr4_fixed0.storage = 0;
+            vcpu.m_ia32_vmx_cr4_fixed1.storage = ~uint64_t{ 0 };
+        }
+        return slot->vcpu;
+    }
+
+    void exit_replayer::replay_one(const exit_record_t& record) {
+        auto& vcpu = get_vcpu(record.vcpu_index);
+        auto* evmcs = vcpu.get_enlightened_vmcs();
+
+        // what L0 leaves in the enlightened vmcs at VM exit
+        evmcs->info_exit_reason = record.vmcs_in.exit_reason;
+        evmcs->info_vmexit_instruction_length = record.vmcs_in.vmexit_instruction_length;
+        evmcs->info_vmexit_instruction_info = record.vmcs_in.vmexit_instruction_info;
+        evmcs->info_vmexit_interruption_info = record.vmcs_in.vmexit_interruption_info;
+        evmcs->info_vmexit_exception_error_code = record.vmcs_in.vmexit_exception_error_code;
+        evmcs->info_idt_vectoring_info = record.vmcs_in.idt_vectoring_info;
+        evmcs->info_idt_vectoring_error_code = record.vmcs_in.idt_vectoring_error_code;
+        evmcs->info_exit_qualification = record.vmcs_in.exit_qualification;
+        evmcs->info_guest_linear_address = record.vmcs_in.guest_linear_address;
+        evmcs->info_guest_physical_address = record.vmcs_in.guest_physical_address;
+        evmcs->guest_rip = record.vmcs_in.guest_rip;
+        evmcs->guest_rsp = record.vmcs_in.guest_rsp;
+        evmcs->guest_rflags = record.vmcs_in.guest_rflags;
+        evmcs->guest_cr0 = record.vmcs_in.guest_cr0;
+        evmcs->guest_cr3 = record.vmcs_in.guest_cr3;
+        evmcs->guest_cr4 = record.vmcs_in.guest_cr4;
+        evmcs->ctrl_cr0_read_shadow = record.vmcs_in.cr0_read_shadow;
+        evmcs->ctrl_cr4_read_shadow = record.vmcs_in.cr4_read_shadow;
+
+        // VM entry consumed the previous injection
+        evmcs->ctrl_vmentry_interruption_info = 0;
+
+        // CS is not recorded. The vmcall handler injects #UD for ring 3 only, so that is where such a vmcall came from.
+        x86::vmcsf_t<x86::VMCSF_INFO_EXIT_REASON> exit_reason{ .storage = record.vmcs_in.exit_reason };
+        bool vmcall_from_ring3 =
+            exit_reason.semantics.basic_exit_reason == x86::vmx_exit_reason_e::INSTRUCTION_VMCALL &&
+            record.vmcs_out.vmentry_interruption_info == ud_exception_interruption_info_v;
+        evmcs->guest_cs_selector = vmcall_from_ring3 ? 0x33 : 0x10;
+
+        auto& machine = tests::host_machine;
+
+        machine.cpuid = [&](uint32_t, uint32_t, uint32_t (&registers)[4]) {
+            registers[0] = static_cast<uint32_t>(record.guest_state_out.rax);
+            registers[1] = static_cast<uint32_t>(record.guest_state_out.rbx);
+            registers[2] = static_cast<uint32_t>(record.guest_state_out.rcx);
+            registers[3] = static_cast<uint32_t>(record.guest_state_out.rdx);
+        };
+
+        // Only the MSR the guest read gets its recorded value. Anything else goes to the fallback, zero keeps HLT from polling.
+        bool is_rdmsr = exit_reason.semantics.basic_exit_reason == x86::vmx_exit_reason_e::INSTRUCTION_RDMSR;
+        machine.read_msr = [&, is_rdmsr](uint32_t address) -> uint64_t {
+            if (is_rdmsr && address == static_cast<uint32_t>(record.guest_state_in.rcx)) {
+                return (record.guest_state_out.rdx << 32u) | (record.guest_state_out.rax & 0xffffffffu);
+            }
+            return m_msr_fallback ? m_msr_fallback(address) : 0;
+        };
+
+        machine.guest_hypercall = [&](uint64_t, guest_state_t* guest_state) -> uint64_t {
+            if (guest_state) {
+                guest_state->rdx = record.guest_state_out.rdx;
+                guest_state->r8 = record.guest_state_out.r8;
+                guest_state->xmm0 = record.guest_state_out.xmm0;
+                guest_state->xmm1 = record.guest_state_out.xmm1;
+                guest_state->xmm2 = record.guest_state_out.xmm2;
+                guest_state->xmm3 = record.guest_state_out.xmm3;
+                guest_state->xmm4 = record.guest_state_out.xmm4;
+                guest_state->xmm5 = record.guest_state_out.xmm5;
+            }
+            return record.guest_state_out.rax;
+        };
+
+        tests::set_current_processor(record.vcpu_index % tests::host_machine.processor_count);
+
+        guest_state_t guest_state = record.guest_state_in;
+        [[maybe_unused]]
+        auto resume = mshv_vmexit_handler::dispatch(&vcpu, &guest_state);
+
+        machine.cpuid = nullptr;
+        machine.read_msr = nullptr;
+        machine.guest_hypercall = nullptr;
+    }
+
+    exit_replayer::result_t exit_replayer::replay(std::span<const exit_record_t> records) {
+        result_t result{ .record_count = records.size(), .mismatched_record_count = 0, .handler_ticks = 0, .mismatches = {} };
+        if (records.empty()) {
+            return result;
+        }
+
+        auto& recorder = m_hv->get_exit_recorder();
+        if (recorder.start(records.size()).has_error()) {
+            fprintf(stderr, "exit_replayer: exit_recorder::start failed\n");
+            abort();
+        }
+
+        for (auto& record : records) {
+            replay_one(record);
+        }
+
+        recorder.stop();
+
+        std::vector<uint8_t> buffer(sizeof(exit_record_file_header_t) + records.size() * sizeof(exit_record_t));
+        auto expt_size = recorder.read(buffer.data(), buffer.size(), 0);
+        if (expt_size.has_error()) {
+            fprintf(stderr, "exit_replayer: exit_recorder::read failed\n");
+            abort();
+        }
+
+        exit_record_file_header_t header;
+        memcpy(&header, buffer.data(), sizeof(header));
+
+        for (uint64_t i = 0; i < records.size(); ++i) {
+            auto& recorded = records[i];
+
+            // a record that dispatch() did not fill in counts as replayed with nothing at all
+            exit_record_t replayed{};
+            if (i < header.record_count) {
+                memcpy(&replayed, buffer.data() + sizeof(header) + i * sizeof(exit_record_t), sizeof(exit_record_t));
+            }
+
+            result.handler_ticks += replayed.handler_ticks;
+
+            bool mismatched = false;
+            for (auto& field : compared_fields) {
+                auto recorded_value = field.get(recorded);
+                auto replayed_value = field.get(replayed);
+                if (recorded_value != replayed_value) {
+                    result.mismatches.push_back({ .record_index = i, .field = field.name, .recorded = recorded_value, .replayed = replayed_value });
+                    mismatched = true;
+                }
+            }
+
+            // the error code field keeps whatever was last injected, it only means something next to a valid error code injection
+            auto injects_error_code = interruption_info_valid_v | interruption_info_deliver_error_code_v;
+            if ((recorded.vmcs_out.vmentry_interruption_info & injects_error_code) == injects_error_code &&
+                recorded.vmcs_out.vmentry_exception_error_code != replayed.vmcs_out.vmentry_exception_error_code) {
+                result.mismatches.push_back({
+                    .record_index = i,
+                    .field = "vmcs_out.vmentry_exception_error_code",
+                    .recorded = recorded.vmcs_out.vmentry_exception_error_code,
+                    .replayed = replayed.vmcs_out.vmentry_exception_error_code
+                });
+                mismatched = true;
+            }
+
+            if (mismatched) {
+                ++result.mismatched_record_count;
+            }
+        }
+
+        return result;
+    }
+
+    void exit_replayer::set_msr_fallback(std::function<uint64_t(uint32_t address)> fallback) {
+        m_msr_fallback = std::move(fallback);
+    }
+
+    const mshv_virtual_cpu* exit_replayer::get_virtual_cpu(uint32_t vcpu_index) const {
+        auto it = m_vcpus.find(vcpu_index);
+        return it != m_vcpus.end() ? &it->second->vcpu : nullptr;
+    }
+
+    std::optional<std::vector<exit_record_t>> exit_replayer::load(const char* path) {
+        auto* file = fopen(path, "rb");
+        if (file == nullptr) {
+            return std::nullopt;
+        }
+
+        std::optional<std::vector<exit_record_t>> retval;
+
+        exit_record_file_header_t header;
+        if (fread(&header, sizeof(header), 1, file) == 1 &&
+            header.magic == exit_record_magic_v &&
+            header.version == exit_record_version_v &&
+            header.header_size == sizeof(exit_record_file_header_t) &&
+            header.record_size == sizeof(exit_record_t)) {
+            std::vector<exit_record_t> records(header.record_count);
+            if (fread(records.data(), sizeof(exit_record_t), records.size(), file) == records.size()) {
+                retval = std::move(records);
+            }
+        }
+
+        fclose(file);
+        return retval;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+#include "vmx/exit_record.hpp"
+
+namespace siren::vmx {
+    class mshv_hypervisor;
+    class mshv_virtual_cpu;
+
+    // Feeds recorded VM exits through mshv_vmexit_handler::dispatch on the host, against the stubs in tests/stubs.
+    // Each record gets its own virtual cpu state back from vmcs_in and guest_state_in, CPUID, RDMSR and hypercall results
+    // come from guest_state_out. The exit recorder of the replaying hypervisor records the replay, which is then compared with the input.
+    class exit_replayer {
+    public:
+        struct mismatch_t {
+            uint64_t record_index;
+            std::string field;
+            uint64_t recorded;
+            uint64_t replayed;
+        };
+
+        struct result_t {
+            uint64_t record_count;
+            uint64_t mismatched_record_count;
+            uint64_t handler_ticks;     // dispatch time of the replay, in TSC ticks
+            std::vector<mismatch_t> mismatches;
+        };
+
+    private:
+        struct vcpu_slot_t;
+
+        std::unique_ptr<mshv_hypervisor> m_hv;
+        std::map<uint32_t, std::unique_ptr<vcpu_slot_t>> m_vcpus;
+        std::function<uint64_t(uint32_t address)> m_msr_fallback;
+
+        mshv_virtual_cpu& get_vcpu(uint32_t vcpu_index);
+
+        void replay_one(const exit_record_t& record);
+
+    public:
+        exit_replayer();
+
+        exit_replayer(const exit_replayer&) = delete;
+
+        exit_replayer& operator=(const exit_replayer&) = delete;
+
+        ~exit_replayer();
+
+        // Virtual cpus keep their lazy and cached state across calls, like they do across exits.
+        result_t replay(std::span<const exit_record_t> records);
+
+        // Answers the MSR reads a record does not cover, e.g. the APIC state a HLT looks at. Without one they read zero.
+        void set_msr_fallback(std::function<uint64_t(uint32_t address)> fallback);
+
+        // Null until a record of that virtual cpu was replayed.
+        [[nodiscard]]
+        const mshv_virtual_cpu* get_virtual_cpu(uint32_t vcpu_index) const;
+
+        // Reads a trace written by IOCTL_SIREN_HV_EXIT_RECORDER_READ. Returns nothing if the file is not a trace of this version.
+        static std::optional<std::vector<exit_record_t>> load(const char* path);
+    };
+}
@@ -0,0 +1,42 @@
+#include "exit_replayer.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+// exit_replayer <trace> [max_mismatches]
+// Replays a trace read with IOCTL_SIREN_HV_EXIT_RECORDER_READ and prints where the handlers of this tree disagree with the recording.
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [max_mismatches]\n", argv[0]);
+        return 2;
+    }
+
+    size_t max_mismatches = argc > 2 ? strtoull(argv[2], nullptr, 0) : 32;
+
+    auto records = siren::vmx::exit_replayer::load(argv[1]);
+    if (!records.has_value()) {
+        fprintf(stderr, "%s: not an exit trace of version %u\n", argv[1], static_cast<unsigned>(siren::vmx::exit_record_version_v));
+        return 2;
+    }
+
+    siren::vmx::exit_replayer replayer;
+    auto result = replayer.replay(records.value());
+
+    for (size_t i = 0; i < result.mismatches.size() && i < max_mismatches; ++i) {
+        auto& mismatch = result.mismatches[i];
+        auto& record = records.value()[mismatch.record_index];
+        printf("record %llu (vcpu %u, exit reason %u): %s recorded 0x%llx, replayed 0x%llx\n",
+            static_cast<unsigned long long>(mismatch.record_index),
+            record.vcpu_index,
+            record.vmcs_in.exit_reason & 0xffffu,
+            mismatch.field.c_str(),
+            static_cast<unsigned long long>(mismatch.recorded),
+            static_cast<unsigned long long>(mismatch.replayed));
+    }
+
+    printf("%llu records, %llu mismatched, %llu handler ticks\n",
+        static_cast<unsigned long long>(result.record_count),
+        static_cast<unsigned long long>(result.mismatched_record_count),
+        static_cast<unsigned long long>(result.handler_ticks));
+
+    return result.mismatched_record_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,324 @@
+#include "check.hpp"
+#include "exit_replayer.hpp"
+#include "stubs/host_machine.hpp"
+#include "microsoft_hv/tlfs.hypercalls.hpp"
+#include "vmx/mshv_virtual_cpu.hpp"
+#include "x86/model_specific_registers.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using siren::vmx::exit_record_t;
+using siren::vmx::exit_replayer;
+
+namespace {
+    constexpr uint32_t exit_reason_cpuid_v = 10;
+    constexpr uint32_t exit_reason_hlt_v = 12;
+    constexpr uint32_t exit_reason_vmcall_v = 18;
+    constexpr uint32_t exit_reason_cr_access_v = 28;
+    constexpr uint32_t exit_reason_rdmsr_v = 31;
+
+    constexpr uint64_t cr0_v = 0x80050033;
+    constexpr uint64_t cr3_v = 0x1ad000;
+    constexpr uint64_t cr4_v = 0x350ef8;    // PCIDE clear, so a MOV to CR3 flushes
+
+    // An exit with nothing changed yet: the guest state goes out as it came in, rip still at the instruction.
+    exit_record_t make_record(uint32_t vcpu_index, uint32_t exit_reason, uint32_t instruction_length) {
+        exit_record_t record{};
+        record.vcpu_index = vcpu_index;
+        record.flags = exit_record_t::flag_resumed_v;
+
+        record.vmcs_in.exit_reason = exit_reason;
+        record.vmcs_in.vmexit_instruction_length = instruction_length;
+        record.vmcs_in.guest_rip = 0xfffff80012340000u;
+        record.vmcs_in.guest_rsp = 0xffffa00012345f00u;
+        record.vmcs_in.guest_rflags = 0x246;
+        record.vmcs_in.guest_cr0 = cr0_v;
+        record.vmcs_in.guest_cr3 = cr3_v;
+        record.vmcs_in.guest_cr4 = cr4_v;
+        record.vmcs_in.cr0_read_shadow = cr0_v;
+        record.vmcs_in.cr4_read_shadow = cr4_v;
+
+        record.vmcs_out.guest_rip = record.vmcs_in.guest_rip + instruction_length;
+        record.vmcs_out.guest_rsp = record.vmcs_in.guest_rsp;
+        record.vmcs_out.guest_rflags = record.vmcs_in.guest_rflags;
+        record.vmcs_out.guest_cr0 = cr0_v;
+        record.vmcs_out.guest_cr3 = cr3_v;
+        record.vmcs_out.guest_cr4 = cr4_v;
+        record.vmcs_out.cr0_read_shadow = cr0_v;
+        record.vmcs_out.cr4_read_shadow = cr4_v;
+
+        record.guest_state_in.rbx = 0x1111;
+        record.guest_state_in.rsi = 0x2222;
+        record.guest_state_in.r15 = 0x3333;
+        record.guest_state_out = record.guest_state_in;
+        return record;
+    }
+
+    std::vector<exit_record_t> make_trace() {
+        std::vector<exit_record_t> trace;
+
+        auto cpuid = make_record(0, exit_reason_cpuid_v, 2);
+        cpuid.guest_state_in.rax = 1;
+        cpuid.guest_state_out.rax = 0x000906ea;
+        cpuid.guest_state_out.rbx = 0x01100800;
+        cpuid.guest_state_out.rcx = 0xfffa3203;
+        cpuid.guest_state_out.rdx = 0x178bfbff;
+        trace.push_back(cpuid);
+
+        auto rdmsr = make_record(1, exit_reason_rdmsr_v, 2);
+        rdmsr.guest_state_in.rcx = 0x10;   // IA32_TIME_STAMP_COUNTER
+        rdmsr.guest_state_out.rcx = 0x10;
+        rdmsr.guest_state_out.rax = 0x89abcdef;
+        rdmsr.guest_state_out.rdx = 0x01234567;
+        trace.push_back(rdmsr);
+
+        auto hlt = make_record(0, exit_reason_hlt_v, 1);
+        trace.push_back(hlt);
+
+        // MOV CR3, RAX
+        auto mov_to_cr3 = make_record(1, exit_reason_cr_access_v, 3);
+        mov_to_cr3.vmcs_in.exit_qualification = 3;
+        mov_to_cr3.guest_state_in.rax = 0x2be000;
+        mov_to_cr3.guest_state_out.rax = 0x2be000;
+        mov_to_cr3.vmcs_out.guest_cr3 = 0x2be000;
+        trace.push_back(mov_to_cr3);
+
+        // MOV RSP, CR3 goes through the lazy rsp
+        auto mov_from_cr3 = make_record(0, exit_reason_cr_access_v, 3);
+        mov_from_cr3.vmcs_in.exit_qualification = 3 | 1u << 4u | 4u << 8u;
+        mov_from_cr3.vmcs_out.guest_rsp = cr3_v;
+        trace.push_back(mov_from_cr3);
+
+        // siren echo
+        auto echo = make_record(0, exit_reason_vmcall_v, 3);
+        echo.guest_state_in.rax = 'vhrs';
+        echo.guest_state_in.rbx = 0;
+        echo.guest_state_out.rax = 'srhv';
+        echo.guest_state_out.rbx = 0;
+        trace.push_back(echo);
+
+        // a slow Microsoft hypercall, its result comes back in rax
+        auto hypercall = make_record(1, exit_reason_vmcall_v, 3);
+        hypercall.guest_state_in.rcx = 0x0002;
+        hypercall.guest_state_out.rcx = 0x0002;
+        hypercall.guest_state_out.rax = 0x0000;
+        trace.push_back(hypercall);
+
+        // VMCALL from ring 3 gets #UD and stays on the instruction
+        auto ring3_vmcall = make_record(0, exit_reason_vmcall_v, 3);
+        ring3_vmcall.vmcs_out.guest_rip = ring3_vmcall.vmcs_in.guest_rip;
+        ring3_vmcall.vmcs_out.vmentry_interruption_info = 1u << 31u | 3u << 8u | 6u;
+        trace.push_back(ring3_vmcall);
+
+        return trace;
+    }
+
+    void test_trace_replays_cleanly() {
+        auto trace = make_trace();
+
+        exit_replayer replayer;
+        auto result = replayer.replay(trace);
+
+        SIREN_CHECK(result.record_count == trace.size());
+        SIREN_CHECK(result.mismatched_record_count == 0);
+        for (auto& mismatch : result.mismatches) {
+            fprintf(stderr, "record %llu: %s recorded 0x%llx, replayed 0x%llx\n",
+                static_cast<unsigned long long>(mismatch.record_index), mismatch.field.c_str(),
+                static_cast<unsigned long long>(mismatch.recorded), static_cast<unsigned long long>(mismatch.replayed));
+        }
+    }
+
+    void test_divergence_is_reported() {
+        auto trace = make_trace();
+        trace[2].vmcs_out.guest_rip += 1;                   // the HLT skipped two bytes in the recording
+        trace[4].vmcs_out.guest_rsp = 0;                    // and MOV from CR3 landed elsewhere
+
+        exit_replayer replayer;
+        auto result = replayer.replay(trace);
+
+        SIREN_CHECK(result.mismatched_record_count == 2);
+        SIREN_CHECK(result.mismatches.size() == 2);
+        if (result.mismatches.size() == 2) {
+            SIREN_CHECK(result.mismatches[0].record_index == 2);
+            SIREN_CHECK(result.mismatches[0].field == "vmcs_out.guest_rip");
+            SIREN_CHECK(result.mismatches[0].replayed == trace[2].vmcs_in.guest_rip + 1);
+            SIREN_CHECK(result.mismatches[1].record_index == 4);
+            SIREN_CHECK(result.mismatches[1].field == "vmcs_out.guest_rsp");
+            SIREN_CHECK(result.mismatches[1].replayed == cr3_v);
+        }
+    }
+
+    // x2APIC on, nothing pending
+    uint64_t idle_x2apic(uint32_t address) {
+        constexpr uint64_t x2apic_enabled_v = 1u << 10u | 1u << 11u;
+        return address == siren::x86::IA32_APIC_BASE ? x2apic_enabled_v : 0;
+    }
+
+    void test_hlt_opens_the_poll_window() {
+        auto hlt = make_record(0, exit_reason_hlt_v, 1);
+
+        auto masked_hlt = hlt;
+        masked_hlt.vmcs_in.guest_rflags = masked_hlt.vmcs_out.guest_rflags = 0x46;
+
+        exit_replayer replayer;
+        replayer.set_msr_fallback(&idle_x2apic);
+
+        // nothing to poll for with interrupts masked
+        SIREN_CHECK(replayer.replay(std::vector{ masked_hlt }).mismatched_record_count == 0);
+        SIREN_CHECK(replayer.get_virtual_cpu(0)->get_halt_poll_statistics().grow_count == 0);
+
+        // the first HLT that could have been polled opens the window, the next one polls it
+        SIREN_CHECK(replayer.replay(std::vector{ hlt }).mismatched_record_count == 0);
+        SIREN_CHECK(replayer.get_virtual_cpu(0)->get_halt_poll_statistics().grow_count == 1);
+
+        SIREN_CHECK(replayer.replay(std::vector{ hlt }).mismatched_record_count == 0);
+        SIREN_CHECK(replayer.get_virtual_cpu(0)->get_halt_poll_statistics().wasted_polls == 1);
+    }
+
+    // siren_hypercalls::suspend_vm, the exit leaves the guest with rip past the VMCALL
+    exit_record_t make_suspend_record(uint32_t vcpu_index) {
+        auto suspend = make_record(vcpu_index, exit_reason_vmcall_v, 3);
+        suspend.flags = 0;
+        suspend.guest_state_in.rax = suspend.guest_state_out.rax = 'vhrs';
+        suspend.guest_state_in.rbx = suspend.guest_state_out.rbx = 9;
+        suspend.guest_state_out.rip = suspend.vmcs_out.guest_rip;
+        return suspend;
+    }
+
+    // After resume() the first exit must take rsp and rflags from the enlightened vmcs, not from what the suspend left in guest_state.
+    void test_suspend_leaves_no_lazy_registers_behind() {
+        {
+            auto hlt = make_record(0, exit_reason_hlt_v, 1);
+            hlt.guest_state_in.rflags.storage = 0x2;    // interrupts masked in the stale copy only
+
+            exit_replayer replayer;
+            replayer.set_msr_fallback(&idle_x2apic);
+            SIREN_CHECK(replayer.replay(std::vector{ make_suspend_record(0), hlt }).mismatched_record_count == 0);
+            SIREN_CHECK(replayer.get_virtual_cpu(0)->get_halt_poll_statistics().grow_count == 1);
+        }
+
+        {
+            // MOV CR3, RSP
+            auto mov_to_cr3 = make_record(0, exit_reason_cr_access_v, 3);
+            mov_to_cr3.vmcs_in.exit_qualification = 3 | 4u << 8u;
+            mov_to_cr3.vmcs_in.guest_rsp = mov_to_cr3.vmcs_out.guest_rsp = 0x3c1000;     // bit 63 would be dropped
+            mov_to_cr3.vmcs_out.guest_cr3 = 0x3c1000;
+            mov_to_cr3.guest_state_in.rsp = mov_to_cr3.guest_state_out.rsp = 0x2be000;
+
+            exit_replayer replayer;
+            SIREN_CHECK(replayer.replay(std::vector{ make_suspend_record(0), mov_to_cr3 }).mismatched_record_count == 0);
+        }
+    }
+
+    struct tlb_flush_t {
+        uint64_t address_space;
+        siren::microsoft_hv::flush_flags_t flags;
+    };
+
+    // MOV CR4, RAX from `old_cr4` to `new_cr4`, replayed on its own. Returns the TLB flushes it issued.
+    std::vector<tlb_flush_t> replay_mov_to_cr4(uint64_t old_cr4, uint64_t new_cr4) {
+        using namespace siren::microsoft_hv::hypercalls;
+
+        auto mov_to_cr4 = make_record(0, exit_reason_cr_access_v, 3);
+        mov_to_cr4.vmcs_in.exit_qualification = 4;
+        mov_to_cr4.vmcs_in.guest_cr4 = mov_to_cr4.vmcs_in.cr4_read_shadow = old_cr4;
+        mov_to_cr4.vmcs_out.guest_cr4 = mov_to_cr4.vmcs_out.cr4_read_shadow = new_cr4;
+        mov_to_cr4.guest_state_in.rax = mov_to_cr4.guest_state_out.rax = new_cr4;
+
+        std::vector<tlb_flush_t> flushes;
+        siren::tests::host_machine.hypercall = [&flushes](uint64_t input_value, const uint64_t* input_block, size_t) -> uint64_t {
+            auto call_code = input_value_t{ .storage = input_value }.semantics.call_code;
+            SIREN_CHECK(call_code == call_code_e::HvCallFlushVirtualAddressSpaceEx);
+            flushes.push_back({ .address_space = input_block[0], .flags = { .storage = static_cast<uint32_t>(input_block[1]) } });
+            return 0;
+        };
+
+        exit_replayer replayer;
+        SIREN_CHECK(replayer.replay(std::vector{ mov_to_cr4 }).mismatched_record_count == 0);
+
+        siren::tests::host_machine.hypercall = nullptr;
+        return flushes;
+    }
+
+    // The SDM's TLB rules for MOV to CR4, see on_mov_to_cr4.
+    void test_mov_to_cr4_flushes() {
+        constexpr uint64_t pse_v = 1u << 4u;
+        constexpr uint64_t pae_v = 1u << 5u;
+        constexpr uint64_t pge_v = 1u << 7u;
+        constexpr uint64_t umip_v = 1u << 11u;
+        constexpr uint64_t pcide_v = 1u << 17u;
+
+        // a PGE toggle drops every address space, global translations included
+        for (auto flushes : { replay_mov_to_cr4(cr4_v, cr4_v & ~pge_v), replay_mov_to_cr4(cr4_v & ~pge_v, cr4_v) }) {
+            SIREN_CHECK(flushes.size() == 1);
+            SIREN_CHECK(flushes.size() == 1 && flushes[0].flags.semantics.all_virtual_address_spaces == 1 && flushes[0].flags.semantics.non_global_mappings_only == 0);
+        }
+
+        // so does clearing PCIDE, setting it does not
+        auto flushes = replay_mov_to_cr4(cr4_v | pcide_v, cr4_v);
+        SIREN_CHECK(flushes.size() == 1 && flushes[0].flags.semantics.all_virtual_address_spaces == 1);
+        SIREN_CHECK(replay_mov_to_cr4(cr4_v, cr4_v | pcide_v).empty());
+
+        // a PAE or PSE change drops the current address space only
+        for (auto bit : { pae_v, pse_v }) {
+            flushes = replay_mov_to_cr4(cr4_v, cr4_v ^ bit);
+            SIREN_CHECK(flushes.size() == 1);
+            SIREN_CHECK(flushes.size() == 1 && flushes[0].address_space == cr3_v && flushes[0].flags.semantics.all_virtual_address_spaces == 0);
+        }
+
+        // nothing for a bit that has no bearing on paging
+        SIREN_CHECK(replay_mov_to_cr4(cr4_v, cr4_v ^ umip_v).empty());
+    }
+
+    void test_trace_file_round_trips() {
+        auto trace = make_trace();
+
+        char path[] = "/tmp/siren_exit_trace_XXXXXX";
+        int fd = mkstemp(path);
+        SIREN_CHECK(fd >= 0);
+        if (fd < 0) {
+            return;
+        }
+
+        siren::vmx::exit_record_file_header_t header{
+            .magic = siren::vmx::exit_record_magic_v,
+            .version = siren::vmx::exit_record_version_v,
+            .header_size = sizeof(siren::vmx::exit_record_file_header_t),
+            .record_size = sizeof(exit_record_t),
+            .reserved = 0,
+            .record_count = trace.size(),
+            .capacity = trace.size()
+        };
+
+        auto* file = fdopen(fd, "wb");
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(trace.data(), sizeof(exit_record_t), trace.size(), file);
+        fclose(file);
+
+        auto loaded = exit_replayer::load(path);
+        SIREN_CHECK(loaded.has_value());
+        SIREN_CHECK(loaded.has_value() && loaded->size() == trace.size());
+        SIREN_CHECK(loaded.has_value() && memcmp(loaded->data(), trace.data(), trace.size() * sizeof(exit_record_t)) == 0);
+
+        // a trace of another layout is refused
+        header.record_size += 8;
+        file = fopen(path, "wb");
+        fwrite(&header, sizeof(header), 1, file);
+        fclose(file);
+        SIREN_CHECK(!exit_replayer::load(path).has_value());
+
+        remove(path);
+    }
+}
+
+int main() {
+    test_trace_replays_cleanly();
+    test_divergence_is_reported();
+    test_hlt_opens_the_poll_window();
+    test_suspend_leaves_no_lazy_registers_behind();
+    test_mov_to_cr4_flushes();
+    test_trace_file_round_trips();
+    return siren::tests::check_result();
+}
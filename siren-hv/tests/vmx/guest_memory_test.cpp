@@ -0,0 +1,234 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "vmx/guest_memory.hpp"
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace siren::size_literals;
+using siren::vmx::copy_guest_physical;
+using siren::vmx::copy_guest_virtual;
+using siren::vmx::guest_translation_t;
+using siren::vmx::guest_walk_e;
+using siren::vmx::physical_memory_map;
+
+namespace {
+    // Guest physical memory from 0 up, mapped by the fake the way guest_mapping_window maps it, with every call recorded.
+    class fake_window {
+    public:
+        static constexpr size_t data_page_count_v = 4;
+
+        std::vector<std::byte> memory;
+        std::set<siren::x86::paddr_t> refused;      // frames that are not RAM
+        std::vector<std::pair<siren::x86::paddr_t, size_t>> maps;
+        size_t mapped = 0;
+
+        explicit fake_window(size_t page_count)
+            : memory(page_count * 4_Kiuz)
+        {
+            for (size_t i = 0; i < memory.size(); ++i) {
+                memory[i] = std::byte(i * 7 + i / 4096);
+            }
+        }
+
+        std::byte* map_data(siren::x86::paddr_t first_page, size_t page_count) noexcept {
+            SIREN_CHECK(mapped == 0 && first_page % 4_Kiuz == 0 && 0 < page_count && page_count <= data_page_count_v);
+            for (size_t i = 0; i < page_count; ++i) {
+                if (refused.contains(first_page + i * 4_Kiuz)) {
+                    return nullptr;
+                }
+            }
+
+            maps.emplace_back(first_page, page_count);
+            mapped = page_count;
+            return memory.data() + first_page;
+        }
+
+        void unmap_data(size_t page_count) noexcept {
+            SIREN_CHECK(page_count == mapped);
+            mapped = 0;
+        }
+    };
+
+    using maps_t = std::vector<std::pair<siren::x86::paddr_t, size_t>>;
+
+    void test_physical_runs() {
+        fake_window window{ 16 };
+        std::vector<std::byte> buffer(9 * 4_Kiuz);
+
+        // 100 bytes into page 1, 9 pages of bytes touch 10 frames: runs of 4, 4 and 2
+        SIREN_CHECK(copy_guest_physical(window, 4_Kiuz + 100, buffer.data(), buffer.size()).has_value());
+        SIREN_CHECK((window.maps == maps_t{ { 4_Kiuz, 4 }, { 5 * 4_Kiuz, 4 }, { 9 * 4_Kiuz, 2 } }));
+        SIREN_CHECK(window.mapped == 0);
+        SIREN_CHECK(std::equal(buffer.begin(), buffer.end(), window.memory.begin() + 4_Kiuz + 100));
+
+        // a few bytes straddling two frames
+        window.maps.clear();
+        const std::byte bytes[8] = { std::byte{ 1 }, std::byte{ 2 }, std::byte{ 3 }, std::byte{ 4 }, std::byte{ 5 }, std::byte{ 6 }, std::byte{ 7 }, std::byte{ 8 } };
+        SIREN_CHECK(copy_guest_physical(window, 3 * 4_Kiuz - 3, bytes, sizeof(bytes)).has_value());
+        SIREN_CHECK((window.maps == maps_t{ { 2 * 4_Kiuz, 2 } }));
+        SIREN_CHECK(std::equal(std::begin(bytes), std::end(bytes), window.memory.begin() + 3 * 4_Kiuz - 3));
+
+        // nothing to copy, nothing mapped
+        window.maps.clear();
+        SIREN_CHECK(copy_guest_physical(window, 5, buffer.data(), 0).has_value());
+        SIREN_CHECK(window.maps.empty());
+    }
+
+    // A frame that is not RAM stops the copy, what came before it has been copied.
+    void test_physical_refused_frame() {
+        fake_window window{ 16 };
+        window.refused.insert(5 * 4_Kiuz);
+
+        std::vector<std::byte> buffer(6 * 4_Kiuz, std::byte{ 0xcc });
+        SIREN_CHECK(copy_guest_physical(window, 0, buffer.data(), buffer.size()).error() == siren::nt_status_invalid_address_v);
+        SIREN_CHECK((window.maps == maps_t{ { 0, 4 } }));
+        SIREN_CHECK(window.mapped == 0);
+        SIREN_CHECK(std::equal(buffer.begin(), buffer.begin() + 4 * 4_Kiuz, window.memory.begin()));
+        SIREN_CHECK(buffer[4 * 4_Kiuz] == std::byte{ 0xcc });
+    }
+
+    struct copy_t {
+        siren::x86::paddr_t gpa;
+        size_t size;
+    };
+
+    // A guest mapping of 4KiB pages at gva 0x10000 and up, and one 2MiB page at gva 0x400000, each to a gpa far from the gva.
+    auto translator(std::vector<guest_walk_e>& walks) {
+        return [&walks](siren::x86::vaddr64_t gva, guest_walk_e walk) noexcept -> siren::expected<guest_translation_t, siren::nt_status> {
+            walks.push_back(walk);
+            if (0x10000 <= gva && gva < 0x20000) {
+                return guest_translation_t{ .gpa = 0x90000 - (gva & ~uint64_t{ 0xfff }) + (gva & 0xfff), .page_size = 4_Kiuz, .writable = gva < 0x18000, .user = false, .executable = false };
+            }
+            if (0x400000 <= gva && gva < 0x600000) {
+                return guest_translation_t{ .gpa = 0x1000000 + (gva - 0x400000), .page_size = 2_Miuz, .writable = true, .user = false, .executable = false };
+            }
+            return siren::unexpected{ siren::nt_status_not_found_v };
+        };
+    }
+
+    void test_virtual_split_per_page() {
+        std::vector<guest_walk_e> walks;
+        std::vector<copy_t> copies;
+        auto copy_physical = [&copies](siren::x86::paddr_t gpa, std::byte*, size_t size) noexcept -> siren::expected<void, siren::nt_status> {
+            copies.push_back({ gpa, size });
+            return {};
+        };
+
+        // 4KiB pages that are not contiguous in guest physical memory, one copy each
+        std::vector<std::byte> buffer(0x100 + 2 * 4_Kiuz + 100);
+        SIREN_CHECK(copy_guest_virtual(translator(walks), copy_physical, 0x10f00, buffer.data(), buffer.size()).has_value());
+        SIREN_CHECK(copies.size() == 4);
+        SIREN_CHECK(copies[0].gpa == 0x80f00 && copies[0].size == 0x100);
+        SIREN_CHECK(copies[1].gpa == 0x7f000 && copies[1].size == 4_Kiuz);
+        SIREN_CHECK(copies[2].gpa == 0x7e000 && copies[2].size == 4_Kiuz);
+        SIREN_CHECK(copies[3].gpa == 0x7d000 && copies[3].size == 100);
+        SIREN_CHECK(walks.size() == 4 && walks[0] == guest_walk_e::set_accessed);
+
+        // within a 2MiB page one translation covers it all, up to the end of the large page
+        walks.clear();
+        copies.clear();
+        buffer.resize(64_Kiuz);
+        SIREN_CHECK(copy_guest_virtual(translator(walks), copy_physical, 0x600000 - 16_Kiuz, buffer.data(), 16_Kiuz).has_value());
+        SIREN_CHECK(copies.size() == 1 && copies[0].gpa == 0x11fc000 && copies[0].size == 16_Kiuz);
+        SIREN_CHECK(walks.size() == 1);
+
+        // running off the large page is a translation error, after the part that did translate
+        copies.clear();
+        SIREN_CHECK(copy_guest_virtual(translator(walks), copy_physical, 0x600000 - 16_Kiuz, buffer.data(), buffer.size()).error() == siren::nt_status_not_found_v);
+        SIREN_CHECK(copies.size() == 1 && copies[0].size == 16_Kiuz);
+    }
+
+    void test_virtual_write_rights() {
+        std::vector<guest_walk_e> walks;
+        std::vector<copy_t> copies;
+        auto copy_physical = [&copies](siren::x86::paddr_t gpa, const std::byte*, size_t size) noexcept -> siren::expected<void, siren::nt_status> {
+            copies.push_back({ gpa, size });
+            return {};
+        };
+
+        // 0x18000 and up is read-only, the writable page before it is written first
+        std::vector<std::byte> buffer(4_Kiuz);
+        const std::byte* bytes = buffer.data();
+        SIREN_CHECK(copy_guest_virtual(translator(walks), copy_physical, 0x17800, bytes, buffer.size()).error() == siren::nt_status_access_violation_v);
+        SIREN_CHECK(copies.size() == 1 && copies[0].size == 0x800);
+        SIREN_CHECK(walks.size() == 2 && walks[0] == guest_walk_e::set_accessed_dirty);
+
+        // an error of the physical copy ends it too
+        auto refuse = [](siren::x86::paddr_t, const std::byte*, size_t) noexcept -> siren::expected<void, siren::nt_status> {
+            return siren::unexpected{ siren::nt_status_invalid_address_v };
+        };
+        walks.clear();
+        SIREN_CHECK(copy_guest_virtual(translator(walks), refuse, 0x400000, bytes, buffer.size()).error() == siren::nt_status_invalid_address_v);
+        SIREN_CHECK(walks.size() == 1);
+    }
+
+    // MmGetPhysicalMemoryRanges reports ranges unsorted and possibly adjacent, contains() sees through that.
+    void test_physical_memory_map() {
+        physical_memory_map ram;
+        SIREN_CHECK(!ram.contains(0x1000, 1));
+
+        siren::tests::host_machine.physical_memory_ranges = {
+            { 0x100000, 0x100000 },
+            { 0x1000, 0x9e000 },
+            { 0x200000, 0x200000 },        // adjacent to the first one
+            { 0x100000000, 0x40000000 },
+        };
+        SIREN_CHECK(ram.initialize().has_value());
+        SIREN_CHECK(ram.initialize().error() == siren::nt_status_invalid_device_state_v);
+        SIREN_CHECK(ram.get_range_count() == 3);
+
+        SIREN_CHECK(!ram.contains(0, 4_Kiuz));
+        SIREN_CHECK(ram.contains(0x1000, 4_Kiuz));
+        SIREN_CHECK(ram.contains(0x9e000, 4_Kiuz) && !ram.contains(0x9f000, 4_Kiuz));
+        SIREN_CHECK(!ram.contains(0x9e000, 8_Kiuz));                // runs off into the legacy video range
+        SIREN_CHECK(!ram.contains(0xa0000, 4_Kiuz) && !ram.contains(0xff000, 4_Kiuz));
+        SIREN_CHECK(ram.contains(0x1ff000, 8_Kiuz));                // across the merged ranges
+        SIREN_CHECK(ram.contains(0x100000, 3_Miuz) && !ram.contains(0x100000, 3_Miuz + 1));
+        SIREN_CHECK(!ram.contains(0xfee00000, 4_Kiuz));             // the local APIC
+        SIREN_CHECK(ram.contains(0x13ffff000, 4_Kiuz) && !ram.contains(0x140000000, 4_Kiuz));
+
+        physical_memory_map moved{ std::move(ram) };
+        SIREN_CHECK(moved.contains(0x1000, 1) && !ram.contains(0x1000, 1));
+
+        moved.release();
+        SIREN_CHECK(!moved.contains(0x1000, 1));
+        siren::tests::reset_host_machine();
+    }
+
+    // The window itself, over the host page tables that the stubs keep for reserved mapping addresses.
+    void test_window_refuses_non_ram() {
+        siren::tests::host_machine.physical_memory_ranges = { { 0x100000, 0x400000 } };
+
+        physical_memory_map ram;
+        SIREN_CHECK(ram.initialize().has_value());
+
+        siren::vmx::guest_mapping_window window;
+        SIREN_CHECK(window.map_table(0x100000) == nullptr);        // not initialized
+        SIREN_CHECK(window.initialize(ram).has_value());
+
+        SIREN_CHECK(window.map_table(0x100008) != nullptr);
+        SIREN_CHECK(window.map_table(0xfee00000) == nullptr);
+        window.unmap_table();
+
+        SIREN_CHECK(window.map_data(0x4fd000, 4) == nullptr);      // the last frame is past the end
+        std::byte* mapped = window.map_data(0x4fd000, 3);
+        SIREN_CHECK(mapped != nullptr);
+        if (mapped) {
+            window.unmap_data(3);
+        }
+
+        window.release();
+        siren::tests::reset_host_machine();
+    }
+}
+
+int main() {
+    test_physical_runs();
+    test_physical_refused_frame();
+    test_virtual_split_per_page();
+    test_virtual_write_rights();
+    test_physical_memory_map();
+    test_window_refuses_non_ram();
+    return siren::tests::check_result();
+}
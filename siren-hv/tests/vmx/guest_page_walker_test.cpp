@@ -0,0 +1,196 @@
+#include "check.hpp"
+#include "vmx/guest_page_walker.hpp"
+#include <map>
+#include <vector>
+
+using namespace siren::size_literals;
+using namespace siren::vmx::guest_paging;
+using siren::vmx::guest_walk_e;
+using siren::vmx::make_guest_paging_context;
+using siren::vmx::walk_guest_page_tables;
+using siren::vmx::locate_page_table_entry;
+
+namespace {
+    constexpr uint64_t cr0_paging_v = uint64_t{ 1 } << 31u;
+    constexpr uint64_t cr4_la57_v = uint64_t{ 1 } << 12u;
+    constexpr uint64_t cr4_pcide_v = uint64_t{ 1 } << 17u;
+    constexpr uint64_t efer_lma_v = uint64_t{ 1 } << 10u;
+    constexpr uint64_t efer_nxe_v = uint64_t{ 1 } << 11u;
+
+    // Synthetic guest physical memory, one table per page that was ever touched.
+    class guest_tables {
+    private:
+        std::map<uint64_t, std::vector<uint64_t>> m_tables;
+
+    public:
+        uint64_t* operator[](uint64_t gpa) {
+            auto& table = m_tables[gpa];
+            table.resize(512);
+            return table.data();
+        }
+
+        // The accessor handed to the walker, nullptr for a page that holds no table.
+        [[nodiscard]]
+        auto accessor() noexcept {
+            return [this](siren::x86::paddr_t gpa) noexcept -> uint64_t* {
+                auto it = m_tables.find(gpa);
+                return it != m_tables.end() ? it->second.data() : nullptr;
+            };
+        }
+    };
+
+    // CR3 at 0x1000:
+    //   0x0000'0000'5000  4KiB read-only page at 0xabc000
+    //   0x0000'0020'0000  2MiB writable XD page at 0x200000, with the PAT bit set
+    //   0x0000'4000'0000  1GiB writable page at 0x40000000
+    //   0xffff'ffff'c000'0000  1GiB supervisor page at 0
+    void build_tables(guest_tables& tables) {
+        tables[0x1000][0] = 0x2000 | present_v | writable_v | user_v;
+        tables[0x1000][511] = 0x7000 | present_v | writable_v;
+        tables[0x2000][0] = 0x3000 | present_v | writable_v | user_v;
+        tables[0x2000][1] = 0x40000000 | present_v | page_size_v | writable_v;
+        tables[0x3000][0] = 0x4000 | present_v | user_v;
+        tables[0x3000][1] = 0x200000 | present_v | page_size_v | writable_v | user_v | execute_disable_v | (uint64_t{ 1 } << 12u);
+        tables[0x4000][5] = 0xabc000 | present_v | writable_v | user_v;
+        tables[0x7000][511] = 0x8000 | present_v | writable_v | page_size_v;
+    }
+
+    void test_paging_context() {
+        auto expt_context = make_guest_paging_context(cr0_paging_v, 0x9000 | 0x5, cr4_la57_v | cr4_pcide_v, efer_lma_v);
+        SIREN_CHECK(expt_context.has_value());
+        if (expt_context.has_value()) {
+            auto& context = expt_context.value();
+            SIREN_CHECK(context.page_table_base == 0x9000);
+            SIREN_CHECK(context.pcid == 5);
+            SIREN_CHECK(context.five_level);
+            SIREN_CHECK(!context.no_execute);
+        }
+
+        // without CR4.PCIDE the low bits of CR3 are flags, not a PCID
+        SIREN_CHECK(make_guest_paging_context(cr0_paging_v, 0x9000 | 0x18, 0, efer_lma_v | efer_nxe_v).value().pcid == 0);
+
+        SIREN_CHECK(make_guest_paging_context(0, 0x1000, 0, efer_lma_v).has_error());
+        SIREN_CHECK(make_guest_paging_context(cr0_paging_v, 0x1000, 0, 0).has_error());
+    }
+
+    void test_walks_every_page_size() {
+        guest_tables tables;
+        build_tables(tables);
+        auto context = make_guest_paging_context(cr0_paging_v, 0x1000, 0, efer_lma_v | efer_nxe_v).value();
+
+        auto expt_translation = walk_guest_page_tables(context, 0x5123, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_value());
+        if (expt_translation.has_value()) {
+            auto& translation = expt_translation.value();
+            SIREN_CHECK(translation.gpa == 0xabc123);
+            SIREN_CHECK(translation.page_size == 4_Kiuz);
+            SIREN_CHECK(!translation.writable);     // the PDE is read-only
+            SIREN_CHECK(translation.user);
+            SIREN_CHECK(translation.executable);
+        }
+
+        // the PAT bit of the 2MiB page is not part of the address
+        expt_translation = walk_guest_page_tables(context, 0x2fffff, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_value());
+        if (expt_translation.has_value()) {
+            SIREN_CHECK(expt_translation.value().gpa == 0x2fffff);
+            SIREN_CHECK(expt_translation.value().page_size == 2_Miuz);
+            SIREN_CHECK(expt_translation.value().writable);
+            SIREN_CHECK(!expt_translation.value().executable);
+        }
+
+        expt_translation = walk_guest_page_tables(context, 0x40001234, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_value() && expt_translation.value().gpa == 0x40001234 && expt_translation.value().page_size == 1_Giuz);
+
+        expt_translation = walk_guest_page_tables(context, 0xffff'ffff'c000'0010, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_value() && expt_translation.value().gpa == 0x10 && !expt_translation.value().user);
+
+        // the same tables under a PML5 entry
+        tables[0x9000][0] = 0x1000 | present_v | writable_v | user_v;
+        auto context5 = make_guest_paging_context(cr0_paging_v, 0x9000, cr4_la57_v, efer_lma_v).value();
+        expt_translation = walk_guest_page_tables(context5, 0x5123, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_value() && expt_translation.value().gpa == 0xabc123);
+
+        // canonical with 5 levels, not with 4
+        tables[0x1000][256] = 0x2000 | present_v | writable_v | user_v;
+        expt_translation = walk_guest_page_tables(context5, 0x0000'8000'0000'5123, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_value() && expt_translation.value().gpa == 0xabc123);
+        expt_translation = walk_guest_page_tables(context, 0x0000'8000'0000'5123, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_error() && expt_translation.error() == siren::nt_status_invalid_address_v);
+    }
+
+    void test_walk_failures() {
+        guest_tables tables;
+        build_tables(tables);
+        auto context = make_guest_paging_context(cr0_paging_v, 0x1000, 0, efer_lma_v | efer_nxe_v).value();
+
+        auto expt_translation = walk_guest_page_tables(context, 0x0000'8000'0000'0000, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_error() && expt_translation.error() == siren::nt_status_invalid_address_v);     // not canonical
+
+        expt_translation = walk_guest_page_tables(context, 0x6000, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_error() && expt_translation.error() == siren::nt_status_invalid_address_v);     // not present
+
+        tables[0x1000][1] = present_v | page_size_v;
+        expt_translation = walk_guest_page_tables(context, 0x80'0000'0000, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_error() && expt_translation.error() == siren::nt_status_invalid_parameter_v);   // PS in a PML4E
+
+        tables[0x1000][2] = 0x99000 | present_v;
+        expt_translation = walk_guest_page_tables(context, 0x100'0000'0000, guest_walk_e::read_only, tables.accessor());
+        SIREN_CHECK(expt_translation.has_error() && expt_translation.error() == siren::nt_status_not_found_v);           // table not mapped
+    }
+
+    void test_accessed_and_dirty_bits() {
+        guest_tables tables;
+        build_tables(tables);
+        auto context = make_guest_paging_context(cr0_paging_v, 0x1000, 0, efer_lma_v | efer_nxe_v).value();
+
+        SIREN_CHECK(walk_guest_page_tables(context, 0x5000, guest_walk_e::read_only, tables.accessor()).has_value());
+        SIREN_CHECK((tables[0x4000][5] & accessed_v) == 0);
+
+        SIREN_CHECK(walk_guest_page_tables(context, 0x2fffff, guest_walk_e::set_accessed_dirty, tables.accessor()).has_value());
+        SIREN_CHECK((tables[0x3000][1] & (accessed_v | dirty_v)) == (accessed_v | dirty_v));
+        SIREN_CHECK((tables[0x1000][0] & accessed_v) != 0);
+        SIREN_CHECK((tables[0x1000][0] & dirty_v) == 0);    // D only in the leaf
+
+        // a leaf that is writable on its own but read-only above is not dirtied
+        SIREN_CHECK(walk_guest_page_tables(context, 0x5000, guest_walk_e::set_accessed_dirty, tables.accessor()).has_value());
+        SIREN_CHECK((tables[0x4000][5] & accessed_v) != 0);
+        SIREN_CHECK((tables[0x4000][5] & dirty_v) == 0);
+    }
+
+    // Every walk reads the tables as they are now, an edit shows up in the next walk without any flush.
+    void test_walks_see_table_edits() {
+        guest_tables tables;
+        build_tables(tables);
+        auto context = make_guest_paging_context(cr0_paging_v, 0x1000, 0, efer_lma_v).value();
+
+        SIREN_CHECK(walk_guest_page_tables(context, 0x5020, guest_walk_e::read_only, tables.accessor()).value().gpa == 0xabc020);
+        tables[0x4000][5] = 0xdef000 | present_v;
+        SIREN_CHECK(walk_guest_page_tables(context, 0x5020, guest_walk_e::read_only, tables.accessor()).value().gpa == 0xdef020);
+    }
+
+    void test_locate_page_table_entry() {
+        guest_tables tables;
+        build_tables(tables);
+        auto context = make_guest_paging_context(cr0_paging_v, 0x1000, 0, efer_lma_v).value();
+
+        auto expt_entry = locate_page_table_entry(context, 0x6000, tables.accessor());
+        SIREN_CHECK(expt_entry.has_value() && expt_entry.value() == tables[0x4000] + 6);    // not present, still found
+
+        expt_entry = locate_page_table_entry(context, 0x200000, tables.accessor());
+        SIREN_CHECK(expt_entry.has_error() && expt_entry.error() == siren::nt_status_invalid_parameter_v);
+
+        expt_entry = locate_page_table_entry(context, 0x200'0000'0000, tables.accessor());
+        SIREN_CHECK(expt_entry.has_error() && expt_entry.error() == siren::nt_status_invalid_address_v);
+    }
+}
+
+int main() {
+    test_paging_context();
+    test_walks_every_page_size();
+    test_walk_failures();
+    test_accessed_and_dirty_bits();
+    test_walks_see_table_edits();
+    test_locate_page_table_entry();
+    return siren::tests::check_result();
+}
@@ -0,0 +1,125 @@
+#include "check.hpp"
+#include "vmx/halt_poll_policy.hpp"
+#include <vector>
+
+using siren::vmx::halt_poll_policy;
+
+namespace {
+    // Replays wake-up distances the way on_instruction_hlt does: poll for the current window, then idle until the wake-up.
+    void replay(halt_poll_policy& policy, const std::vector<uint64_t>& wakeup_distances) {
+        for (auto distance : wakeup_distances) {
+            auto window = policy.get_window();
+            bool woke_in_poll = window != 0 && distance <= window;
+            policy.update(woke_in_poll ? distance : window, woke_in_poll, distance);
+        }
+    }
+
+    void test_starts_without_polling() {
+        halt_poll_policy policy;
+        SIREN_CHECK(policy.get_window() == 0);
+        SIREN_CHECK(policy.get_statistics().grow_count == 0);
+    }
+
+    void test_short_sleeps_grow_the_window_until_covered() {
+        halt_poll_policy policy;
+        auto& parameters = policy.get_parameters();
+
+        replay(policy, { 30'000 });
+        SIREN_CHECK(policy.get_window() == parameters.grow_start);
+
+        replay(policy, std::vector<uint64_t>(8, 30'000));
+        SIREN_CHECK(policy.get_window() == 4 * parameters.grow_start);    // 10'000 -> 20'000 -> 40'000 covers 30'000
+        SIREN_CHECK(policy.get_statistics().grow_count == 3);
+        SIREN_CHECK(policy.get_statistics().successful_polls == 6);
+        SIREN_CHECK(policy.get_statistics().successful_poll_ticks == 6 * 30'000);
+        SIREN_CHECK(policy.get_statistics().wasted_polls == 2);
+        SIREN_CHECK(policy.get_statistics().wasted_poll_ticks == 10'000 + 20'000);
+    }
+
+    void test_window_is_capped() {
+        halt_poll_policy policy;
+        replay(policy, std::vector<uint64_t>(32, policy.get_parameters().max_window - 1));
+        SIREN_CHECK(policy.get_window() == policy.get_parameters().max_window);
+    }
+
+    void test_long_sleep_resets_the_window() {
+        halt_poll_policy policy;
+        replay(policy, { 30'000, 30'000, 30'000 });
+        SIREN_CHECK(policy.get_window() != 0);
+
+        replay(policy, { 10 * policy.get_parameters().max_window });
+        SIREN_CHECK(policy.get_window() == 0);
+        SIREN_CHECK(policy.get_statistics().shrink_count == 1);
+        SIREN_CHECK(policy.get_statistics().wasted_polls == 3);
+    }
+
+    void test_shrink_factor_halves_and_drops_below_grow_start() {
+        halt_poll_policy policy{ { .max_window = 80'000, .grow_start = 10'000, .grow_factor = 2, .shrink_factor = 2 } };
+        replay(policy, std::vector<uint64_t>(4, 79'000));
+        SIREN_CHECK(policy.get_window() == 80'000);
+
+        replay(policy, { 1'000'000 });
+        SIREN_CHECK(policy.get_window() == 40'000);
+        replay(policy, { 1'000'000, 1'000'000 });
+        SIREN_CHECK(policy.get_window() == 10'000);
+        replay(policy, { 1'000'000 });
+        SIREN_CHECK(policy.get_window() == 0);
+        SIREN_CHECK(policy.get_statistics().shrink_count == 4);
+    }
+
+    void test_mixed_trace_settles_between_bursts() {
+        // bursts of short sleeps separated by one long idle period each
+        halt_poll_policy policy;
+        std::vector<uint64_t> trace;
+        for (int burst = 0; burst < 4; ++burst) {
+            trace.insert(trace.end(), 16, 15'000);
+            trace.push_back(50'000'000);
+        }
+        replay(policy, trace);
+
+        auto& statistics = policy.get_statistics();
+        SIREN_CHECK(statistics.successful_polls == 4 * 14);
+        SIREN_CHECK(statistics.shrink_count == 4);
+        SIREN_CHECK(policy.get_window() == 0);
+    }
+
+    void test_zero_max_window_disables_polling() {
+        halt_poll_policy policy{ { .max_window = 0, .grow_start = 10'000, .grow_factor = 2, .shrink_factor = 0 } };
+        replay(policy, std::vector<uint64_t>(16, 100));
+        SIREN_CHECK(policy.get_window() == 0);
+        SIREN_CHECK(policy.get_statistics().successful_polls == 0);
+        SIREN_CHECK(policy.get_statistics().wasted_polls == 0);
+    }
+
+    void test_set_parameters_clamps_the_window() {
+        halt_poll_policy policy;
+        replay(policy, std::vector<uint64_t>(32, policy.get_parameters().max_window - 1));
+        SIREN_CHECK(policy.get_window() == policy.get_parameters().max_window);
+
+        policy.set_parameters({ .max_window = 50'000, .grow_start = 10'000, .grow_factor = 2, .shrink_factor = 0 });
+        SIREN_CHECK(policy.get_window() == 50'000);
+    }
+
+    // the policy is constexpr, so a trace can also be checked at compile time
+    constexpr uint64_t window_after_three_short_sleeps() {
+        halt_poll_policy policy;
+        for (int i = 0; i < 3; ++i) {
+            policy.update(policy.get_window(), false, 100'000);
+        }
+        return policy.get_window();
+    }
+
+    static_assert(window_after_three_short_sleeps() == 40'000);
+}
+
+int main() {
+    test_starts_without_polling();
+    test_short_sleeps_grow_the_window_until_covered();
+    test_window_is_capped();
+    test_long_sleep_resets_the_window();
+    test_shrink_factor_halves_and_drops_below_grow_start();
+    test_mixed_trace_settles_between_bursts();
+    test_zero_max_window_disables_polling();
+    test_set_parameters_clamps_the_window();
+    return siren::tests::check_result();
+}
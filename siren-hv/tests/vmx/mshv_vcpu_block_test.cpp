@@ -0,0 +1,101 @@
+#include "check.hpp"
+#include "stubs/host_machine.hpp"
+#include "vmx/mshv_hypervisor.hpp"
+#include "vmx/mshv_vcpu_block.hpp"
+#include "vmx/mshv_virtual_cpu.hpp"
+#include "microsoft_hv/tlfs.model_specific_registers.hpp"
+#include <stdlib.h>
+#include <memory>
+
+using namespace siren::size_literals;
+using siren::vmx::mshv_vcpu_block_layout_t;
+using siren::vmx::mshv_virtual_cpu;
+
+namespace {
+    constexpr size_t page_size_v = mshv_vcpu_block_layout_t::page_size_v;
+
+    void test_every_stack_size_gives_a_valid_layout() {
+        for (size_t stack_size = mshv_virtual_cpu::vmexit_stack_size_min_v; stack_size <= mshv_virtual_cpu::vmexit_stack_size_max_v; stack_size += page_size_v) {
+            auto layout = mshv_vcpu_block_layout_t::compute(stack_size);
+            SIREN_CHECK(layout.is_valid());
+            SIREN_CHECK(layout.vmexit_stack_offset == 0);
+            SIREN_CHECK(layout.evmcs_offset == stack_size);
+            SIREN_CHECK(layout.page_count() == stack_size / page_size_v + 3);
+        }
+    }
+
+    void test_unaligned_or_empty_stacks_are_refused() {
+        SIREN_CHECK(!mshv_vcpu_block_layout_t::compute(0).is_valid());
+        SIREN_CHECK(!mshv_vcpu_block_layout_t::compute(page_size_v / 2).is_valid());
+        SIREN_CHECK(!mshv_vcpu_block_layout_t::compute(16_Kiuz + 8).is_valid());
+
+        auto layout = mshv_vcpu_block_layout_t::compute(16_Kiuz);
+        layout.vmxon_region_offset = layout.partition_assist_page_offset;     // overlapping regions
+        SIREN_CHECK(!layout.is_valid());
+    }
+
+    // The regions prepare() carves out of the block, checked through what a virtual cpu hands to the processor.
+    void test_prepare_places_the_regions(size_t stack_size) {
+        siren::tests::reset_host_machine();
+
+        // prepare() takes the hypercall page and the VP assist page from Hyper-V
+        auto* hypercall_page = aligned_alloc(page_size_v, page_size_v);
+        auto* vp_assist_page = aligned_alloc(page_size_v, page_size_v);
+        siren::tests::host_machine.read_msr = [&](uint32_t address) -> uint64_t {
+            switch (address) {
+                case siren::microsoft_hv::HV_X64_MSR_HYPERCALL:
+                    return reinterpret_cast<uintptr_t>(hypercall_page) | 1;
+                case siren::microsoft_hv::HV_X64_MSR_VP_ASSIST_PAGE:
+                    return reinterpret_cast<uintptr_t>(vp_assist_page) | 1;
+                default:
+                    return siren::tests::read_default_msr(address);
+            }
+        };
+
+        auto hv = std::make_unique<siren::vmx::mshv_hypervisor>();
+        SIREN_CHECK(hv->set_vmexit_stack_size(stack_size).has_value());
+        SIREN_CHECK(hv->intialize().has_value());
+        auto* vcpu = static_cast<mshv_virtual_cpu*>(hv->get_virtual_cpu(0));
+        SIREN_CHECK(vcpu->prepare().has_value());
+
+        auto* evmcs = reinterpret_cast<uint8_t*>(vcpu->get_enlightened_vmcs());
+        auto* stack_top = reinterpret_cast<mshv_virtual_cpu::vmexit_stack_top_t*>(vcpu->get_enlightened_vmcs()->host_rsp);
+
+        // HOST_RSP points at the last KiB of the stack, right below the enlightened vmcs
+        SIREN_CHECK(reinterpret_cast<uint8_t*>(stack_top) + sizeof(mshv_virtual_cpu::vmexit_stack_top_t) == evmcs);
+        SIREN_CHECK(stack_top->self == vcpu);
+        SIREN_CHECK(reinterpret_cast<uintptr_t>(evmcs) % page_size_v == 0);
+
+        // the cold regions follow, one page each
+        auto layout = mshv_vcpu_block_layout_t::compute(stack_size);
+        auto* block = evmcs - layout.evmcs_offset;
+        auto* partition_assist_page = reinterpret_cast<uint8_t*>(vcpu->get_enlightened_vmcs()->mshv_partition_assist_page);
+        SIREN_CHECK(partition_assist_page == block + layout.partition_assist_page_offset);
+        SIREN_CHECK(partition_assist_page == evmcs + page_size_v);
+
+        // the whole stack below the top is canary, nothing ran on it yet
+        auto usage = vcpu->get_vmexit_stack_usage();
+        SIREN_CHECK(usage.size == stack_size - sizeof(mshv_virtual_cpu::vmexit_stack_top_t));
+        SIREN_CHECK(usage.high_water_mark == 0);
+        SIREN_CHECK(*reinterpret_cast<const uint64_t*>(block) == mshv_virtual_cpu::vmexit_stack_canary_v);
+
+        // a write anywhere in the stack shows up as its depth from the top
+        auto* deepest = reinterpret_cast<uint8_t*>(stack_top) - 3 * page_size_v;
+        *reinterpret_cast<uint64_t*>(deepest) = 0;
+        SIREN_CHECK(vcpu->get_vmexit_stack_usage().high_water_mark == 3 * page_size_v);
+
+        hv.reset();
+        free(hypercall_page);
+        free(vp_assist_page);
+        siren::tests::reset_host_machine();
+    }
+}
+
+int main() {
+    test_every_stack_size_gives_a_valid_layout();
+    test_unaligned_or_empty_stacks_are_refused();
+    test_prepare_places_the_regions(mshv_virtual_cpu::vmexit_stack_size_min_v);
+    test_prepare_places_the_regions(64_Kiuz);
+    test_prepare_places_the_regions(mshv_virtual_cpu::vmexit_stack_size_max_v);
+    return siren::tests::check_result();
+}
@@ -0,0 +1,124 @@
+#include "check.hpp"
+#include "vmx/pause_loop_policy.hpp"
+
+using siren::vmx::pause_loop_policy;
+
+namespace {
+    constexpr pause_loop_policy::parameters_t parameters_v = {
+        .enabled = true,
+        .gap = 10,
+        .window = 100,
+        .min_window = 25,
+        .max_window = 400,
+        .grow_factor = 2,
+        .shrink_factor = 2
+    };
+
+    // Feeds PAUSE exits `step` ticks apart in [`from`, `to`], the way on_instruction_pause does. Returns how many asked to yield.
+    constexpr uint32_t spin(pause_loop_policy& policy, uint64_t from, uint64_t to, uint64_t step = 5) {
+        uint32_t yields = 0;
+        for (uint64_t now = from; now <= to; now += step) {
+            yields += policy.on_pause(now) ? 1 : 0;
+        }
+        return yields;
+    }
+
+    void test_new_loop_after_gap() {
+        pause_loop_policy policy{ parameters_v };
+
+        // exactly `gap` apart still belongs to the loop
+        SIREN_CHECK(spin(policy, 1000, 1020, parameters_v.gap) == 0);
+        SIREN_CHECK(policy.get_statistics().spin_loops == 1);
+        SIREN_CHECK(policy.get_loop_pause_count() == 3);
+
+        SIREN_CHECK(!policy.on_pause(1020 + parameters_v.gap + 1));
+        SIREN_CHECK(policy.get_statistics().spin_loops == 2);
+        SIREN_CHECK(policy.get_loop_pause_count() == 1);
+        SIREN_CHECK(policy.get_statistics().pause_exits == 4);
+
+        // a loop that never yielded leaves the window alone
+        SIREN_CHECK(policy.get_window() == parameters_v.window);
+        SIREN_CHECK(policy.get_statistics().shrink_count == 0);
+    }
+
+    void test_yields_once_per_window() {
+        pause_loop_policy policy{ parameters_v };
+
+        SIREN_CHECK(spin(policy, 0, 95) == 0);
+        SIREN_CHECK(policy.on_pause(100));
+        SIREN_CHECK(policy.get_statistics().long_spin_waits == 1);
+
+        // the first yield of a loop does not grow, the window restarts from it
+        SIREN_CHECK(policy.get_window() == parameters_v.window);
+        SIREN_CHECK(spin(policy, 105, 195) == 0);
+        SIREN_CHECK(policy.get_statistics().spin_loops == 1);
+    }
+
+    // Spinning on after a yield doubles the window, up to max_window.
+    void test_grows_after_repeated_yields() {
+        pause_loop_policy policy{ parameters_v };
+
+        SIREN_CHECK(spin(policy, 0, 100) == 1);
+        SIREN_CHECK(spin(policy, 105, 200) == 1);
+        SIREN_CHECK(policy.get_window() == 200);
+        SIREN_CHECK(spin(policy, 205, 400) == 1);
+        SIREN_CHECK(policy.get_window() == 400);
+        SIREN_CHECK(policy.get_statistics().grow_count == 2);
+
+        // at max_window, further yields do not count as growing
+        SIREN_CHECK(spin(policy, 405, 800) == 1);
+        SIREN_CHECK(policy.get_window() == parameters_v.max_window);
+        SIREN_CHECK(policy.get_statistics().grow_count == 2);
+        SIREN_CHECK(policy.get_statistics().long_spin_waits == 4);
+        SIREN_CHECK(policy.get_statistics().spin_loops == 1);
+    }
+
+    // A loop that ends soon after its yield halves the window of the next one, down to min_window.
+    void test_shrinks_after_short_loop() {
+        pause_loop_policy policy{ parameters_v };
+
+        SIREN_CHECK(spin(policy, 0, 100) == 1);
+        SIREN_CHECK(!policy.on_pause(200));
+        SIREN_CHECK(policy.get_window() == 50);
+        SIREN_CHECK(policy.get_statistics().shrink_count == 1);
+
+        SIREN_CHECK(spin(policy, 205, 250) == 1);
+        SIREN_CHECK(!policy.on_pause(300));
+        SIREN_CHECK(policy.get_window() == parameters_v.min_window);
+
+        SIREN_CHECK(spin(policy, 305, 325) == 1);
+        SIREN_CHECK(!policy.on_pause(400));
+        SIREN_CHECK(policy.get_window() == parameters_v.min_window);
+        SIREN_CHECK(policy.get_statistics().shrink_count == 2);
+        SIREN_CHECK(policy.get_statistics().spin_loops == 4);
+    }
+
+    void test_zero_shrink_factor_drops_to_min_window() {
+        auto parameters = parameters_v;
+        parameters.shrink_factor = 0;
+        pause_loop_policy policy{ parameters };
+
+        SIREN_CHECK(spin(policy, 0, 100) == 1);
+        SIREN_CHECK(!policy.on_pause(200));
+        SIREN_CHECK(policy.get_window() == parameters.min_window);
+    }
+
+    // the policy is constexpr, so a trace can also be checked at compile time
+    constexpr uint64_t window_after_grow_and_shrink() {
+        pause_loop_policy policy{ parameters_v };
+        spin(policy, 0, 200);       // yields at 100 and 200, grows to 200
+        bool yielded = policy.on_pause(300);        // new loop, shrinks back to 100
+        return yielded ? 0 : policy.get_window();
+    }
+
+    static_assert(window_after_grow_and_shrink() == 100);
+}
+
+int main() {
+    test_new_loop_after_gap();
+    test_yields_once_per_window();
+    test_grows_after_repeated_yields();
+    test_shrinks_after_short_loop();
+    test_zero_shrink_factor_drops_to_min_window();
+    return siren::tests::check_result();
+}
@@ -0,0 +1,103 @@
+#include "check.hpp"
+#include "vmx/vpid_allocator.hpp"
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using siren::vmx::vpid_allocator;
+
+namespace {
+    void test_never_hands_out_vpid_zero_and_exhausts() {
+        auto allocator = std::make_unique<vpid_allocator>();
+        std::vector<bool> seen(vpid_allocator::capacity_v);
+
+        for (size_t i = 1; i < vpid_allocator::capacity_v; ++i) {
+            auto expt_vpid = allocator->allocate();
+            SIREN_CHECK(expt_vpid.has_value());
+            if (expt_vpid.has_value()) {
+                auto vpid = expt_vpid.value();
+                SIREN_CHECK(vpid != vpid_allocator::invalid_vpid_v);
+                SIREN_CHECK(!seen[vpid]);
+                SIREN_CHECK(allocator->is_allocated(vpid));
+                seen[vpid] = true;
+            }
+        }
+
+        auto expt_vpid = allocator->allocate();
+        SIREN_CHECK(expt_vpid.has_error());
+        SIREN_CHECK(expt_vpid.has_error() && expt_vpid.error() == siren::nt_status_insufficient_resources_v);
+    }
+
+    void test_released_vpid_is_stale_once() {
+        auto allocator = std::make_unique<vpid_allocator>();
+
+        auto first = allocator->allocate().value();
+        SIREN_CHECK(!allocator->consume_stale(first));
+
+        allocator->release(first);
+        SIREN_CHECK(!allocator->is_allocated(first));
+
+        // the lowest free bit is taken first, so the released vpid comes right back
+        auto second = allocator->allocate().value();
+        SIREN_CHECK(second == first);
+        SIREN_CHECK(allocator->consume_stale(second));
+        SIREN_CHECK(!allocator->consume_stale(second));
+
+        auto third = allocator->allocate().value();
+        SIREN_CHECK(third != first);
+        SIREN_CHECK(!allocator->consume_stale(third));
+    }
+
+    void test_releasing_the_invalid_vpid_is_ignored() {
+        auto allocator = std::make_unique<vpid_allocator>();
+        allocator->release(vpid_allocator::invalid_vpid_v);
+        SIREN_CHECK(allocator->is_allocated(vpid_allocator::invalid_vpid_v));
+        SIREN_CHECK(allocator->allocate().value() != vpid_allocator::invalid_vpid_v);
+    }
+
+    void test_concurrent_allocations_are_unique() {
+        constexpr size_t thread_count = 4;
+        constexpr size_t per_thread = 2000;
+
+        auto allocator = std::make_unique<vpid_allocator>();
+        std::vector<std::vector<vpid_allocator::vpid_t>> results(thread_count);
+        std::vector<std::thread> threads;
+
+        for (size_t t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t] {
+                for (size_t i = 0; i < per_thread; ++i) {
+                    auto vpid = allocator->allocate().value();
+                    results[t].push_back(vpid);
+                    // churn: give every other one back, the next owner must see it stale
+                    if (i % 2 == 1) {
+                        allocator->release(vpid);
+                        results[t].pop_back();
+                    }
+                }
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        std::vector<vpid_allocator::vpid_t> all;
+        for (auto& result : results) {
+            all.insert(all.end(), result.begin(), result.end());
+        }
+        std::sort(all.begin(), all.end());
+
+        SIREN_CHECK(all.size() == thread_count * per_thread / 2);
+        SIREN_CHECK(std::adjacent_find(all.begin(), all.end()) == all.end());
+        SIREN_CHECK(std::all_of(all.begin(), all.end(), [&](auto vpid) { return vpid != 0 && allocator->is_allocated(vpid); }));
+    }
+}
+
+int main() {
+    test_never_hands_out_vpid_zero_and_exhausts();
+    test_released_vpid_is_stale_once();
+    test_releasing_the_invalid_vpid_is_ignored();
+    test_concurrent_allocations_are_unique();
+    return siren::tests::check_result();
+}